@@ -0,0 +1,209 @@
+#include "AST.h"
+#include "ASTContext.h"
+#include "CodeGen.h"
+#include "ConstFold.h"
+#include "Lexer.h"
+#include "Parser.h"
+#include "ProgramGenerator.h"
+#include "Sema.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/FileUtilities.h"
+#include "llvm/Support/Program.h"
+#include <benchmark/benchmark.h>
+
+// Benchmarks of the compiler phases on generated programs, and of the
+// programs the compiler emits. The range argument is the size passed to
+// generateProgram.
+
+static const ProgramShape Shapes[] = {
+    ProgramShape::Declarations, ProgramShape::NestedIf, ProgramShape::Loops,
+    ProgramShape::Power, ProgramShape::Prints, ProgramShape::Mixed};
+
+// A parsed and checked program that stays alive for a whole benchmark.
+struct ParsedProgram
+{
+    std::string Source;
+    ASTContext Context;
+    Program *Tree = nullptr;
+
+    ParsedProgram(ProgramShape Shape, unsigned Size, bool Fold = false)
+        : Source(generateProgram(Shape, Size))
+    {
+        Lexer Lex(Source, Context.getSymbols());
+        Parser P(Lex, Context);
+        Tree = P.parse();
+        if (!Tree || P.hasError() || Sema(Context.getSymbols()).semantic(Tree))
+        {
+            Tree = nullptr;
+            return;
+        }
+        if (Fold)
+            Tree = ConstFold(Context).fold(Tree);
+    }
+};
+
+static void BM_Lexer(benchmark::State &State, ProgramShape Shape)
+{
+    std::string Source = generateProgram(Shape, State.range(0));
+    uint64_t Tokens = 0;
+    for (auto _ : State)
+    {
+        SymbolTable Symbols;
+        Lexer Lex(Source, Symbols);
+        Token Tok;
+        do
+            Lex.next(Tok);
+        while (Tok.getKind() != Token::eoi);
+        Tokens += Lex.getNumTokens();
+    }
+    State.SetBytesProcessed(State.iterations() * Source.size());
+    State.counters["tokens"] = benchmark::Counter(Tokens, benchmark::Counter::kIsRate);
+}
+
+static void BM_Parser(benchmark::State &State, ProgramShape Shape)
+{
+    std::string Source = generateProgram(Shape, State.range(0));
+    for (auto _ : State)
+    {
+        ASTContext Context;
+        Lexer Lex(Source, Context.getSymbols());
+        Parser P(Lex, Context);
+        benchmark::DoNotOptimize(P.parse());
+    }
+    State.SetBytesProcessed(State.iterations() * Source.size());
+}
+
+static void BM_Sema(benchmark::State &State, ProgramShape Shape)
+{
+    ParsedProgram Prog(Shape, State.range(0));
+    if (!Prog.Tree)
+    {
+        State.SkipWithError("generated program does not compile");
+        return;
+    }
+    for (auto _ : State)
+        benchmark::DoNotOptimize(Sema(Prog.Context.getSymbols(), llvm::nulls()).semantic(Prog.Tree));
+    State.SetBytesProcessed(State.iterations() * Prog.Source.size());
+}
+
+static void BM_ConstFold(benchmark::State &State, ProgramShape Shape)
+{
+    ParsedProgram Prog(Shape, State.range(0));
+    if (!Prog.Tree)
+    {
+        State.SkipWithError("generated program does not compile");
+        return;
+    }
+    // Folded nodes are allocated in the program's context, so memory grows
+    // with the number of iterations; the phase itself is what is measured.
+    for (auto _ : State)
+        benchmark::DoNotOptimize(ConstFold(Prog.Context).fold(Prog.Tree));
+    State.SetBytesProcessed(State.iterations() * Prog.Source.size());
+}
+
+static void BM_CodeGen(benchmark::State &State, ProgramShape Shape, unsigned OptLevel, EmitKind Emit)
+{
+    ParsedProgram Prog(Shape, State.range(0), /*Fold=*/true);
+    if (!Prog.Tree)
+    {
+        State.SkipWithError("generated program does not compile");
+        return;
+    }
+    CodeGenOptions Opts;
+    Opts.OptLevel = OptLevel;
+    Opts.Emit = Emit;
+    Opts.OutputFile = "/dev/null";
+    uint64_t Instructions = 0;
+    for (auto _ : State)
+    {
+        CodeGen CG(Opts, llvm::nulls());
+        if (CG.compile(Prog.Tree))
+        {
+            State.SkipWithError("code generation failed");
+            return;
+        }
+        Instructions += CG.getNumInstructions();
+    }
+    State.counters["ir_instructions"] = benchmark::Counter(Instructions, benchmark::Counter::kIsRate);
+}
+
+// Links the program into an executable once and measures running it, with
+// its output sent to /dev/null.
+static void BM_Run(benchmark::State &State, ProgramShape Shape, unsigned OptLevel)
+{
+    ParsedProgram Prog(Shape, State.range(0), /*Fold=*/true);
+    llvm::SmallString<128> Executable;
+    if (!Prog.Tree || llvm::sys::fs::createTemporaryFile("compiler-bench", "", Executable))
+    {
+        State.SkipWithError("cannot set up the program");
+        return;
+    }
+    llvm::FileRemover Remover(Executable);
+
+    CodeGenOptions Opts;
+    Opts.OptLevel = OptLevel;
+    Opts.Emit = EmitKind::Executable;
+    Opts.OutputFile = std::string(Executable.str());
+    Opts.RuntimeObject = RTCOMPILER_PATH;
+    if (CodeGen(Opts, llvm::nulls()).compile(Prog.Tree))
+    {
+        State.SkipWithError("cannot build the executable");
+        return;
+    }
+
+    llvm::StringRef Args[] = {Executable};
+    llvm::Optional<llvm::StringRef> Redirects[] = {llvm::None, llvm::StringRef(""), llvm::None};
+    for (auto _ : State)
+        if (llvm::sys::ExecuteAndWait(Executable, Args, llvm::None, Redirects) != 0)
+        {
+            State.SkipWithError("the program failed");
+            return;
+        }
+}
+
+int main(int argc, char **argv)
+{
+    for (ProgramShape Shape : Shapes)
+    {
+        std::string Name = getShapeName(Shape).str();
+        benchmark::RegisterBenchmark(("lexer/" + Name).c_str(), BM_Lexer, Shape)
+            ->RangeMultiplier(8)
+            ->Range(512, 32768);
+        benchmark::RegisterBenchmark(("parser/" + Name).c_str(), BM_Parser, Shape)
+            ->RangeMultiplier(8)
+            ->Range(512, 32768);
+        benchmark::RegisterBenchmark(("sema/" + Name).c_str(), BM_Sema, Shape)
+            ->RangeMultiplier(8)
+            ->Range(512, 32768);
+        benchmark::RegisterBenchmark(("constfold/" + Name).c_str(), BM_ConstFold, Shape)
+            ->RangeMultiplier(8)
+            ->Range(512, 32768);
+        for (unsigned OptLevel : {0u, 2u})
+        {
+            std::string Suffix = "/O" + std::to_string(OptLevel);
+            benchmark::RegisterBenchmark(("codegen-ll/" + Name + Suffix).c_str(), BM_CodeGen,
+                                         Shape, OptLevel, EmitKind::LLVMIR)
+                ->RangeMultiplier(8)
+                ->Range(64, 4096)
+                ->Unit(benchmark::kMillisecond);
+            benchmark::RegisterBenchmark(("codegen-obj/" + Name + Suffix).c_str(), BM_CodeGen,
+                                         Shape, OptLevel, EmitKind::Object)
+                ->RangeMultiplier(8)
+                ->Range(64, 4096)
+                ->Unit(benchmark::kMillisecond);
+            // The program runs in a child process, so its CPU time is not ours.
+            benchmark::RegisterBenchmark(("run/" + Name + Suffix).c_str(), BM_Run, Shape, OptLevel)
+                ->RangeMultiplier(8)
+                ->Range(64, 512)
+                ->UseRealTime()
+                ->Unit(benchmark::kMillisecond);
+        }
+    }
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    return 0;
+}
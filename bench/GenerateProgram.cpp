@@ -0,0 +1,36 @@
+#include "ProgramGenerator.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/raw_ostream.h"
+
+// Writes a synthetic program to stdout, for example
+//   compiler-gen --shape=loops --size=10000 > loops.txt
+static llvm::cl::opt<std::string>
+    Shape("shape",
+          llvm::cl::desc("Shape of the program: declarations, nested-if, loops, power, prints or mixed"),
+          llvm::cl::init("mixed"));
+
+static llvm::cl::opt<unsigned>
+    Size("size",
+         llvm::cl::desc("Number of statements of the shape (default 1000)"),
+         llvm::cl::init(1000));
+
+static llvm::cl::opt<unsigned>
+    Seed("seed",
+         llvm::cl::desc("Seed of the constants and variables chosen (default 1)"),
+         llvm::cl::init(1));
+
+int main(int argc, const char **argv)
+{
+    llvm::InitLLVM X(argc, argv);
+    llvm::cl::ParseCommandLineOptions(argc, argv, "Synthetic program generator\n");
+
+    ProgramShape S;
+    if (!parseShapeName(Shape, S))
+    {
+        llvm::errs() << "Unknown shape " << Shape << "\n";
+        return 1;
+    }
+    llvm::outs() << generateProgram(S, Size, Seed);
+    return 0;
+}
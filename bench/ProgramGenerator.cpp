@@ -0,0 +1,247 @@
+#include "ProgramGenerator.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <random>
+
+namespace
+{
+  class ProgramGenerator
+  {
+    llvm::raw_string_ostream OS;
+    std::mt19937 Rng;
+    unsigned NumDecls = 0; // declarations emitted so far, names d0, d1, ...
+    unsigned NumLoops = 0; // loop counters emitted so far, names i0, i1, ...
+
+    unsigned random(unsigned Max) { return Rng() % (Max + 1); }
+
+    const char *intVar()
+    {
+      static const char *const Vars[] = {"a", "b", "c", "x"};
+      return Vars[random(3)];
+    }
+
+    // An int expression over the common variables, with Depth nested operators.
+    void expr(unsigned Depth)
+    {
+      if (Depth == 0)
+      {
+        if (random(2) == 0)
+          OS << random(99);
+        else
+          OS << intVar();
+        return;
+      }
+      static const char *const Ops[] = {" + ", " - ", " * ", " / ", " % "};
+      unsigned Op = random(4);
+      OS << '(';
+      expr(Depth - 1);
+      OS << Ops[Op];
+      // Divisors are non-zero constants, so the programs never trap.
+      if (Op >= 3)
+        OS << random(8) + 1;
+      else
+        expr(Depth - 1);
+      OS << ')';
+    }
+
+    void condition()
+    {
+      static const char *const Ops[] = {" < ", " > ", " <= ", " >= ", " == ", " != "};
+      OS << intVar() << Ops[random(5)];
+      expr(1);
+    }
+
+    void assignment()
+    {
+      OS << intVar() << " = ";
+      expr(2);
+      OS << ";\n";
+    }
+
+    // Declares a fresh loop counter before the statement that uses it.
+    std::string loopCounter()
+    {
+      std::string Name = "i" + std::to_string(NumLoops++);
+      OS << "int " << Name << ";\n";
+      return Name;
+    }
+
+  public:
+    ProgramGenerator(std::string &Out, unsigned Seed) : OS(Out), Rng(Seed)
+    {
+      // Variables shared by every shape; x stays in a small range through the
+      // % in the loops, so nested conditions take different paths.
+      OS << "int a = 1, b = 2, c = 3, e = 0, x = " << Seed % 17 << ";\n"
+         << "bool p = true, q = false;\n";
+    }
+
+    void declarations(unsigned Size)
+    {
+      for (unsigned I = 0; I < Size; ++I, ++NumDecls)
+      {
+        if (NumDecls % 4 == 3)
+        {
+          OS << "bool d" << NumDecls << " = a > " << random(50) << ";\n";
+          continue;
+        }
+        OS << "int d" << NumDecls << " = ";
+        if (NumDecls % 4 == 0)
+          expr(1);
+        else
+          OS << "d" << NumDecls - 1 << " + " << random(9);
+        OS << ";\n";
+      }
+    }
+
+    void nestedIf(unsigned Size)
+    {
+      const unsigned Depth = 16;
+      for (unsigned Done = 0; Done < Size; Done += Depth)
+      {
+        unsigned Levels = std::min(Depth, Size - Done);
+        for (unsigned L = 0; L < Levels; ++L)
+        {
+          OS << "if (";
+          condition();
+          OS << ") {\n";
+          assignment();
+        }
+        for (unsigned L = 0; L < Levels; ++L)
+        {
+          OS << "} else if (";
+          condition();
+          OS << ") {\n";
+          assignment();
+          OS << "} else {\n";
+          assignment();
+          OS << "}\n";
+        }
+        OS << "x = x % 16;\n";
+      }
+    }
+
+    void loops(unsigned Size, unsigned TripCount)
+    {
+      const unsigned BodySize = 64;
+      for (unsigned Done = 0, N = 0; Done < Size; Done += BodySize, ++N)
+      {
+        std::string I = loopCounter();
+        unsigned Statements = std::min(BodySize, Size - Done);
+        if (N % 2 == 0)
+          OS << "for (" << I << " = 0; " << I << " < " << TripCount << "; " << I << "++) {\n";
+        else
+          OS << I << " = 0;\nwhile (" << I << " < " << TripCount << ") {\n";
+        for (unsigned S = 0; S < Statements; ++S)
+          if (S % 8 == 7)
+            OS << "a += " << I << ";\n";
+          else
+            assignment();
+        if (N % 2 != 0)
+          OS << I << "++;\n";
+        OS << "}\n"
+           << "x = x % 16;\n";
+      }
+    }
+
+    void power(unsigned Size, unsigned TripCount)
+    {
+      const unsigned BodySize = 32;
+      for (unsigned Done = 0; Done < Size; Done += BodySize)
+      {
+        std::string I = loopCounter();
+        OS << "for (" << I << " = 0; " << I << " < " << TripCount << "; " << I << "++) {\n"
+           << "e = " << I << " % 9;\n";
+        for (unsigned S = 0, N = std::min(BodySize, Size - Done); S < N; ++S)
+          if (S % 2 == 0)
+            OS << intVar() << " = (" << intVar() << " ^ " << random(11) + 2 << ") - a;\n";
+          else
+            OS << intVar() << " = (" << intVar() << " ^ e) + " << random(9) << ";\n";
+        OS << "}\n";
+      }
+    }
+
+    void prints(unsigned Size)
+    {
+      for (unsigned I = 0; I < Size; ++I)
+      {
+        if (I % 6 == 5)
+          OS << "print(" << (random(1) ? "p" : "q") << ");\n";
+        else
+          OS << "print(" << intVar() << ");\n";
+        if (I % 12 == 11)
+          OS << "a++;\n";
+      }
+    }
+
+    void finish() { OS << "print(a);\nprint(b);\nprint(c);\nprint(x);\n"; }
+  };
+}
+
+std::string generateProgram(ProgramShape Shape, unsigned Size, unsigned Seed)
+{
+  // Loops run long enough to dominate the run time of the program, but the
+  // programs still finish quickly at the sizes the benchmarks use.
+  const unsigned TripCount = 1000;
+
+  std::string Out;
+  ProgramGenerator G(Out, Seed);
+  switch (Shape)
+  {
+  case ProgramShape::Declarations:
+    G.declarations(Size);
+    break;
+  case ProgramShape::NestedIf:
+    G.nestedIf(Size);
+    break;
+  case ProgramShape::Loops:
+    G.loops(Size, TripCount);
+    break;
+  case ProgramShape::Power:
+    G.power(Size, TripCount);
+    break;
+  case ProgramShape::Prints:
+    G.prints(Size);
+    break;
+  case ProgramShape::Mixed:
+    G.declarations(Size / 5);
+    G.nestedIf(Size / 5);
+    G.loops(Size / 5, TripCount);
+    G.power(Size / 5, TripCount);
+    G.prints(Size / 5);
+    break;
+  }
+  G.finish();
+  return Out;
+}
+
+static const struct
+{
+  ProgramShape Shape;
+  const char *Name;
+} ShapeNames[] = {
+    {ProgramShape::Declarations, "declarations"},
+    {ProgramShape::NestedIf, "nested-if"},
+    {ProgramShape::Loops, "loops"},
+    {ProgramShape::Power, "power"},
+    {ProgramShape::Prints, "prints"},
+    {ProgramShape::Mixed, "mixed"},
+};
+
+llvm::StringRef getShapeName(ProgramShape Shape)
+{
+  for (const auto &S : ShapeNames)
+    if (S.Shape == Shape)
+      return S.Name;
+  return "";
+}
+
+bool parseShapeName(llvm::StringRef Name, ProgramShape &Shape)
+{
+  for (const auto &S : ShapeNames)
+    if (Name == S.Name)
+    {
+      Shape = S.Shape;
+      return true;
+    }
+  return false;
+}
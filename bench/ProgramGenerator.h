@@ -0,0 +1,29 @@
+#ifndef PROGRAMGENERATOR_H
+#define PROGRAMGENERATOR_H
+
+#include "llvm/ADT/StringRef.h"
+#include <string>
+
+// Shapes of synthetic programs. Each one stresses a different part of the
+// compiler; the size of the program grows linearly with the Size argument of
+// generateProgram.
+enum class ProgramShape
+{
+  Declarations, // Size declarations, each initialized from the previous ones
+  NestedIf,     // Size if/else if/else statements nested 16 deep
+  Loops,        // for and while loops with Size statements in their bodies
+  Power,        // Size assignments using ^ with constant and variable exponents
+  Prints,       // Size prints of int and bool variables
+  Mixed         // a fifth of each of the above
+};
+
+// Returns a well-formed program that passes Sema. The same shape, size and
+// seed always give the same program.
+std::string generateProgram(ProgramShape Shape, unsigned Size, unsigned Seed = 1);
+
+// Maps a shape to and from its name on the command line ("declarations",
+// "nested-if", "loops", "power", "prints", "mixed").
+llvm::StringRef getShapeName(ProgramShape Shape);
+bool parseShapeName(llvm::StringRef Name, ProgramShape &Shape);
+
+#endif
@@ -1,20 +1,170 @@
+#include <setjmp.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+/* Output is collected in a user-space buffer and written with one fwrite per
+   buffer instead of one printf per value. It is flushed when full, before
+   reading input and at exit. Each thread has its own buffer and may send its
+   output to a sink instead of stdout (see rt_set_output). */
+#define RT_BUFFER_SIZE (64 * 1024)
+#define RT_MAX_INT_LEN 12 /* "-2147483648\n" */
+
+typedef void (*rt_sink)(void *ctx, const char *data, size_t n);
+
+static _Thread_local char rt_buffer[RT_BUFFER_SIZE];
+static _Thread_local size_t rt_used;
+static _Thread_local rt_sink rt_sink_fn;
+static _Thread_local void *rt_sink_ctx;
+static atomic_int rt_registered;
+
+void rt_flush(void)
+{
+    if (rt_sink_fn)
+    {
+        if (rt_used)
+            rt_sink_fn(rt_sink_ctx, rt_buffer, rt_used);
+        rt_used = 0;
+        return;
+    }
+    if (rt_used)
+    {
+        fwrite(rt_buffer, 1, rt_used, stdout);
+        rt_used = 0;
+    }
+    fflush(stdout);
+}
+
+/* Sends the output of the calling thread to fn instead of stdout, or back to
+   stdout if fn is NULL. The compiler server uses it to capture the output of
+   programs it runs with the JIT. */
+void rt_set_output(rt_sink fn, void *ctx)
+{
+    /* Not stdio's buffer: a child process that runs a program for the
+       compiler must not write the one it inherited. */
+    if (rt_used)
+        rt_flush();
+    rt_sink_fn = fn;
+    rt_sink_ctx = ctx;
+}
+
+static void rt_reserve(size_t n)
+{
+    /* Threads with a sink flush explicitly; only stdout needs the exit hook.
+       It flushes the buffer of the thread that exits: programs run on other
+       threads flush theirs when main returns (see JITProgram::run). The
+       exchange makes exactly one of the threads that get here register it. */
+    if (!rt_sink_fn && !atomic_load_explicit(&rt_registered, memory_order_relaxed) &&
+        !atomic_exchange(&rt_registered, 1))
+        atexit(rt_flush);
+    if (rt_used + n > RT_BUFFER_SIZE)
+        rt_flush();
+}
+
+static void rt_put_int(int v)
+{
+    char tmp[RT_MAX_INT_LEN];
+    char *end = tmp + sizeof(tmp);
+    char *p = end;
+    unsigned u = v < 0 ? 0u - (unsigned)v : (unsigned)v;
+
+    *--p = '\n';
+    do
+    {
+        *--p = (char)('0' + u % 10);
+        u /= 10;
+    } while (u);
+    if (v < 0)
+        *--p = '-';
+
+    memcpy(rt_buffer + rt_used, p, (size_t)(end - p));
+    rt_used += (size_t)(end - p);
+}
 
 void print_int(int v)
 {
-    printf("%d\n", v);
+    rt_reserve(RT_MAX_INT_LEN);
+    rt_put_int(v);
+}
+
+/* Prints n values, one per line; CodeGen groups consecutive prints into one call. */
+void print_int_n(const int *v, int n)
+{
+    for (int i = 0; i < n; ++i)
+    {
+        rt_reserve(RT_MAX_INT_LEN);
+        rt_put_int(v[i]);
+    }
 }
 
 void print_bool(int v)
 {
-    printf("%s\n", v ? "true" : "false");
+    const char *s = v ? "true\n" : "false\n";
+    size_t len = v ? 5 : 6;
+    rt_reserve(len);
+    memcpy(rt_buffer + rt_used, s, len);
+    rt_used += len;
+}
+
+/* Writes n bytes of output at once; CodeGen emits one call with the whole
+   output of a program it could evaluate at compile time. */
+void rt_write(const char *s, int n)
+{
+    if ((size_t)n <= RT_BUFFER_SIZE)
+    {
+        rt_reserve((size_t)n);
+        memcpy(rt_buffer + rt_used, s, (size_t)n);
+        rt_used += (size_t)n;
+        return;
+    }
+    rt_reserve(RT_BUFFER_SIZE);
+    rt_flush();
+    if (rt_sink_fn)
+        rt_sink_fn(rt_sink_ctx, s, (size_t)n);
+    else
+        fwrite(s, 1, (size_t)n, stdout);
+}
+
+/* Compiled code calls rt_div_error instead of dividing by zero or dividing
+   INT_MIN by -1, with one of these codes. Inside rt_try the error returns
+   from rt_try, so that a compiler running a program in-process can report
+   it and go on; otherwise the program reports it and exits. */
+#define RT_DIV_ZERO 1
+#define RT_DIV_OVERFLOW 2
+
+static _Thread_local jmp_buf *rt_trap;
+
+/* Calls fn(arg) and returns 0, or the code of the division error that
+   stopped it, after flushing what it printed. */
+int rt_try(void (*fn)(void *), void *arg)
+{
+    jmp_buf env;
+    jmp_buf *outer = rt_trap;
+    int code = setjmp(env);
+    if (code == 0)
+    {
+        rt_trap = &env;
+        fn(arg);
+    }
+    rt_trap = outer;
+    return code;
+}
+
+void rt_div_error(int code)
+{
+    rt_flush();
+    if (rt_trap)
+        longjmp(*rt_trap, code);
+    fputs(code == RT_DIV_ZERO ? "Division by zero\n" : "Integer overflow in division\n", stderr);
+    exit(1);
 }
 
 int compiler_read(char *s)
 {
     char buf[64];
     int val;
+    rt_flush();
     printf("Enter a value for %s: ", s);
     fgets(buf, sizeof(buf), stdin);
     if (EOF == sscanf(buf, "%d", &val))
@@ -23,4 +173,156 @@ int compiler_read(char *s)
         exit(1);
     }
     return val;
-}
\ No newline at end of file
+}
+
+/* Counter tables of a program built with --profile-generate (table 0) or
+   --instrument (table 1). main takes zeroed ones of n counters when it
+   starts. They belong to the calling thread, so that the runs of a program
+   on several threads at once, or one after the other, each count their own. */
+static _Thread_local unsigned long long *rt_counter_tables[2];
+static _Thread_local size_t rt_counter_sizes[2];
+
+unsigned long long *rt_counters(int table, int n)
+{
+    if ((size_t)n > rt_counter_sizes[table])
+    {
+        unsigned long long *c = realloc(rt_counter_tables[table], (size_t)n * sizeof(*c));
+        if (!c)
+        {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+        rt_counter_tables[table] = c;
+        rt_counter_sizes[table] = n;
+    }
+    if (n)
+        memset(rt_counter_tables[table], 0, (size_t)n * sizeof(**rt_counter_tables));
+    return rt_counter_tables[table];
+}
+
+static void rt_profile_merge(const char *path, unsigned long long checksum,
+                             const unsigned long long *counters, int sites)
+{
+    unsigned long long runs = 0, old_checksum, *old;
+    int old_sites, i;
+    FILE *f;
+
+    old = calloc(2 * (size_t)sites + 1, sizeof(*old));
+    if (!old)
+        return;
+    f = fopen(path, "r");
+    if (f)
+    {
+        if (fscanf(f, "compiler-profile 1 checksum %llx runs %llu sites %d",
+                   &old_checksum, &runs, &old_sites) != 3 ||
+            old_checksum != checksum || old_sites != sites)
+            runs = 0;
+        for (i = 0; runs && i < 2 * sites; ++i)
+            if (fscanf(f, "%llu", &old[i]) != 1)
+                runs = 0;
+        if (!runs)
+            memset(old, 0, 2 * (size_t)sites * sizeof(*old));
+        fclose(f);
+    }
+
+    f = fopen(path, "w");
+    if (!f)
+    {
+        fprintf(stderr, "Cannot write profile %s\n", path);
+        free(old);
+        return;
+    }
+    fprintf(f, "compiler-profile 1\nchecksum %016llx\nruns %llu\nsites %d\n", checksum, runs + 1, sites);
+    for (i = 0; i < sites; ++i)
+        fprintf(f, "%llu %llu\n", old[2 * i] + counters[2 * i], old[2 * i + 1] + counters[2 * i + 1]);
+    fclose(f);
+    free(old);
+}
+
+/* Writes the branch counters of a program built with --profile-generate to
+   path: two per site, the times its condition was true and false. If path
+   already holds a profile of the same program (same checksum), the counts
+   are added to it, so a profile can collect several runs. Runs that end at
+   once on several threads add to the file one at a time. */
+static atomic_flag rt_profile_lock = ATOMIC_FLAG_INIT;
+
+void rt_profile_write(const char *path, unsigned long long checksum,
+                      const unsigned long long *counters, int sites)
+{
+    while (atomic_flag_test_and_set_explicit(&rt_profile_lock, memory_order_acquire))
+        ;
+    rt_profile_merge(path, checksum, counters, sites);
+    atomic_flag_clear_explicit(&rt_profile_lock, memory_order_release);
+}
+
+/* Hot-spot report of a program built with --instrument. spots holds the
+   source line and kind of each instrumented statement and counters three
+   counts per statement: how often it ran, how often one of its bodies ran
+   (loop iterations, taken if/else branches) and the cycles spent in it,
+   nested statements included. The report is sorted by cycles and written
+   as a table to stderr if path is "-", otherwise as JSON to path. */
+static const char *const rt_spot_kinds[] = {"if", "while", "for"};
+static _Thread_local const unsigned long long *rt_sort_counters;
+
+static int rt_compare_spots(const void *a, const void *b)
+{
+    unsigned long long ca = rt_sort_counters[3 * *(const int *)a + 2];
+    unsigned long long cb = rt_sort_counters[3 * *(const int *)b + 2];
+    if (ca != cb)
+        return ca < cb ? 1 : -1;
+    return *(const int *)a - *(const int *)b;
+}
+
+void rt_instrument_report(const char *path, const unsigned *spots,
+                          const unsigned long long *counters, int n, unsigned long long total)
+{
+    int *order, i;
+    FILE *f;
+
+    rt_flush();
+    order = malloc((n ? n : 1) * sizeof(*order));
+    if (!order)
+        return;
+    for (i = 0; i < n; ++i)
+        order[i] = i;
+    rt_sort_counters = counters;
+    qsort(order, n, sizeof(*order), rt_compare_spots);
+
+    if (strcmp(path, "-") == 0)
+    {
+        fprintf(stderr,
+                "===-------------------------------------------------------------------------===\n"
+                "                                Hot spots\n"
+                "===-------------------------------------------------------------------------===\n"
+                "  Total cycles: %llu\n\n"
+                "    line  statement      entries         bodies           cycles       %%\n",
+                total);
+        for (i = 0; i < n; ++i)
+        {
+            const unsigned long long *c = counters + 3 * order[i];
+            fprintf(stderr, "%8u  %-9s %12llu   %12llu   %14llu  %5.1f%%\n", spots[2 * order[i]],
+                    rt_spot_kinds[spots[2 * order[i] + 1]], c[0], c[1], c[2],
+                    total ? 100.0 * (double)c[2] / (double)total : 0.0);
+        }
+        free(order);
+        return;
+    }
+
+    f = fopen(path, "w");
+    if (!f)
+    {
+        fprintf(stderr, "Cannot write hot-spot report %s\n", path);
+        free(order);
+        return;
+    }
+    fprintf(f, "{\n  \"total_cycles\": %llu,\n  \"spots\": [", total);
+    for (i = 0; i < n; ++i)
+    {
+        const unsigned long long *c = counters + 3 * order[i];
+        fprintf(f, "%s\n    {\"line\": %u, \"statement\": \"%s\", \"entries\": %llu, \"bodies\": %llu, \"cycles\": %llu}",
+                i ? "," : "", spots[2 * order[i]], rt_spot_kinds[spots[2 * order[i] + 1]], c[0], c[1], c[2]);
+    }
+    fprintf(f, "%s]\n}\n", n ? "\n  " : "");
+    fclose(f);
+    free(order);
+}
@@ -1,6 +1,4 @@
 cd build
 cd src
-./compiler "$(cat ../../input.txt)" > compiler.ll
-llc --filetype=obj -o=compiler.o compiler.ll
-clang -o compilerbin compiler.o ../../rtCompiler.c
+./compiler -O2 --file=../../input.txt --emit=exe --runtime=librtcompiler.a -o compilerbin
 ./compilerbin
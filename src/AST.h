@@ -1,8 +1,12 @@
 #ifndef AST_H
 #define AST_H
 
-#include "llvm/ADT/SmallVector.h"
-#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/Support/Casting.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "LoopHints.h"
+#include "SymbolTable.h"
+#include <cstdint>
 
 // Forward declarations of classes used in the AST
 class AST;
@@ -25,127 +29,148 @@ class elifStmt;
 class ForStmt;
 class PrintStmt;
 
-// ASTVisitor class defines a visitor pattern to traverse the AST
-class ASTVisitor
+// AST class serves as the base class for all AST nodes. Nodes have no
+// vtable: each one records its kind, which llvm::isa/cast/dyn_cast test
+// through the classof functions and ASTVisitor switches on.
+//
+// Nodes are kept small, since large programs have millions of them. Kinds
+// and operators are single bytes and the first field of a node after them
+// shares the word with the kind. Identifiers are only their symbol ID, whose
+// name is in the SymbolTable, and literals their value. Child lists are
+// arena arrays with a 32-bit size, and the sizes are placed so that they
+// fill what would otherwise be padding.
+class AST
 {
 public:
-  // Virtual visit functions for each AST node type
-  virtual void visit(AST &) {}               // Visit the base AST node
-  virtual void visit(Expr &) {}              // Visit the expression node
-  virtual void visit(Logic &) {}             // Visit the Logic node
-  virtual void visit(Program &) {};          // Visit the group of expressions node
-  virtual void visit(Final &) = 0;           // Visit the Final node
-  virtual void visit(BinaryOp &) = 0;        // Visit the binary operation node
-  virtual void visit(UnaryOp &) = 0;
-  virtual void visit(SignedNumber &) = 0;
-  virtual void visit(NegExpr &) = 0;
-  virtual void visit(Assignment &) = 0;      // Visit the assignment expression node
-  virtual void visit(DeclarationInt &) = 0;     // Visit the variable declaration node
-  virtual void visit(DeclarationBool &) = 0;     // Visit the variable declaration node
-  virtual void visit(Comparison &) = 0;      // Visit the Comparison node
-  virtual void visit(LogicalExpr &) = 0;     // Visit the LogicalExpr node
-  virtual void visit(IfStmt &) = 0;          // Visit the IfStmt node
-  virtual void visit(WhileStmt &) = 0;        // Visit the IterStmt node
-  virtual void visit(elifStmt &) = 0;        // Visit the elifStmt node
-  virtual void visit(ForStmt &) = 0;
-  virtual void visit(PrintStmt &) = 0;
-};
+  enum NodeKind : uint8_t
+  {
+    NK_Program,
+    NK_DeclarationInt,
+    NK_DeclarationBool,
+    NK_Assignment,
+    NK_IfStmt,
+    NK_elifStmt,
+    NK_WhileStmt,
+    NK_ForStmt,
+    NK_PrintStmt,
+    NK_Final,
+    NK_BinaryOp,
+    NK_UnaryOp,
+    NK_SignedNumber,
+    NK_NegExpr,
+    NK_Comparison,
+    NK_LogicalExpr,
+    NK_FirstExpr = NK_Final,
+    NK_LastExpr = NK_NegExpr,
+    NK_FirstLogic = NK_Comparison,
+    NK_LastLogic = NK_LogicalExpr
+  };
+
+private:
+  const NodeKind Kind;
+
+protected:
+  AST(NodeKind Kind) : Kind(Kind) {}
 
-// AST class serves as the base class for all AST nodes
-class AST
-{
 public:
-  virtual ~AST() {}
-  virtual void accept(ASTVisitor &V) = 0;    // Accept a visitor for traversal
+  NodeKind getKind() const { return Kind; }
 };
 
 // Expr class represents an expression in the AST
 class Expr : public AST
 {
+protected:
+  Expr(NodeKind Kind) : AST(Kind) {}
+
 public:
-  Expr() {}
+  static bool classof(const AST *N) { return N->getKind() >= NK_FirstExpr && N->getKind() <= NK_LastExpr; }
 };
 
 class Logic : public AST
 {
+protected:
+  Logic(NodeKind Kind) : AST(Kind) {}
+
 public:
-  Logic() {}
+  static bool classof(const AST *N) { return N->getKind() >= NK_FirstLogic && N->getKind() <= NK_LastLogic; }
 };
 
 // Program class represents a group of expressions in the AST
 class Program : public AST
 {
-  using dataVector = llvm::SmallVector<AST *>;
+  using dataVector = llvm::ArrayRef<AST *>;
 
 private:
-  dataVector data;                          // Stores the list of expressions
+  uint32_t NumData = 0;
+  AST *const *data = nullptr;               // Stores the list of expressions (arena-allocated)
 
 public:
-  Program(llvm::SmallVector<AST *> data) : data(data) {}
-  Program() = default;
+  Program(llvm::ArrayRef<AST *> data) : AST(NK_Program), NumData(data.size()), data(data.data()) {}
+  Program() : AST(NK_Program) {}
 
-  llvm::SmallVector<AST *> getdata() { return data; }
+  static bool classof(const AST *N) { return N->getKind() == NK_Program; }
 
-  dataVector::const_iterator begin() { return data.begin(); }
+  llvm::ArrayRef<AST *> getdata() { return llvm::ArrayRef<AST *>(data, NumData); }
 
-  dataVector::const_iterator end() { return data.end(); }
+  dataVector::const_iterator begin() { return data; }
 
-  virtual void accept(ASTVisitor &V) override
-  {
-    V.visit(*this);
-  }
+  dataVector::const_iterator end() { return data + NumData; }
 };
 
 // Declaration class represents a variable declaration with an initializer in the AST
-class DeclarationInt : public Program
+class DeclarationInt : public AST
 {
-  using VarVector = llvm::SmallVector<llvm::StringRef>;
-  using ValueVector = llvm::SmallVector<Expr *>;
-  VarVector Vars;                           // Stores the list of variables
-  ValueVector Values;                       // Stores the list of initializers
+  using SymbolVector = llvm::ArrayRef<unsigned>;
+  using ValueVector = llvm::ArrayRef<Expr *>;
+  uint32_t NumSymbols;
+  const unsigned *Symbols;                  // Symbol IDs of the variables
+  Expr *const *Values;                     // Stores the list of initializers
+  uint32_t NumValues;
 
 public:
-  // Declaration(llvm::SmallVector<llvm::StringRef> Vars, Expr *E) : Vars(Vars), E(E) {}
-  DeclarationInt(llvm::SmallVector<llvm::StringRef> Vars, llvm::SmallVector<Expr *> Values) : Vars(Vars), Values(Values) {}
+  DeclarationInt(llvm::ArrayRef<unsigned> Symbols, llvm::ArrayRef<Expr *> Values) : AST(NK_DeclarationInt), NumSymbols(Symbols.size()), Symbols(Symbols.data()), Values(Values.data()), NumValues(Values.size()) {}
 
-  VarVector::const_iterator varBegin() { return Vars.begin(); }
+  static bool classof(const AST *N) { return N->getKind() == NK_DeclarationInt; }
 
-  VarVector::const_iterator varEnd() { return Vars.end(); }
+  SymbolVector getSymbols() { return SymbolVector(Symbols, NumSymbols); }
 
-  ValueVector::const_iterator valBegin() { return Values.begin(); }
+  ValueVector getValues() { return ValueVector(Values, NumValues); }
 
-  ValueVector::const_iterator valEnd() { return Values.end(); }
+  SymbolVector::const_iterator varBegin() { return Symbols; }
 
-  virtual void accept(ASTVisitor &V) override
-  {
-    V.visit(*this);
-  }
+  SymbolVector::const_iterator varEnd() { return Symbols + NumSymbols; }
+
+  ValueVector::const_iterator valBegin() { return Values; }
+
+  ValueVector::const_iterator valEnd() { return Values + NumValues; }
 };
 
 // Declaration class represents a variable declaration with an initializer in the AST
-class DeclarationBool : public Program
+class DeclarationBool : public AST
 {
-  using VarVector = llvm::SmallVector<llvm::StringRef>;
-  using ValueVector = llvm::SmallVector<Logic *>;
-  VarVector Vars;                           // Stores the list of variables
-  ValueVector Values;                       // Stores the list of initializers
+  using SymbolVector = llvm::ArrayRef<unsigned>;
+  using ValueVector = llvm::ArrayRef<Logic *>;
+  uint32_t NumSymbols;
+  const unsigned *Symbols;                  // Symbol IDs of the variables
+  Logic *const *Values;                     // Stores the list of initializers
+  uint32_t NumValues;
 
 public:
-  // Declaration(llvm::SmallVector<llvm::StringRef> Vars, Expr *E) : Vars(Vars), E(E) {}
-  DeclarationBool(llvm::SmallVector<llvm::StringRef> Vars, llvm::SmallVector<Logic *> Values) : Vars(Vars), Values(Values) {}
+  DeclarationBool(llvm::ArrayRef<unsigned> Symbols, llvm::ArrayRef<Logic *> Values) : AST(NK_DeclarationBool), NumSymbols(Symbols.size()), Symbols(Symbols.data()), Values(Values.data()), NumValues(Values.size()) {}
 
-  VarVector::const_iterator varBegin() { return Vars.begin(); }
+  static bool classof(const AST *N) { return N->getKind() == NK_DeclarationBool; }
 
-  VarVector::const_iterator varEnd() { return Vars.end(); }
+  SymbolVector getSymbols() { return SymbolVector(Symbols, NumSymbols); }
 
-  ValueVector::const_iterator valBegin() { return Values.begin(); }
+  ValueVector getValues() { return ValueVector(Values, NumValues); }
 
-  ValueVector::const_iterator valEnd() { return Values.end(); }
+  SymbolVector::const_iterator varBegin() { return Symbols; }
 
-  virtual void accept(ASTVisitor &V) override
-  {
-    V.visit(*this);
-  }
+  SymbolVector::const_iterator varEnd() { return Symbols + NumSymbols; }
+
+  ValueVector::const_iterator valBegin() { return Values; }
+
+  ValueVector::const_iterator valEnd() { return Values + NumValues; }
 };
 
 
@@ -153,34 +178,43 @@ public:
 class Final : public Expr
 {
 public:
-  enum ValueKind
+  enum ValueKind : uint8_t
   {
     Ident,
     Number
   };
 
 private:
-  ValueKind Kind;                            // Stores the kind of Final (identifier or number or true or false)
-  llvm::StringRef Val;                       // Stores the value of the Final
+  ValueKind VK;                              // Stores the kind of Final (identifier or number or true or false)
+  union
+  {
+    unsigned Symbol;                         // Symbol ID of an identifier
+    int32_t Val;                             // Stores the value of a number
+  };
 
 public:
-  Final(ValueKind Kind, llvm::StringRef Val) : Kind(Kind), Val(Val) {}
+  Final(ValueKind VK, int32_t Val, unsigned Symbol = SymbolTable::Invalid) : Expr(NK_Final), VK(VK)
+  {
+    if (VK == Ident)
+      this->Symbol = Symbol;
+    else
+      this->Val = Val;
+  }
 
-  ValueKind getKind() { return Kind; }
+  static bool classof(const AST *N) { return N->getKind() == NK_Final; }
 
-  llvm::StringRef getVal() { return Val; }
+  ValueKind getValueKind() { return VK; }
 
-  virtual void accept(ASTVisitor &V) override
-  {
-    V.visit(*this);
-  }
+  int32_t getVal() { return VK == Number ? Val : 0; }
+
+  unsigned getSymbol() { return VK == Ident ? Symbol : SymbolTable::Invalid; }
 };
 
 // BinaryOp class represents a binary operation in the AST (plus, minus, multiplication, division)
 class BinaryOp : public Expr
 {
 public:
-  enum Operator
+  enum Operator : uint8_t
   {
     Plus,
     Minus,
@@ -191,76 +225,67 @@ public:
   };
 
 private:
+  Operator Op;                              // Operator of the binary operation
   Expr *Left;                               // Left-hand side expression
   Expr *Right;                              // Right-hand side expression
-  Operator Op;                              // Operator of the binary operation
 
 public:
-  BinaryOp(Operator Op, Expr *L, Expr *R) : Op(Op), Left(L), Right(R) {}
+  BinaryOp(Operator Op, Expr *L, Expr *R) : Expr(NK_BinaryOp), Op(Op), Left(L), Right(R) {}
+
+  static bool classof(const AST *N) { return N->getKind() == NK_BinaryOp; }
 
   Expr *getLeft() { return Left; }
 
   Expr *getRight() { return Right; }
 
   Operator getOperator() { return Op; }
-
-  virtual void accept(ASTVisitor &V) override
-  {
-    V.visit(*this);
-  }
 };
 
 // naryOp class represents a unary operation in the AST (plus plus, minus minus)
 class UnaryOp : public Expr
 {
 public:
-  enum Operator
+  enum Operator : uint8_t
   {
     Plus_plus,
     Minus_minus
   };
 
 private:
-  llvm::StringRef Ident;                      
   Operator Op;                              // Operator of the unary operation
+  unsigned Symbol;                          // Symbol ID of the variable
 
 public:
-  UnaryOp(Operator Op, llvm::StringRef I) : Op(Op), Ident(I) {}
+  UnaryOp(Operator Op, unsigned Symbol) : Expr(NK_UnaryOp), Op(Op), Symbol(Symbol) {}
 
-  llvm::StringRef getIdent() { return Ident; }
+  static bool classof(const AST *N) { return N->getKind() == NK_UnaryOp; }
 
-  Operator getOperator() { return Op; }
+  unsigned getSymbol() { return Symbol; }
 
-  virtual void accept(ASTVisitor &V) override
-  {
-    V.visit(*this);
-  }
+  Operator getOperator() { return Op; }
 };
 
 class SignedNumber : public Expr
 {
 public:
-  enum Sign
+  enum Sign : uint8_t
   {
     Plus,
     Minus
   };
 
 private:
-  llvm::StringRef Value;                              
-  Sign s;                              
+  Sign s;
+  int32_t Value;                            // value of the literal, without the sign
 
 public:
-  SignedNumber(Sign S, llvm::StringRef V) : s(S), Value(V) {}
+  SignedNumber(Sign S, int32_t V) : Expr(NK_SignedNumber), s(S), Value(V) {}
 
-  llvm::StringRef getValue() { return Value; }
+  static bool classof(const AST *N) { return N->getKind() == NK_SignedNumber; }
 
-  Sign getSign() { return s; }
+  int32_t getValue() { return Value; }
 
-  virtual void accept(ASTVisitor &V) override
-  {
-    V.visit(*this);
-  }
+  Sign getSign() { return s; }
 };
 
 class NegExpr : public Expr
@@ -270,21 +295,18 @@ private:
   Expr *expr;                              
 
 public:
-  NegExpr(Expr *E) : expr(E) {}
+  NegExpr(Expr *E) : Expr(NK_NegExpr), expr(E) {}
 
-  Expr *getExpr() { return expr; }
+  static bool classof(const AST *N) { return N->getKind() == NK_NegExpr; }
 
-  virtual void accept(ASTVisitor &V) override
-  {
-    V.visit(*this);
-  }
+  Expr *getExpr() { return expr; }
 };
 
 // Assignment class represents an assignment expression in the AST
-class Assignment : public Program
+class Assignment : public AST
 {
   public:
-  enum AssignKind
+  enum AssignKind : uint8_t
   {
     Assign,         // =
     Minus_assign,   // -=
@@ -293,13 +315,15 @@ class Assignment : public Program
     Slash_assign,   // /=
 };
 private:
+  AssignKind AK;                           // Kind of assignment
   Final *Left;                             // Left-hand side Final (identifier)
   Expr *RightExpr;                         // Right-hand side expression
   Logic *RightLogicExpr;                   // Right-hand side logical expression
-  AssignKind AK;                           // Kind of assignment
 
 public:
-  Assignment(Final *L, Expr *RE, AssignKind AK, Logic *RL) : Left(L), RightExpr(RE), AK(AK), RightLogicExpr(RL) {}
+  Assignment(Final *L, Expr *RE, AssignKind AK, Logic *RL) : AST(NK_Assignment), AK(AK), Left(L), RightExpr(RE), RightLogicExpr(RL) {}
+
+  static bool classof(const AST *N) { return N->getKind() == NK_Assignment; }
 
   Final *getLeft() { return Left; }
 
@@ -308,18 +332,13 @@ public:
   Logic *getRightLogic() { return RightLogicExpr; }
 
   AssignKind getAssignKind() { return AK; }
-
-  virtual void accept(ASTVisitor &V) override
-  {
-    V.visit(*this);
-  }
 };
 
 // Comparison class represents a comparison expression in the AST
 class Comparison : public Logic
 {
   public:
-  enum Operator
+  enum Operator : uint8_t
   {
     Equal,          // ==
     Not_equal,      // !=
@@ -333,151 +352,167 @@ class Comparison : public Logic
   };
     
 private:
+  Operator Op;                               // Kind of assignment
   Expr *Left;                                // Left-hand side expression
   Expr *Right;                               // Right-hand side expression
-  Operator Op;                               // Kind of assignment
 
 public:
-  Comparison(Expr *L, Expr *R, Operator Op) : Left(L), Right(R), Op(Op) {}
+  Comparison(Expr *L, Expr *R, Operator Op) : Logic(NK_Comparison), Op(Op), Left(L), Right(R) {}
+
+  static bool classof(const AST *N) { return N->getKind() == NK_Comparison; }
 
   Expr *getLeft() { return Left; }
 
   Expr *getRight() { return Right; }
 
   Operator getOperator() { return Op; }
-
-  virtual void accept(ASTVisitor &V) override
-  {
-    V.visit(*this);
-  }
 };
 
 // LogicalExpr class represents a logical expression in the AST
 class LogicalExpr : public Logic
 {
   public:
-  enum Operator
+  enum Operator : uint8_t
   {
     And,          // &&
     Or,           // ||
   };
 
 private:
+  Operator Op;                                // Kind of assignment
   Logic *Left;                                // Left-hand side expression
   Logic *Right;                               // Right-hand side expression
-  Operator Op;                                // Kind of assignment
 
 public:
-  LogicalExpr(Logic *L, Logic *R, Operator Op) : Left(L), Right(R), Op(Op) {}
+  LogicalExpr(Logic *L, Logic *R, Operator Op) : Logic(NK_LogicalExpr), Op(Op), Left(L), Right(R) {}
+
+  static bool classof(const AST *N) { return N->getKind() == NK_LogicalExpr; }
 
   Logic *getLeft() { return Left; }
 
   Logic *getRight() { return Right; }
 
   Operator getOperator() { return Op; }
-
-  virtual void accept(ASTVisitor &V) override
-  {
-    V.visit(*this);
-  }
 };
 
-class elifStmt : public Program
+class elifStmt : public AST
 {
-  using Stmts = llvm::SmallVector<AST *>;
+  using Stmts = llvm::ArrayRef<AST *>;
 
 private:
-  Stmts S;
+  uint32_t NumS;
+  AST *const *S;
   Logic *Cond;
 
 public:
-  elifStmt(Logic *Cond, llvm::SmallVector<AST *> S) : Cond(Cond), S(S) {}
+  elifStmt(Logic *Cond, llvm::ArrayRef<AST *> S) : AST(NK_elifStmt), NumS(S.size()), S(S.data()), Cond(Cond) {}
+
+  static bool classof(const AST *N) { return N->getKind() == NK_elifStmt; }
 
   Logic *getCond() { return Cond; }
 
-  Stmts::const_iterator begin() { return S.begin(); }
+  Stmts getBody() { return Stmts(S, NumS); }
 
-  Stmts::const_iterator end() { return S.end(); }
+  Stmts::const_iterator begin() { return S; }
 
-  virtual void accept(ASTVisitor &V) override
-  {
-    V.visit(*this);
-  }
+  Stmts::const_iterator end() { return S + NumS; }
 
 };
 
-class IfStmt : public Program
+class IfStmt : public AST
 {
-using BodyVector = llvm::SmallVector<AST *>;
-using elifVector = llvm::SmallVector<elifStmt *>;
+using BodyVector = llvm::ArrayRef<AST *>;
+using elifVector = llvm::ArrayRef<elifStmt *>;
 
 private:
-  BodyVector ifStmts;
-  elifVector elifStmts;
-  BodyVector elseStmts;
+  unsigned Line; // source line of the if keyword
+  AST *const *ifStmts;
+  elifStmt *const *elifStmts;
+  AST *const *elseStmts;
   Logic *Cond;
+  uint32_t NumIf, NumElif, NumElse;
 
 public:
-  IfStmt(Logic *Cond, llvm::SmallVector<AST *> ifStmts, llvm::SmallVector<AST *> elseStmts, llvm::SmallVector<elifStmt *> elifStmts) : Cond(Cond), ifStmts(ifStmts), elseStmts(elseStmts), elifStmts(elifStmts) {}
+  IfStmt(Logic *Cond, llvm::ArrayRef<AST *> ifStmts, llvm::ArrayRef<AST *> elseStmts, llvm::ArrayRef<elifStmt *> elifStmts, unsigned Line) : AST(NK_IfStmt), Line(Line), ifStmts(ifStmts.data()), elifStmts(elifStmts.data()), elseStmts(elseStmts.data()), Cond(Cond), NumIf(ifStmts.size()), NumElif(elifStmts.size()), NumElse(elseStmts.size()) {}
+
+  static bool classof(const AST *N) { return N->getKind() == NK_IfStmt; }
 
   Logic *getCond() { return Cond; }
 
-  BodyVector::const_iterator begin() { return ifStmts.begin(); }
+  unsigned getLine() const { return Line; }
 
-  BodyVector::const_iterator end() { return ifStmts.end(); }
+  BodyVector getBody() { return BodyVector(ifStmts, NumIf); }
 
-  BodyVector::const_iterator beginElse() { return elseStmts.begin(); }
+  BodyVector getElse() { return BodyVector(elseStmts, NumElse); }
 
-  BodyVector::const_iterator endElse() { return elseStmts.end(); }
+  elifVector getElifs() { return elifVector(elifStmts, NumElif); }
 
-  elifVector::const_iterator beginElif() { return elifStmts.begin(); }
+  BodyVector::const_iterator begin() { return ifStmts; }
 
-  elifVector::const_iterator endElif() { return elifStmts.end(); }
+  BodyVector::const_iterator end() { return ifStmts + NumIf; }
 
-  virtual void accept(ASTVisitor &V) override
-  {
-    V.visit(*this);
-  }
+  BodyVector::const_iterator beginElse() { return elseStmts; }
+
+  BodyVector::const_iterator endElse() { return elseStmts + NumElse; }
+
+  elifVector::const_iterator beginElif() { return elifStmts; }
+
+  elifVector::const_iterator endElif() { return elifStmts + NumElif; }
 };
 
-class WhileStmt : public Program
+class WhileStmt : public AST
 {
-using BodyVector = llvm::SmallVector<AST *>;
-BodyVector Body;
+using BodyVector = llvm::ArrayRef<AST *>;
 
 private:
+  unsigned Line; // source line of the while keyword
+  AST *const *Body;
   Logic *Cond;
+  uint32_t NumBody;
+  LoopHints Hints;
 
 public:
-  WhileStmt(Logic *Cond, llvm::SmallVector<AST *> Body) : Cond(Cond), Body(Body) {}
+  WhileStmt(Logic *Cond, llvm::ArrayRef<AST *> Body, unsigned Line, LoopHints Hints) : AST(NK_WhileStmt), Line(Line), Body(Body.data()), Cond(Cond), NumBody(Body.size()), Hints(Hints) {}
+
+  static bool classof(const AST *N) { return N->getKind() == NK_WhileStmt; }
 
   Logic *getCond() { return Cond; }
 
-  BodyVector::const_iterator begin() { return Body.begin(); }
+  unsigned getLine() const { return Line; }
 
-  BodyVector::const_iterator end() { return Body.end(); }
+  LoopHints getHints() const { return Hints; }
 
-  virtual void accept(ASTVisitor &V) override
-  {
-    V.visit(*this);
-  }
+  BodyVector getBody() { return BodyVector(Body, NumBody); }
+
+  BodyVector::const_iterator begin() { return Body; }
+
+  BodyVector::const_iterator end() { return Body + NumBody; }
 };
 
 
-class ForStmt : public Program
+class ForStmt : public AST
 {
-using BodyVector = llvm::SmallVector<AST *>;
-BodyVector Body;
+using BodyVector = llvm::ArrayRef<AST *>;
 
 private:
+  unsigned Line; // source line of the for keyword
+  AST *const *Body;
   Assignment *First;
   Logic *Second;
   Assignment *ThirdAssign;
   UnaryOp *ThirdUnary;
+  uint32_t NumBody;
+  LoopHints Hints;
 
 
 public:
-  ForStmt(Assignment *First, Logic *Second, Assignment *ThirdAssign, UnaryOp* ThirdUnary, llvm::SmallVector<AST *> Body) : First(First), Second(Second), ThirdAssign(ThirdAssign), ThirdUnary(ThirdUnary), Body(Body) {}
+  ForStmt(Assignment *First, Logic *Second, Assignment *ThirdAssign, UnaryOp* ThirdUnary, llvm::ArrayRef<AST *> Body, unsigned Line, LoopHints Hints) : AST(NK_ForStmt), Line(Line), Body(Body.data()), First(First), Second(Second), ThirdAssign(ThirdAssign), ThirdUnary(ThirdUnary), NumBody(Body.size()), Hints(Hints) {}
+
+  static bool classof(const AST *N) { return N->getKind() == NK_ForStmt; }
+
+  unsigned getLine() const { return Line; }
+
+  LoopHints getHints() const { return Hints; }
 
   Assignment *getFirst() { return First; }
 
@@ -487,30 +522,104 @@ public:
 
   UnaryOp *getThirdUnary() { return ThirdUnary; }
 
-  BodyVector::const_iterator begin() { return Body.begin(); }
+  BodyVector getBody() { return BodyVector(Body, NumBody); }
 
-  BodyVector::const_iterator end() { return Body.end(); }
+  BodyVector::const_iterator begin() { return Body; }
 
-  virtual void accept(ASTVisitor &V) override
-  {
-    V.visit(*this);
-  }
+  BodyVector::const_iterator end() { return Body + NumBody; }
 };
 
-class PrintStmt : public Program
+class PrintStmt : public AST
 {
 private:
-  llvm::StringRef Var;
+  unsigned Symbol;                          // Symbol ID of the printed variable
   
 public:
-  PrintStmt(llvm::StringRef Var) : Var(Var) {}
+  PrintStmt(unsigned Symbol) : AST(NK_PrintStmt), Symbol(Symbol) {}
+
+  static bool classof(const AST *N) { return N->getKind() == NK_PrintStmt; }
+
+  unsigned getSymbol() { return Symbol; }
+};
+
+// StatementStream hands the top-level statements of a program to CodeGen
+// one at a time, so a program can be compiled without holding its whole
+// AST. A statement is only valid until the next call to next().
+class StatementStream
+{
+public:
+  virtual ~StatementStream() = default;
+
+  // Returns the next statement, or null if there are no more.
+  virtual AST *next() = 0;
+
+  // True if the statements ended early because of an error in the program;
+  // only meaningful once next() returned null.
+  virtual bool hasError() = 0;
+};
+
+// ASTVisitor is a CRTP base for AST traversals, in the style of
+// llvm::InstVisitor. visit() switches on the node kind and calls the
+// derived class's visitXXX function directly, so handlers can be inlined
+// into the traversal. A handler that is not overridden falls back to the
+// one for its base class (visitFinal -> visitExpr -> visitAST), which does
+// nothing. Handlers return RetTy.
+template <typename Derived, typename RetTy = void>
+class ASTVisitor
+{
+  Derived &derived() { return *static_cast<Derived *>(this); }
 
-  llvm::StringRef getVar() { return Var; }
+public:
+  RetTy visit(AST *Node) { return visit(*Node); }
 
-  virtual void accept(ASTVisitor &V) override
+  RetTy visit(AST &Node)
   {
-    V.visit(*this);
+    switch (Node.getKind())
+    {
+#define DISPATCH(CLASS)                                                                            \
+  case AST::NK_##CLASS:                                                                            \
+    return derived().visit##CLASS(llvm::cast<CLASS>(Node));
+      DISPATCH(Program)
+      DISPATCH(DeclarationInt)
+      DISPATCH(DeclarationBool)
+      DISPATCH(Assignment)
+      DISPATCH(IfStmt)
+      DISPATCH(elifStmt)
+      DISPATCH(WhileStmt)
+      DISPATCH(ForStmt)
+      DISPATCH(PrintStmt)
+      DISPATCH(Final)
+      DISPATCH(BinaryOp)
+      DISPATCH(UnaryOp)
+      DISPATCH(SignedNumber)
+      DISPATCH(NegExpr)
+      DISPATCH(Comparison)
+      DISPATCH(LogicalExpr)
+#undef DISPATCH
+    }
+    llvm_unreachable("unknown AST node kind");
   }
+
+  // Default handlers.
+  RetTy visitAST(AST &) { return RetTy(); }
+  RetTy visitExpr(Expr &Node) { return derived().visitAST(Node); }
+  RetTy visitLogic(Logic &Node) { return derived().visitAST(Node); }
+  RetTy visitProgram(Program &Node) { return derived().visitAST(Node); }
+  RetTy visitDeclarationInt(DeclarationInt &Node) { return derived().visitAST(Node); }
+  RetTy visitDeclarationBool(DeclarationBool &Node) { return derived().visitAST(Node); }
+  RetTy visitAssignment(Assignment &Node) { return derived().visitAST(Node); }
+  RetTy visitIfStmt(IfStmt &Node) { return derived().visitAST(Node); }
+  RetTy visitelifStmt(elifStmt &Node) { return derived().visitAST(Node); }
+  RetTy visitWhileStmt(WhileStmt &Node) { return derived().visitAST(Node); }
+  RetTy visitForStmt(ForStmt &Node) { return derived().visitAST(Node); }
+  RetTy visitPrintStmt(PrintStmt &Node) { return derived().visitAST(Node); }
+  RetTy visitFinal(Final &Node) { return derived().visitExpr(Node); }
+  RetTy visitBinaryOp(BinaryOp &Node) { return derived().visitExpr(Node); }
+  RetTy visitUnaryOp(UnaryOp &Node) { return derived().visitExpr(Node); }
+  RetTy visitSignedNumber(SignedNumber &Node) { return derived().visitExpr(Node); }
+  RetTy visitNegExpr(NegExpr &Node) { return derived().visitExpr(Node); }
+  RetTy visitComparison(Comparison &Node) { return derived().visitLogic(Node); }
+  RetTy visitLogicalExpr(LogicalExpr &Node) { return derived().visitLogic(Node); }
 };
 
 #endif
@@ -0,0 +1,59 @@
+#ifndef ASTCONTEXT_H
+#define ASTCONTEXT_H
+
+#include "AST.h"
+#include "SymbolTable.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/Support/Allocator.h"
+#include <memory>
+#include <utility>
+
+// ASTContext owns every node of a program's AST. Nodes and their child
+// arrays are bump-allocated from a single arena and all released together
+// when the context goes away. Nodes only refer to arena memory, so their
+// destructors are never run. The context also owns the symbol table whose
+// IDs the nodes carry, which outlives any arena.
+class ASTContext
+{
+  llvm::BumpPtrAllocator OwnAllocator;
+  llvm::BumpPtrAllocator *Allocator = &OwnAllocator; // where new nodes go
+  SymbolTable Symbols;
+  size_t NumNodes = 0;
+
+public:
+  ASTContext() = default;
+  ASTContext(const ASTContext &) = delete;
+  ASTContext &operator=(const ASTContext &) = delete;
+
+  // Allocate and construct a node of type T in the arena.
+  template <typename T, typename... ArgTs>
+  T *create(ArgTs &&...Args)
+  {
+    ++NumNodes;
+    return new (Allocator->Allocate<T>()) T(std::forward<ArgTs>(Args)...);
+  }
+
+  // Copy a list of children into the arena, typically from a parser-local SmallVector.
+  template <typename T>
+  llvm::ArrayRef<T> copyArray(llvm::ArrayRef<T> Elts)
+  {
+    if (Elts.empty())
+      return llvm::ArrayRef<T>();
+    T *Mem = Allocator->Allocate<T>(Elts.size());
+    std::uninitialized_copy(Elts.begin(), Elts.end(), Mem);
+    return llvm::ArrayRef<T>(Mem, Elts.size());
+  }
+
+  // Allocate new nodes from A instead of the context's own arena, or from
+  // the own arena again if A is null. A streaming compile gives every
+  // statement an arena of its own and resets it once the statement is lowered.
+  void setArena(llvm::BumpPtrAllocator *A) { Allocator = A ? A : &OwnAllocator; }
+
+  SymbolTable &getSymbols() { return Symbols; }
+
+  size_t getNumNodes() const { return NumNodes; }
+
+  size_t getBytesAllocated() const { return OwnAllocator.getBytesAllocated(); }
+};
+
+#endif
@@ -0,0 +1,590 @@
+#include "ASTFile.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/Endian.h"
+#include <vector>
+
+using namespace llvm;
+
+static const uint32_t NoNode = ~0u;     // offset of an absent child
+static const unsigned HeaderSize = 28; // magic and six words
+
+namespace
+{
+  class Writer : public ASTVisitor<Writer, uint32_t>
+  {
+    std::vector<uint32_t> Words;
+    std::vector<StringRef> Strings;
+
+    uint32_t child(AST *Node) { return Node ? visit(Node) : NoNode; }
+
+    template <typename T> SmallVector<uint32_t, 8> children(ArrayRef<T *> Nodes)
+    {
+      SmallVector<uint32_t, 8> Offsets;
+      for (T *Node : Nodes)
+        Offsets.push_back(child(Node));
+      return Offsets;
+    }
+
+    // Starts a node; its children must all be written already.
+    uint32_t begin(AST &Node, unsigned Field = 0)
+    {
+      Words.push_back(Node.getKind() | Field << 8);
+      return Words.size() - 1;
+    }
+
+    void add(std::initializer_list<uint32_t> Fields) { Words.insert(Words.end(), Fields); }
+
+    void addList(ArrayRef<uint32_t> Offsets)
+    {
+      Words.push_back(Offsets.size());
+      Words.insert(Words.end(), Offsets.begin(), Offsets.end());
+    }
+
+    static void write32(raw_ostream &OS, uint32_t W)
+    {
+      char Buf[4];
+      support::endian::write32le(Buf, W);
+      OS.write(Buf, 4);
+    }
+
+  public:
+    Writer(const SymbolTable &Symbols)
+    {
+      for (unsigned ID = 0, N = Symbols.size(); ID != N; ++ID)
+        Strings.push_back(Symbols.getName(ID));
+    }
+
+    void write(Program *Tree, unsigned NumSymbols, raw_ostream &OS)
+    {
+      uint32_t Root = visit(Tree);
+      uint32_t DataSize = 0;
+      for (StringRef S : Strings)
+        DataSize += S.size();
+
+      OS.write(astfile::Magic, sizeof(astfile::Magic));
+      for (uint32_t W : {astfile::Version, (uint32_t)NumSymbols, (uint32_t)Strings.size(), DataSize,
+                         (uint32_t)Words.size(), Root})
+        write32(OS, W);
+      uint32_t Offset = 0;
+      for (StringRef S : Strings)
+      {
+        write32(OS, Offset);
+        write32(OS, S.size());
+        Offset += S.size();
+      }
+      for (StringRef S : Strings)
+        OS << S;
+      OS.write_zeros(-DataSize & 3);
+      for (uint32_t W : Words)
+        write32(OS, W);
+    }
+
+    uint32_t visitProgram(Program &Node)
+    {
+      SmallVector<uint32_t, 8> Stmts = children(Node.getdata());
+      uint32_t Off = begin(Node);
+      addList(Stmts);
+      return Off;
+    }
+
+    template <typename DeclT> uint32_t declaration(DeclT &Node)
+    {
+      SmallVector<uint32_t, 8> Values = children(Node.getValues());
+      uint32_t Off = begin(Node);
+      add({(uint32_t)Node.getSymbols().size(), (uint32_t)Values.size()});
+      Words.insert(Words.end(), Node.getSymbols().begin(), Node.getSymbols().end());
+      Words.insert(Words.end(), Values.begin(), Values.end());
+      return Off;
+    }
+
+    uint32_t visitDeclarationInt(DeclarationInt &Node) { return declaration(Node); }
+
+    uint32_t visitDeclarationBool(DeclarationBool &Node) { return declaration(Node); }
+
+    uint32_t visitAssignment(Assignment &Node)
+    {
+      uint32_t Left = child(Node.getLeft());
+      uint32_t RightExpr = child(Node.getRightExpr());
+      uint32_t RightLogic = child(Node.getRightLogic());
+      uint32_t Off = begin(Node, Node.getAssignKind());
+      add({Left, RightExpr, RightLogic});
+      return Off;
+    }
+
+    uint32_t visitIfStmt(IfStmt &Node)
+    {
+      uint32_t Cond = child(Node.getCond());
+      SmallVector<uint32_t, 8> Body = children(Node.getBody());
+      SmallVector<uint32_t, 8> Elifs = children(Node.getElifs());
+      SmallVector<uint32_t, 8> Else = children(Node.getElse());
+      uint32_t Off = begin(Node);
+      add({Node.getLine(), Cond});
+      addList(Body);
+      addList(Elifs);
+      addList(Else);
+      return Off;
+    }
+
+    uint32_t visitelifStmt(elifStmt &Node)
+    {
+      uint32_t Cond = child(Node.getCond());
+      SmallVector<uint32_t, 8> Body = children(Node.getBody());
+      uint32_t Off = begin(Node);
+      add({Cond});
+      addList(Body);
+      return Off;
+    }
+
+    uint32_t visitWhileStmt(WhileStmt &Node)
+    {
+      uint32_t Cond = child(Node.getCond());
+      SmallVector<uint32_t, 8> Body = children(Node.getBody());
+      uint32_t Off = begin(Node);
+      add({Node.getLine(), Node.getHints().toWord(), Cond});
+      addList(Body);
+      return Off;
+    }
+
+    uint32_t visitForStmt(ForStmt &Node)
+    {
+      uint32_t First = child(Node.getFirst());
+      uint32_t Second = child(Node.getSecond());
+      uint32_t ThirdAssign = child(Node.getThirdAssign());
+      uint32_t ThirdUnary = child(Node.getThirdUnary());
+      SmallVector<uint32_t, 8> Body = children(Node.getBody());
+      uint32_t Off = begin(Node);
+      add({Node.getLine(), Node.getHints().toWord(), First, Second, ThirdAssign, ThirdUnary});
+      addList(Body);
+      return Off;
+    }
+
+    uint32_t visitPrintStmt(PrintStmt &Node)
+    {
+      uint32_t Off = begin(Node);
+      add({Node.getSymbol()});
+      return Off;
+    }
+
+    uint32_t visitFinal(Final &Node)
+    {
+      uint32_t Off = begin(Node, Node.getValueKind());
+      add({Node.getValueKind() == Final::Ident ? Node.getSymbol() : (uint32_t)Node.getVal()});
+      return Off;
+    }
+
+    uint32_t visitBinaryOp(BinaryOp &Node)
+    {
+      uint32_t Left = child(Node.getLeft());
+      uint32_t Right = child(Node.getRight());
+      uint32_t Off = begin(Node, Node.getOperator());
+      add({Left, Right});
+      return Off;
+    }
+
+    uint32_t visitUnaryOp(UnaryOp &Node)
+    {
+      uint32_t Off = begin(Node, Node.getOperator());
+      add({Node.getSymbol()});
+      return Off;
+    }
+
+    uint32_t visitSignedNumber(SignedNumber &Node)
+    {
+      uint32_t Off = begin(Node, Node.getSign());
+      add({(uint32_t)Node.getValue()});
+      return Off;
+    }
+
+    uint32_t visitNegExpr(NegExpr &Node)
+    {
+      uint32_t E = child(Node.getExpr());
+      uint32_t Off = begin(Node);
+      add({E});
+      return Off;
+    }
+
+    uint32_t visitComparison(Comparison &Node)
+    {
+      uint32_t Left = child(Node.getLeft());
+      uint32_t Right = child(Node.getRight());
+      uint32_t Off = begin(Node, Node.getOperator());
+      add({Left, Right});
+      return Off;
+    }
+
+    uint32_t visitLogicalExpr(LogicalExpr &Node)
+    {
+      uint32_t Left = child(Node.getLeft());
+      uint32_t Right = child(Node.getRight());
+      uint32_t Off = begin(Node, Node.getOperator());
+      add({Left, Right});
+      return Off;
+    }
+  };
+
+  // Kinds the parser produces as statements.
+  bool isStatement(const AST *Node)
+  {
+    switch (Node->getKind())
+    {
+    case AST::NK_DeclarationInt:
+    case AST::NK_DeclarationBool:
+    case AST::NK_Assignment:
+    case AST::NK_IfStmt:
+    case AST::NK_WhileStmt:
+    case AST::NK_ForStmt:
+    case AST::NK_PrintStmt:
+    case AST::NK_UnaryOp:
+      return true;
+    default:
+      return false;
+    }
+  }
+} // namespace
+
+bool isBinaryAST(StringRef Buffer) { return Buffer.startswith(StringRef(astfile::Magic, sizeof(astfile::Magic))); }
+
+void writeBinaryAST(Program *Tree, const SymbolTable &Symbols, raw_ostream &OS)
+{
+  Writer(Symbols).write(Tree, Symbols.size(), OS);
+}
+
+ASTReader::ASTReader(StringRef Buffer, ASTContext &Ctx, raw_ostream &Diags)
+    : Buffer(Buffer), Ctx(Ctx), Diags(Diags)
+{
+  if (!isBinaryAST(Buffer) || Buffer.size() < HeaderSize)
+  {
+    error();
+    return;
+  }
+  const char *Header = Buffer.data() + sizeof(astfile::Magic);
+  auto header = [Header](unsigned I) { return support::endian::read32le(Header + 4 * I); };
+  if (header(0) != astfile::Version)
+  {
+    Diags << "Binary AST version " << header(0) << " is not supported\n";
+    HasError = true;
+    return;
+  }
+  NumSymbols = header(1);
+  NumStrings = header(2);
+  StringDataSize = header(3);
+  NumNodeWords = header(4);
+  Root = header(5);
+  uint64_t DataEnd = HeaderSize + 8 * (uint64_t)NumStrings + StringDataSize;
+  uint64_t Size = DataEnd + (-DataEnd & 3) + 4 * (uint64_t)NumNodeWords;
+  if (NumSymbols > NumStrings || Size != Buffer.size())
+  {
+    error();
+    return;
+  }
+  Strings = Buffer.data() + HeaderSize;
+  StringData = Strings + 8 * NumStrings;
+  Nodes = Buffer.data() + DataEnd + (-DataEnd & 3);
+  Claimed.resize(NumNodeWords);
+
+  // The symbols get the IDs the nodes refer to.
+  SymbolTable &Symbols = Ctx.getSymbols();
+  for (uint32_t ID = 0; ID != NumSymbols; ++ID)
+  {
+    StringRef Name;
+    if (!readString(ID, Name) || Symbols.intern(Name) != ID)
+    {
+      error();
+      return;
+    }
+  }
+
+  uint32_t Head;
+  if (!readWord(Root, NumNodeWords, Head) || Head != AST::NK_Program || !readWord(Root + 1, NumNodeWords, NumStmts) ||
+      (uint64_t)Root + 2 + NumStmts > NumNodeWords)
+    error();
+}
+
+bool ASTReader::error()
+{
+  if (!HasError)
+    Diags << "Invalid binary AST\n";
+  HasError = true;
+  return false;
+}
+
+bool ASTReader::readWord(uint32_t Pos, uint32_t End, uint32_t &W)
+{
+  if (Pos >= End)
+    return error();
+  W = support::endian::read32le(Nodes + 4 * (uint64_t)Pos);
+  return true;
+}
+
+bool ASTReader::readString(uint32_t Index, StringRef &S)
+{
+  if (Index >= NumStrings)
+    return error();
+  uint32_t Offset = support::endian::read32le(Strings + 8 * (uint64_t)Index);
+  uint32_t Size = support::endian::read32le(Strings + 8 * (uint64_t)Index + 4);
+  if ((uint64_t)Offset + Size > StringDataSize)
+    return error();
+  S = StringRef(StringData + Offset, Size);
+  return true;
+}
+
+bool ASTReader::readNodeWord(uint32_t Pos, uint32_t End, uint32_t &W)
+{
+  if (!readWord(Pos, End, W))
+    return false;
+  if (Claimed[Pos])
+    return error();
+  Claimed.set(Pos);
+  return true;
+}
+
+// Reads the node at word Off. Its words must lie below Limit, the offset of
+// its parent, and its children below Off, so a damaged file cannot make the
+// reader loop. No word may belong to two nodes either. This rejects a child
+// shared by several parents, whose subtree would otherwise be built once per
+// path to it, and keeps reading linear in the size of the file.
+AST *ASTReader::readNode(uint32_t Off, uint32_t Limit)
+{
+  uint32_t Head;
+  if (HasError || !readNodeWord(Off, Limit, Head))
+    return nullptr;
+  uint32_t Pos = Off + 1;
+  unsigned Field = Head >> 8;
+
+  auto word = [&](uint32_t &W) { return readNodeWord(Pos++, Limit, W); };
+  auto field = [&](unsigned Max) { return Field <= Max || error(); };
+  // Identifiers are stored as their symbol.
+  auto symbol = [&](unsigned &Symbol) { return word(Symbol) && (Symbol < NumSymbols || error()); };
+  auto hints = [&](LoopHints &H)
+  {
+    uint32_t W;
+    if (!word(W))
+      return false;
+    H = LoopHints::fromWord(W);
+    return (H.toWord() == W && H.isValid()) || error();
+  };
+  auto value = [&](int32_t &V)
+  {
+    uint32_t W;
+    if (!word(W))
+      return false;
+    V = (int32_t)W;
+    return true;
+  };
+  // Reads the offset of a child of type T, which may be absent if Optional.
+  auto child = [&](auto *&Child, bool Optional = false)
+  {
+    using T = std::remove_pointer_t<std::remove_reference_t<decltype(Child)>>;
+    uint32_t ChildOff;
+    if (!word(ChildOff))
+      return false;
+    Child = nullptr;
+    if (ChildOff == NoNode)
+      return Optional || error();
+    AST *Node = readNode(ChildOff, Off);
+    Child = dyn_cast_or_null<T>(Node);
+    if (!Child || (std::is_same<T, AST>::value && !isStatement(Child)))
+      return error();
+    return true;
+  };
+  // Reads a count and that many children of type T into the context.
+  auto children = [&](auto &List)
+  {
+    using T = std::remove_pointer_t<typename std::remove_reference_t<decltype(List)>::value_type>;
+    uint32_t N;
+    if (!word(N) || (uint64_t)Pos + N > Limit)
+      return error();
+    SmallVector<T *, 8> Nodes;
+    for (uint32_t I = 0; I != N; ++I)
+    {
+      T *Child;
+      if (!child(Child))
+        return false;
+      Nodes.push_back(Child);
+    }
+    List = Ctx.copyArray<T *>(Nodes);
+    return true;
+  };
+  // Reads a declaration; initializers may be absent.
+  auto declaration = [&](auto *&Node)
+  {
+    using DeclT = std::remove_pointer_t<std::remove_reference_t<decltype(Node)>>;
+    using ValT = std::remove_pointer_t<typename decltype(std::declval<DeclT>().getValues())::value_type>;
+    uint32_t NumVars, NumValues;
+    if (!word(NumVars) || !word(NumValues) || NumValues > NumVars || (uint64_t)Pos + NumVars + NumValues > Limit)
+      return error();
+    SmallVector<unsigned, 8> Symbols;
+    SmallVector<ValT *, 8> Values;
+    for (uint32_t I = 0; I != NumVars; ++I)
+    {
+      Symbols.emplace_back();
+      if (!symbol(Symbols.back()))
+        return false;
+    }
+    for (uint32_t I = 0; I != NumValues; ++I)
+    {
+      Values.emplace_back();
+      if (!child(Values.back(), true))
+        return false;
+    }
+    Node = Ctx.create<DeclT>(Ctx.copyArray<unsigned>(Symbols), Ctx.copyArray<ValT *>(Values));
+    return true;
+  };
+
+  switch (Head & 0xff)
+  {
+  case AST::NK_DeclarationInt:
+  {
+    DeclarationInt *Node;
+    return declaration(Node) ? Node : nullptr;
+  }
+  case AST::NK_DeclarationBool:
+  {
+    DeclarationBool *Node;
+    return declaration(Node) ? Node : nullptr;
+  }
+  case AST::NK_Assignment:
+  {
+    Final *Left;
+    Expr *RightExpr;
+    Logic *RightLogic;
+    if (!field(Assignment::Slash_assign) || !child(Left) || !child(RightExpr, true) || !child(RightLogic, true))
+      return nullptr;
+    if (!RightExpr == !RightLogic || Left->getValueKind() != Final::Ident)
+      return error(), nullptr;
+    return Ctx.create<Assignment>(Left, RightExpr, (Assignment::AssignKind)Field, RightLogic);
+  }
+  case AST::NK_IfStmt:
+  {
+    uint32_t Line;
+    Logic *Cond;
+    ArrayRef<AST *> Body, Else;
+    ArrayRef<elifStmt *> Elifs;
+    if (!word(Line) || !child(Cond) || !children(Body) || !children(Elifs) || !children(Else))
+      return nullptr;
+    return Ctx.create<IfStmt>(Cond, Body, Else, Elifs, Line);
+  }
+  case AST::NK_elifStmt:
+  {
+    Logic *Cond;
+    ArrayRef<AST *> Body;
+    if (!child(Cond) || !children(Body))
+      return nullptr;
+    return Ctx.create<elifStmt>(Cond, Body);
+  }
+  case AST::NK_WhileStmt:
+  {
+    uint32_t Line;
+    LoopHints Hints;
+    Logic *Cond;
+    ArrayRef<AST *> Body;
+    if (!word(Line) || !hints(Hints) || !child(Cond) || !children(Body))
+      return nullptr;
+    return Ctx.create<WhileStmt>(Cond, Body, Line, Hints);
+  }
+  case AST::NK_ForStmt:
+  {
+    uint32_t Line;
+    LoopHints Hints;
+    Assignment *First, *ThirdAssign;
+    Logic *Second;
+    UnaryOp *ThirdUnary;
+    ArrayRef<AST *> Body;
+    if (!word(Line) || !hints(Hints) || !child(First) || !child(Second) || !child(ThirdAssign, true) ||
+        !child(ThirdUnary, true) || !children(Body))
+      return nullptr;
+    if (!ThirdAssign == !ThirdUnary)
+      return error(), nullptr;
+    return Ctx.create<ForStmt>(First, Second, ThirdAssign, ThirdUnary, Body, Line, Hints);
+  }
+  case AST::NK_PrintStmt:
+  {
+    unsigned Symbol;
+    if (!symbol(Symbol))
+      return nullptr;
+    return Ctx.create<PrintStmt>(Symbol);
+  }
+  case AST::NK_Final:
+  {
+    int32_t Val = 0;
+    unsigned Symbol = SymbolTable::Invalid;
+    if (!field(Final::Number) || !(Field == Final::Ident ? symbol(Symbol) : value(Val)))
+      return nullptr;
+    return Ctx.create<Final>((Final::ValueKind)Field, Val, Symbol);
+  }
+  case AST::NK_BinaryOp:
+  {
+    Expr *Left, *Right;
+    if (!field(BinaryOp::Exp) || !child(Left) || !child(Right))
+      return nullptr;
+    return Ctx.create<BinaryOp>((BinaryOp::Operator)Field, Left, Right);
+  }
+  case AST::NK_UnaryOp:
+  {
+    unsigned Symbol;
+    if (!field(UnaryOp::Minus_minus) || !symbol(Symbol))
+      return nullptr;
+    return Ctx.create<UnaryOp>((UnaryOp::Operator)Field, Symbol);
+  }
+  case AST::NK_SignedNumber:
+  {
+    int32_t Value;
+    if (!field(SignedNumber::Minus) || !value(Value))
+      return nullptr;
+    return Ctx.create<SignedNumber>((SignedNumber::Sign)Field, Value);
+  }
+  case AST::NK_NegExpr:
+  {
+    Expr *E;
+    if (!child(E))
+      return nullptr;
+    return Ctx.create<NegExpr>(E);
+  }
+  case AST::NK_Comparison:
+  {
+    Expr *Left, *Right;
+    if (!field(Comparison::Ident) || !child(Left, true) || !child(Right, true))
+      return nullptr;
+    // Literals have no operands and a bool variable only a left one.
+    bool Valid = Field == Comparison::True || Field == Comparison::False ? !Left && !Right
+                 : Field == Comparison::Ident ? isa_and_nonnull<Final>(Left) && !Right &&
+                                                    cast<Final>(Left)->getValueKind() == Final::Ident
+                                              : Left && Right;
+    if (!Valid)
+      return error(), nullptr;
+    return Ctx.create<Comparison>(Left, Right, (Comparison::Operator)Field);
+  }
+  case AST::NK_LogicalExpr:
+  {
+    Logic *Left, *Right;
+    if (!field(LogicalExpr::Or) || !child(Left) || !child(Right, true))
+      return nullptr;
+    return Ctx.create<LogicalExpr>(Left, Right, (LogicalExpr::Operator)Field);
+  }
+  default:
+    // Programs only occur as the root.
+    return error(), nullptr;
+  }
+}
+
+Program *ASTReader::readProgram()
+{
+  SmallVector<AST *> Stmts;
+  while (AST *Stmt = readStatement())
+    Stmts.push_back(Stmt);
+  if (HasError)
+    return nullptr;
+  return Ctx.create<Program>(Ctx.copyArray<AST *>(Stmts));
+}
+
+AST *ASTReader::readStatement()
+{
+  if (HasError || NextStmt == NumStmts)
+    return nullptr;
+  uint32_t Off;
+  readWord(Root + 2 + NextStmt++, NumNodeWords, Off);
+  AST *Stmt = readNode(Off, Root);
+  if (Stmt && !isStatement(Stmt))
+    return error(), nullptr;
+  return Stmt;
+}
@@ -0,0 +1,84 @@
+#ifndef ASTFILE_H
+#define ASTFILE_H
+
+#include "AST.h"
+#include "ASTContext.h"
+#include "SymbolTable.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstdint>
+
+// A binary AST file holds a parsed and checked program, so that it can be
+// compiled any number of times without lexing and parsing it again. It is
+// written by --emit-ast and recognised by its first bytes wherever source
+// text is accepted.
+//
+// All fields are little-endian 32-bit words. The file starts with a header
+// (magic, version, number of symbols, number of strings, size of the string
+// data, number of node words, offset of the root), followed by an offset and
+// a size per string, the string data padded to a word, and the nodes. The
+// first strings are the names of the symbols in ID order. A node is a word
+// with its NodeKind in the low byte and its operator or kind above it, then
+// its fields, with identifiers as their symbol ID, integer literals as their
+// value, loop hints as LoopHints::toWord and children as word offsets into
+// the nodes. Children come before their parents, so the root, a Program, is
+// the last node, and every node other than the root has a single parent.
+namespace astfile
+{
+  static constexpr char Magic[4] = {'\0', 'A', 'S', 'T'};
+  static constexpr uint32_t Version = 3;
+}
+
+// Returns true if Buffer holds a binary AST rather than source text; no
+// source text starts with a NUL.
+bool isBinaryAST(llvm::StringRef Buffer);
+
+// Writes Tree, whose symbol IDs were given by Symbols, as a binary AST.
+void writeBinaryAST(Program *Tree, const SymbolTable &Symbols, llvm::raw_ostream &OS);
+
+// ASTReader turns a binary AST into nodes of an ASTContext, either all at
+// once or one top-level statement at a time. The file is checked as it is
+// read, so a damaged one is reported instead of yielding a broken tree.
+// The nodes do not point into Buffer, which only has to outlive the reader
+// and may be a mapped file.
+class ASTReader
+{
+  llvm::StringRef Buffer;
+  ASTContext &Ctx;
+  llvm::raw_ostream &Diags;
+  bool HasError = false;
+
+  const char *Strings = nullptr; // offset and size of each string
+  const char *StringData = nullptr;
+  const char *Nodes = nullptr;
+  uint32_t NumSymbols = 0, NumStrings = 0, StringDataSize = 0, NumNodeWords = 0;
+
+  // The statements of the root Program and the next one to read.
+  uint32_t Root = 0, NumStmts = 0, NextStmt = 0;
+
+  // The node words that have been read as part of a node.
+  llvm::BitVector Claimed;
+
+  bool error();
+  bool readWord(uint32_t Pos, uint32_t End, uint32_t &W);
+  bool readString(uint32_t Index, llvm::StringRef &S);
+  bool readNodeWord(uint32_t Pos, uint32_t End, uint32_t &W);
+  AST *readNode(uint32_t Off, uint32_t Limit);
+
+public:
+  // Reads the header of Buffer and interns the symbols into Ctx, which must
+  // have no symbols yet so that they keep their IDs.
+  ASTReader(llvm::StringRef Buffer, ASTContext &Ctx, llvm::raw_ostream &Diags);
+
+  // Reads the whole program; returns null if the file is invalid.
+  Program *readProgram();
+
+  // Reads the next top-level statement; returns null at the end of the
+  // program or if the file is invalid.
+  AST *readStatement();
+
+  bool hasError() const { return HasError; }
+};
+
+#endif
@@ -1,23 +1,141 @@
 #include "CodeGen.h"
-#include "llvm/ADT/StringMap.h"
+#include "Eval.h"
+#include "Interp.h"
+#include "SymbolCollector.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringExtras.h"
 #include "llvm/IR/Constants.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/StandardInstrumentations.h"
+#include "llvm/ProfileData/InstrProf.h"
+#include "llvm/ProfileData/ProfileCommon.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/FileUtilities.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Target/TargetMachine.h"
+#include <atomic>
+#include <mutex>
+#include <vector>
 
 using namespace llvm;
 
-// Define a visitor class for generating LLVM IR from the AST.
 namespace
 ns{
-  class ToIRVisitor : public ASTVisitor
+  // Estimates how expensive an operand is to evaluate and whether it must
+  // not run unconditionally, which decides how and/or are lowered.
+  class CostEstimator : public ASTVisitor<CostEstimator>
+  {
+  public:
+    unsigned Cost = 0;
+    bool MustGuard = false; // writes a variable (++/--) or may trap (/, %)
+
+    void visitFinal(Final &Node)
+    {
+      if (Node.getValueKind() == Final::Ident)
+        Cost += 1;
+    };
+
+    void visitBinaryOp(BinaryOp &Node)
+    {
+      switch (Node.getOperator())
+      {
+      case BinaryOp::Div:
+      case BinaryOp::Mod:
+        MustGuard = true;
+        Cost += 20;
+        break;
+      case BinaryOp::Exp:
+        Cost += 10;
+        break;
+      default:
+        Cost += 1;
+        break;
+      }
+      visit(Node.getLeft());
+      visit(Node.getRight());
+    };
+
+    void visitUnaryOp(UnaryOp &Node)
+    {
+      MustGuard = true;
+      Cost += 2;
+    };
+
+    void visitSignedNumber(SignedNumber &Node) {};
+
+    void visitNegExpr(NegExpr &Node)
+    {
+      Cost += 1;
+      visit(Node.getExpr());
+    };
+
+    void visitComparison(Comparison &Node)
+    {
+      if (Node.getRight() == nullptr)
+      {
+        if (Node.getOperator() == Comparison::Ident)
+          Cost += 1;
+        return;
+      }
+      Cost += 1;
+      visit(Node.getLeft());
+      visit(Node.getRight());
+    };
+
+    void visitLogicalExpr(LogicalExpr &Node)
+    {
+      Cost += 1;
+      visit(Node.getLeft());
+      if (Node.getRight())
+        visit(Node.getRight());
+    };
+
+    // Statements never appear inside conditions; the default handlers ignore them.
+  };
+
+  // Branch counts read from the profile written by a program built with
+  // --profile-generate: how often the condition of each site was true and
+  // false. Sites are the if, elif, while and for conditions, numbered in
+  // the order ToIRVisitor lowers their branches.
+  struct BranchProfile
+  {
+    uint64_t Checksum = 0; // identifies the sites of the profiled program
+    uint64_t Runs = 0;     // number of runs the counts were collected from
+    std::vector<uint64_t> Counts; // true and false count of each site
+  };
+
+  enum VarKind : uint8_t
+  {
+    NoVar,
+    IntVar,
+    BoolVar
+  };
+
+  // Define a visitor class for generating LLVM IR from the AST.
+  class ToIRVisitor : public ASTVisitor<ToIRVisitor>
   {
     Module *M;
     IRBuilder<> Builder;
     Type *VoidTy;
     Type *Int1Ty;
     Type *Int32Ty;
+    Type *Int64Ty;
     Type *Int8PtrTy;
     Type *Int8PtrPtrTy;
     Constant *Int32Zero;
@@ -26,8 +144,10 @@ ns{
     Constant *Int1True;
 
     Value *V;
-    StringMap<AllocaInst *> nameMapInt;
-    StringMap<AllocaInst *> nameMapBool;
+    // Variable storage indexed by symbol ID; null if the symbol has no
+    // variable of that type.
+    std::vector<AllocaInst *> IntSlots;
+    std::vector<AllocaInst *> BoolSlots;
 
     FunctionType *PrintIntFnTy;
     Function *PrintIntFn;
@@ -35,14 +155,63 @@ ns{
     FunctionType *PrintBoolFnTy;
     Function *PrintBoolFn;
 
+    // Consecutive int prints are queued and emitted as one print_int_n call
+    // through PrintBuf. The queue is flushed before any other output and
+    // before control flow, so output order is unchanged.
+    static constexpr unsigned MaxBatchedPrints = 16;
+    FunctionType *PrintIntNFnTy;
+    Function *PrintIntNFn;
+    llvm::SmallVector<Value *, MaxBatchedPrints> PendingInts;
+    ArrayType *PrintBufTy;
+    AllocaInst *PrintBuf = nullptr;
+
+    // Branch profiling. With a ProfileFile each site counts which way its
+    // branch goes, in the counter table that main gets from rt_counters; its
+    // size is only filled in once the number of sites is known. With a
+    // Profile the branch of each site gets the weights measured for it.
+    enum SiteKind { IfSite = 1, ElifSite, WhileSite, ForSite };
+    std::string ProfileFile;
+    const BranchProfile *Profile;
+    CallInst *Counters = nullptr;
+    unsigned NumSites = 0;
+    uint64_t Checksum = 0xcbf29ce484222325; // FNV-1a of the site kinds
+    std::vector<BranchInst *> Weighted;     // branches given weights from Profile
+    bool ProfileMismatch = false;
+
+    // Hot-spot instrumentation. Every if, while and for statement gets
+    // three counters: how often it ran, how often a body of it ran and the
+    // cycles spent in it, nested statements included. Like the branch
+    // counters, they are in a table of rt_counters.
+    enum SpotKind { IfSpot, WhileSpot, ForSpot }; // as rt_instrument_report numbers them
+    struct SpotStart
+    {
+      unsigned Index;
+      Value *Cycles; // cycle counter when the statement started, null if not instrumenting
+    };
+    std::string InstrumentFile;
+    CallInst *SpotCounters = nullptr;
+    std::vector<uint32_t> Spots; // source line and kind of each statement
+    Value *MainStart = nullptr;
+
+    // A loop compiled on its own by runLoop, which the caller enters at its
+    // condition: a for loop has already run its initializer.
+    AST *LoopEntry = nullptr;
+
+    // The variables array of the region or loop function being lowered.
+    Value *RegionVars = nullptr;
+
   public:
     // Constructor for the visitor class.
-    ToIRVisitor(Module *M) : M(M), Builder(M->getContext())
+    ToIRVisitor(Module *M, StringRef ProfileFile = "", const BranchProfile *Profile = nullptr,
+                StringRef InstrumentFile = "")
+        : M(M), Builder(M->getContext()), ProfileFile(ProfileFile.str()), Profile(Profile),
+          InstrumentFile(InstrumentFile.str())
     {
       // Initialize LLVM types and constants.
       VoidTy = Type::getVoidTy(M->getContext());
       Int1Ty = Type::getInt1Ty(M->getContext());
       Int32Ty = Type::getInt32Ty(M->getContext());
+      Int64Ty = Type::getInt64Ty(M->getContext());
       Int8PtrTy = Type::getInt8PtrTy(M->getContext());
       Int8PtrPtrTy = Int8PtrTy->getPointerTo();
 
@@ -59,10 +228,23 @@ ns{
       PrintBoolFnTy = FunctionType::get(VoidTy, {Int1Ty}, false);
       // Create a function declaration for the "compiler_write" function.
       PrintBoolFn = Function::Create(PrintBoolFnTy, GlobalValue::ExternalLinkage, "print_bool", M);
+      // The runtime takes an int, so the i1 argument must arrive zero-extended.
+      PrintBoolFn->addParamAttr(0, Attribute::ZExt);
+
+      PrintIntNFnTy = FunctionType::get(VoidTy, {Int32Ty->getPointerTo(), Int32Ty}, false);
+      PrintIntNFn = Function::Create(PrintIntNFnTy, GlobalValue::ExternalLinkage, "print_int_n", M);
+      PrintBufTy = ArrayType::get(Int32Ty, MaxBatchedPrints);
     }
 
-    // Entry point for generating LLVM IR from the AST.
-    void run(Program *Tree)
+    // True if the profile given to the visitor was not made from this
+    // program; its weights were then all dropped.
+    bool hasProfileMismatch() const { return ProfileMismatch; }
+
+    // Entry point for generating LLVM IR from the AST. Top-level
+    // statements are lowered into main as they arrive. With an Evaluator,
+    // they are also run; if the whole program runs, main only writes what
+    // it printed.
+    void run(StatementStream &Stmts, Evaluator *Eval = nullptr)
     {
       // Create the main function with the appropriate function type.
       FunctionType *MainFty = FunctionType::get(Int32Ty, {Int32Ty, Int8PtrPtrTy}, false);
@@ -71,33 +253,456 @@ ns{
       // Create a basic block for the entry point of the main function.
       BasicBlock *BB = BasicBlock::Create(M->getContext(), "entry", MainFn);
       Builder.SetInsertPoint(BB);
+      if (!ProfileFile.empty())
+        Counters = createCounters(ProfileTable);
+      if (!InstrumentFile.empty())
+      {
+        SpotCounters = createCounters(SpotTable);
+        MainStart = Builder.CreateIntrinsic(Intrinsic::readcyclecounter, {}, {});
+      }
+
+      // Visit each statement to generate IR.
+      while (AST *S = Stmts.next())
+      {
+        if (Eval && !Eval->run(S))
+          Eval = nullptr;
+        visit(*S);
+      }
 
-      // Visit the root node of the AST to generate IR.
-      Tree->accept(*this);
+      if (Eval)
+      {
+        replaceWithOutput(MainFn, Eval->getOutput());
+        return;
+      }
 
       // Create a return instruction at the end of the main function.
+      flushPrints();
+      finishProfile(MainFn);
+      finishSpots();
+      Builder.CreateRet(Int32Zero);
+    }
+
+    void replaceWithOutput(Function *MainFn, StringRef Output)
+    {
+      PendingInts.clear();
+      PrintBuf = nullptr;
+      MainFn->deleteBody();
+      for (Function *Fn : {PrintIntFn, PrintBoolFn, PrintIntNFn})
+        if (Fn->use_empty())
+          Fn->eraseFromParent();
+
+      Builder.SetInsertPoint(BasicBlock::Create(M->getContext(), "entry", MainFn));
+      if (!Output.empty())
+      {
+        FunctionCallee WriteFn = M->getOrInsertFunction("rt_write", FunctionType::get(VoidTy, {Int8PtrTy, Int32Ty}, false));
+        Builder.CreateCall(WriteFn, {Builder.CreateGlobalStringPtr(Output, "output"),
+                                     ConstantInt::get(Int32Ty, Output.size())});
+      }
       Builder.CreateRet(Int32Zero);
     }
 
+    // Lowers Loop into a function Name(i32 *Vars) that runs it on the
+    // variables in Vars, indexed by symbol ID: it loads the variables the
+    // loop uses, runs the loop from its condition and stores them back,
+    // bools as 0 or 1.
+    void runLoop(AST &Loop, ArrayRef<unsigned> IntVars, ArrayRef<unsigned> BoolVars, StringRef Name)
+    {
+      beginRegion(Name);
+      for (unsigned Symbol : IntVars)
+        importVariable(Symbol, IntVar);
+      for (unsigned Symbol : BoolVars)
+        importVariable(Symbol, BoolVar);
+
+      LoopEntry = &Loop;
+      visit(Loop);
+      endRegion();
+    }
+
+    // A region is a function Name(i32 *Vars) of top-level statements, which
+    // keeps the variables it uses in slots of its own between loading them
+    // from Vars and storing them back at its end.
+    void beginRegion(StringRef Name)
+    {
+      FunctionType *RegionFty = FunctionType::get(VoidTy, {Int32Ty->getPointerTo()}, false);
+      Function *RegionFn = Function::Create(RegionFty, GlobalValue::ExternalLinkage, Name, M);
+      RegionVars = RegionFn->getArg(0);
+      // Variables are loaded in the entry block, ahead of the statements of
+      // the body, whenever a statement first uses them.
+      BasicBlock *Entry = BasicBlock::Create(M->getContext(), "entry", RegionFn);
+      BasicBlock *Body = BasicBlock::Create(M->getContext(), "body", RegionFn);
+      BranchInst::Create(Body, Entry);
+      Builder.SetInsertPoint(Body);
+    }
+
+    // Gives the region a slot for the variable Symbol, loaded from Vars.
+    void importVariable(unsigned Symbol, VarKind Kind)
+    {
+      IRBuilder<> EntryB(Builder.GetInsertBlock()->getParent()->getEntryBlock().getTerminator());
+      AllocaInst *&Slot = slot(Kind == BoolVar ? BoolSlots : IntSlots, Symbol);
+      Slot = createEntryBlockAlloca(Kind == BoolVar ? Int1Ty : Int32Ty);
+      Value *Val = EntryB.CreateLoad(Int32Ty, EntryB.CreateConstInBoundsGEP1_32(Int32Ty, RegionVars, Symbol));
+      EntryB.CreateStore(Kind == BoolVar ? EntryB.CreateICmpNE(Val, Int32Zero) : Val, Slot);
+    }
+
+    // Kind of the variable Symbol in this function, NoVar if it has none.
+    VarKind getVariableKind(unsigned Symbol) const
+    {
+      if (Symbol < BoolSlots.size() && BoolSlots[Symbol])
+        return BoolVar;
+      if (Symbol < IntSlots.size() && IntSlots[Symbol])
+        return IntVar;
+      return NoVar;
+    }
+
+    // Number of symbol IDs the function may have slots for.
+    unsigned getNumVariableSlots() const { return std::max(IntSlots.size(), BoolSlots.size()); }
+
+    // Stores the variables of the region back to Vars and returns.
+    void endRegion()
+    {
+      flushPrints();
+      for (unsigned Symbol = 0, N = IntSlots.size(); Symbol != N; ++Symbol)
+        if (IntSlots[Symbol])
+          Builder.CreateStore(Builder.CreateLoad(Int32Ty, IntSlots[Symbol]),
+                              Builder.CreateConstInBoundsGEP1_32(Int32Ty, RegionVars, Symbol));
+      for (unsigned Symbol = 0, N = BoolSlots.size(); Symbol != N; ++Symbol)
+        if (BoolSlots[Symbol])
+          Builder.CreateStore(Builder.CreateZExt(Builder.CreateLoad(Int1Ty, BoolSlots[Symbol]), Int32Ty),
+                              Builder.CreateConstInBoundsGEP1_32(Int32Ty, RegionVars, Symbol));
+      Builder.CreateRetVoid();
+    }
+
+    // Creates the main function of a program lowered into regions. The
+    // variables live in a global frame, indexed by symbol ID, which main
+    // hands to the regions region.0 to region.<NumRegions - 1> in turn.
+    Function *runRegions(unsigned NumRegions, unsigned NumVars)
+    {
+      FunctionType *MainFty = FunctionType::get(Int32Ty, {Int32Ty, Int8PtrPtrTy}, false);
+      Function *MainFn = Function::Create(MainFty, GlobalValue::ExternalLinkage, "main", M);
+      Builder.SetInsertPoint(BasicBlock::Create(M->getContext(), "entry", MainFn));
+
+      ArrayType *FrameTy = ArrayType::get(Int32Ty, std::max(NumVars, 1u));
+      GlobalVariable *Frame = new GlobalVariable(*M, FrameTy, false, GlobalValue::InternalLinkage,
+                                                 ConstantAggregateZero::get(FrameTy), "frame");
+      Value *Vars = Builder.CreateConstInBoundsGEP2_32(FrameTy, Frame, 0, 0);
+      FunctionType *RegionFty = FunctionType::get(VoidTy, {Int32Ty->getPointerTo()}, false);
+      for (unsigned I = 0; I != NumRegions; ++I)
+        Builder.CreateCall(M->getOrInsertFunction(getRegionName(I), RegionFty), {Vars});
+      Builder.CreateRet(Int32Zero);
+      return MainFn;
+    }
+
+    static std::string getRegionName(unsigned Index) { return "region." + utostr(Index); }
+
+    // Gets a zeroed counter table from the runtime, whose size finishCounters
+    // fills in. The tables are thread-local in the runtime rather than
+    // globals of the module, so that runs of one program in the JIT on
+    // several threads at once count apart.
+    enum CounterTable { ProfileTable, SpotTable }; // as rt_counters numbers them
+    CallInst *createCounters(CounterTable Table)
+    {
+      FunctionCallee CountersFn =
+          M->getOrInsertFunction("rt_counters", FunctionType::get(Int64Ty->getPointerTo(), {Int32Ty, Int32Ty}, false));
+      // Only main uses the table, like memory from malloc.
+      cast<Function>(CountersFn.getCallee())->addRetAttr(Attribute::NoAlias);
+      return Builder.CreateCall(CountersFn, {ConstantInt::get(Int32Ty, Table), Int32Zero});
+    }
+
+    Value *finishCounters(CallInst *Counters, unsigned Size)
+    {
+      Counters->setArgOperand(1, ConstantInt::get(Int32Ty, Size));
+      return Counters;
+    }
+
+    void addToCounter(Value *Counters, unsigned Index, Value *N)
+    {
+      Value *Counter = Builder.CreateConstInBoundsGEP1_32(Int64Ty, Counters, Index);
+      Builder.CreateStore(Builder.CreateAdd(Builder.CreateLoad(Int64Ty, Counter), N), Counter);
+    }
+
+    // Starts timing an instrumented statement; pending prints belong to the
+    // code before it.
+    SpotStart beginSpot(unsigned Line, SpotKind Kind)
+    {
+      if (!SpotCounters)
+        return {0, nullptr};
+      flushPrints();
+      unsigned Index = Spots.size() / 2;
+      Spots.push_back(Line);
+      Spots.push_back(Kind);
+      return {Index, Builder.CreateIntrinsic(Intrinsic::readcyclecounter, {}, {})};
+    }
+
+    // Counts a run of a body of the statement, at the start of the body.
+    void countSpotBody(const SpotStart &Spot)
+    {
+      if (Spot.Cycles)
+        addToCounter(SpotCounters, 3 * Spot.Index + 1, ConstantInt::get(Int64Ty, 1));
+    }
+
+    // Ends timing the statement, where control leaves it.
+    void endSpot(const SpotStart &Spot)
+    {
+      if (!Spot.Cycles)
+        return;
+      addToCounter(SpotCounters, 3 * Spot.Index, ConstantInt::get(Int64Ty, 1));
+      Value *Now = Builder.CreateIntrinsic(Intrinsic::readcyclecounter, {}, {});
+      addToCounter(SpotCounters, 3 * Spot.Index + 2, Builder.CreateSub(Now, Spot.Cycles));
+    }
+
+    // Hands the counters to the runtime, which writes the report.
+    void finishSpots()
+    {
+      if (!SpotCounters)
+        return;
+      unsigned NumSpots = Spots.size() / 2;
+      Value *First = finishCounters(SpotCounters, 3 * NumSpots);
+      SpotCounters = nullptr;
+
+      Constant *SpotsInit = ConstantDataArray::get(M->getContext(), Spots);
+      GlobalVariable *SpotsArray = new GlobalVariable(*M, SpotsInit->getType(), true, GlobalValue::PrivateLinkage,
+                                                      SpotsInit, "__spots");
+      Value *Total = Builder.CreateSub(Builder.CreateIntrinsic(Intrinsic::readcyclecounter, {}, {}), MainStart);
+      FunctionType *ReportFnTy = FunctionType::get(
+          VoidTy, {Int8PtrTy, Int32Ty->getPointerTo(), Int64Ty->getPointerTo(), Int32Ty, Int64Ty}, false);
+      FunctionCallee ReportFn = M->getOrInsertFunction("rt_instrument_report", ReportFnTy);
+      Builder.CreateCall(ReportFn, {Builder.CreateGlobalStringPtr(InstrumentFile),
+                                    Builder.CreateConstInBoundsGEP2_32(SpotsInit->getType(), SpotsArray, 0, 0), First,
+                                    ConstantInt::get(Int32Ty, NumSpots), Total});
+    }
+
+    // Creates the conditional branch of a profiling site. With
+    // --profile-generate it first adds one to the site's true or false
+    // counter; with --profile-use it gets the weights measured for the site.
+    BranchInst *createSiteCondBr(Value *Cond, BasicBlock *True, BasicBlock *False, SiteKind Kind)
+    {
+      unsigned Site = NumSites++;
+      Checksum = (Checksum ^ Kind) * 0x100000001b3;
+      if (Counters)
+      {
+        Value *Index = Builder.CreateSelect(Cond, ConstantInt::get(Int32Ty, 2 * Site),
+                                            ConstantInt::get(Int32Ty, 2 * Site + 1));
+        Value *Counter = Builder.CreateInBoundsGEP(Int64Ty, Counters, Index);
+        Builder.CreateStore(Builder.CreateAdd(Builder.CreateLoad(Int64Ty, Counter), ConstantInt::get(Int64Ty, 1)),
+                            Counter);
+      }
+      BranchInst *Br = Builder.CreateCondBr(Cond, True, False);
+      if (Profile && 2 * Site + 1 < Profile->Counts.size())
+      {
+        // Weights are 32-bit; like clang, scale large counts down and add
+        // one so that a branch never taken is unlikely but not impossible.
+        uint64_t TrueCount = Profile->Counts[2 * Site], FalseCount = Profile->Counts[2 * Site + 1];
+        uint64_t Scale = std::max(TrueCount, FalseCount) / UINT32_MAX + 1;
+        Br->setMetadata(LLVMContext::MD_prof, MDBuilder(M->getContext())
+                                                  .createBranchWeights(TrueCount / Scale + 1, FalseCount / Scale + 1));
+        Weighted.push_back(Br);
+      }
+      return Br;
+    }
+
+    // Gives Latch, the branch back to the condition of a loop, the
+    // llvm.loop metadata of the loop's hints.
+    void addLoopHints(BranchInst *Latch, LoopHints Hints)
+    {
+      if (Hints.empty())
+        return;
+      LLVMContext &Ctx = M->getContext();
+      SmallVector<Metadata *, 4> Props;
+      Props.push_back(nullptr); // the loop ID itself
+      auto add = [&](StringRef Name, Constant *Val = nullptr)
+      {
+        if (Val)
+          Props.push_back(MDNode::get(Ctx, {MDString::get(Ctx, Name), ConstantAsMetadata::get(Val)}));
+        else
+          Props.push_back(MDNode::get(Ctx, MDString::get(Ctx, Name)));
+      };
+      auto count = [&](unsigned N) { return ConstantInt::get(Int32Ty, N); };
+
+      if (Hints.Unroll)
+      {
+        // Like clang, unrolling by 1 is not unrolling.
+        if (Hints.UnrollCount == 1)
+          add("llvm.loop.unroll.disable");
+        else if (Hints.UnrollCount)
+          add("llvm.loop.unroll.count", count(Hints.UnrollCount));
+        else
+          add("llvm.loop.unroll.enable");
+      }
+      if (Hints.Vectorize)
+      {
+        add("llvm.loop.vectorize.enable", Hints.VectorizeWidth == 1 ? Int1False : Int1True);
+        if (Hints.VectorizeWidth)
+          add("llvm.loop.vectorize.width", count(Hints.VectorizeWidth));
+      }
+      if (Hints.InterleaveCount)
+        add("llvm.loop.interleave.count", count(Hints.InterleaveCount));
+
+      MDNode *LoopID = MDNode::getDistinct(Ctx, Props);
+      LoopID->replaceOperandWith(0, LoopID);
+      Latch->setMetadata(LLVMContext::MD_loop, LoopID);
+    }
+
+    // Returns true if E is an integer literal, with its value in V.
+    static bool getLiteral(Expr *E, int64_t &V)
+    {
+      if (Final *F = dyn_cast_or_null<Final>(E))
+      {
+        V = F->getVal();
+        return F->getValueKind() == Final::Number;
+      }
+      if (SignedNumber *N = dyn_cast_or_null<SignedNumber>(E))
+      {
+        V = N->getSign() == SignedNumber::Minus ? -(int64_t)N->getValue() : N->getValue();
+        return true;
+      }
+      return false;
+    }
+
+    // Returns how often the body of a for loop runs if the loop counts a
+    // variable from a literal to a literal bound in literal steps, which
+    // the body does not change, as in for (i = 0; i < 100; i++). Returns -1
+    // for other loops and for ones that only end when the variable wraps.
+    static int64_t getTripCount(ForStmt &Node)
+    {
+      Assignment *Init = Node.getFirst();
+      int64_t Start, Bound, Step;
+      if (Init->getAssignKind() != Assignment::Assign || !getLiteral(Init->getRightExpr(), Start))
+        return -1;
+      unsigned Var = Init->getLeft()->getSymbol();
+
+      Comparison *Cond = dyn_cast<Comparison>(Node.getSecond());
+      if (!Cond)
+        return -1;
+      Comparison::Operator Op = Cond->getOperator();
+      Final *Left = dyn_cast_or_null<Final>(Cond->getLeft());
+      Final *Right = dyn_cast_or_null<Final>(Cond->getRight());
+      if (Right && Right->getSymbol() == Var && getLiteral(Cond->getLeft(), Bound))
+      {
+        // Bound < i is i > Bound.
+        switch (Op)
+        {
+        case Comparison::Greater: Op = Comparison::Less; break;
+        case Comparison::Less: Op = Comparison::Greater; break;
+        case Comparison::Greater_equal: Op = Comparison::Less_equal; break;
+        case Comparison::Less_equal: Op = Comparison::Greater_equal; break;
+        default: break;
+        }
+      }
+      else if (!Left || Left->getSymbol() != Var || !getLiteral(Cond->getRight(), Bound))
+        return -1;
+
+      if (UnaryOp *Inc = Node.getThirdUnary())
+      {
+        if (Inc->getSymbol() != Var)
+          return -1;
+        Step = Inc->getOperator() == UnaryOp::Plus_plus ? 1 : -1;
+      }
+      else
+      {
+        Assignment *Update = Node.getThirdAssign();
+        if (Update->getLeft()->getSymbol() != Var || !getLiteral(Update->getRightExpr(), Step))
+          return -1;
+        if (Update->getAssignKind() == Assignment::Minus_assign)
+          Step = -Step;
+        else if (Update->getAssignKind() != Assignment::Plus_assign)
+          return -1;
+      }
+      if (Step == 0)
+        return -1;
+
+      SymbolCollector Uses;
+      for (AST *S : Node.getBody())
+        Uses.visit(S);
+      if (Uses.isWritten(Var))
+        return -1;
+
+      // The body runs for Start, Start + Step, ... until the condition
+      // fails, which must happen before the variable leaves the int range.
+      int64_t Trips;
+      switch (Op)
+      {
+      case Comparison::Less:
+        Trips = Start >= Bound ? 0 : Step > 0 ? (Bound - Start + Step - 1) / Step : -1;
+        break;
+      case Comparison::Less_equal:
+        Trips = Start > Bound ? 0 : Step > 0 ? (Bound - Start) / Step + 1 : -1;
+        break;
+      case Comparison::Greater:
+        Trips = Start <= Bound ? 0 : Step < 0 ? (Start - Bound - Step - 1) / -Step : -1;
+        break;
+      case Comparison::Greater_equal:
+        Trips = Start < Bound ? 0 : Step < 0 ? (Start - Bound) / -Step + 1 : -1;
+        break;
+      case Comparison::Equal:
+        Trips = Start == Bound ? 1 : 0;
+        break;
+      case Comparison::Not_equal:
+        Trips = (Bound - Start) % Step == 0 && (Bound - Start) / Step >= 0 ? (Bound - Start) / Step : -1;
+        break;
+      default:
+        return -1;
+      }
+      int64_t Exit = Start + Trips * Step;
+      if (Trips < 0 || Exit < INT32_MIN || Exit > INT32_MAX)
+        return -1;
+      return Trips;
+    }
+
+    void finishProfile(Function *MainFn)
+    {
+      if (Counters)
+      {
+        // Now that the sites are known, size the counters and write them
+        // out when main returns.
+        Value *First = finishCounters(Counters, 2 * NumSites);
+        Counters = nullptr;
+
+        FunctionType *WriteFnTy =
+            FunctionType::get(VoidTy, {Int8PtrTy, Int64Ty, Int64Ty->getPointerTo(), Int32Ty}, false);
+        FunctionCallee WriteFn = M->getOrInsertFunction("rt_profile_write", WriteFnTy);
+        Builder.CreateCall(WriteFn, {Builder.CreateGlobalStringPtr(ProfileFile), ConstantInt::get(Int64Ty, Checksum),
+                                     First, ConstantInt::get(Int32Ty, NumSites)});
+      }
+
+      if (!Profile)
+        return;
+      if (Profile->Checksum != Checksum || Profile->Counts.size() != 2 * NumSites)
+      {
+        for (BranchInst *Br : Weighted)
+          Br->setMetadata(LLVMContext::MD_prof, nullptr);
+        ProfileMismatch = true;
+        return;
+      }
+      // With an entry count and a profile summary, LLVM can tell which
+      // blocks are hot and which are cold from the branch weights.
+      MainFn->setEntryCount(Function::ProfileCount(Profile->Runs, Function::PCT_Real));
+      std::vector<uint64_t> Counts;
+      Counts.push_back(Profile->Runs);
+      Counts.insert(Counts.end(), Profile->Counts.begin(), Profile->Counts.end());
+      InstrProfSummaryBuilder Summary(ProfileSummaryBuilder::DefaultCutoffs.vec());
+      Summary.addRecord(InstrProfRecord(std::move(Counts)));
+      M->setProfileSummary(Summary.getSummary()->getMD(M->getContext()), ProfileSummary::PSK_Instr);
+    }
+
     // Visit function for the Program node in the AST.
-    virtual void visit(Program &Node) override
+    void visitProgram(Program &Node)
     {
       // Iterate over the children of the Program node and visit each child.
-      for (llvm::SmallVector<AST *>::const_iterator I = Node.begin(), E = Node.end(); I != E; ++I)
+      for (llvm::ArrayRef<AST *>::const_iterator I = Node.begin(), E = Node.end(); I != E; ++I)
     {
-      (*I)->accept(*this); // Visit each child node
+      visit(*I); // Visit each child node
     }
     };
 
-    virtual void visit(DeclarationInt &Node) override
+    void visitDeclarationInt(DeclarationInt &Node)
     {
       llvm::SmallVector<Value *, 8> vals;
 
-      llvm::SmallVector<Expr *, 8>::const_iterator E = Node.valBegin();
-      for (llvm::SmallVector<llvm::StringRef, 8>::const_iterator Var = Node.varBegin(), End = Node.varEnd(); Var != End; ++Var){
+      llvm::ArrayRef<Expr *>::const_iterator E = Node.valBegin();
+      for (llvm::ArrayRef<unsigned>::const_iterator Var = Node.varBegin(), End = Node.varEnd(); Var != End; ++Var){
         if (E<Node.valEnd() && *E != nullptr)
         {
-          (*E)->accept(*this); // If the Declaration node has an expression, recursively visit the expression node
+          visit(*E); // If the Declaration node has an expression, recursively visit the expression node
           vals.push_back(V);
         }
         else 
@@ -106,38 +711,36 @@ ns{
         }
         E++;
       }
-      StringRef Var;
-      Value* val;
       llvm::SmallVector<Value *, 8>::const_iterator itVal = vals.begin();
-      for (llvm::SmallVector<llvm::StringRef, 8>::const_iterator S = Node.varBegin(), End = Node.varEnd(); S != End; ++S){
+      for (llvm::ArrayRef<unsigned>::const_iterator S = Node.getSymbols().begin(), End = Node.getSymbols().end(); S != End; ++S){
         
-        Var = *S;
+        AllocaInst *&Slot = slot(IntSlots, *S);
 
         // Create an alloca instruction to allocate memory for the variable.
-        nameMapInt[Var] = Builder.CreateAlloca(Int32Ty);
+        Slot = createEntryBlockAlloca(Int32Ty);
         
         // Store the initial value (if any) in the variable's memory location.
         if (*itVal != nullptr)
         {
-          Builder.CreateStore(*itVal, nameMapInt[Var]);
+          Builder.CreateStore(*itVal, Slot);
         }
         else
         {
-          Builder.CreateStore(Int32Zero, nameMapInt[Var]);
+          Builder.CreateStore(Int32Zero, Slot);
         }
         itVal++;
       }
     };
 
-    virtual void visit(DeclarationBool &Node) override
+    void visitDeclarationBool(DeclarationBool &Node)
     {
       llvm::SmallVector<Value *, 8> vals;
 
-      llvm::SmallVector<Logic *, 8>::const_iterator L = Node.valBegin();
-      for (llvm::SmallVector<llvm::StringRef, 8>::const_iterator Var = Node.varBegin(), End = Node.varEnd(); Var != End; ++Var){
+      llvm::ArrayRef<Logic *>::const_iterator L = Node.valBegin();
+      for (llvm::ArrayRef<unsigned>::const_iterator Var = Node.varBegin(), End = Node.varEnd(); Var != End; ++Var){
         if (L<Node.valEnd() && *L != nullptr)
         {
-          (*L)->accept(*this); // If the Declaration node has an expression, recursively visit the expression node
+          visit(*L); // If the Declaration node has an expression, recursively visit the expression node
           vals.push_back(V);
         }
         else 
@@ -146,40 +749,38 @@ ns{
         }
         L++;
       }
-      StringRef Var;
-      Value* val;
       llvm::SmallVector<Value *, 8>::const_iterator itVal = vals.begin();
-      for (llvm::SmallVector<llvm::StringRef, 8>::const_iterator S = Node.varBegin(), End = Node.varEnd(); S != End; ++S){
+      for (llvm::ArrayRef<unsigned>::const_iterator S = Node.getSymbols().begin(), End = Node.getSymbols().end(); S != End; ++S){
         
-        Var = *S;
+        AllocaInst *&Slot = slot(BoolSlots, *S);
 
         // Create an alloca instruction to allocate memory for the variable.
-        nameMapBool[Var] = Builder.CreateAlloca(Int1Ty);
+        Slot = createEntryBlockAlloca(Int1Ty);
         
         // Store the initial value (if any) in the variable's memory location.
         if (*itVal != nullptr)
         {
-          Builder.CreateStore(*itVal, nameMapBool[Var]);
+          Builder.CreateStore(*itVal, Slot);
         }
         else
         {
-          Builder.CreateStore(Int1False, nameMapBool[Var]);
+          Builder.CreateStore(Int1False, Slot);
         }
         itVal++;
       }
     };
     // TODO
-    virtual void visit(Assignment &Node) override
+    void visitAssignment(Assignment &Node)
     {
-      // Get the name of the variable being assigned.
-      llvm::StringRef varName = Node.getLeft()->getVal();
-      Node.getLeft()->accept(*this);
+      // Get the symbol of the variable being assigned.
+      unsigned Symbol = Node.getLeft()->getSymbol();
+      visit(Node.getLeft());
       Value *varVal = V;
 
       if (Node.getRightExpr() == nullptr)
-        Node.getRightLogic()->accept(*this);        
+        visit(Node.getRightLogic());        
       else
-        Node.getRightExpr()->accept(*this);
+        visit(Node.getRightExpr());
 
       Value *val = V;
 
@@ -195,47 +796,45 @@ ns{
         val = Builder.CreateNSWMul(varVal, val);
         break;
       case Assignment::Slash_assign:
-        val = Builder.CreateSDiv(varVal, val);
+        val = CreateDivide(varVal, val, false);
         break;
       default:
         break;
       }
 
       // Create a store instruction to assign the value to the variable.
-      if (isBool(((Final*)Node.getLeft())->getVal()))
-        Builder.CreateStore(val, nameMapBool[varName]);
+      if (isBool(Symbol))
+        Builder.CreateStore(val, slot(BoolSlots, Symbol));
       else
-        Builder.CreateStore(val, nameMapInt[varName]);
+        Builder.CreateStore(val, slot(IntSlots, Symbol));
 
     };
 
-    virtual void visit(Final &Node) override
+    void visitFinal(Final &Node)
     {
-      if (Node.getKind() == Final::Ident)
+      if (Node.getValueKind() == Final::Ident)
       {
         // If the Final is an identifier, load its value from memory.
-        if (isBool(Node.getVal()))
-          V = Builder.CreateLoad(Int1Ty, nameMapBool[Node.getVal()]);
+        if (isBool(Node.getSymbol()))
+          V = Builder.CreateLoad(Int1Ty, slot(BoolSlots, Node.getSymbol()));
         else
-          V = Builder.CreateLoad(Int32Ty, nameMapInt[Node.getVal()]);
+          V = Builder.CreateLoad(Int32Ty, slot(IntSlots, Node.getSymbol()));
       }
       else
       {
-        // If the Final is a literal, convert it to an integer and create a constant.
-        int intval;
-        Node.getVal().getAsInteger(10, intval);
-        V = ConstantInt::get(Int32Ty, intval, true);
+        // If the Final is a literal, create a constant of its value.
+        V = ConstantInt::get(Int32Ty, Node.getVal(), true);
       }
     };
 
-    virtual void visit(BinaryOp &Node) override
+    void visitBinaryOp(BinaryOp &Node)
     {
       // Visit the left-hand side of the binary operation and get its value.
-      Node.getLeft()->accept(*this);
+      visit(Node.getLeft());
       Value *Left = V;
 
       // Visit the right-hand side of the binary operation and get its value.
-      Node.getRight()->accept(*this);
+      visit(Node.getRight());
       Value *Right = V;
 
       // Perform the binary operation based on the operator type and create the corresponding instruction.
@@ -251,10 +850,10 @@ ns{
         V = Builder.CreateNSWMul(Left, Right);
         break;
       case BinaryOp::Div:
-        V = Builder.CreateSDiv(Left, Right);
+        V = CreateDivide(Left, Right, false);
         break;
       case BinaryOp::Mod:
-        V = Builder.CreateSRem(Left, Right);
+        V = CreateDivide(Left, Right, true);
         break;
       case BinaryOp::Exp:
         V = CreateExp(Left, Right);
@@ -264,44 +863,112 @@ ns{
       }
     };
 
-    Value* CreateExp(Value *Left, Value *Right)
+    // Computes Left / Right, or Left % Right with IsRem. A divisor of zero,
+    // or INT_MIN divided by -1, calls rt_div_error instead of trapping in
+    // the hardware, so that the compiler can report it for programs it runs
+    // in-process.
+    Value *CreateDivide(Value *Left, Value *Right, bool IsRem)
     {
-      AllocaInst* counterAlloca = Builder.CreateAlloca(Int32Ty);
-      AllocaInst* resultAlloca = Builder.CreateAlloca(Int32Ty);
-      Builder.CreateStore(Int32Zero, counterAlloca);
-      Builder.CreateStore(Int32One, resultAlloca);
-
-      llvm::BasicBlock* ForCondBB = llvm::BasicBlock::Create(M->getContext(), "exp.cond", Builder.GetInsertBlock()->getParent());
-      llvm::BasicBlock* ForBodyBB = llvm::BasicBlock::Create(M->getContext(), "exp.body", Builder.GetInsertBlock()->getParent());
-      llvm::BasicBlock* AfterForBB = llvm::BasicBlock::Create(M->getContext(), "after.exp", Builder.GetInsertBlock()->getParent());
-
-      Builder.CreateBr(ForCondBB); //?
-
-      Builder.SetInsertPoint(ForCondBB);
-      Value* counterLoad = Builder.CreateLoad(counterAlloca);
-
-      Value *cond = Builder.CreateICmpSLT(counterLoad, Right);
-      Builder.CreateCondBr(cond, ForBodyBB, AfterForBB);
-
-      Builder.SetInsertPoint(ForBodyBB);
-      Value* resultLoad = Builder.CreateLoad(resultAlloca);
+      ConstantInt *C = dyn_cast<ConstantInt>(Right);
+      if (!C || C->isZero() || C->isMinusOne())
+      {
+        // The queued prints come before the error.
+        flushPrints();
+        Value *IsZero = Builder.CreateICmpEQ(Right, Int32Zero);
+        Value *IsOverflow = Builder.CreateAnd(Builder.CreateICmpEQ(Left, ConstantInt::get(Int32Ty, INT32_MIN, true)),
+                                              Builder.CreateICmpEQ(Right, ConstantInt::get(Int32Ty, -1, true)));
+        Function *Fn = Builder.GetInsertBlock()->getParent();
+        BasicBlock *ErrorBB = BasicBlock::Create(M->getContext(), "div.error", Fn);
+        BasicBlock *DivBB = BasicBlock::Create(M->getContext(), "div", Fn);
+        Builder.CreateCondBr(Builder.CreateOr(IsZero, IsOverflow), ErrorBB, DivBB,
+                             MDBuilder(M->getContext()).createBranchWeights(1, 2000));
+
+        Builder.SetInsertPoint(ErrorBB);
+        FunctionCallee ErrorFn = M->getOrInsertFunction("rt_div_error", FunctionType::get(VoidTy, {Int32Ty}, false));
+        if (Function *F = dyn_cast<Function>(ErrorFn.getCallee()))
+        {
+          F->setDoesNotReturn();
+          F->setDoesNotThrow();
+          F->addFnAttr(Attribute::Cold);
+        }
+        // The codes of rtCompiler.c: 1 for a zero divisor, 2 for overflow.
+        Builder.CreateCall(ErrorFn, {Builder.CreateSelect(IsZero, Int32One, ConstantInt::get(Int32Ty, 2))});
+        Builder.CreateUnreachable();
+        Builder.SetInsertPoint(DivBB);
+      }
+      return IsRem ? Builder.CreateSRem(Left, Right) : Builder.CreateSDiv(Left, Right);
+    }
 
-      Value* resultMul = Builder.CreateMul(resultLoad, Left);
-      Value* counterInc = Builder.CreateAdd(counterLoad, Int32One);
-      Builder.CreateStore(resultMul, resultAlloca);
-      Builder.CreateStore(counterInc, counterAlloca);
+    // Computes Left ^ Right by squaring, with wrapping multiplies; a
+    // non-positive exponent yields 1.
+    Value* CreateExp(Value *Left, Value *Right)
+    {
+      // A constant exponent is unrolled into a multiply chain.
+      if (ConstantInt *C = dyn_cast<ConstantInt>(Right))
+      {
+        int64_t N = C->getSExtValue();
+        Value *Result = Int32One;
+        Value *Base = Left;
+        bool First = true;
+        while (N > 0)
+        {
+          if (N & 1)
+          {
+            Result = First ? Base : Builder.CreateMul(Result, Base);
+            First = false;
+          }
+          N >>= 1;
+          if (N > 0)
+            Base = Builder.CreateMul(Base, Base);
+        }
+        return Result;
+      }
 
-      Builder.CreateBr(ForCondBB);
-      Builder.SetInsertPoint(AfterForBB);
+      Function *Fn = Builder.GetInsertBlock()->getParent();
+      llvm::BasicBlock* PreBB = Builder.GetInsertBlock();
+      llvm::BasicBlock* LoopBB = llvm::BasicBlock::Create(M->getContext(), "exp.loop", Fn);
+      llvm::BasicBlock* AfterBB = llvm::BasicBlock::Create(M->getContext(), "after.exp", Fn);
+
+      Builder.CreateCondBr(Builder.CreateICmpSGT(Right, Int32Zero), LoopBB, AfterBB);
+
+      // Each iteration consumes one bit of the exponent.
+      Builder.SetInsertPoint(LoopBB);
+      PHINode *Base = Builder.CreatePHI(Int32Ty, 2);
+      PHINode *Exp = Builder.CreatePHI(Int32Ty, 2);
+      PHINode *Acc = Builder.CreatePHI(Int32Ty, 2);
+      Value *Bit = Builder.CreateTrunc(Exp, Int1Ty);
+      Value *NextAcc = Builder.CreateSelect(Bit, Builder.CreateMul(Acc, Base), Acc);
+      Value *NextExp = Builder.CreateLShr(Exp, 1);
+      Value *NextBase = Builder.CreateMul(Base, Base);
+      Builder.CreateCondBr(Builder.CreateICmpNE(NextExp, Int32Zero), LoopBB, AfterBB);
+
+      Base->addIncoming(Left, PreBB);
+      Base->addIncoming(NextBase, LoopBB);
+      Exp->addIncoming(Right, PreBB);
+      Exp->addIncoming(NextExp, LoopBB);
+      Acc->addIncoming(Int32One, PreBB);
+      Acc->addIncoming(NextAcc, LoopBB);
+
+      Builder.SetInsertPoint(AfterBB);
+      PHINode *Result = Builder.CreatePHI(Int32Ty, 2);
+      Result->addIncoming(Int32One, PreBB);
+      Result->addIncoming(NextAcc, LoopBB);
+      return Result;
+    }
 
-      Value* result = Builder.CreateLoad(resultAlloca);
-      return result;
+    // Allocas are placed in the entry block so mem2reg can promote them and
+    // declarations inside loops do not grow the stack.
+    AllocaInst *createEntryBlockAlloca(Type *Ty)
+    {
+      BasicBlock &Entry = Builder.GetInsertBlock()->getParent()->getEntryBlock();
+      IRBuilder<> TmpB(&Entry, Entry.begin());
+      return TmpB.CreateAlloca(Ty);
     }
 
-    virtual void visit(UnaryOp &Node) override
+    void visitUnaryOp(UnaryOp &Node)
     {
       // Visit the left-hand side of the binary operation and get its value.
-      Value *Left = Builder.CreateLoad(Int32Ty, nameMapInt[Node.getIdent()]);;
+      Value *Left = Builder.CreateLoad(Int32Ty, slot(IntSlots, Node.getSymbol()));;
 
       // Perform the binary operation based on the operator type and create the corresponding instruction.
       switch (Node.getOperator())
@@ -315,25 +982,28 @@ ns{
         break;
       }
       
-      Builder.CreateStore(V, nameMapInt[Node.getIdent()]);
+      Builder.CreateStore(V, slot(IntSlots, Node.getSymbol()));
     };
 
-    virtual void visit(SignedNumber &Node) override
+    void visitSignedNumber(SignedNumber &Node)
     {
-      int intval;
-      Node.getValue().getAsInteger(10, intval);
+      int intval = Node.getValue();
       V = ConstantInt::get(Int32Ty, (Node.getSign() == SignedNumber::Minus) ? -intval : intval, true);
     };
 
-    virtual void visit(NegExpr &Node) override
+    void visitNegExpr(NegExpr &Node)
     {
-      Node.getExpr()->accept(*this);
+      visit(Node.getExpr());
       V = Builder.CreateNeg(V);
     };
 
-    virtual void visit(LogicalExpr &Node) override{
+    // Right operands at most this expensive are evaluated unconditionally
+    // and combined with and/or instead of being branched around.
+    static constexpr unsigned MaxBranchlessCost = 4;
+
+    void visitLogicalExpr(LogicalExpr &Node) {
       // Visit the left-hand side of the Logical operation and get its value.
-      Node.getLeft()->accept(*this);
+      visit(Node.getLeft());
       Value *Left = V;
 
       if (Node.getRight() == nullptr)
@@ -341,24 +1011,46 @@ ns{
         V = Left;
         return; 
       }
-      // Visit the right-hand side of the Logical operation and get its value.
-      Node.getRight()->accept(*this);
-      Value *Right = V;
+      bool IsAnd = Node.getOperator() == LogicalExpr::And;
 
-      switch (Node.getOperator())
+      // and/or short-circuit. A cheap right operand that cannot trap or
+      // write a variable is evaluated anyway, which avoids a branch.
+      CostEstimator Cost;
+      Cost.visit(Node.getRight());
+      if (!Cost.MustGuard && Cost.Cost <= MaxBranchlessCost)
       {
-      case LogicalExpr::And:
-        V = Builder.CreateAnd(Left, Right);
-        break;
-      case LogicalExpr::Or:
-        V = Builder.CreateOr(Left, Right);
-        break;
-      default:
-        break;
+        visit(Node.getRight());
+        V = IsAnd ? Builder.CreateAnd(Left, V) : Builder.CreateOr(Left, V);
+        return;
       }
+
+      // The right operand only runs on one path, so prints it would flush
+      // must be emitted before the branch.
+      flushPrints();
+      Function *Fn = Builder.GetInsertBlock()->getParent();
+      llvm::BasicBlock* LeftBB = Builder.GetInsertBlock();
+      llvm::BasicBlock* RightBB = llvm::BasicBlock::Create(M->getContext(), IsAnd ? "and.rhs" : "or.rhs", Fn);
+      llvm::BasicBlock* AfterBB = llvm::BasicBlock::Create(M->getContext(), IsAnd ? "after.and" : "after.or", Fn);
+      if (IsAnd)
+        Builder.CreateCondBr(Left, RightBB, AfterBB);
+      else
+        Builder.CreateCondBr(Left, AfterBB, RightBB);
+
+      // Visit the right-hand side of the Logical operation and get its value.
+      Builder.SetInsertPoint(RightBB);
+      visit(Node.getRight());
+      Value *Right = V;
+      llvm::BasicBlock* RightEndBB = Builder.GetInsertBlock();
+      Builder.CreateBr(AfterBB);
+
+      Builder.SetInsertPoint(AfterBB);
+      PHINode *Result = Builder.CreatePHI(Int1Ty, 2);
+      Result->addIncoming(IsAnd ? Int1False : Int1True, LeftBB);
+      Result->addIncoming(Right, RightEndBB);
+      V = Result;
     };
 
-    virtual void visit(Comparison &Node) override{
+    void visitComparison(Comparison &Node) {
       // Visit the left-hand side of the Comparison operation and get its value.
       if (Node.getRight() == nullptr)
       {
@@ -371,12 +1063,12 @@ ns{
           V = Int1False;
           break;
         case Comparison::Ident: 
-          if(isBool(((Final*)Node.getLeft())->getVal())){
-            V = Builder.CreateLoad(Int1Ty, nameMapBool[((Final*)Node.getLeft())->getVal()]);
+          if(isBool(cast<Final>(Node.getLeft())->getSymbol())){
+            V = Builder.CreateLoad(Int1Ty, slot(BoolSlots, cast<Final>(Node.getLeft())->getSymbol()));
             break;
           }
           
-          V = Builder.CreateLoad(Int32Ty, nameMapInt[((Final*)Node.getLeft())->getVal()]);
+          V = Builder.CreateLoad(Int32Ty, slot(IntSlots, cast<Final>(Node.getLeft())->getSymbol()));
           break;
         
         default:
@@ -384,11 +1076,11 @@ ns{
         }
         return;
       }
-      Node.getLeft()->accept(*this);
+      visit(Node.getLeft());
       Value *Left = V;
 
       // Visit the right-hand side of the Comparison operation and get its value.
-      Node.getRight()->accept(*this);
+      visit(Node.getRight());
       Value *Right = V;
 
       switch (Node.getOperator())
@@ -416,163 +1108,957 @@ ns{
       }
     };
 
-    bool isBool(llvm::StringRef Var)
+    bool isBool(unsigned Symbol)
+    {
+      return Symbol < BoolSlots.size() && BoolSlots[Symbol] != nullptr;
+    }
+
+    AllocaInst *&slot(std::vector<AllocaInst *> &Slots, unsigned Symbol)
     {
-      return nameMapBool.find(Var) != nameMapBool.end();
+      if (Symbol >= Slots.size())
+        Slots.resize(Symbol + 1, nullptr);
+      return Slots[Symbol];
     }
 
-    virtual void visit(PrintStmt &Node) override
+    void visitPrintStmt(PrintStmt &Node)
     {
       // Visit the right-hand side of the assignment and get its value.
-      if (isBool(Node.getVar())){
-        V = Builder.CreateLoad(Int1Ty, nameMapBool[Node.getVar()]);
+      if (isBool(Node.getSymbol())){
+        V = Builder.CreateLoad(Int1Ty, slot(BoolSlots, Node.getSymbol()));
+        flushPrints();
         CallInst *Call = Builder.CreateCall(PrintBoolFnTy, PrintBoolFn, {V});
       }
       else{
-        V = Builder.CreateLoad(Int32Ty, nameMapInt[Node.getVar()]);
-        CallInst *Call = Builder.CreateCall(PrintIntFnTy, PrintIntFn, {V});
+        // The value is loaded now; only the call is deferred.
+        V = Builder.CreateLoad(Int32Ty, slot(IntSlots, Node.getSymbol()));
+        PendingInts.push_back(V);
+        if (PendingInts.size() == MaxBatchedPrints)
+          flushPrints();
       }      
     };
 
-    virtual void visit(WhileStmt &Node) override
+    // Emit the queued int prints: a single value goes to print_int, more
+    // are stored to PrintBuf and passed to print_int_n.
+    void flushPrints()
+    {
+      if (PendingInts.empty())
+        return;
+      if (PendingInts.size() == 1)
+        Builder.CreateCall(PrintIntFnTy, PrintIntFn, {PendingInts.front()});
+      else
+      {
+        if (!PrintBuf)
+          PrintBuf = createEntryBlockAlloca(PrintBufTy);
+        for (unsigned I = 0, N = PendingInts.size(); I != N; ++I)
+          Builder.CreateStore(PendingInts[I], Builder.CreateConstInBoundsGEP2_32(PrintBufTy, PrintBuf, 0, I));
+        Value *Count = ConstantInt::get(Int32Ty, PendingInts.size(), true);
+        Builder.CreateCall(PrintIntNFnTy, PrintIntNFn, {Builder.CreateConstInBoundsGEP2_32(PrintBufTy, PrintBuf, 0, 0), Count});
+      }
+      PendingInts.clear();
+    }
+
+    void visitWhileStmt(WhileStmt &Node)
     {
       llvm::BasicBlock* WhileCondBB = llvm::BasicBlock::Create(M->getContext(), "while.cond", Builder.GetInsertBlock()->getParent());
       llvm::BasicBlock* WhileBodyBB = llvm::BasicBlock::Create(M->getContext(), "while.body", Builder.GetInsertBlock()->getParent());
       llvm::BasicBlock* AfterWhileBB = llvm::BasicBlock::Create(M->getContext(), "after.while", Builder.GetInsertBlock()->getParent());
 
+      flushPrints();
+      SpotStart Spot = beginSpot(Node.getLine(), WhileSpot);
       Builder.CreateBr(WhileCondBB); //?
       Builder.SetInsertPoint(WhileCondBB);
-      Node.getCond()->accept(*this);
+      visit(Node.getCond());
       Value* val=V;
-      Builder.CreateCondBr(val, WhileBodyBB, AfterWhileBB);
+      createSiteCondBr(val, WhileBodyBB, AfterWhileBB, WhileSite);
       Builder.SetInsertPoint(WhileBodyBB);
+      countSpotBody(Spot);
 
-      for (llvm::SmallVector<AST* >::const_iterator I = Node.begin(), E = Node.end(); I != E; ++I)
+      for (llvm::ArrayRef<AST *>::const_iterator I = Node.begin(), E = Node.end(); I != E; ++I)
         {
-            (*I)->accept(*this);
+            visit(*I);
         }
 
-      Builder.CreateBr(WhileCondBB);
+      flushPrints();
+      addLoopHints(Builder.CreateBr(WhileCondBB), Node.getHints());
 
       Builder.SetInsertPoint(AfterWhileBB);
+      endSpot(Spot);
         
     };
 
-    virtual void visit(ForStmt &Node) override
+    void visitForStmt(ForStmt &Node)
     {
       llvm::BasicBlock* ForCondBB = llvm::BasicBlock::Create(M->getContext(), "for.cond", Builder.GetInsertBlock()->getParent());
       llvm::BasicBlock* ForBodyBB = llvm::BasicBlock::Create(M->getContext(), "for.body", Builder.GetInsertBlock()->getParent());
       llvm::BasicBlock* AfterForBB = llvm::BasicBlock::Create(M->getContext(), "after.for", Builder.GetInsertBlock()->getParent());
 
-      Node.getFirst()->accept(*this);
+      SpotStart Spot = beginSpot(Node.getLine(), ForSpot);
+      if (&Node != LoopEntry)
+        visit(Node.getFirst());
 
+      flushPrints();
       Builder.CreateBr(ForCondBB); //?
 
       Builder.SetInsertPoint(ForCondBB);
-      Node.getSecond()->accept(*this);
+      visit(Node.getSecond());
       Value* val=V;
-      Builder.CreateCondBr(val, ForBodyBB, AfterForBB);
+      BranchInst *CondBr = createSiteCondBr(val, ForBodyBB, AfterForBB, ForSite);
+      // Without a profile, a loop with literal bounds is weighted by its
+      // trip count, which tells the optimizer how often it runs.
+      if (!CondBr->getMetadata(LLVMContext::MD_prof) && &Node != LoopEntry)
+      {
+        int64_t Trips = getTripCount(Node);
+        if (Trips > 0)
+          CondBr->setMetadata(LLVMContext::MD_prof, MDBuilder(M->getContext())
+                                                         .createBranchWeights(std::min<int64_t>(Trips, UINT32_MAX), 1));
+      }
 
       Builder.SetInsertPoint(ForBodyBB);
-      for (llvm::SmallVector<AST* >::const_iterator I = Node.begin(), E = Node.end(); I != E; ++I)
+      countSpotBody(Spot);
+      for (llvm::ArrayRef<AST *>::const_iterator I = Node.begin(), E = Node.end(); I != E; ++I)
         {
-            (*I)->accept(*this);
+            visit(*I);
         }
 
       if (Node.getThirdAssign() == nullptr)
-        Node.getThirdUnary()->accept(*this);
+        visit(Node.getThirdUnary());
       else
-        Node.getThirdAssign()->accept(*this);
+        visit(Node.getThirdAssign());
 
-      Builder.CreateBr(ForCondBB);
+      flushPrints();
+      addLoopHints(Builder.CreateBr(ForCondBB), Node.getHints());
 
       Builder.SetInsertPoint(AfterForBB);
+      endSpot(Spot);
     };
 
-    virtual void visit(IfStmt &Node) override{
+    void visitIfStmt(IfStmt &Node) {
       llvm::BasicBlock* IfCondBB = llvm::BasicBlock::Create(M->getContext(), "if.cond", Builder.GetInsertBlock()->getParent());
       llvm::BasicBlock* IfBodyBB = llvm::BasicBlock::Create(M->getContext(), "if.body", Builder.GetInsertBlock()->getParent());
       llvm::BasicBlock* AfterIfBB = llvm::BasicBlock::Create(M->getContext(), "after.if", Builder.GetInsertBlock()->getParent());
 
+      flushPrints();
+      SpotStart Spot = beginSpot(Node.getLine(), IfSpot);
       Builder.CreateBr(IfCondBB); //?
       Builder.SetInsertPoint(IfCondBB);
-      Node.getCond()->accept(*this);
+      visit(Node.getCond());
       Value* IfCondVal=V;
+      // and/or may have split the condition; branch from where it ended.
+      llvm::BasicBlock* IfCondEndBB = Builder.GetInsertBlock();
 
       Builder.SetInsertPoint(IfBodyBB);
+      countSpotBody(Spot);
 
-      for (llvm::SmallVector<AST* >::const_iterator I = Node.begin(), E = Node.end(); I != E; ++I)
+      for (llvm::ArrayRef<AST *>::const_iterator I = Node.begin(), E = Node.end(); I != E; ++I)
         {
-            (*I)->accept(*this);
+            visit(*I);
         }
 
+      flushPrints();
       Builder.CreateBr(AfterIfBB);
 
-      llvm::BasicBlock* PreviousCondBB = IfCondBB;
+      llvm::BasicBlock* PreviousCondBB = IfCondEndBB;
       llvm::BasicBlock* PreviousBodyBB = IfBodyBB;
       Value* PreviousCondVal = IfCondVal;
+      SiteKind PreviousKind = IfSite;
 
-      for (llvm::SmallVector<elifStmt *, 8>::const_iterator I = Node.beginElif(), E = Node.endElif(); I != E; ++I)
+      for (llvm::ArrayRef<elifStmt *>::const_iterator I = Node.beginElif(), E = Node.endElif(); I != E; ++I)
       {
         llvm::BasicBlock* ElifCondBB = llvm::BasicBlock::Create(M->getContext(), "elif.cond", Builder.GetInsertBlock()->getParent());
         llvm::BasicBlock* ElifBodyBB = llvm::BasicBlock::Create(M->getContext(), "elif.body", Builder.GetInsertBlock()->getParent());
 
         Builder.SetInsertPoint(PreviousCondBB);
-        Builder.CreateCondBr(PreviousCondVal, PreviousBodyBB, ElifCondBB);
+        createSiteCondBr(PreviousCondVal, PreviousBodyBB, ElifCondBB, PreviousKind);
 
         Builder.SetInsertPoint(ElifCondBB);
-        (*I)->getCond()->accept(*this);
+        visit((*I)->getCond());
         Value* ElifCondVal = V;
+        llvm::BasicBlock* ElifCondEndBB = Builder.GetInsertBlock();
 
         Builder.SetInsertPoint(ElifBodyBB);
-        (*I)->accept(*this);
+        countSpotBody(Spot);
+        visit(*I);
+        flushPrints();
         Builder.CreateBr(AfterIfBB);
 
-        PreviousCondBB = ElifCondBB;
+        PreviousCondBB = ElifCondEndBB;
         PreviousCondVal = ElifCondVal;
         PreviousBodyBB = ElifBodyBB;
+        PreviousKind = ElifSite;
       }
       if (Node.beginElse() != Node.endElse()) {
         llvm::BasicBlock* ElseBB = llvm::BasicBlock::Create(M->getContext(), "else.body", Builder.GetInsertBlock()->getParent());
         Builder.SetInsertPoint(ElseBB);
-        for (llvm::SmallVector<AST* >::const_iterator I = Node.beginElse(), E = Node.endElse(); I != E; ++I)
+        countSpotBody(Spot);
+        for (llvm::ArrayRef<AST *>::const_iterator I = Node.beginElse(), E = Node.endElse(); I != E; ++I)
         {
-            (*I)->accept(*this);
+            visit(*I);
         }
+        flushPrints();
         Builder.CreateBr(AfterIfBB);
 
         Builder.SetInsertPoint(PreviousCondBB);
-        Builder.CreateCondBr(PreviousCondVal, PreviousBodyBB, ElseBB);
+        createSiteCondBr(PreviousCondVal, PreviousBodyBB, ElseBB, PreviousKind);
       }
       else {
         Builder.SetInsertPoint(PreviousCondBB);
-        Builder.CreateCondBr(IfCondVal, PreviousBodyBB, AfterIfBB);
+        createSiteCondBr(PreviousCondVal, PreviousBodyBB, AfterIfBB, PreviousKind);
       }
 
       Builder.SetInsertPoint(AfterIfBB);
+      endSpot(Spot);
     };
 
-    virtual void visit(elifStmt &Node) override{
-      for (llvm::SmallVector<AST* >::const_iterator I = Node.begin(), E = Node.end(); I != E; ++I)
+    void visitelifStmt(elifStmt &Node) {
+      for (llvm::ArrayRef<AST *>::const_iterator I = Node.begin(), E = Node.end(); I != E; ++I)
         {
-            (*I)->accept(*this);
+            visit(*I);
         }
     };
   };
+
+  // Hands CodeGen the statements of a program that was parsed as a whole.
+  class ProgramStream : public StatementStream
+  {
+    llvm::ArrayRef<AST *> Stmts;
+
+  public:
+    ProgramStream(Program *Tree) : Stmts(Tree->getdata()) {}
+
+    AST *next() override
+    {
+      if (Stmts.empty())
+        return nullptr;
+      AST *S = Stmts.front();
+      Stmts = Stmts.drop_front();
+      return S;
+    }
+
+    bool hasError() override { return false; }
+  };
 }; // namespace
 
-void CodeGen::compile(Program *Tree)
+// In-process versions of the runtime functions, resolved by the JIT.
+extern "C" void print_int(int v);
+extern "C" void print_bool(int v);
+extern "C" void print_int_n(const int *v, int n);
+extern "C" void rt_flush(void);
+extern "C" void rt_write(const char *s, int n);
+extern "C" void rt_div_error(int code);
+extern "C" int rt_try(void (*fn)(void *), void *arg);
+extern "C" unsigned long long *rt_counters(int table, int n);
+extern "C" void rt_profile_write(const char *path, unsigned long long checksum,
+                                 const unsigned long long *counters, int sites);
+extern "C" void rt_instrument_report(const char *path, const unsigned *spots,
+                                     const unsigned long long *counters, int n, unsigned long long total);
+
+// Create a target machine for the requested (or host) triple and CPU.
+static std::unique_ptr<TargetMachine> createTargetMachine(const CodeGenOptions &Opts, raw_ostream &Diags)
 {
-  // Create an LLVM context and a module.
-  LLVMContext Ctx;
-  Module *M = new Module("simple-compiler", Ctx);
+  std::string Triple = Opts.Triple.empty() ? sys::getDefaultTargetTriple() : Opts.Triple;
+
+  std::string Error;
+  const Target *T = TargetRegistry::lookupTarget(Triple, Error);
+  if (!T)
+  {
+    Diags << Error << "\n";
+    return nullptr;
+  }
+
+  CodeGenOpt::Level Level = Opts.OptLevel == 0   ? CodeGenOpt::None
+                            : Opts.OptLevel == 1 ? CodeGenOpt::Less
+                            : Opts.OptLevel == 2 ? CodeGenOpt::Default
+                                                 : CodeGenOpt::Aggressive;
+
+  // Executables are linked by the system driver, which may default to PIE.
+  TargetOptions TOpts;
+  return std::unique_ptr<TargetMachine>(T->createTargetMachine(
+      Triple, Opts.CPU, "", TOpts, Reloc::PIC_, None, Level));
+}
+
+// Run the default new pass manager pipeline for the given -O level on the module.
+static void optimize(Module &M, TargetMachine &TM, unsigned OptLevel)
+{
+  if (OptLevel == 0)
+    return;
+
+  LoopAnalysisManager LAM;
+  FunctionAnalysisManager FAM;
+  CGSCCAnalysisManager CGAM;
+  ModuleAnalysisManager MAM;
+
+  // Report per-pass timings with -time-passes.
+  PassInstrumentationCallbacks PIC;
+  StandardInstrumentations SI(/*DebugLogging=*/false);
+  SI.registerCallbacks(PIC, &FAM);
+
+  PassBuilder PB(&TM, PipelineTuningOptions(), None, &PIC);
+  PB.registerModuleAnalyses(MAM);
+  PB.registerCGSCCAnalyses(CGAM);
+  PB.registerFunctionAnalyses(FAM);
+  PB.registerLoopAnalyses(LAM);
+  PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+  OptimizationLevel Level = OptLevel == 1   ? OptimizationLevel::O1
+                            : OptLevel == 2 ? OptimizationLevel::O2
+                                            : OptimizationLevel::O3;
+
+  // The per-module pipeline runs SROA/mem2reg, instcombine, GVN, LICM and the loop passes.
+  ModulePassManager MPM = PB.buildPerModuleDefaultPipeline(Level);
+  MPM.run(M, MAM);
+}
+
+// Write the module as a native object file to OS.
+static bool emitObject(Module &M, TargetMachine &TM, raw_pwrite_stream &OS, raw_ostream &Diags)
+{
+  legacy::PassManager PM;
+  if (TM.addPassesToEmitFile(PM, OS, nullptr, CGFT_ObjectFile))
+  {
+    Diags << "Target cannot emit object files\n";
+    return true;
+  }
+  PM.run(M);
+  return false;
+}
+
+// Link the object files, given by their contents, with the runtime into an
+// executable using the system driver.
+static bool linkExecutable(ArrayRef<StringRef> Objects, const CodeGenOptions &Opts, raw_ostream &Diags)
+{
+  if (Opts.RuntimeObject.empty())
+  {
+    Diags << "Linking an executable requires --runtime\n";
+    return true;
+  }
+
+  ErrorOr<std::string> Linker = sys::findProgramByName(Opts.Linker);
+  if (!Linker)
+  {
+    Diags << "Cannot find linker " << Opts.Linker << "\n";
+    return true;
+  }
+
+  std::vector<std::string> ObjectFiles;
+  std::vector<std::unique_ptr<FileRemover>> Removers;
+  for (StringRef Object : Objects)
+  {
+    SmallString<128> ObjectFile;
+    int FD;
+    if (std::error_code EC = sys::fs::createTemporaryFile("compiler", "o", FD, ObjectFile))
+    {
+      Diags << "Cannot create temporary file: " << EC.message() << "\n";
+      return true;
+    }
+    Removers.push_back(std::make_unique<FileRemover>(ObjectFile));
+    raw_fd_ostream OS(FD, /*shouldClose=*/true);
+    OS << Object;
+    ObjectFiles.push_back(std::string(ObjectFile.str()));
+  }
+
+  SmallVector<StringRef, 8> Args = {*Linker, "-o", Opts.OutputFile};
+  Args.append(ObjectFiles.begin(), ObjectFiles.end());
+  Args.push_back(Opts.RuntimeObject);
+  std::string ErrMsg;
+  if (sys::ExecuteAndWait(*Linker, Args, None, {}, 0, 0, &ErrMsg) != 0)
+  {
+    Diags << "Linking failed" << (ErrMsg.empty() ? "" : ": ") << ErrMsg << "\n";
+    return true;
+  }
+  return false;
+}
+
+// Write the module in the requested format.
+static bool emit(Module &M, TargetMachine &TM, const CodeGenOptions &Opts, raw_ostream &Diags)
+{
+  if (Opts.Emit == EmitKind::Executable)
+  {
+    SmallVector<char, 0> Object;
+    raw_svector_ostream OS(Object);
+    if (emitObject(M, TM, OS, Diags))
+      return true;
+    return linkExecutable(StringRef(Object.data(), Object.size()), Opts, Diags);
+  }
+
+  std::error_code EC;
+  ToolOutputFile Out(Opts.OutputFile, EC,
+                     Opts.Emit == EmitKind::LLVMIR ? sys::fs::OF_Text : sys::fs::OF_None);
+  if (EC)
+  {
+    Diags << "Cannot open " << Opts.OutputFile << ": " << EC.message() << "\n";
+    return true;
+  }
+
+  switch (Opts.Emit)
+  {
+  case EmitKind::LLVMIR:
+    M.print(Out.os(), nullptr);
+    break;
+  case EmitKind::Bitcode:
+    WriteBitcodeToFile(M, Out.os());
+    break;
+  case EmitKind::Object:
+    if (emitObject(M, TM, Out.os(), Diags))
+      return true;
+    break;
+  default:
+    break;
+  }
+
+  Out.keep();
+  return false;
+}
+
+// The JIT compiles for the host CPU it runs on.
+static Expected<orc::JITTargetMachineBuilder> getJITTargetMachineBuilder(unsigned OptLevel)
+{
+  Expected<orc::JITTargetMachineBuilder> JTMB = orc::JITTargetMachineBuilder::detectHost();
+  if (JTMB)
+    JTMB->setCodeGenOptLevel(OptLevel == 0 ? CodeGenOpt::None : CodeGenOpt::Default);
+  return JTMB;
+}
+
+// Create an ORC LLJIT whose main JITDylib resolves the runtime functions to
+// the copies linked into the compiler.
+static std::unique_ptr<orc::LLJIT> createJIT(unsigned OptLevel, raw_ostream &Diags)
+{
+  Expected<orc::JITTargetMachineBuilder> JTMB = getJITTargetMachineBuilder(OptLevel);
+  if (!JTMB)
+  {
+    logAllUnhandledErrors(JTMB.takeError(), Diags, "JIT: ");
+    return nullptr;
+  }
+  Expected<std::unique_ptr<orc::LLJIT>> J =
+      orc::LLJITBuilder().setJITTargetMachineBuilder(std::move(*JTMB)).create();
+  if (!J)
+  {
+    logAllUnhandledErrors(J.takeError(), Diags, "JIT: ");
+    return nullptr;
+  }
+
+  orc::MangleAndInterner Mangle((*J)->getExecutionSession(), (*J)->getDataLayout());
+  orc::SymbolMap Runtime;
+  Runtime[Mangle("print_int")] =
+      JITEvaluatedSymbol(pointerToJITTargetAddress(&print_int), JITSymbolFlags::Exported);
+  Runtime[Mangle("print_bool")] =
+      JITEvaluatedSymbol(pointerToJITTargetAddress(&print_bool), JITSymbolFlags::Exported);
+  Runtime[Mangle("print_int_n")] =
+      JITEvaluatedSymbol(pointerToJITTargetAddress(&print_int_n), JITSymbolFlags::Exported);
+  Runtime[Mangle("rt_write")] =
+      JITEvaluatedSymbol(pointerToJITTargetAddress(&rt_write), JITSymbolFlags::Exported);
+  Runtime[Mangle("rt_div_error")] =
+      JITEvaluatedSymbol(pointerToJITTargetAddress(&rt_div_error), JITSymbolFlags::Exported);
+  Runtime[Mangle("rt_counters")] =
+      JITEvaluatedSymbol(pointerToJITTargetAddress(&rt_counters), JITSymbolFlags::Exported);
+  Runtime[Mangle("rt_profile_write")] =
+      JITEvaluatedSymbol(pointerToJITTargetAddress(&rt_profile_write), JITSymbolFlags::Exported);
+  Runtime[Mangle("rt_instrument_report")] =
+      JITEvaluatedSymbol(pointerToJITTargetAddress(&rt_instrument_report), JITSymbolFlags::Exported);
+
+  if (Error Err = (*J)->getMainJITDylib().define(orc::absoluteSymbols(std::move(Runtime))))
+  {
+    logAllUnhandledErrors(std::move(Err), Diags, "JIT: ");
+    return nullptr;
+  }
+  return std::move(*J);
+}
+
+// Add the modules of a program to the JIT in a JITDylib of their own and
+// look up its main function. Destroying the program removes the JITDylib,
+// which frees the program's code, so one JIT can hold any number of
+// programs.
+static std::unique_ptr<JITProgram> loadJIT(orc::LLJIT &J, std::vector<orc::ThreadSafeModule> Modules,
+                                           raw_ostream &Diags)
+{
+  static std::atomic<unsigned> NumRuns{0};
+  Expected<orc::JITDylib &> JD = J.createJITDylib("program." + utostr(NumRuns++));
+  if (!JD)
+  {
+    logAllUnhandledErrors(JD.takeError(), Diags, "JIT: ");
+    return nullptr;
+  }
+  JD->addToLinkOrder(J.getMainJITDylib());
+
+  Error Err = Error::success();
+  for (orc::ThreadSafeModule &TSM : Modules)
+    if ((Err = J.addIRModule(*JD, std::move(TSM))))
+      break;
+  if (Err)
+    logAllUnhandledErrors(std::move(Err), Diags, "JIT: ");
+  else
+  {
+    Expected<JITEvaluatedSymbol> MainSym = J.lookup(*JD, "main");
+    if (MainSym)
+      return std::make_unique<JITProgram>(
+          J, *JD, jitTargetAddressToFunction<JITProgram::MainFunction>(MainSym->getAddress()));
+    logAllUnhandledErrors(MainSym.takeError(), Diags, "JIT: ");
+  }
+
+  if (Error Err = J.getExecutionSession().removeJITDylib(*JD))
+    logAllUnhandledErrors(std::move(Err), Diags, "JIT: ");
+  return nullptr;
+}
+
+JITProgram::JITProgram(orc::LLJIT &J, orc::JITDylib &JD, MainFunction Main)
+    : J(J), JD(JD), Main(Main) {}
+
+JITProgram::~JITProgram()
+{
+  if (Error Err = J.getExecutionSession().removeJITDylib(JD))
+    logAllUnhandledErrors(std::move(Err), errs(), "JIT: ");
+}
+
+// Returns the message of a division error code of rt_try.
+static const char *getDivisionError(int Code)
+{
+  return Code == 1 ? "Division by zero" : "Integer overflow in division";
+}
+
+bool JITProgram::run(int &ExitCode, raw_ostream &Diags)
+{
+  struct Call
+  {
+    MainFunction Main;
+    int ExitCode;
+  } C = {Main, 0};
+  int Error = rt_try(
+      [](void *Arg)
+      {
+        Call &C = *static_cast<Call *>(Arg);
+        char ProgName[] = "compiler";
+        char *Argv[] = {ProgName, nullptr};
+        C.ExitCode = C.Main(1, Argv);
+      },
+      &C);
+  // The runtime buffers output; write it before the compiler goes on.
+  rt_flush();
+  ExitCode = Error ? 1 : C.ExitCode;
+  if (Error)
+    Diags << getDivisionError(Error) << "\n";
+  return Error != 0;
+}
+
+// Reads a profile written by rt_profile_write.
+static bool readProfile(StringRef Path, StringRef Data, ns::BranchProfile &P, raw_ostream &Diags)
+{
+  StringRef Rest = Data;
+  auto Next = [&Rest]()
+  {
+    std::pair<StringRef, StringRef> Token = getToken(Rest);
+    Rest = Token.second;
+    return Token.first;
+  };
+  unsigned Sites;
+  bool Invalid = Next() != "compiler-profile" || Next() != "1" || Next() != "checksum" ||
+                 Next().getAsInteger(16, P.Checksum) || Next() != "runs" || Next().getAsInteger(10, P.Runs) ||
+                 Next() != "sites" || Next().getAsInteger(10, Sites);
+  for (unsigned I = 0; !Invalid && I != 2 * Sites; ++I)
+  {
+    P.Counts.push_back(0);
+    Invalid = Next().getAsInteger(10, P.Counts.back());
+  }
+  if (Invalid)
+  {
+    Diags << "Invalid profile " << Path << "\n";
+    return true;
+  }
+  return false;
+}
+
+CodeGenContext::CodeGenContext() = default;
+
+CodeGenContext::~CodeGenContext() = default;
+
+bool CodeGen::compile(Program *Tree)
+{
+  ns::ProgramStream Stmts(Tree);
+  return compile(Stmts);
+}
+
+// Batch mode compiles on several threads; register the target only once.
+static void initializeTarget()
+{
+  static once_flag InitTarget;
+  llvm::call_once(InitTarget, []
+            {
+    InitializeNativeTarget();
+    InitializeNativeTargetAsmPrinter(); });
+}
+
+std::unique_ptr<TargetMachine> CodeGen::newTargetMachine(bool ForJIT, unsigned OptLevel, raw_ostream &Errs)
+{
+  if (ForJIT)
+  {
+    Expected<orc::JITTargetMachineBuilder> JTMB = getJITTargetMachineBuilder(OptLevel);
+    Expected<std::unique_ptr<TargetMachine>> HostTM =
+        JTMB ? JTMB->createTargetMachine() : JTMB.takeError();
+    if (!HostTM)
+    {
+      logAllUnhandledErrors(HostTM.takeError(), Errs, "JIT: ");
+      return nullptr;
+    }
+    return std::move(*HostTM);
+  }
+  CodeGenOptions TMOpts = Opts;
+  TMOpts.OptLevel = OptLevel;
+  return createTargetMachine(TMOpts, Errs);
+}
+
+// Target machines and JITs are created for this compile, or taken from the
+// caller's context when they were created by an earlier one.
+TargetMachine *CodeGen::getTargetMachine(bool ForJIT, unsigned OptLevel, std::unique_ptr<TargetMachine> &Owned)
+{
+  std::string TMKey = (ForJIT ? std::string("jit") : Opts.Triple) + "|" + Opts.CPU + "|" + utostr(OptLevel);
+  std::unique_ptr<TargetMachine> *TMSlot = Reuse ? &Reuse->TargetMachines[TMKey] : &Owned;
+  if (!*TMSlot)
+    *TMSlot = newTargetMachine(ForJIT, OptLevel, Diags);
+  return TMSlot->get();
+}
+
+orc::LLJIT *CodeGen::getJIT(unsigned OptLevel)
+{
+  std::unique_ptr<orc::LLJIT> &JITSlot = Reuse ? Reuse->JITs[OptLevel == 0 ? 0 : 1] : OwnedJIT;
+  if (!JITSlot)
+    JITSlot = createJIT(OptLevel, Diags);
+  return JITSlot.get();
+}
+
+CodeGen::CodeGen(const CodeGenOptions &Opts, raw_ostream &Diags, CodeGenContext *Reuse)
+    : Opts(Opts), Diags(Diags), Reuse(Reuse) {}
+
+CodeGen::~CodeGen()
+{
+  if (LoopDylib)
+    if (Error Err = LoopJIT->getExecutionSession().removeJITDylib(*LoopDylib))
+      logAllUnhandledErrors(std::move(Err), Diags, "JIT: ");
+}
+
+bool CodeGen::compile(StatementStream &Stmts)
+{
+  if (Opts.Interpret)
+  {
+    Interp VM(*this, Diags, Opts.TierUp);
+    return VM.run(Stmts);
+  }
+
+  initializeTarget();
+  bool UseJIT = Opts.Run || Opts.Load;
+  TargetMachine *TMPtr = getTargetMachine(UseJIT, Opts.OptLevel, OwnedTM);
+  if (!TMPtr)
+    return true;
+  TargetMachine &TM = *TMPtr;
+
+  orc::LLJIT *JIT = nullptr;
+  if (UseJIT && !(JIT = getJIT(Opts.OptLevel)))
+    return true;
+
+  // Branch counters and hot-spot reports are kept per program in main.
+  if (Opts.CodeGenThreads && Opts.ProfileGenerate.empty() && Opts.ProfileUse.empty() && Opts.Instrument.empty())
+    return compileRegions(Stmts, TM, JIT);
+
+  // Create an LLVM context and a module for the target.
+  auto Ctx = std::make_unique<LLVMContext>();
+  std::unique_ptr<Module> M = std::make_unique<Module>("simple-compiler", *Ctx);
+  M->setTargetTriple(TM.getTargetTriple().str());
+  M->setDataLayout(TM.createDataLayout());
+
+  ns::BranchProfile Profile;
+  if (!Opts.ProfileUse.empty() && readProfile(Opts.ProfileUse, Opts.ProfileData, Profile, Diags))
+    return true;
 
   // Create an instance of the ToIRVisitor and run it on the AST to generate LLVM IR.
-  ns::ToIRVisitor *ToIR = new ns::ToIRVisitor(M);
+  ns::ToIRVisitor ToIR(M.get(), Opts.ProfileGenerate, Opts.ProfileUse.empty() ? nullptr : &Profile,
+                       Opts.Instrument);
+  // Profiles and hot-spot reports are about the program running, so such
+  // programs are never replaced by their output.
+  std::unique_ptr<Evaluator> Eval;
+  if (Opts.EvalFuel && Opts.ProfileGenerate.empty() && Opts.Instrument.empty())
+    Eval = std::make_unique<Evaluator>(Opts.EvalFuel);
+  ToIR.run(Stmts, Eval.get());
+  if (Stmts.hasError())
+    return true;
+  if (ToIR.hasProfileMismatch())
+    Diags << "warning: profile " << Opts.ProfileUse << " does not match the program; it is ignored\n";
+  NumInstructions = M->getInstructionCount();
+
+  // Optimize the generated IR before it is emitted.
+  optimize(*M, TM, Opts.OptLevel);
+  NumOptInstructions = M->getInstructionCount();
+
+  if (UseJIT)
+  {
+    std::vector<orc::ThreadSafeModule> Modules;
+    Modules.emplace_back(std::move(M), std::move(Ctx));
+    return finishJIT(*JIT, std::move(Modules));
+  }
+
+  return emit(*M, TM, Opts, Diags);
+}
+
+// Loads the modules of the program into the JIT, then runs it with Opts.Run
+// or keeps it for takeProgram with Opts.Load.
+bool CodeGen::finishJIT(orc::LLJIT &JIT, std::vector<orc::ThreadSafeModule> Modules)
+{
+  Loaded = loadJIT(JIT, std::move(Modules), Diags);
+  if (!Loaded)
+    return true;
+  if (Opts.Run)
+  {
+    bool Failed = Loaded->run(ExitCode, Diags);
+    Loaded.reset();
+    return Failed;
+  }
+  // A program loaded without a context keeps the JIT it lives in.
+  else if (!Reuse)
+    Loaded->OwnedJIT = std::move(OwnedJIT);
+  return false;
+}
+
+namespace
+{
+  // An outlined region of the program, lowered into a module and an
+  // LLVMContext of its own so that a worker thread can optimize and compile
+  // it while the statements after it are lowered.
+  struct Region
+  {
+    std::unique_ptr<LLVMContext> Ctx;
+    std::unique_ptr<Module> M;
+    SmallVector<char, 0> Output; // object file or bitcode written by the worker
+    std::string Diags;
+    unsigned NumOptInstructions = 0;
+    bool Failed = false;
+  };
+}
+
+// A region is closed after the statement that takes it to this many IR
+// instructions. Regions do not depend on the number of threads, so neither
+// does the output.
+static const unsigned RegionSize = 4096;
+
+// Lowers the top-level statements into regions, functions of their own that
+// main calls in turn with the variables in a global frame, and optimizes and
+// compiles the regions on a pool of Opts.CodeGenThreads threads. LLVM then
+// never sees one huge main, whose optimization and instruction selection
+// grow faster than its size. Executables link the objects of the regions;
+// the JIT loads every region as a module; other outputs link the optimized
+// regions back into one module.
+bool CodeGen::compileRegions(StatementStream &Stmts, TargetMachine &TM, orc::LLJIT *JIT)
+{
+  bool UseJIT = Opts.Run || Opts.Load;
+  bool Link = Opts.Emit == EmitKind::Executable && !UseJIT;
+
+  // Target machines are not thread-safe; each worker takes one of its own.
+  std::mutex TMLock;
+  std::vector<std::unique_ptr<TargetMachine>> IdleTMs;
+  auto Work = [&](Region &R)
+  {
+    raw_string_ostream RegionDiags(R.Diags);
+    std::unique_ptr<TargetMachine> WorkerTM;
+    {
+      std::lock_guard<std::mutex> Guard(TMLock);
+      if (!IdleTMs.empty())
+      {
+        WorkerTM = std::move(IdleTMs.back());
+        IdleTMs.pop_back();
+      }
+    }
+    if (!WorkerTM && !(WorkerTM = newTargetMachine(UseJIT, Opts.OptLevel, RegionDiags)))
+    {
+      R.Failed = true;
+      return;
+    }
+
+    optimize(*R.M, *WorkerTM, Opts.OptLevel);
+    R.NumOptInstructions = R.M->getInstructionCount();
+    if (!UseJIT)
+    {
+      raw_svector_ostream OS(R.Output);
+      if (Link)
+        R.Failed = emitObject(*R.M, *WorkerTM, OS, RegionDiags);
+      else
+        WriteBitcodeToFile(*R.M, OS);
+      // Only the output is needed from here on.
+      R.M.reset();
+      R.Ctx.reset();
+    }
+
+    std::lock_guard<std::mutex> Guard(TMLock);
+    IdleTMs.push_back(std::move(WorkerTM));
+  };
 
+  std::unique_ptr<Evaluator> Eval;
+  if (Opts.EvalFuel)
+    Eval = std::make_unique<Evaluator>(Opts.EvalFuel);
 
-  ToIR->run(Tree);
+  // Kind of each variable, by symbol ID, as the regions before the current
+  // one left it in the frame.
+  std::vector<uint8_t> Kinds;
+  std::vector<std::unique_ptr<Region>> Regions;
+  std::unique_ptr<Region> Current;
+  std::unique_ptr<ns::ToIRVisitor> ToIR;
+  // Declared last, so that it finishes the work on the regions before they go.
+  ThreadPool Pool(hardware_concurrency(Opts.CodeGenThreads));
 
-  // Print the generated module to the standard output.
-  M->print(outs(), nullptr);
+  auto CloseRegion = [&]()
+  {
+    ToIR->endRegion();
+    for (unsigned Symbol = 0, N = ToIR->getNumVariableSlots(); Symbol != N; ++Symbol)
+      if (ns::VarKind Kind = ToIR->getVariableKind(Symbol))
+      {
+        if (Symbol >= Kinds.size())
+          Kinds.resize(Symbol + 1, ns::NoVar);
+        Kinds[Symbol] = Kind;
+      }
+    ToIR.reset();
+    NumInstructions += Current->M->getInstructionCount();
+    Region *R = Current.get();
+    Regions.push_back(std::move(Current));
+    Pool.async([&Work, R]
+               { Work(*R); });
+  };
+
+  while (AST *S = Stmts.next())
+  {
+    if (Eval && !Eval->run(S))
+      Eval = nullptr;
+
+    if (!ToIR)
+    {
+      Current = std::make_unique<Region>();
+      Current->Ctx = std::make_unique<LLVMContext>();
+      Current->M = std::make_unique<Module>("simple-compiler", *Current->Ctx);
+      Current->M->setTargetTriple(TM.getTargetTriple().str());
+      Current->M->setDataLayout(TM.createDataLayout());
+      ToIR = std::make_unique<ns::ToIRVisitor>(Current->M.get());
+      ToIR->beginRegion(ns::ToIRVisitor::getRegionName(Regions.size()));
+    }
+
+    // Variables of earlier regions are loaded from the frame.
+    SymbolCollector Uses;
+    Uses.visit(S);
+    for (unsigned Symbol : Uses.Symbols)
+      if (Symbol < Kinds.size() && Kinds[Symbol] != ns::NoVar && ToIR->getVariableKind(Symbol) == ns::NoVar)
+        ToIR->importVariable(Symbol, (ns::VarKind)Kinds[Symbol]);
+    ToIR->visit(*S);
+
+    if (Current->M->getInstructionCount() >= RegionSize)
+      CloseRegion();
+  }
+  if (Stmts.hasError())
+    return true;
+  if (ToIR)
+    CloseRegion();
+
+  // main lives in a module of its own, which the regions are linked into
+  // unless they go to the JIT or the linker.
+  auto Ctx = std::make_unique<LLVMContext>();
+  std::unique_ptr<Module> M = std::make_unique<Module>("simple-compiler", *Ctx);
+  M->setTargetTriple(TM.getTargetTriple().str());
+  M->setDataLayout(TM.createDataLayout());
+  ns::ToIRVisitor MainIR(M.get());
+  Function *MainFn = MainIR.runRegions(Eval ? 0 : Regions.size(), Kinds.size());
+  if (Eval)
+    MainIR.replaceWithOutput(MainFn, Eval->getOutput());
+  NumInstructions += M->getInstructionCount();
+  optimize(*M, TM, Opts.OptLevel);
+
+  Pool.wait();
+  NumOptInstructions = M->getInstructionCount();
+  bool Failed = false;
+  for (std::unique_ptr<Region> &R : Regions)
+  {
+    Diags << R->Diags;
+    Failed |= R->Failed;
+    NumOptInstructions += R->NumOptInstructions;
+  }
+  if (Failed)
+    return true;
+  // A program that was run at compile time only prints its output.
+  if (Eval)
+    Regions.clear();
+
+  if (UseJIT)
+  {
+    std::vector<orc::ThreadSafeModule> Modules;
+    Modules.emplace_back(std::move(M), std::move(Ctx));
+    for (std::unique_ptr<Region> &R : Regions)
+      Modules.emplace_back(std::move(R->M), std::move(R->Ctx));
+    return finishJIT(*JIT, std::move(Modules));
+  }
+
+  if (Link)
+  {
+    SmallVector<char, 0> MainObject;
+    raw_svector_ostream OS(MainObject);
+    if (emitObject(*M, TM, OS, Diags))
+      return true;
+    std::vector<StringRef> Objects;
+    Objects.push_back(StringRef(MainObject.data(), MainObject.size()));
+    for (std::unique_ptr<Region> &R : Regions)
+      Objects.push_back(StringRef(R->Output.data(), R->Output.size()));
+    return linkExecutable(Objects, Opts, Diags);
+  }
+
+  for (std::unique_ptr<Region> &R : Regions)
+  {
+    Expected<std::unique_ptr<Module>> RegionM =
+        parseBitcodeFile(MemoryBufferRef(StringRef(R->Output.data(), R->Output.size()), "region"), *Ctx);
+    if (!RegionM)
+    {
+      logAllUnhandledErrors(RegionM.takeError(), Diags, "CodeGen: ");
+      return true;
+    }
+    if (Linker::linkModules(*M, std::move(*RegionM)))
+    {
+      Diags << "Cannot link the regions of the program\n";
+      return true;
+    }
+    R->Output.clear();
+  }
+  return emit(*M, TM, Opts, Diags);
+}
+
+CodeGen::LoopFunction CodeGen::compileLoop(AST &Loop, ArrayRef<unsigned> IntVars, ArrayRef<unsigned> BoolVars)
+{
+  // A loop is worth compiling because it is hot, so it is always optimized.
+  unsigned OptLevel = std::max(Opts.OptLevel, 2u);
+  initializeTarget();
+  TargetMachine *TM = getTargetMachine(true, OptLevel, OwnedLoopTM);
+  if (!TM)
+    return nullptr;
+  if (!LoopJIT && !(LoopJIT = getJIT(OptLevel)))
+    return nullptr;
+  if (!LoopDylib)
+  {
+    static std::atomic<unsigned> NumDylibs{0};
+    Expected<orc::JITDylib &> JD = LoopJIT->createJITDylib("loops." + utostr(NumDylibs++));
+    if (!JD)
+    {
+      logAllUnhandledErrors(JD.takeError(), Diags, "JIT: ");
+      return nullptr;
+    }
+    JD->addToLinkOrder(LoopJIT->getMainJITDylib());
+    LoopDylib = &*JD;
+  }
+
+  auto Ctx = std::make_unique<LLVMContext>();
+  std::unique_ptr<Module> M = std::make_unique<Module>("simple-compiler-loop", *Ctx);
+  M->setTargetTriple(TM->getTargetTriple().str());
+  M->setDataLayout(TM->createDataLayout());
+  std::string Name = "loop." + utostr(NumLoops++);
+  ns::ToIRVisitor ToIR(M.get());
+  ToIR.runLoop(Loop, IntVars, BoolVars, Name);
+  optimize(*M, *TM, OptLevel);
+
+  if (Error Err = LoopJIT->addIRModule(*LoopDylib, orc::ThreadSafeModule(std::move(M), std::move(Ctx))))
+  {
+    logAllUnhandledErrors(std::move(Err), Diags, "JIT: ");
+    return nullptr;
+  }
+  Expected<JITEvaluatedSymbol> Sym = LoopJIT->lookup(*LoopDylib, Name);
+  if (!Sym)
+  {
+    logAllUnhandledErrors(Sym.takeError(), Diags, "JIT: ");
+    return nullptr;
+  }
+  return jitTargetAddressToFunction<LoopFunction>(Sym->getAddress());
 }
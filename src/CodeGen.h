@@ -2,11 +2,152 @@
 #define CODEGEN_H
 
 #include "AST.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace llvm
+{
+  class TargetMachine;
+  namespace orc
+  {
+    class JITDylib;
+    class LLJIT;
+    class ThreadSafeModule;
+  }
+}
+
+// Kind of output written by CodeGen::compile.
+enum class EmitKind
+{
+  LLVMIR,     // textual LLVM IR (.ll)
+  Bitcode,    // LLVM bitcode (.bc)
+  Object,     // native object file (.o)
+  Executable, // object linked with the runtime
+  AST         // binary AST (.ast), written by the driver instead of CodeGen
+};
+
+struct CodeGenOptions
+{
+  unsigned OptLevel = 0;           // 0-3, selects the LLVM optimization pipeline
+  EmitKind Emit = EmitKind::LLVMIR;
+  std::string Triple;              // target triple, empty for the host
+  std::string CPU;                 // target CPU, empty for a generic CPU of the target
+  std::string OutputFile = "-";    // "-" writes to stdout
+  std::string RuntimeObject;       // prebuilt runtime linked into executables
+  std::string Linker = "cc";       // driver used to link executables
+  bool Run = false;                // JIT the program and run it instead of emitting
+  bool Load = false;               // JIT the program and keep it for CodeGen::takeProgram
+  std::string ProfileGenerate;     // count branches and write them to this file when run
+  std::string ProfileUse;          // name of a profile written by ProfileGenerate, for messages
+  std::string ProfileData;         // contents of ProfileUse, whose counts give branch weights
+  std::string Instrument;          // hot-spot report at exit: "-" for stderr, else a JSON file
+  uint64_t EvalFuel = 0;           // steps to evaluate the program in at compile time, 0 for none
+  bool Interpret = false;          // run the program in the bytecode interpreter instead
+  uint64_t TierUp = 0;             // iterations after which Interpret JITs a loop, 0 for never
+  unsigned CodeGenThreads = 0;     // outline regions and compile them on this many threads, 0 for one main
+};
+
+// Target state that CodeGen keeps between compiles when it is given one:
+// the target machines for each target and -O level, and the JITs that run
+// programs. A long-running process saves the target setup of every compile.
+// Not thread-safe; every thread needs its own.
+struct CodeGenContext
+{
+  llvm::StringMap<std::unique_ptr<llvm::TargetMachine>> TargetMachines;
+  std::unique_ptr<llvm::orc::LLJIT> JITs[2]; // for -O0 and for optimized code
+
+  CodeGenContext();
+  ~CodeGenContext();
+};
+
+// A program compiled with CodeGenOptions::Load and kept in the JIT, so that
+// it can be run any number of times without compiling it again. A program
+// compiled with a CodeGenContext lives in the context's JIT and must be
+// destroyed before the context; otherwise it owns its JIT.
+class JITProgram
+{
+public:
+  using MainFunction = int (*)(int, char **);
+
+private:
+  llvm::orc::LLJIT &J;
+  llvm::orc::JITDylib &JD;
+  MainFunction Main;
+  std::unique_ptr<llvm::orc::LLJIT> OwnedJIT;
+
+  friend class CodeGen;
+
+public:
+  JITProgram(llvm::orc::LLJIT &J, llvm::orc::JITDylib &JD, MainFunction Main);
+  ~JITProgram();
+
+  // Runs main and stores its exit code in ExitCode. What the program
+  // prints goes through the runtime of the calling thread. A division error
+  // stops the program with exit code 1; it is reported to Diags and run
+  // returns true.
+  bool run(int &ExitCode, llvm::raw_ostream &Diags);
+};
 
 class CodeGen
 {
+  CodeGenOptions Opts;
+  llvm::raw_ostream &Diags;        // receives target, emission and JIT errors
+  CodeGenContext *Reuse;           // target state kept between compiles, may be null
+  int ExitCode = 0;                // result of main when the program was run
+  unsigned NumInstructions = 0;    // IR instructions emitted by ToIRVisitor
+  unsigned NumOptInstructions = 0; // IR instructions left after optimization
+
+  // Target state of this compile when there is no Reuse context.
+  std::unique_ptr<llvm::TargetMachine> OwnedTM;
+  std::unique_ptr<llvm::TargetMachine> OwnedLoopTM;
+  std::unique_ptr<llvm::orc::LLJIT> OwnedJIT;
+
+  // Loops compiled by compileLoop, kept until CodeGen is destroyed.
+  llvm::orc::LLJIT *LoopJIT = nullptr;
+  llvm::orc::JITDylib *LoopDylib = nullptr;
+  unsigned NumLoops = 0;
+
+  std::unique_ptr<JITProgram> Loaded; // compiled with Opts.Load
+
+  std::unique_ptr<llvm::TargetMachine> newTargetMachine(bool ForJIT, unsigned OptLevel, llvm::raw_ostream &Errs);
+  llvm::TargetMachine *getTargetMachine(bool ForJIT, unsigned OptLevel, std::unique_ptr<llvm::TargetMachine> &Owned);
+  llvm::orc::LLJIT *getJIT(unsigned OptLevel);
+
+  bool compileRegions(StatementStream &Stmts, llvm::TargetMachine &TM, llvm::orc::LLJIT *JIT);
+  bool finishJIT(llvm::orc::LLJIT &JIT, std::vector<llvm::orc::ThreadSafeModule> Modules);
+
 public:
- void compile(Program *Tree);
+ CodeGen(const CodeGenOptions &Opts = CodeGenOptions(), llvm::raw_ostream &Diags = llvm::errs(),
+         CodeGenContext *Reuse = nullptr);
+ ~CodeGen();
+
+ // Returns true if an error occurred.
+ bool compile(Program *Tree);
+
+ // Lowers the statements of Stmts as they arrive, then emits or runs the
+ // program. Nothing is emitted if Stmts ends with an error.
+ bool compile(StatementStream &Stmts);
+
+ // Native code for a loop of the interpreter. It runs the loop from its
+ // condition on the interpreter's variables, indexed by symbol ID.
+ using LoopFunction = void (*)(int32_t *Vars);
+
+ // Compiles Loop, which uses the given int and bool variables, with the JIT.
+ // Returns null if it cannot be compiled; the error went to Diags.
+ LoopFunction compileLoop(AST &Loop, llvm::ArrayRef<unsigned> IntVars, llvm::ArrayRef<unsigned> BoolVars);
+
+ int getExitCode() { return ExitCode; }
+
+ // Returns the program compiled with Opts.Load, or null if there is none.
+ std::unique_ptr<JITProgram> takeProgram() { return std::move(Loaded); }
+
+ unsigned getNumInstructions() const { return NumInstructions; }
+
+ unsigned getNumOptimizedInstructions() const { return NumOptInstructions; }
 
 };
-#endif
\ No newline at end of file
+#endif
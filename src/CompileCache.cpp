@@ -0,0 +1,155 @@
+#include "CompileCache.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/SHA1.h"
+#include <chrono>
+
+using namespace llvm;
+
+// Bump when the layout of the key or of the entries changes.
+static const char CacheFormat[] = "compiler-cache-1";
+
+CompileCache::CompileCache(StringRef Dir, StringRef CompilerPath) : Dir(Dir)
+{
+  // Size and modification time of the executable stand in for its version;
+  // any rebuild of the compiler changes at least one of them.
+  sys::fs::file_status Status;
+  CompilerID = CompilerPath.str();
+  if (!sys::fs::status(CompilerPath, Status))
+    CompilerID += ":" + utostr(Status.getSize()) + ":" +
+                  utostr(Status.getLastModificationTime().time_since_epoch().count());
+}
+
+bool CompileCache::isCacheable(const CodeGenOptions &Opts)
+{
+  return !Opts.Run && !Opts.Load && !Opts.Interpret && Opts.Emit != EmitKind::Executable;
+}
+
+std::string CompileCache::getKey(StringRef Source, const CodeGenOptions &Opts, bool ConstFold) const
+{
+  SHA1 Hasher;
+  // Every field is terminated so that adjacent fields cannot run together.
+  auto Add = [&Hasher](StringRef Field)
+  {
+    Hasher.update(Field);
+    Hasher.update(StringRef("\0", 1));
+  };
+  Add(CacheFormat);
+  Add(LLVM_VERSION_STRING);
+  Add(CompilerID);
+  Add(Opts.Triple.empty() ? sys::getDefaultTargetTriple() : Opts.Triple);
+  Add(Opts.CPU);
+  Add(utostr(Opts.OptLevel));
+  Add(utostr((unsigned)Opts.Emit));
+  Add(ConstFold ? "fold" : "nofold");
+  // The counters name the profile file; branch weights come from its contents.
+  Add(Opts.ProfileGenerate);
+  Add(Opts.ProfileUse.empty() ? "" : Opts.ProfileData);
+  Add(Opts.Instrument);
+  Add(utostr(Opts.EvalFuel));
+  // Any number of threads gives the same output; only splitting changes it.
+  Add(Opts.CodeGenThreads ? "regions" : "main");
+  Add(utostr(Source.size()));
+  Hasher.update(Source);
+  return toHex(Hasher.final(), /*LowerCase=*/true);
+}
+
+// Writes the file Path to OutputFile ('-' for stdout).
+static bool copyToOutput(StringRef Path, StringRef OutputFile)
+{
+  if (OutputFile != "-")
+    return (bool)sys::fs::copy_file(Path, OutputFile);
+
+  ErrorOr<std::unique_ptr<MemoryBuffer>> Buffer = MemoryBuffer::getFile(Path);
+  if (!Buffer)
+    return true;
+  outs() << (*Buffer)->getBuffer();
+  outs().flush();
+  return false;
+}
+
+bool CompileCache::lookup(StringRef Key, StringRef OutputFile)
+{
+  SmallString<128> Entry(Dir);
+  sys::path::append(Entry, "llvmcache-" + Key);
+  if (!sys::fs::exists(Entry) || copyToOutput(Entry, OutputFile))
+  {
+    ++Misses;
+    return false;
+  }
+
+  // pruneCache evicts by access time; mark the entry as used.
+  int FD;
+  if (!sys::fs::openFileForWrite(Entry, FD, sys::fs::CD_OpenExisting, sys::fs::OF_Append))
+  {
+    sys::TimePoint<> Now = std::chrono::system_clock::now();
+    sys::fs::setLastAccessAndModificationTime(FD, Now, Now);
+    sys::Process::SafelyCloseFileDescriptor(FD);
+  }
+  ++Hits;
+  return true;
+}
+
+std::string CompileCache::createTempFile(raw_ostream &Diags)
+{
+  if (std::error_code EC = sys::fs::create_directories(Dir))
+  {
+    Diags << "Cannot create cache directory " << Dir << ": " << EC.message() << "\n";
+    return "";
+  }
+
+  // Temporary files do not match llvmcache-*, so pruning leaves them alone.
+  SmallString<128> Model(Dir);
+  sys::path::append(Model, "tmp-%%%%%%%%");
+  SmallString<128> TempFile;
+  int FD;
+  if (std::error_code EC = sys::fs::createUniqueFile(Model, FD, TempFile))
+  {
+    Diags << "Cannot create file in cache directory " << Dir << ": " << EC.message() << "\n";
+    return "";
+  }
+  sys::Process::SafelyCloseFileDescriptor(FD);
+  return std::string(TempFile.str());
+}
+
+bool CompileCache::insert(StringRef Key, StringRef TempFile, StringRef OutputFile,
+                          raw_ostream &Diags)
+{
+  SmallString<128> Entry(Dir);
+  sys::path::append(Entry, "llvmcache-" + Key);
+  // rename is atomic, so concurrent writers of one key leave a complete entry.
+  if (std::error_code EC = sys::fs::rename(TempFile, Entry))
+  {
+    Diags << "Cannot add " << Entry << " to the cache: " << EC.message() << "\n";
+    sys::fs::remove(TempFile);
+    return true;
+  }
+  bool Failed = copyToOutput(Entry, OutputFile);
+  if (Failed)
+    Diags << "Cannot write " << OutputFile << "\n";
+
+  // Only one thread prunes at a time; the others do not wait for it.
+  if (PrunePolicy && ++Inserts % InsertsPerPrune == 0)
+  {
+    std::unique_lock<std::mutex> Lock(PruneMutex, std::try_to_lock);
+    if (Lock)
+      prune(*PrunePolicy);
+  }
+  return Failed;
+}
+
+void CompileCache::prune(const CachePruningPolicy &Policy)
+{
+  pruneCache(Dir, Policy);
+}
+
+void CompileCache::setPrunePolicy(const CachePruningPolicy &Policy)
+{
+  PrunePolicy = Policy;
+}
@@ -0,0 +1,70 @@
+#ifndef COMPILECACHE_H
+#define COMPILECACHE_H
+
+#include "CodeGen.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/CachePruning.h"
+#include "llvm/Support/raw_ostream.h"
+#include <atomic>
+#include <mutex>
+#include <string>
+
+// CompileCache keeps emitted outputs in a directory, keyed by a SHA1 of the
+// source bytes, the compiler binary and every option that changes the
+// output. Entries are named llvmcache-<key> so that llvm::pruneCache evicts
+// them by size and age. One cache may be shared by several threads.
+class CompileCache
+{
+  std::string Dir;
+  std::string CompilerID; // identifies the compiler build that wrote the entries
+  std::atomic<unsigned> Hits{0};
+  std::atomic<unsigned> Misses{0};
+
+  // Set by setPrunePolicy; Inserts counts towards the next pruning.
+  llvm::Optional<llvm::CachePruningPolicy> PrunePolicy;
+  std::atomic<unsigned> Inserts{0};
+  std::mutex PruneMutex;
+
+public:
+  // CompilerPath is the running compiler executable; rebuilding it
+  // invalidates all entries.
+  CompileCache(llvm::StringRef Dir, llvm::StringRef CompilerPath);
+
+  // Returns false for outputs that are not cached: programs run with the
+  // JIT or the interpreter, programs loaded into the JIT and linked
+  // executables.
+  static bool isCacheable(const CodeGenOptions &Opts);
+
+  // Returns the key of compiling Source with Opts.
+  std::string getKey(llvm::StringRef Source, const CodeGenOptions &Opts, bool ConstFold) const;
+
+  // Writes the entry for Key to OutputFile ('-' for stdout). Returns false
+  // on a miss.
+  bool lookup(llvm::StringRef Key, llvm::StringRef OutputFile);
+
+  // Returns a fresh temporary file in the cache directory for CodeGen to
+  // write into, or an empty string if the directory is not usable.
+  std::string createTempFile(llvm::raw_ostream &Diags);
+
+  // Moves a finished TempFile into the cache as the entry for Key and writes
+  // it to OutputFile. Returns true if an error occurred.
+  bool insert(llvm::StringRef Key, llvm::StringRef TempFile, llvm::StringRef OutputFile,
+              llvm::raw_ostream &Diags);
+
+  // Evicts entries according to Policy.
+  void prune(const llvm::CachePruningPolicy &Policy);
+
+  // Makes every InsertsPerPrune-th insert also prune with Policy, for a
+  // cache that stays in use as long as the server. Must be called before
+  // the cache is shared by several threads.
+  void setPrunePolicy(const llvm::CachePruningPolicy &Policy);
+
+  static const unsigned InsertsPerPrune = 64;
+
+  unsigned getNumHits() const { return Hits; }
+
+  unsigned getNumMisses() const { return Misses; }
+};
+
+#endif
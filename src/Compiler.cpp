@@ -1,12 +1,28 @@
 #include "Lexer.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Pass.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Timer.h"
+#include "llvm/Support/ToolOutputFile.h"
 #include "llvm/Support/raw_ostream.h"
+#include <algorithm>
 #include <iostream>
 #include "AST.h"
+#include "ASTContext.h"
 #include "CodeGen.h"
-#include "Parser.h"
-#include "Sema.h"
+#include "CompileCache.h"
+#include "Driver.h"
+#include "Server.h"
+
+#ifdef LLVM_ON_UNIX
+#include <sys/resource.h>
+#endif
 
 // Define a command-line option for specifying the input expression.
 static llvm::cl::opt<std::string>
@@ -14,6 +30,394 @@ static llvm::cl::opt<std::string>
           llvm::cl::desc("<input expression>"),
           llvm::cl::init(""));
 
+// Define a command-line option for reading the program from a file instead.
+static llvm::cl::opt<std::string>
+    InputFile("file",
+              llvm::cl::desc("Read the program from <file> ('-' for stdin)"),
+              llvm::cl::value_desc("file"));
+static llvm::cl::alias InputFileAlias("f",
+                                      llvm::cl::desc("Alias for --file"),
+                                      llvm::cl::aliasopt(InputFile));
+
+// Define a command-line option for the optimization level (-O0 to -O3).
+static llvm::cl::opt<unsigned>
+    OptLevel("O",
+             llvm::cl::desc("Optimization level: -O0, -O1, -O2 or -O3 (default -O0)"),
+             llvm::cl::Prefix,
+             llvm::cl::init(0));
+
+// Define command-line options for the kind and location of the output.
+static llvm::cl::opt<EmitKind>
+    Emit("emit",
+         llvm::cl::desc("Kind of output to produce"),
+         llvm::cl::values(clEnumValN(EmitKind::LLVMIR, "ll", "Textual LLVM IR (default)"),
+                          clEnumValN(EmitKind::Bitcode, "bc", "LLVM bitcode"),
+                          clEnumValN(EmitKind::Object, "obj", "Native object file"),
+                          clEnumValN(EmitKind::Executable, "exe", "Executable linked with --runtime")),
+         llvm::cl::init(EmitKind::LLVMIR));
+
+static llvm::cl::opt<bool>
+    EmitAST("emit-ast",
+            llvm::cl::desc("Write the checked program as a binary AST, which later compiles skip lexing and "
+                           "parsing for"));
+
+static llvm::cl::opt<std::string>
+    OutputFile("o",
+               llvm::cl::desc("Output file ('-' for stdout)"),
+               llvm::cl::value_desc("file"),
+               llvm::cl::init("-"));
+
+static llvm::cl::opt<std::string>
+    RuntimeObject("runtime",
+                  llvm::cl::desc("Prebuilt runtime object or library linked into executables"),
+                  llvm::cl::value_desc("file"));
+
+static llvm::cl::opt<std::string>
+    Linker("linker",
+           llvm::cl::desc("Compiler driver used to link executables"),
+           llvm::cl::init("cc"));
+
+static llvm::cl::opt<std::string>
+    TargetTriple("mtriple",
+                 llvm::cl::desc("Target triple (default: host)"));
+
+static llvm::cl::opt<std::string>
+    TargetCPU("mcpu",
+              llvm::cl::desc("Target CPU (default: generic)"));
+
+static llvm::cl::opt<bool>
+    Run("run",
+        llvm::cl::desc("Compile the program with the JIT and run it in-process"));
+
+static llvm::cl::opt<bool>
+    Interpret("interp",
+              llvm::cl::desc("Run the program in the bytecode interpreter, without building LLVM IR"));
+
+static llvm::cl::opt<uint64_t>
+    TierUp("tier-up",
+           llvm::cl::desc("With --interp, compile a loop with the JIT once its condition was tested <n> times "
+                          "(default: 0, never)"),
+           llvm::cl::value_desc("n"),
+           llvm::cl::init(0));
+
+static llvm::cl::opt<unsigned>
+    CodeGenThreads("codegen-threads",
+                   llvm::cl::desc("Outline top-level regions of the program into functions and optimize and "
+                                  "compile them on <n> threads (default: 0, the whole program in main)"),
+                   llvm::cl::value_desc("n"),
+                   llvm::cl::init(0));
+
+static llvm::cl::opt<bool>
+    ConstFolding("const-fold",
+                 llvm::cl::desc("Fold constant expressions and branches before code generation (default: true)"),
+                 llvm::cl::init(true));
+
+static llvm::cl::opt<uint64_t>
+    EvalFuel("eval-fuel",
+             llvm::cl::desc("Run the program at compile time for up to <steps> steps and, if it finishes, "
+                            "emit only its output (default: 0, off)"),
+             llvm::cl::value_desc("steps"),
+             llvm::cl::init(0));
+
+// Define command-line options for profile-guided optimization.
+static llvm::cl::opt<std::string>
+    ProfileGenerate("profile-generate",
+                    llvm::cl::desc("Count branches and write them to <file> when the program exits "
+                                   "(default: compiler.prof)"),
+                    llvm::cl::value_desc("file"),
+                    llvm::cl::ValueOptional);
+
+static llvm::cl::opt<std::string>
+    ProfileUse("profile-use",
+               llvm::cl::desc("Optimize with the branch profile in <file> written by --profile-generate"),
+               llvm::cl::value_desc("file"));
+
+static llvm::cl::opt<std::string>
+    Instrument("instrument",
+               llvm::cl::desc("Time every if, while and for statement and report the hot spots at exit, "
+                              "as JSON in <file> or on stderr if no file is given"),
+               llvm::cl::value_desc("file"),
+               llvm::cl::ValueOptional);
+
+// Define command-line options for compiling many files in one process.
+static llvm::cl::list<std::string>
+    Batch("batch",
+          llvm::cl::desc("Compile each <file>, or every file in <dir>, to its own output"),
+          llvm::cl::value_desc("file|dir"),
+          llvm::cl::CommaSeparated);
+
+static llvm::cl::opt<unsigned>
+    Jobs("j",
+         llvm::cl::desc("Number of parallel jobs of --batch and workers of --serve (default: all cores)"),
+         llvm::cl::Prefix,
+         llvm::cl::init(0));
+
+static llvm::cl::opt<std::string>
+    OutputDir("output-dir",
+              llvm::cl::desc("Directory for the outputs of --batch (default: next to each input)"),
+              llvm::cl::value_desc("dir"));
+
+// Define command-line options for the compilation cache.
+static llvm::cl::opt<std::string>
+    CacheDir("cache-dir",
+             llvm::cl::desc("Reuse outputs of unchanged programs cached in <dir>"),
+             llvm::cl::value_desc("dir"));
+
+static llvm::cl::opt<std::string>
+    CachePolicy("cache-policy",
+                llvm::cl::desc("Eviction policy of --cache-dir, e.g. cache_size_bytes=1g:prune_after=24h"),
+                llvm::cl::value_desc("policy"),
+                llvm::cl::init("cache_size_bytes=512m"));
+
+// Define command-line options for the compiler server.
+static llvm::cl::opt<std::string>
+    Serve("serve",
+          llvm::cl::desc("Serve compile and --run requests on the Unix socket <path> (-j workers)"),
+          llvm::cl::value_desc("path"));
+
+static llvm::cl::opt<unsigned>
+    RunTimeout("run-timeout",
+               llvm::cl::desc("Seconds a program run by a --serve request may take (0 for no limit)"),
+               llvm::cl::value_desc("seconds"),
+               llvm::cl::init(10));
+
+static llvm::cl::opt<std::string>
+    Connect("connect",
+            llvm::cl::desc("Send the compile to the server listening on <path>"),
+            llvm::cl::value_desc("path"));
+
+// -time-passes and -stats are LLVM's own options; they also enable the
+// compiler's phase timers and counters below.
+static llvm::cl::opt<std::string>
+    StatsFile("stats-file",
+              llvm::cl::desc("Write phase timings and statistics as JSON to <file>"),
+              llvm::cl::value_desc("file"));
+
+// Returns the peak resident set size of the process in KiB (0 if unknown).
+static uint64_t getPeakRSSKB()
+{
+#ifdef LLVM_ON_UNIX
+    struct rusage Usage;
+    if (getrusage(RUSAGE_SELF, &Usage) == 0)
+#ifdef __APPLE__
+        return Usage.ru_maxrss / 1024;
+#else
+        return Usage.ru_maxrss;
+#endif
+#endif
+    return 0;
+}
+
+static void printStats(const CompilerStats &S, llvm::raw_ostream &OS)
+{
+    OS << "===-------------------------------------------------------------------------===\n"
+       << "                          Compiler statistics\n"
+       << "===-------------------------------------------------------------------------===\n";
+    OS << llvm::format("%12llu tokens lexed\n", S.Tokens)
+       << llvm::format("%12llu tokens of parser lookahead\n", S.LookaheadTokens)
+       << llvm::format("%12llu AST nodes allocated\n", S.ASTNodes)
+       << llvm::format("%12llu AST arena bytes\n", S.ASTBytes)
+       << llvm::format("%12llu IR instructions emitted\n", S.IRInstructions)
+       << llvm::format("%12llu IR instructions after optimization\n", S.OptimizedIRInstructions)
+       << llvm::format("%12llu KiB peak RSS\n", S.PeakRSSKB)
+       << llvm::format("%12llu cache hits\n", S.CacheHits)
+       << llvm::format("%12llu cache misses\n", S.CacheMisses);
+}
+
+static bool writeStatsJSON(const CompilerStats &S, llvm::ArrayRef<llvm::Timer *> Timers)
+{
+    std::error_code EC;
+    llvm::raw_fd_ostream OS(StatsFile, EC, llvm::sys::fs::OF_Text);
+    if (EC)
+    {
+        llvm::errs() << "Cannot open " << StatsFile << ": " << EC.message() << "\n";
+        return true;
+    }
+
+    llvm::json::OStream J(OS, 2);
+    J.object([&]
+             {
+        J.attribute("tokens", (int64_t)S.Tokens);
+        J.attribute("lookahead_tokens", (int64_t)S.LookaheadTokens);
+        J.attribute("ast_nodes", (int64_t)S.ASTNodes);
+        J.attribute("ast_bytes", (int64_t)S.ASTBytes);
+        J.attribute("ir_instructions", (int64_t)S.IRInstructions);
+        J.attribute("ir_instructions_optimized", (int64_t)S.OptimizedIRInstructions);
+        J.attribute("peak_rss_kib", (int64_t)S.PeakRSSKB);
+        J.attribute("cache_hits", (int64_t)S.CacheHits);
+        J.attribute("cache_misses", (int64_t)S.CacheMisses);
+        J.attributeObject("time", [&]
+                          {
+            for (llvm::Timer *T : Timers)
+            {
+                llvm::TimeRecord R = T->getTotalTime();
+                J.attributeObject(T->getName(), [&]
+                                  {
+                    J.attribute("wall", R.getWallTime());
+                    J.attribute("user", R.getUserTime());
+                    J.attribute("system", R.getSystemTime()); });
+            } }); });
+    OS << "\n";
+    return false;
+}
+
+// Files in a --batch directory with these extensions are outputs, not programs.
+static bool isOutputFile(llvm::StringRef Path)
+{
+    llvm::StringRef Ext = llvm::sys::path::extension(Path);
+    return Ext == ".ll" || Ext == ".bc" || Ext == ".o";
+}
+
+// Expands the --batch arguments into the list of programs to compile.
+// Directories contribute their regular files, sorted by name.
+static bool collectBatchInputs(std::vector<std::string> &Inputs)
+{
+    for (const std::string &Arg : Batch)
+    {
+        if (!llvm::sys::fs::is_directory(Arg))
+        {
+            Inputs.push_back(Arg);
+            continue;
+        }
+
+        std::vector<std::string> Files;
+        std::error_code EC;
+        for (llvm::sys::fs::directory_iterator I(Arg, EC), E; I != E && !EC; I.increment(EC))
+        {
+            llvm::ErrorOr<llvm::sys::fs::basic_file_status> Status = I->status();
+            if (Status && Status->type() == llvm::sys::fs::file_type::regular_file &&
+                !isOutputFile(I->path()))
+                Files.push_back(I->path());
+        }
+        if (EC)
+        {
+            llvm::errs() << "Cannot read directory " << Arg << ": " << EC.message() << "\n";
+            return true;
+        }
+        std::sort(Files.begin(), Files.end());
+        Inputs.insert(Inputs.end(), Files.begin(), Files.end());
+    }
+    return false;
+}
+
+// Returns the output of a --batch input: the input with the extension of the
+// emitted kind, placed in --output-dir when one is given.
+static std::string getBatchOutputFile(llvm::StringRef Input)
+{
+    llvm::StringRef Ext = EmitAST                     ? ".ast"
+                          : Emit == EmitKind::LLVMIR  ? ".ll"
+                          : Emit == EmitKind::Bitcode ? ".bc"
+                          : Emit == EmitKind::Object  ? ".o"
+                                                      : "";
+    llvm::SmallString<128> Path;
+    if (OutputDir.empty())
+        Path = Input;
+    else
+    {
+        Path = OutputDir;
+        llvm::sys::path::append(Path, llvm::sys::path::filename(Input));
+    }
+    llvm::sys::path::replace_extension(Path, Ext);
+
+    // Never overwrite the input itself, e.g. an input without extension
+    // compiled to an executable.
+    if (Path == Input)
+        Path += Ext.empty() ? llvm::StringRef(".out") : Ext;
+    return std::string(Path.str());
+}
+
+// State of one --batch job. Each job only touches its own entry.
+struct BatchJob
+{
+    std::string Input;
+    CodeGenOptions Opts;
+    std::string Diags; // diagnostics, printed once all jobs are done
+    bool Failed = false;
+    CompilerStats Stats;
+};
+
+static void runBatchJob(BatchJob &Job, CompileCache *Cache)
+{
+    llvm::raw_string_ostream Diags(Job.Diags);
+    llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> BufferOrErr =
+        llvm::MemoryBuffer::getFile(Job.Input);
+    if (std::error_code EC = BufferOrErr.getError())
+    {
+        Diags << "Cannot read " << Job.Input << ": " << EC.message() << "\n";
+        Job.Failed = true;
+        return;
+    }
+    int ExitCode = 0;
+    CompileEnv Env;
+    Env.Cache = Cache;
+    Job.Failed = compileSource((*BufferOrErr)->getBuffer(), Job.Opts, ConstFolding, Diags, Job.Stats,
+                               ExitCode, Env);
+}
+
+// Compiles every --batch input on a thread pool. Each job runs its own
+// lexer, parser, Sema, ConstFold and CodeGen with its own LLVMContext and
+// module, so the jobs share nothing but the read-only options.
+static int runBatch(const CodeGenOptions &Opts, CompileCache *Cache)
+{
+    std::vector<std::string> Inputs;
+    if (collectBatchInputs(Inputs))
+        return 1;
+
+    if (!OutputDir.empty())
+        if (std::error_code EC = llvm::sys::fs::create_directories(OutputDir))
+        {
+            llvm::errs() << "Cannot create " << OutputDir << ": " << EC.message() << "\n";
+            return 1;
+        }
+
+    std::vector<BatchJob> BatchJobs(Inputs.size());
+    for (size_t I = 0; I < Inputs.size(); ++I)
+    {
+        BatchJobs[I].Input = Inputs[I];
+        BatchJobs[I].Opts = Opts;
+        BatchJobs[I].Opts.OutputFile = getBatchOutputFile(Inputs[I]);
+    }
+
+    {
+        llvm::ThreadPool Pool(llvm::hardware_concurrency(Jobs));
+        for (BatchJob &Job : BatchJobs)
+            Pool.async([&Job, Cache]
+                       { runBatchJob(Job, Cache); });
+        Pool.wait();
+    }
+
+    // Report in input order, each diagnostic line prefixed with its file.
+    unsigned NumFailed = 0;
+    CompilerStats Total;
+    for (BatchJob &Job : BatchJobs)
+    {
+        llvm::SmallVector<llvm::StringRef, 8> Lines;
+        llvm::StringRef(Job.Diags).split(Lines, '\n', -1, /*KeepEmpty=*/false);
+        for (llvm::StringRef Line : Lines)
+            llvm::errs() << Job.Input << ": " << Line << "\n";
+        if (Job.Failed)
+            ++NumFailed;
+        Total.add(Job.Stats);
+    }
+    if (NumFailed)
+        llvm::errs() << NumFailed << " of " << BatchJobs.size() << " files failed to compile\n";
+
+    if (llvm::AreStatisticsEnabled() || !StatsFile.empty())
+    {
+        Total.PeakRSSKB = getPeakRSSKB();
+        if (Cache)
+        {
+            Total.CacheHits = Cache->getNumHits();
+            Total.CacheMisses = Cache->getNumMisses();
+        }
+        if (llvm::AreStatisticsEnabled())
+            printStats(Total, llvm::errs());
+        if (!StatsFile.empty() && writeStatsJSON(Total, {}))
+            return 1;
+    }
+    return NumFailed ? 1 : 0;
+}
+
 // The main function of the program.
 int main(int argc, const char **argv)
 {
@@ -23,34 +427,227 @@ int main(int argc, const char **argv)
     // Parse command-line options.
     llvm::cl::ParseCommandLineOptions(argc, argv, "Simple Compiler\n");
 
-    // Create a lexer object and initialize it with the input expression.
-    Lexer Lex(Input);
+    if (OptLevel > 3)
+    {
+        llvm::errs() << "Invalid optimization level -O" << OptLevel << "\n";
+        return 1;
+    }
+
+    CodeGenOptions Opts;
+    Opts.OptLevel = OptLevel;
+    Opts.Emit = EmitAST ? EmitKind::AST : Emit;
+    Opts.Triple = TargetTriple;
+    Opts.CPU = TargetCPU;
+    Opts.OutputFile = OutputFile;
+    Opts.RuntimeObject = RuntimeObject;
+    Opts.Linker = Linker;
+    Opts.Run = Run;
+    Opts.Interpret = Interpret;
+    Opts.TierUp = TierUp;
+    Opts.CodeGenThreads = CodeGenThreads;
+    if (ProfileGenerate.getNumOccurrences())
+        Opts.ProfileGenerate = ProfileGenerate.empty() ? "compiler.prof" : ProfileGenerate.getValue();
+    Opts.ProfileUse = ProfileUse;
+    Opts.EvalFuel = EvalFuel;
+    if (Instrument.getNumOccurrences())
+        Opts.Instrument = Instrument.empty() ? "-" : Instrument.getValue();
+    if (Opts.Emit == EmitKind::Executable && Opts.OutputFile == "-")
+        Opts.OutputFile = "a.out";
+    if (EmitAST && (Run || Interpret || Emit.getNumOccurrences()))
+    {
+        llvm::errs() << "--emit-ast cannot be combined with --emit, --run or --interp\n";
+        return 1;
+    }
+    // Profiles and hot-spot reports are written by compiled programs.
+    if (Interpret && (Run || !Opts.ProfileGenerate.empty() || !Opts.ProfileUse.empty() || !Opts.Instrument.empty()))
+    {
+        llvm::errs() << "--interp cannot be combined with --run, --profile-generate, --profile-use or --instrument\n";
+        return 1;
+    }
+    if (TierUp && !Interpret)
+    {
+        llvm::errs() << "--tier-up needs --interp\n";
+        return 1;
+    }
+    // Branch counters and hot-spot reports belong to main.
+    if (CodeGenThreads && (Interpret || !Opts.ProfileGenerate.empty() || !Opts.ProfileUse.empty() ||
+                           !Opts.Instrument.empty()))
+    {
+        llvm::errs() << "--codegen-threads cannot be combined with --interp, --profile-generate, --profile-use "
+                        "or --instrument\n";
+        return 1;
+    }
+    // CodeGen takes the contents of the profile, so that --connect can send
+    // them instead of a path for the server to open.
+    if (!Opts.ProfileUse.empty())
+    {
+        llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> Profile = llvm::MemoryBuffer::getFile(Opts.ProfileUse);
+        if (!Profile)
+        {
+            llvm::errs() << "Cannot read profile " << Opts.ProfileUse << ": " << Profile.getError().message() << "\n";
+            return 1;
+        }
+        Opts.ProfileData = std::string((*Profile)->getBuffer());
+    }
 
-    // Create a parser object and initialize it with the lexer.
-    Parser Parser(Lex);
+    // Outputs of unchanged programs are taken from the cache, if one is given.
+    std::unique_ptr<CompileCache> Cache;
+    llvm::CachePruningPolicy Policy;
+    if (!CacheDir.empty())
+    {
+        llvm::Expected<llvm::CachePruningPolicy> PolicyOrErr =
+            llvm::parseCachePruningPolicy(CachePolicy);
+        if (!PolicyOrErr)
+        {
+            llvm::logAllUnhandledErrors(PolicyOrErr.takeError(), llvm::errs(), "--cache-policy: ");
+            return 1;
+        }
+        Policy = *PolicyOrErr;
+        Cache = std::make_unique<CompileCache>(
+            CacheDir, llvm::sys::fs::getMainExecutable(argv[0], (void *)&main));
+    }
 
-    // Parse the input expression and generate an abstract syntax tree (AST).
-    Program *Tree = Parser.parse();
+    if (!Serve.empty())
+    {
+        // The server runs for long, so its cache is also pruned as it grows.
+        if (Cache)
+        {
+            Cache->prune(Policy);
+            Cache->setPrunePolicy(Policy);
+        }
+        ServerOptions Options;
+        Options.Jobs = Jobs;
+        Options.RunTimeout = RunTimeout;
+        Options.RuntimeObject = RuntimeObject;
+        Options.Linker = Linker;
+        return runServer(Serve, Options, Cache.get());
+    }
 
-    // Check if parsing was successful or if there were any syntax errors.
-    if (!Tree || Parser.hasError())
+    if (!Batch.empty())
     {
-        llvm::errs() << "Syntax errors occurred\n";
-        return 1;
+        // Outputs are named after the inputs, the LLVM pass timers are not
+        // safe to use from several threads, and profiles and hot-spot
+        // reports belong to a single program.
+        if (!Input.empty() || !InputFile.empty() || OutputFile != "-" || Run || Interpret ||
+            llvm::TimePassesIsEnabled || !Opts.ProfileGenerate.empty() || !Opts.ProfileUse.empty() ||
+            !Opts.Instrument.empty())
+        {
+            llvm::errs() << "--batch cannot be combined with an input expression, --file, -o, --run, --interp, "
+                            "-time-passes, --profile-generate, --profile-use or --instrument\n";
+            return 1;
+        }
+        int Result = runBatch(Opts, Cache.get());
+        if (Cache)
+            Cache->prune(Policy);
+        return Result;
+    }
+
+    // Map the input file (if any) so the lexer works on it directly without copying.
+    std::unique_ptr<llvm::MemoryBuffer> FileBuffer;
+    llvm::StringRef Source = Input;
+    if (!InputFile.empty())
+    {
+        llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> BufferOrErr =
+            llvm::MemoryBuffer::getFileOrSTDIN(InputFile);
+        if (std::error_code EC = BufferOrErr.getError())
+        {
+            llvm::errs() << "Cannot read " << InputFile << ": " << EC.message() << "\n";
+            return 1;
+        }
+        FileBuffer = std::move(*BufferOrErr);
+        Source = FileBuffer->getBuffer();
+    }
+
+    // Let a running server do the work. It returns the output, which is
+    // written here, and links with its own runtime and linker. It resolves
+    // the other paths in its own directory, so send them as absolute paths.
+    if (!Connect.empty())
+    {
+        if (RuntimeObject.getNumOccurrences() || Linker.getNumOccurrences())
+        {
+            llvm::errs() << "--connect cannot be combined with --runtime or --linker; pass them to --serve\n";
+            return 1;
+        }
+        ServerRequest Request;
+        Request.Opts = Opts;
+        Request.Opts.OutputFile = "-";
+        Request.ConstFold = ConstFolding;
+        Request.Source = Source.str();
+        for (std::string *Path : {&Request.Opts.ProfileGenerate, &Request.Opts.Instrument})
+            if (!Path->empty() && *Path != "-")
+            {
+                llvm::SmallString<128> Absolute(*Path);
+                llvm::sys::fs::make_absolute(Absolute);
+                *Path = std::string(Absolute.str());
+            }
+
+        ServerResponse Response;
+        if (sendRequest(Connect, Request, Response, llvm::errs()))
+            return 1;
+        llvm::errs() << Response.Diagnostics;
+        if (Run || Interpret || Opts.OutputFile == "-")
+            llvm::outs() << Response.Output;
+        else if (!Response.Failed)
+        {
+            std::error_code EC;
+            llvm::ToolOutputFile Out(Opts.OutputFile, EC, llvm::sys::fs::OF_None);
+            if (EC)
+            {
+                llvm::errs() << "Cannot open " << Opts.OutputFile << ": " << EC.message() << "\n";
+                return 1;
+            }
+            Out.os() << Response.Output;
+            Out.keep();
+            if (Opts.Emit == EmitKind::Executable)
+                llvm::sys::fs::setPermissions(Opts.OutputFile, llvm::sys::fs::all_read | llvm::sys::fs::all_exe |
+                                                                   llvm::sys::fs::owner_write);
+        }
+        return Response.Failed ? 1 : Response.ExitCode;
     }
 
-    // Perform semantic analysis on the AST.
-    Sema Semantic;
-    if (Semantic.semantic(Tree))
+    // Phase timers, reported with -time-passes and --stats-file.
+    bool WantStats = llvm::AreStatisticsEnabled() || !StatsFile.empty();
+    bool WantTimers = llvm::TimePassesIsEnabled || !StatsFile.empty();
+    llvm::TimerGroup PhaseTimerGroup("compiler", "Compiler phase timing");
+    llvm::Timer ParseTimer("parse", "Lexing and parsing", PhaseTimerGroup);
+    llvm::Timer SemaTimer("sema", "Semantic analysis", PhaseTimerGroup);
+    llvm::Timer FoldTimer("fold", "Constant folding", PhaseTimerGroup);
+    llvm::Timer CodeGenTimer("codegen", "Code generation", PhaseTimerGroup);
+    CompileEnv Env;
+    Env.Cache = Cache.get();
+    if (WantTimers)
     {
-        llvm::errs() << "Semantic errors occurred\n";
+        Env.Timers.Parse = &ParseTimer;
+        Env.Timers.Sema = &SemaTimer;
+        Env.Timers.Fold = &FoldTimer;
+        Env.Timers.CodeGen = &CodeGenTimer;
+    }
+
+    CompilerStats S;
+    int ExitCode = 0;
+    if (compileSource(Source, Opts, ConstFolding, llvm::errs(), S, ExitCode, Env))
         return 1;
+    if (Cache)
+    {
+        Cache->prune(Policy);
+        S.CacheHits = Cache->getNumHits();
+        S.CacheMisses = Cache->getNumMisses();
     }
 
-    // Generate code for the AST using a code generator.
-    CodeGen CodeGenerator;
-    CodeGenerator.compile(Tree);
+    if (WantStats)
+    {
+        S.PeakRSSKB = getPeakRSSKB();
+        if (llvm::AreStatisticsEnabled())
+            printStats(S, llvm::errs());
+        if (!StatsFile.empty() && writeStatsJSON(S, {&ParseTimer, &SemaTimer, &FoldTimer, &CodeGenTimer}))
+            return 1;
+    }
+
+    if (llvm::TimePassesIsEnabled)
+        PhaseTimerGroup.print(llvm::errs(), /*ResetAfterPrint=*/true);
+    else
+        PhaseTimerGroup.clear();
 
     // The program executed successfully.
-    return 0;
+    return ExitCode;
 }
@@ -0,0 +1,772 @@
+#include "ConstFold.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include <cstdint>
+
+namespace cf{
+// Evaluate a binary operator the way CodeGen lowers it on i32. Returns false
+// when the result is not defined at compile time (division by zero or
+// INT_MIN / -1), in which case the operation is left to run.
+bool evalBinary(BinaryOp::Operator Op, int32_t L, int32_t R, int32_t &Res)
+{
+  uint32_t UL = L, UR = R;
+  switch (Op)
+  {
+  case BinaryOp::Plus:
+    Res = (int32_t)(UL + UR);
+    return true;
+  case BinaryOp::Minus:
+    Res = (int32_t)(UL - UR);
+    return true;
+  case BinaryOp::Mul:
+    Res = (int32_t)(UL * UR);
+    return true;
+  case BinaryOp::Div:
+  case BinaryOp::Mod:
+    if (R == 0 || (L == INT32_MIN && R == -1))
+      return false;
+    Res = Op == BinaryOp::Div ? L / R : L % R;
+    return true;
+  case BinaryOp::Exp:
+  {
+    // Multiplies wrap and a non-positive exponent yields 1, as in CodeGen.
+    uint32_t Acc = 1;
+    for (int32_t N = R; N > 0; N >>= 1)
+    {
+      if (N & 1)
+        Acc *= UL;
+      UL *= UL;
+    }
+    Res = (int32_t)Acc;
+    return true;
+  }
+  }
+  return false;
+}
+
+bool evalCompare(Comparison::Operator Op, int32_t L, int32_t R)
+{
+  switch (Op)
+  {
+  case Comparison::Equal:
+    return L == R;
+  case Comparison::Not_equal:
+    return L != R;
+  case Comparison::Greater:
+    return L > R;
+  case Comparison::Less:
+    return L < R;
+  case Comparison::Greater_equal:
+    return L >= R;
+  case Comparison::Less_equal:
+    return L <= R;
+  default:
+    return false;
+  }
+}
+
+// Collects the variables a subtree may write and whether it declares any.
+class EffectCollector : public ASTVisitor<EffectCollector>
+{
+public:
+  llvm::DenseSet<unsigned> Written;
+  bool HasDecl = false;
+
+  void collect(llvm::ArrayRef<AST *> Stmts)
+  {
+    for (AST *S : Stmts)
+      visit(S);
+  }
+
+  void visitProgram(Program &Node) { collect(Node.getdata()); }
+
+  void visitFinal(Final &) {}
+
+  void visitBinaryOp(BinaryOp &Node)
+  {
+    visit(Node.getLeft());
+    visit(Node.getRight());
+  }
+
+  void visitUnaryOp(UnaryOp &Node) { Written.insert(Node.getSymbol()); }
+
+  void visitSignedNumber(SignedNumber &) {}
+
+  void visitNegExpr(NegExpr &Node) { visit(Node.getExpr()); }
+
+  void visitAssignment(Assignment &Node)
+  {
+    Written.insert(Node.getLeft()->getSymbol());
+    if (Node.getRightExpr())
+      visit(Node.getRightExpr());
+    else
+      visit(Node.getRightLogic());
+  }
+
+  void visitDeclarationInt(DeclarationInt &Node)
+  {
+    HasDecl = true;
+    for (Expr *E : Node.getValues())
+      if (E)
+        visit(E);
+    for (unsigned Symbol : Node.getSymbols())
+      Written.insert(Symbol);
+  }
+
+  void visitDeclarationBool(DeclarationBool &Node)
+  {
+    HasDecl = true;
+    for (Logic *L : Node.getValues())
+      if (L)
+        visit(L);
+    for (unsigned Symbol : Node.getSymbols())
+      Written.insert(Symbol);
+  }
+
+  void visitComparison(Comparison &Node)
+  {
+    if (Node.getRight() == nullptr)
+      return;
+    visit(Node.getLeft());
+    visit(Node.getRight());
+  }
+
+  void visitLogicalExpr(LogicalExpr &Node)
+  {
+    visit(Node.getLeft());
+    if (Node.getRight())
+      visit(Node.getRight());
+  }
+
+  void visitIfStmt(IfStmt &Node)
+  {
+    visit(Node.getCond());
+    collect(Node.getBody());
+    for (elifStmt *Elif : Node.getElifs())
+      visit(Elif);
+    collect(Node.getElse());
+  }
+
+  void visitelifStmt(elifStmt &Node)
+  {
+    visit(Node.getCond());
+    collect(Node.getBody());
+  }
+
+  void visitWhileStmt(WhileStmt &Node)
+  {
+    visit(Node.getCond());
+    collect(Node.getBody());
+  }
+
+  void visitForStmt(ForStmt &Node)
+  {
+    visit(Node.getFirst());
+    visit(Node.getSecond());
+    collect(Node.getBody());
+    if (Node.getThirdAssign())
+      visit(Node.getThirdAssign());
+    else
+      visit(Node.getThirdUnary());
+  }
+
+  void visitPrintStmt(PrintStmt &) {}
+};
+
+// Rebuilds statements with folded expressions. Statements are appended to
+// Out; expressions and conditions leave their result in ResExpr/ResLogic and
+// what is known about it in Res.
+class Folder : public ASTVisitor<Folder>
+{
+  struct Folded
+  {
+    bool IsConst = false;  // the value is Val (0/1 for conditions)
+    bool Pure = true;      // no ++/-- inside
+    bool IntIdent = false; // a condition that is a lone int variable known to hold Val
+    int32_t Val = 0;
+  };
+
+  struct Arm
+  {
+    Logic *Cond;
+    llvm::ArrayRef<AST *> Body;
+  };
+
+  ASTContext &Ctx;
+  // Per-variable state, keyed by symbol ID.
+  llvm::DenseSet<unsigned> BoolVars;          // CodeGen stores these as i1
+  llvm::DenseMap<unsigned, int32_t> KnownInt; // int variables with a known value here
+  llvm::DenseMap<unsigned, bool> KnownBool;   // bool variables with a known value here
+
+  llvm::SmallVectorImpl<AST *> *Out = nullptr;
+  unsigned ExprDepth = 0;
+  Expr *ResExpr = nullptr;
+  Logic *ResLogic = nullptr;
+  Folded Res;
+
+  Expr *makeInt(int32_t V)
+  {
+    return Ctx.create<Final>(Final::Number, V);
+  }
+
+  Logic *makeBool(bool B)
+  {
+    return Ctx.create<Comparison>(nullptr, nullptr, B ? Comparison::True : Comparison::False);
+  }
+
+  Expr *fold(Expr *E, Folded &F)
+  {
+    ++ExprDepth;
+    Res = Folded();
+    visit(E);
+    --ExprDepth;
+    F = Res;
+    return ResExpr;
+  }
+
+  Logic *fold(Logic *L, Folded &F)
+  {
+    ++ExprDepth;
+    Res = Folded();
+    visit(L);
+    --ExprDepth;
+    F = Res;
+    return ResLogic;
+  }
+
+  // Fold a single statement, which always yields exactly one node.
+  AST *foldOne(AST *S)
+  {
+    llvm::SmallVector<AST *, 1> Stmts;
+    llvm::SmallVectorImpl<AST *> *SavedOut = Out;
+    Out = &Stmts;
+    visit(S);
+    Out = SavedOut;
+    return Stmts.front();
+  }
+
+  void kill(const llvm::DenseSet<unsigned> &Vars)
+  {
+    for (unsigned Symbol : Vars)
+    {
+      KnownInt.erase(Symbol);
+      KnownBool.erase(Symbol);
+    }
+  }
+
+  // Fold a branch or loop body that may not run: what it learns is dropped
+  // and the variables it writes are added to Written.
+  llvm::ArrayRef<AST *> foldConditional(llvm::ArrayRef<AST *> Body, llvm::DenseSet<unsigned> &Written)
+  {
+    EffectCollector Eff;
+    Eff.collect(Body);
+    Written.insert(Eff.Written.begin(), Eff.Written.end());
+
+    llvm::DenseMap<unsigned, int32_t> SavedInt = KnownInt;
+    llvm::DenseMap<unsigned, bool> SavedBool = KnownBool;
+    llvm::ArrayRef<AST *> Folded = foldBody(Body);
+    KnownInt = std::move(SavedInt);
+    KnownBool = std::move(SavedBool);
+    return Folded;
+  }
+
+public:
+  Folder(ASTContext &Ctx) : Ctx(Ctx) {}
+
+  llvm::ArrayRef<AST *> foldBody(llvm::ArrayRef<AST *> Stmts)
+  {
+    llvm::SmallVector<AST *, 16> Folded;
+    llvm::SmallVectorImpl<AST *> *SavedOut = Out;
+    Out = &Folded;
+    for (AST *S : Stmts)
+      visit(S);
+    Out = SavedOut;
+    return Ctx.copyArray<AST *>(Folded);
+  }
+
+  void visitProgram(Program &Node)
+  {
+    for (AST *S : Node.getdata())
+      visit(S);
+  }
+
+  void visitFinal(Final &Node)
+  {
+    ResExpr = &Node;
+    if (Node.getValueKind() == Final::Ident)
+    {
+      llvm::DenseMap<unsigned, int32_t>::iterator I = KnownInt.find(Node.getSymbol());
+      if (I == KnownInt.end())
+        return;
+      ResExpr = makeInt(I->second);
+      Res.Val = I->second;
+      Res.IsConst = true;
+    }
+    else
+    {
+      Res.Val = Node.getVal();
+      Res.IsConst = true;
+    }
+  }
+
+  void visitBinaryOp(BinaryOp &Node)
+  {
+    Folded L, R;
+    Expr *Left = fold(Node.getLeft(), L);
+    Expr *Right = fold(Node.getRight(), R);
+
+    Res = Folded();
+    Res.Pure = L.Pure && R.Pure;
+    if (L.IsConst && R.IsConst && evalBinary(Node.getOperator(), L.Val, R.Val, Res.Val))
+    {
+      Res.IsConst = true;
+      ResExpr = makeInt(Res.Val);
+      return;
+    }
+    if (Left == Node.getLeft() && Right == Node.getRight())
+      ResExpr = &Node;
+    else
+      ResExpr = Ctx.create<BinaryOp>(Node.getOperator(), Left, Right);
+  }
+
+  void visitUnaryOp(UnaryOp &Node)
+  {
+    // The variable is still updated in memory; only its new value is tracked.
+    llvm::DenseMap<unsigned, int32_t>::iterator I = KnownInt.find(Node.getSymbol());
+    if (I != KnownInt.end())
+      I->second = (int32_t)((uint32_t)I->second + (Node.getOperator() == UnaryOp::Plus_plus ? 1u : -1u));
+
+    if (ExprDepth == 0)
+    {
+      Out->push_back(&Node);
+      return;
+    }
+    ResExpr = &Node;
+    Res.Pure = false;
+  }
+
+  void visitSignedNumber(SignedNumber &Node)
+  {
+    ResExpr = &Node;
+    int32_t V = Node.getValue();
+    Res.IsConst = true;
+    Res.Val = Node.getSign() == SignedNumber::Minus ? (int32_t)(0u - (uint32_t)V) : V;
+  }
+
+  void visitNegExpr(NegExpr &Node)
+  {
+    Folded F;
+    Expr *E = fold(Node.getExpr(), F);
+    Res = F;
+    if (F.IsConst)
+    {
+      Res.Val = (int32_t)(0u - (uint32_t)F.Val);
+      ResExpr = makeInt(Res.Val);
+      return;
+    }
+    ResExpr = E == Node.getExpr() ? &Node : Ctx.create<NegExpr>(E);
+  }
+
+  void visitComparison(Comparison &Node)
+  {
+    ResLogic = &Node;
+    if (Node.getRight() == nullptr)
+    {
+      switch (Node.getOperator())
+      {
+      case Comparison::True:
+      case Comparison::False:
+        Res.IsConst = true;
+        Res.Val = Node.getOperator() == Comparison::True;
+        break;
+      case Comparison::Ident:
+      {
+        unsigned Var = llvm::cast<Final>(Node.getLeft())->getSymbol();
+        llvm::DenseMap<unsigned, bool>::iterator B = KnownBool.find(Var);
+        if (B != KnownBool.end())
+        {
+          Res.IsConst = true;
+          Res.Val = B->second;
+          ResLogic = makeBool(B->second);
+          break;
+        }
+        // An int assigned from another int variable parses as a condition.
+        llvm::DenseMap<unsigned, int32_t>::iterator I = KnownInt.find(Var);
+        if (I != KnownInt.end())
+        {
+          Res.IntIdent = true;
+          Res.Val = I->second;
+        }
+        break;
+      }
+      default:
+        break;
+      }
+      return;
+    }
+
+    Folded L, R;
+    Expr *Left = fold(Node.getLeft(), L);
+    Expr *Right = fold(Node.getRight(), R);
+
+    Res = Folded();
+    Res.Pure = L.Pure && R.Pure;
+    if (L.IsConst && R.IsConst)
+    {
+      Res.IsConst = true;
+      Res.Val = evalCompare(Node.getOperator(), L.Val, R.Val);
+      ResLogic = makeBool(Res.Val);
+      return;
+    }
+    if (Left == Node.getLeft() && Right == Node.getRight())
+      ResLogic = &Node;
+    else
+      ResLogic = Ctx.create<Comparison>(Left, Right, Node.getOperator());
+  }
+
+  void visitLogicalExpr(LogicalExpr &Node)
+  {
+    Folded L, R;
+    Logic *Left = fold(Node.getLeft(), L);
+    if (Node.getRight() == nullptr)
+    {
+      Res = L;
+      ResLogic = Left;
+      return;
+    }
+    // and/or short-circuit: the right operand only runs when the left one
+    // does not decide the result.
+    bool IsAnd = Node.getOperator() == LogicalExpr::And;
+    if (L.IsConst && L.Val != IsAnd)
+    {
+      // false and X, true or X: X never runs.
+      Res = Folded();
+      Res.IsConst = true;
+      Res.Val = L.Val;
+      ResLogic = makeBool(L.Val);
+      return;
+    }
+
+    EffectCollector RightEff;
+    RightEff.visit(Node.getRight());
+    Logic *Right = fold(Node.getRight(), R);
+    if (L.IsConst)
+    {
+      // true and X, false or X: X always runs and is the result.
+      Res = R;
+      Res.IntIdent = false;
+      ResLogic = Right;
+      return;
+    }
+    // Otherwise the right operand may be skipped.
+    kill(RightEff.Written);
+
+    Res = Folded();
+    Res.Pure = L.Pure && R.Pure;
+    if (R.IsConst)
+    {
+      if (R.Val == IsAnd)
+      {
+        // X and true, X or false: the result is X.
+        Res = L;
+        Res.IntIdent = false;
+        ResLogic = Left;
+        return;
+      }
+      if (L.Pure)
+      {
+        // X and false, X or true: the result is the constant.
+        Res.IsConst = true;
+        Res.Val = R.Val;
+        ResLogic = makeBool(R.Val);
+        return;
+      }
+    }
+    if (Left == Node.getLeft() && Right == Node.getRight())
+      ResLogic = &Node;
+    else
+      ResLogic = Ctx.create<LogicalExpr>(Left, Right, Node.getOperator());
+  }
+
+  void visitDeclarationInt(DeclarationInt &Node)
+  {
+    llvm::ArrayRef<unsigned> Vars = Node.getSymbols();
+    llvm::ArrayRef<Expr *> Values = Node.getValues();
+    llvm::SmallVector<Expr *, 8> NewValues;
+    llvm::SmallVector<Folded, 8> Info;
+    bool Changed = false;
+
+    // CodeGen evaluates every initializer before storing any of them.
+    for (Expr *E : Values)
+    {
+      Folded F;
+      NewValues.push_back(E ? fold(E, F) : nullptr);
+      Info.push_back(F);
+      Changed |= NewValues.back() != E;
+    }
+    for (unsigned I = 0, N = Vars.size(); I != N; ++I)
+    {
+      if (I >= Values.size() || Values[I] == nullptr)
+        KnownInt[Vars[I]] = 0;
+      else if (Info[I].IsConst)
+        KnownInt[Vars[I]] = Info[I].Val;
+      else
+        KnownInt.erase(Vars[I]);
+    }
+
+    if (Changed)
+      Out->push_back(Ctx.create<DeclarationInt>(Vars, Ctx.copyArray<Expr *>(NewValues)));
+    else
+      Out->push_back(&Node);
+  }
+
+  void visitDeclarationBool(DeclarationBool &Node)
+  {
+    llvm::ArrayRef<unsigned> Vars = Node.getSymbols();
+    llvm::ArrayRef<Logic *> Values = Node.getValues();
+    llvm::SmallVector<Logic *, 8> NewValues;
+    llvm::SmallVector<Folded, 8> Info;
+    bool Changed = false;
+
+    for (Logic *L : Values)
+    {
+      Folded F;
+      NewValues.push_back(L ? fold(L, F) : nullptr);
+      Info.push_back(F);
+      Changed |= NewValues.back() != L;
+    }
+    for (unsigned I = 0, N = Vars.size(); I != N; ++I)
+    {
+      BoolVars.insert(Vars[I]);
+      if (I >= Values.size() || Values[I] == nullptr)
+        KnownBool[Vars[I]] = false;
+      else if (Info[I].IsConst)
+        KnownBool[Vars[I]] = Info[I].Val;
+      else
+        KnownBool.erase(Vars[I]);
+    }
+
+    if (Changed)
+      Out->push_back(Ctx.create<DeclarationBool>(Vars, Ctx.copyArray<Logic *>(NewValues)));
+    else
+      Out->push_back(&Node);
+  }
+
+  void visitAssignment(Assignment &Node)
+  {
+    unsigned Var = Node.getLeft()->getSymbol();
+    Assignment::AssignKind AK = Node.getAssignKind();
+    Expr *RightExpr = nullptr;
+    Logic *RightLogic = nullptr;
+    Folded F;
+    if (Node.getRightExpr())
+      RightExpr = fold(Node.getRightExpr(), F);
+    else
+      RightLogic = fold(Node.getRightLogic(), F);
+
+    if (BoolVars.count(Var))
+    {
+      if (RightLogic && F.IsConst && AK == Assignment::Assign)
+        KnownBool[Var] = F.Val;
+      else
+        KnownBool.erase(Var);
+    }
+    else
+    {
+      if (RightLogic && F.IntIdent)
+      {
+        RightExpr = makeInt(F.Val);
+        RightLogic = nullptr;
+        F.IsConst = true;
+      }
+
+      bool Known = false;
+      int32_t Val = F.Val;
+      if (RightExpr && F.IsConst)
+      {
+        llvm::DenseMap<unsigned, int32_t>::iterator I = KnownInt.find(Var);
+        switch (AK)
+        {
+        case Assignment::Assign:
+          Known = true;
+          break;
+        case Assignment::Plus_assign:
+          Known = I != KnownInt.end() && evalBinary(BinaryOp::Plus, I->second, F.Val, Val);
+          break;
+        case Assignment::Minus_assign:
+          Known = I != KnownInt.end() && evalBinary(BinaryOp::Minus, I->second, F.Val, Val);
+          break;
+        case Assignment::Star_assign:
+          Known = I != KnownInt.end() && evalBinary(BinaryOp::Mul, I->second, F.Val, Val);
+          break;
+        case Assignment::Slash_assign:
+          Known = I != KnownInt.end() && evalBinary(BinaryOp::Div, I->second, F.Val, Val);
+          break;
+        }
+        if (Known && AK != Assignment::Assign)
+        {
+          AK = Assignment::Assign;
+          RightExpr = makeInt(Val);
+        }
+      }
+      if (Known)
+        KnownInt[Var] = Val;
+      else
+        KnownInt.erase(Var);
+    }
+
+    if (RightExpr == Node.getRightExpr() && RightLogic == Node.getRightLogic() && AK == Node.getAssignKind())
+      Out->push_back(&Node);
+    else
+      Out->push_back(Ctx.create<Assignment>(Node.getLeft(), RightExpr, AK, RightLogic));
+  }
+
+  void visitPrintStmt(PrintStmt &Node) { Out->push_back(&Node); }
+
+  void visitWhileStmt(WhileStmt &Node)
+  {
+    // Variables written anywhere in the loop are unknown on every iteration.
+    EffectCollector Eff;
+    Eff.visit(Node.getCond());
+    Eff.collect(Node.getBody());
+    kill(Eff.Written);
+
+    Folded F;
+    Logic *Cond = fold(Node.getCond(), F);
+    if (F.IsConst && !F.Val && !Eff.HasDecl)
+      return;
+
+    llvm::DenseSet<unsigned> Written;
+    llvm::ArrayRef<AST *> Body = foldConditional(Node.getBody(), Written);
+    Out->push_back(Ctx.create<WhileStmt>(Cond, Body, Node.getLine(), Node.getHints()));
+  }
+
+  void visitForStmt(ForStmt &Node)
+  {
+    Assignment *First = llvm::cast<Assignment>(foldOne(Node.getFirst()));
+
+    EffectCollector Eff;
+    Eff.visit(Node.getSecond());
+    Eff.collect(Node.getBody());
+    if (Node.getThirdAssign())
+      Eff.visit(Node.getThirdAssign());
+    else
+      Eff.visit(Node.getThirdUnary());
+    kill(Eff.Written);
+
+    Folded F;
+    Logic *Cond = fold(Node.getSecond(), F);
+    if (F.IsConst && !F.Val && !Eff.HasDecl)
+    {
+      Out->push_back(First);
+      return;
+    }
+
+    llvm::DenseMap<unsigned, int32_t> SavedInt = KnownInt;
+    llvm::DenseMap<unsigned, bool> SavedBool = KnownBool;
+    llvm::ArrayRef<AST *> Body = foldBody(Node.getBody());
+    Assignment *ThirdAssign = nullptr;
+    UnaryOp *ThirdUnary = Node.getThirdUnary();
+    if (Node.getThirdAssign())
+      ThirdAssign = llvm::cast<Assignment>(foldOne(Node.getThirdAssign()));
+    KnownInt = std::move(SavedInt);
+    KnownBool = std::move(SavedBool);
+
+    Out->push_back(Ctx.create<ForStmt>(First, Cond, ThirdAssign, ThirdUnary, Body, Node.getLine(), Node.getHints()));
+  }
+
+  void visitIfStmt(IfStmt &Node)
+  {
+    llvm::SmallVector<Arm, 4> Arms;
+    Arms.push_back({Node.getCond(), Node.getBody()});
+    for (elifStmt *Elif : Node.getElifs())
+      Arms.push_back({Elif->getCond(), Elif->getBody()});
+
+    // Branches that declare variables are kept even when they cannot run,
+    // since CodeGen creates the variables when it visits the declaration.
+    auto HasDecl = [&](unsigned From)
+    {
+      EffectCollector Eff;
+      for (unsigned I = From, N = Arms.size(); I != N; ++I)
+        Eff.collect(Arms[I].Body);
+      Eff.collect(Node.getElse());
+      return Eff.HasDecl;
+    };
+
+    llvm::SmallVector<Arm, 4> Kept;
+    llvm::ArrayRef<AST *> Else;
+    bool ElseFolded = false;
+    llvm::DenseSet<unsigned> Written; // variables written by code that may not run
+    for (unsigned I = 0, N = Arms.size(); I != N; ++I)
+    {
+      EffectCollector CondEff;
+      CondEff.visit(Arms[I].Cond);
+      Written.insert(CondEff.Written.begin(), CondEff.Written.end());
+
+      Folded F;
+      Logic *Cond = fold(Arms[I].Cond, F);
+      if (F.IsConst && !F.Val)
+      {
+        EffectCollector Eff;
+        Eff.collect(Arms[I].Body);
+        if (!Eff.HasDecl)
+          continue;
+      }
+      if (F.IsConst && F.Val && !HasDecl(I + 1))
+      {
+        // The first branch taken is known; everything after it is dead.
+        if (Kept.empty())
+        {
+          for (AST *S : Arms[I].Body)
+            visit(S);
+          return;
+        }
+        Else = foldConditional(Arms[I].Body, Written);
+        ElseFolded = true;
+        break;
+      }
+      Kept.push_back({Cond, foldConditional(Arms[I].Body, Written)});
+    }
+
+    if (!ElseFolded)
+    {
+      if (Kept.empty())
+      {
+        for (AST *S : Node.getElse())
+          visit(S);
+        return;
+      }
+      Else = foldConditional(Node.getElse(), Written);
+    }
+    kill(Written);
+
+    llvm::SmallVector<elifStmt *, 4> Elifs;
+    for (unsigned I = 1, N = Kept.size(); I != N; ++I)
+      Elifs.push_back(Ctx.create<elifStmt>(Kept[I].Cond, Kept[I].Body));
+    Out->push_back(Ctx.create<IfStmt>(Kept[0].Cond, Kept[0].Body, Else, Ctx.copyArray<elifStmt *>(Elifs), Node.getLine()));
+  }
+
+  // elif branches are folded together with their IfStmt.
+  void visitelifStmt(elifStmt &) {}
+};
+} // namespace cf
+
+ConstFold::ConstFold(ASTContext &Ctx) : Ctx(Ctx) {}
+
+ConstFold::~ConstFold() = default;
+
+Program *ConstFold::fold(Program *Tree)
+{
+  if (!Tree)
+    return Tree;
+  cf::Folder Folder(Ctx);
+  return Ctx.create<Program>(Folder.foldBody(Tree->getdata()));
+}
+
+llvm::ArrayRef<AST *> ConstFold::foldStatement(AST *Stmt)
+{
+  if (!Stream)
+    Stream = std::make_unique<cf::Folder>(Ctx);
+  return Stream->foldBody(Stmt);
+}
@@ -0,0 +1,43 @@
+#ifndef CONSTFOLD_H
+#define CONSTFOLD_H
+
+#include "AST.h"
+#include "ASTContext.h"
+#include "llvm/ADT/ArrayRef.h"
+#include <cstdint>
+#include <memory>
+
+namespace cf
+{
+  class Folder;
+
+  // Operators evaluated the way CodeGen lowers them on i32. evalBinary
+  // returns false when the result is not defined at compile time.
+  bool evalBinary(BinaryOp::Operator Op, int32_t L, int32_t R, int32_t &Res);
+  bool evalCompare(Comparison::Operator Op, int32_t L, int32_t R);
+}
+
+// ConstFold runs between Sema and CodeGen. It evaluates expressions and
+// conditions built only from literals and variables whose value is known at
+// that point, feeds declaration and assignment values forward through
+// straight-line code, and drops if/elif/while branches whose condition is a
+// constant false. Changed nodes are rebuilt in the ASTContext; unchanged
+// subtrees are shared with the input tree.
+class ConstFold
+{
+  ASTContext &Ctx;
+  std::unique_ptr<cf::Folder> Stream; // state of foldStatement
+
+public:
+  ConstFold(ASTContext &Ctx);
+  ~ConstFold();
+
+  Program *fold(Program *Tree);
+
+  // Folds the next top-level statement of a program that is given one
+  // statement at a time, with what is known from the statements before it.
+  // The statement may fold into any number of statements, including none.
+  llvm::ArrayRef<AST *> foldStatement(AST *Stmt);
+};
+
+#endif
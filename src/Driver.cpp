@@ -0,0 +1,412 @@
+#include "Driver.h"
+#include "AST.h"
+#include "ASTContext.h"
+#include "ASTFile.h"
+#include "ConstFold.h"
+#include "Lexer.h"
+#include "Parser.h"
+#include "Sema.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace
+{
+    // Runs the front end (parser or ASTReader, Sema and ConstFold) one
+    // top-level statement at a time for CodeGen. Each statement is parsed into one of
+    // NumArenas arenas, which is reset once CodeGen has lowered it, so the
+    // AST in memory is bounded by a few statements instead of the whole
+    // program. Large programs are parsed on a second thread that runs up to
+    // NumArenas statements ahead of CodeGen; small ones on the calling
+    // thread, when CodeGen asks for the next statement.
+    class StreamingFrontend : public StatementStream
+    {
+        static constexpr unsigned NumArenas = 4;
+
+        // Statements ConstFold made of one top-level statement, and the
+        // arena they are in.
+        struct Chunk
+        {
+            unsigned Arena;
+            llvm::ArrayRef<AST *> Stmts;
+        };
+
+        bool Fold;
+        ASTContext Context;
+        Lexer Lex;
+        // Diagnostics are held back until the whole program is checked:
+        // semantic errors are only reported if there is no syntax error.
+        std::string ParseDiagsBuf, SemaDiagsBuf;
+        llvm::raw_string_ostream ParseDiags, SemaDiags;
+        Parser Parse;
+        std::unique_ptr<ASTReader> Reader; // reads programs given as a binary AST
+        Sema Semantic;
+        ConstFold Folder;
+        bool SemaError = false;
+        uint64_t ASTBytes = 0;
+        llvm::BumpPtrAllocator Arenas[NumArenas];
+
+        // The statements CodeGen is lowering.
+        Chunk Current;
+        unsigned Pos = 0;
+        bool HaveCurrent = false;
+
+        // Hand-over between the producer thread and CodeGen.
+        bool Threaded;
+        std::thread Producer;
+        std::mutex Lock;
+        std::condition_variable Changed;
+        std::deque<Chunk> Ready;
+        llvm::SmallVector<unsigned, NumArenas> FreeArenas;
+        bool Done = false;
+
+        // Runs the front end on top-level statements until one yields code,
+        // which is put into C. Returns false at the end of the program or
+        // after a syntax error. Statements after a semantic error are still
+        // checked, so that all errors are reported, but not folded.
+        bool produce(unsigned Arena, Chunk &C)
+        {
+            llvm::BumpPtrAllocator &A = Arenas[Arena];
+            Context.setArena(&A);
+            for (;;)
+            {
+                A.Reset();
+                AST *Stmt = Reader ? Reader->readStatement() : Parse.parseStatement();
+                if (Stmt)
+                    SemaError = Semantic.checkStatement(Stmt);
+                llvm::ArrayRef<AST *> Stmts;
+                if (Stmt && !SemaError)
+                    Stmts = Fold ? Folder.foldStatement(Stmt) : Context.copyArray<AST *>(Stmt);
+                ASTBytes += A.getBytesAllocated();
+                if (!Stmt)
+                    return false;
+                if (!Stmts.empty())
+                {
+                    C = {Arena, Stmts};
+                    return true;
+                }
+            }
+        }
+
+        void runProducer()
+        {
+            for (;;)
+            {
+                unsigned Arena;
+                {
+                    std::unique_lock<std::mutex> L(Lock);
+                    Changed.wait(L, [this]
+                                 { return !FreeArenas.empty(); });
+                    Arena = FreeArenas.pop_back_val();
+                }
+                Chunk C;
+                bool More = produce(Arena, C);
+                std::lock_guard<std::mutex> L(Lock);
+                if (More)
+                    Ready.push_back(C);
+                else
+                    Done = true;
+                Changed.notify_all();
+                if (!More)
+                    return;
+            }
+        }
+
+        // Releases the current chunk and gets the next one.
+        bool nextChunk()
+        {
+            if (!Threaded)
+                return produce(0, Current);
+            std::unique_lock<std::mutex> L(Lock);
+            if (HaveCurrent)
+            {
+                FreeArenas.push_back(Current.Arena);
+                Changed.notify_all();
+            }
+            Changed.wait(L, [this]
+                         { return !Ready.empty() || Done; });
+            if (Ready.empty())
+                return false;
+            Current = Ready.front();
+            Ready.pop_front();
+            return true;
+        }
+
+    public:
+        StreamingFrontend(llvm::StringRef Source, bool Fold, bool Threaded)
+            : Fold(Fold), Lex(isBinaryAST(Source) ? llvm::StringRef("") : Source, Context.getSymbols()),
+              ParseDiags(ParseDiagsBuf), SemaDiags(SemaDiagsBuf), Parse(Lex, Context, ParseDiags),
+              Semantic(Context.getSymbols(), SemaDiags), Folder(Context), Threaded(Threaded)
+        {
+            if (isBinaryAST(Source))
+                Reader = std::make_unique<ASTReader>(Source, Context, ParseDiags);
+            if (!Threaded)
+                return;
+            for (unsigned I = 0; I != NumArenas; ++I)
+                FreeArenas.push_back(I);
+            Producer = std::thread([this]
+                                   { runProducer(); });
+        }
+
+        ~StreamingFrontend() { finish(); }
+
+        AST *next() override
+        {
+            while (!HaveCurrent || Pos == Current.Stmts.size())
+            {
+                HaveCurrent = nextChunk();
+                Pos = 0;
+                if (!HaveCurrent)
+                    return nullptr;
+            }
+            return Current.Stmts[Pos++];
+        }
+
+        bool hasError() override { return Parse.hasError() || (Reader && Reader->hasError()) || SemaError; }
+
+        // Runs the front end to the end of the program, for when CodeGen
+        // stopped before it, and waits for the producer thread.
+        void finish()
+        {
+            while (next())
+                ;
+            if (Producer.joinable())
+                Producer.join();
+        }
+
+        // Writes the diagnostics of the front end after finish(). Returns
+        // true if the program had an error.
+        bool reportErrors(llvm::raw_ostream &Diags)
+        {
+            if (Reader && Reader->hasError())
+            {
+                Diags << ParseDiags.str();
+                return true;
+            }
+            if (Parse.hasError())
+            {
+                Diags << ParseDiags.str() << "Syntax errors occurred\n";
+                return true;
+            }
+            if (SemaError)
+            {
+                Diags << SemaDiags.str() << "Semantic errors occurred\n";
+                return true;
+            }
+            return false;
+        }
+
+        void getStats(CompilerStats &S)
+        {
+            if (!Reader)
+            {
+                S.Tokens = Lex.getNumTokens();
+                S.LookaheadTokens = Parse.getNumLookahead();
+            }
+            S.ASTNodes = Context.getNumNodes();
+            S.ASTBytes = ASTBytes;
+        }
+    };
+} // namespace
+
+// Programs at least this large are parsed on a thread of their own while
+// CodeGen lowers them.
+static const size_t ThreadedStreamSize = 1 << 20;
+
+// Streams the program through the front end into CodeGen, one top-level
+// statement at a time.
+static bool compileStreaming(llvm::StringRef Source, const CodeGenOptions &Opts, bool Fold,
+                             llvm::raw_ostream &Diags, CompilerStats &S, int &ExitCode,
+                             const CompileEnv &Env)
+{
+    StreamingFrontend Frontend(Source, Fold, Source.size() >= ThreadedStreamSize);
+
+    // Errors of the program are reported instead of target or JIT errors,
+    // as when the front end has finished before CodeGen starts.
+    std::string CodeGenDiagsBuf;
+    llvm::raw_string_ostream CodeGenDiags(CodeGenDiagsBuf);
+    CodeGen CodeGenerator(Opts, CodeGenDiags, Env.Reuse);
+    bool CodeGenError = CodeGenerator.compile(Frontend);
+    Frontend.finish();
+    Frontend.getStats(S);
+    if (Frontend.reportErrors(Diags))
+        return true;
+    Diags << CodeGenDiags.str();
+
+    S.IRInstructions = CodeGenerator.getNumInstructions();
+    S.OptimizedIRInstructions = CodeGenerator.getNumOptimizedInstructions();
+    ExitCode = CodeGenerator.getExitCode();
+    if (Env.Program)
+        *Env.Program = CodeGenerator.takeProgram();
+    return CodeGenError;
+}
+
+// Parses and checks the whole program, or reads it if it is a binary AST.
+// Returns null after reporting an error.
+static Program *parseProgram(llvm::StringRef Source, ASTContext &Context, llvm::raw_ostream &Diags,
+                             CompilerStats &S, const PhaseTimers &T)
+{
+    Program *Tree;
+    if (isBinaryAST(Source))
+    {
+        llvm::TimeRegion Region(T.Parse);
+        Tree = ASTReader(Source, Context, Diags).readProgram();
+        if (!Tree)
+            return nullptr;
+    }
+    else
+    {
+        // Create a lexer object and initialize it with the input expression.
+        // Identifiers are interned into the context's symbol table.
+        Lexer Lex(Source, Context.getSymbols());
+
+        // Create a parser object and initialize it with the lexer.
+        Parser Parser(Lex, Context, Diags);
+
+        // Parse the input expression and generate an abstract syntax tree (AST).
+        {
+            llvm::TimeRegion Region(T.Parse);
+            Tree = Parser.parse();
+        }
+        S.Tokens = Lex.getNumTokens();
+        S.LookaheadTokens = Parser.getNumLookahead();
+
+        // Check if parsing was successful or if there were any syntax errors.
+        if (!Tree || Parser.hasError())
+        {
+            Diags << "Syntax errors occurred\n";
+            return nullptr;
+        }
+    }
+
+    // Perform semantic analysis on the AST.
+    Sema Semantic(Context.getSymbols(), Diags);
+    bool SemaError;
+    {
+        llvm::TimeRegion Region(T.Sema);
+        SemaError = Semantic.semantic(Tree);
+    }
+    if (SemaError)
+    {
+        Diags << "Semantic errors occurred\n";
+        return nullptr;
+    }
+    return Tree;
+}
+
+// Runs the pipeline one phase after the other on the whole program, which
+// -time-passes needs to time each phase.
+static bool compileWhole(llvm::StringRef Source, const CodeGenOptions &Opts, bool Fold,
+                         llvm::raw_ostream &Diags, CompilerStats &S, int &ExitCode,
+                         const CompileEnv &Env)
+{
+    const PhaseTimers &T = Env.Timers;
+
+    // The AST context owns every node and the symbol table, and frees them
+    // all when the program is compiled.
+    ASTContext Context;
+    Program *Tree = parseProgram(Source, Context, Diags, S, T);
+    if (!Tree)
+        return true;
+
+    // Fold constant expressions and branches before handing the AST to CodeGen.
+    if (Fold)
+    {
+        llvm::TimeRegion Region(T.Fold);
+        Tree = ConstFold(Context).fold(Tree);
+    }
+    S.ASTNodes = Context.getNumNodes();
+    S.ASTBytes = Context.getBytesAllocated();
+
+    // Generate code for the AST using a code generator.
+    CodeGen CodeGenerator(Opts, Diags, Env.Reuse);
+    bool CodeGenError;
+    {
+        llvm::TimeRegion Region(T.CodeGen);
+        CodeGenError = CodeGenerator.compile(Tree);
+    }
+    S.IRInstructions = CodeGenerator.getNumInstructions();
+    S.OptimizedIRInstructions = CodeGenerator.getNumOptimizedInstructions();
+    ExitCode = CodeGenerator.getExitCode();
+    if (Env.Program)
+        *Env.Program = CodeGenerator.takeProgram();
+    return CodeGenError;
+}
+
+// Writes the checked program as a binary AST. It is not folded, so that it
+// can still be compiled with and without --const-fold.
+static bool emitAST(llvm::StringRef Source, const CodeGenOptions &Opts, llvm::raw_ostream &Diags,
+                    CompilerStats &S, const CompileEnv &Env)
+{
+    ASTContext Context;
+    Program *Tree = parseProgram(Source, Context, Diags, S, Env.Timers);
+    if (!Tree)
+        return true;
+    S.ASTNodes = Context.getNumNodes();
+    S.ASTBytes = Context.getBytesAllocated();
+
+    std::error_code EC;
+    llvm::ToolOutputFile Out(Opts.OutputFile, EC, llvm::sys::fs::OF_None);
+    if (EC)
+    {
+        Diags << "Cannot open " << Opts.OutputFile << ": " << EC.message() << "\n";
+        return true;
+    }
+    writeBinaryAST(Tree, Context.getSymbols(), Out.os());
+    Out.keep();
+    return false;
+}
+
+// Runs the whole pipeline on one program without looking at the cache.
+static bool compileUncached(llvm::StringRef Source, const CodeGenOptions &Opts, bool Fold,
+                            llvm::raw_ostream &Diags, CompilerStats &S, int &ExitCode,
+                            const CompileEnv &Env)
+{
+    // Tokens locate their text with 32-bit offsets.
+    if (Source.size() >= UINT32_MAX)
+    {
+        Diags << "Input is larger than 4 GiB\n";
+        return true;
+    }
+    if (Opts.Emit == EmitKind::AST)
+        return emitAST(Source, Opts, Diags, S, Env);
+    const PhaseTimers &T = Env.Timers;
+    // Loops that tier up are compiled from their AST while the program runs.
+    if (T.Parse || T.Sema || T.Fold || T.CodeGen || (Opts.Interpret && Opts.TierUp))
+        return compileWhole(Source, Opts, Fold, Diags, S, ExitCode, Env);
+    return compileStreaming(Source, Opts, Fold, Diags, S, ExitCode, Env);
+}
+
+// On a cache miss the output is emitted into the cache and copied from there.
+bool compileSource(llvm::StringRef Source, const CodeGenOptions &Opts, bool Fold,
+                   llvm::raw_ostream &Diags, CompilerStats &S, int &ExitCode,
+                   const CompileEnv &Env)
+{
+    CompileCache *Cache = Env.Cache;
+    if (!Cache || !CompileCache::isCacheable(Opts))
+        return compileUncached(Source, Opts, Fold, Diags, S, ExitCode, Env);
+
+    std::string Key = Cache->getKey(Source, Opts, Fold);
+    if (Cache->lookup(Key, Opts.OutputFile))
+        return false;
+
+    std::string TempFile = Cache->createTempFile(Diags);
+    if (TempFile.empty())
+        return compileUncached(Source, Opts, Fold, Diags, S, ExitCode, Env);
+
+    CodeGenOptions CacheOpts = Opts;
+    CacheOpts.OutputFile = TempFile;
+    if (compileUncached(Source, CacheOpts, Fold, Diags, S, ExitCode, Env))
+    {
+        llvm::sys::fs::remove(TempFile);
+        return true;
+    }
+    return Cache->insert(Key, TempFile, Opts.OutputFile, Diags);
+}
+
@@ -0,0 +1,68 @@
+#ifndef DRIVER_H
+#define DRIVER_H
+
+#include "CodeGen.h"
+#include "CompileCache.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Timer.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstdint>
+#include <memory>
+
+// Counters reported with -stats and --stats-file.
+struct CompilerStats
+{
+    uint64_t Tokens = 0;
+    uint64_t LookaheadTokens = 0;
+    uint64_t ASTNodes = 0;
+    uint64_t ASTBytes = 0;
+    uint64_t IRInstructions = 0;
+    uint64_t OptimizedIRInstructions = 0;
+    uint64_t PeakRSSKB = 0;
+    uint64_t CacheHits = 0;
+    uint64_t CacheMisses = 0;
+
+    void add(const CompilerStats &S)
+    {
+        Tokens += S.Tokens;
+        LookaheadTokens += S.LookaheadTokens;
+        ASTNodes += S.ASTNodes;
+        ASTBytes += S.ASTBytes;
+        IRInstructions += S.IRInstructions;
+        OptimizedIRInstructions += S.OptimizedIRInstructions;
+    }
+};
+
+// Timers of the compiler phases; phases without a timer are not timed.
+struct PhaseTimers
+{
+    llvm::Timer *Parse = nullptr;
+    llvm::Timer *Sema = nullptr;
+    llvm::Timer *Fold = nullptr;
+    llvm::Timer *CodeGen = nullptr;
+};
+
+// Optional services used by compileSource.
+struct CompileEnv
+{
+    PhaseTimers Timers;
+    CompileCache *Cache = nullptr;   // reuse outputs of unchanged programs
+    CodeGenContext *Reuse = nullptr; // target machines and JIT kept by the caller
+    std::unique_ptr<JITProgram> *Program = nullptr; // receives the program with Opts.Load
+};
+
+// Runs the whole pipeline on one program: lexing, parsing, Sema, ConstFold
+// (if Fold is set) and CodeGen. A Source that is a binary AST is read
+// instead of lexed and parsed, and EmitKind::AST writes one after Sema.
+// Unless phases are timed, the program goes through it one top-level
+// statement at a time, so only the AST of a few statements is held at once.
+// Every object it creates is local to the call, so several programs can be
+// compiled on different threads as long as they do not share a
+// CodeGenContext. Diagnostics are written to Diags and the counters to S.
+// Returns true if an error occurred; ExitCode is the program's exit code
+// when it was run.
+bool compileSource(llvm::StringRef Source, const CodeGenOptions &Opts, bool Fold,
+                   llvm::raw_ostream &Diags, CompilerStats &S, int &ExitCode,
+                   const CompileEnv &Env = CompileEnv());
+
+#endif
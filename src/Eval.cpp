@@ -0,0 +1,297 @@
+#include "Eval.h"
+#include "ConstFold.h"
+#include "llvm/ADT/StringExtras.h"
+#include <string>
+#include <vector>
+
+namespace ev
+{
+// Interprets statements as CodeGen lowers them: ints wrap on i32, bools are
+// 0 or 1, and and/or short-circuit. Expressions return their value; once
+// Stopped is set, everything returns 0 and the result must not be used.
+class Interpreter : public ASTVisitor<Interpreter, int32_t>
+{
+  uint64_t Fuel;
+  uint64_t Steps = 0;
+  std::string Output;
+  // Per-variable state, indexed by symbol ID.
+  std::vector<int32_t> Values;
+  std::vector<bool> HasValue; // false until the variable was stored to
+  std::vector<bool> IsBool;
+  bool Stopped = false;
+
+  int32_t stop()
+  {
+    Stopped = true;
+    return 0;
+  }
+
+  bool step()
+  {
+    if (Steps == Fuel)
+    {
+      Stopped = true;
+      return false;
+    }
+    ++Steps;
+    return true;
+  }
+
+  void store(unsigned Symbol, int32_t V)
+  {
+    if (Symbol >= Values.size())
+    {
+      Values.resize(Symbol + 1);
+      HasValue.resize(Symbol + 1);
+      IsBool.resize(Symbol + 1);
+    }
+    Values[Symbol] = V;
+    HasValue[Symbol] = true;
+  }
+
+  int32_t load(unsigned Symbol)
+  {
+    if (Symbol >= Values.size() || !HasValue[Symbol])
+      return stop();
+    return Values[Symbol];
+  }
+
+  bool test(Logic *Cond) { return step() && visit(Cond) && !Stopped; }
+
+  void runBody(llvm::ArrayRef<AST *> Stmts)
+  {
+    for (AST *S : Stmts)
+    {
+      if (Stopped || !step())
+        return;
+      visit(S);
+    }
+  }
+
+public:
+  Interpreter(uint64_t Fuel) : Fuel(Fuel) {}
+
+  bool hasStopped() const { return Stopped; }
+
+  llvm::StringRef getOutput() const { return Output; }
+
+  uint64_t getSteps() const { return Steps; }
+
+  // Runs top-level statement Stmt; false if the program cannot be evaluated.
+  bool run(AST *Stmt)
+  {
+    runBody(Stmt);
+    return !Stopped;
+  }
+
+  int32_t visitProgram(Program &Node)
+  {
+    runBody(Node.getdata());
+    return 0;
+  }
+
+  // Initializers are all evaluated before the variables are stored, as in
+  // CodeGen.
+  template <typename DeclT, typename ValT> void declare(DeclT &Node, bool Bool)
+  {
+    llvm::ArrayRef<ValT *> Inits = Node.getValues();
+    llvm::ArrayRef<unsigned> Symbols = Node.getSymbols();
+    std::vector<int32_t> Vals(Symbols.size());
+    for (unsigned I = 0, N = Symbols.size(); I != N && I != Inits.size(); ++I)
+      if (Inits[I])
+        Vals[I] = visit(Inits[I]);
+    if (Stopped)
+      return;
+    for (unsigned I = 0, N = Symbols.size(); I != N; ++I)
+    {
+      store(Symbols[I], Vals[I]);
+      IsBool[Symbols[I]] = Bool;
+    }
+  }
+
+  int32_t visitDeclarationInt(DeclarationInt &Node)
+  {
+    declare<DeclarationInt, Expr>(Node, false);
+    return 0;
+  }
+
+  int32_t visitDeclarationBool(DeclarationBool &Node)
+  {
+    declare<DeclarationBool, Logic>(Node, true);
+    return 0;
+  }
+
+  int32_t visitAssignment(Assignment &Node)
+  {
+    unsigned Symbol = Node.getLeft()->getSymbol();
+    // As in CodeGen, a compound assignment reads its variable before the
+    // right side, which may change it.
+    int32_t Left = 0;
+    if (Node.getAssignKind() != Assignment::Assign)
+      Left = load(Symbol);
+    if (Stopped)
+      return 0;
+    int32_t Right = Node.getRightExpr() ? visit(Node.getRightExpr()) : visit(Node.getRightLogic());
+    if (Stopped)
+      return 0;
+
+    BinaryOp::Operator Op;
+    switch (Node.getAssignKind())
+    {
+    case Assignment::Plus_assign:
+      Op = BinaryOp::Plus;
+      break;
+    case Assignment::Minus_assign:
+      Op = BinaryOp::Minus;
+      break;
+    case Assignment::Star_assign:
+      Op = BinaryOp::Mul;
+      break;
+    case Assignment::Slash_assign:
+      Op = BinaryOp::Div;
+      break;
+    default:
+      store(Symbol, Right);
+      return 0;
+    }
+    int32_t Res;
+    if (!cf::evalBinary(Op, Left, Right, Res))
+      return stop();
+    store(Symbol, Res);
+    return 0;
+  }
+
+  int32_t visitPrintStmt(PrintStmt &Node)
+  {
+    int32_t V = load(Node.getSymbol());
+    if (Stopped)
+      return 0;
+    if (IsBool[Node.getSymbol()])
+      Output += V ? "true\n" : "false\n";
+    else
+    {
+      Output += llvm::itostr(V);
+      Output += '\n';
+    }
+    if (Output.size() > Evaluator::MaxOutput)
+      return stop();
+    return 0;
+  }
+
+  int32_t visitIfStmt(IfStmt &Node)
+  {
+    if (test(Node.getCond()))
+    {
+      runBody(Node.getBody());
+      return 0;
+    }
+    for (elifStmt *Elif : Node.getElifs())
+      if (Stopped || test(Elif->getCond()))
+      {
+        runBody(Elif->getBody());
+        return 0;
+      }
+    runBody(Node.getElse());
+    return 0;
+  }
+
+  int32_t visitWhileStmt(WhileStmt &Node)
+  {
+    while (test(Node.getCond()))
+      runBody(Node.getBody());
+    return 0;
+  }
+
+  int32_t visitForStmt(ForStmt &Node)
+  {
+    visit(Node.getFirst());
+    while (!Stopped && test(Node.getSecond()))
+    {
+      runBody(Node.getBody());
+      if (Stopped)
+        break;
+      if (Node.getThirdAssign())
+        visit(Node.getThirdAssign());
+      else
+        visit(Node.getThirdUnary());
+    }
+    return 0;
+  }
+
+  int32_t visitFinal(Final &Node)
+  {
+    if (Node.getValueKind() == Final::Ident)
+      return load(Node.getSymbol());
+    return Node.getVal();
+  }
+
+  int32_t visitBinaryOp(BinaryOp &Node)
+  {
+    int32_t Left = visit(Node.getLeft());
+    int32_t Right = visit(Node.getRight());
+    int32_t Res;
+    if (Stopped || !cf::evalBinary(Node.getOperator(), Left, Right, Res))
+      return stop();
+    return Res;
+  }
+
+  int32_t visitUnaryOp(UnaryOp &Node)
+  {
+    int32_t V = load(Node.getSymbol());
+    if (Stopped)
+      return 0;
+    V = (int32_t)((uint32_t)V + (Node.getOperator() == UnaryOp::Plus_plus ? 1u : -1u));
+    store(Node.getSymbol(), V);
+    return V;
+  }
+
+  int32_t visitSignedNumber(SignedNumber &Node)
+  {
+    int32_t V = Node.getValue();
+    return Node.getSign() == SignedNumber::Minus ? (int32_t)(0u - (uint32_t)V) : V;
+  }
+
+  int32_t visitNegExpr(NegExpr &Node) { return (int32_t)(0u - (uint32_t)visit(Node.getExpr())); }
+
+  int32_t visitComparison(Comparison &Node)
+  {
+    if (Node.getRight() == nullptr)
+    {
+      switch (Node.getOperator())
+      {
+      case Comparison::True:
+        return 1;
+      case Comparison::False:
+        return 0;
+      case Comparison::Ident:
+        return load(llvm::cast<Final>(Node.getLeft())->getSymbol());
+      default:
+        return stop();
+      }
+    }
+    int32_t Left = visit(Node.getLeft());
+    int32_t Right = visit(Node.getRight());
+    return cf::evalCompare(Node.getOperator(), Left, Right);
+  }
+
+  int32_t visitLogicalExpr(LogicalExpr &Node)
+  {
+    int32_t Left = visit(Node.getLeft());
+    if (Node.getRight() == nullptr)
+      return Left;
+    if (Left != (Node.getOperator() == LogicalExpr::And))
+      return Left;
+    return visit(Node.getRight());
+  }
+};
+} // namespace ev
+
+Evaluator::Evaluator(uint64_t Fuel) : Interp(std::make_unique<ev::Interpreter>(Fuel)) {}
+
+Evaluator::~Evaluator() = default;
+
+bool Evaluator::run(AST *Stmt) { return !Interp->hasStopped() && Interp->run(Stmt); }
+
+llvm::StringRef Evaluator::getOutput() const { return Interp->getOutput(); }
+
+uint64_t Evaluator::getSteps() const { return Interp->getSteps(); }
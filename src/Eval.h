@@ -0,0 +1,43 @@
+#ifndef EVAL_H
+#define EVAL_H
+
+#include "AST.h"
+#include "llvm/ADT/StringRef.h"
+#include <cstdint>
+#include <memory>
+
+namespace ev
+{
+  class Interpreter;
+}
+
+// Evaluator runs a program at compile time. Programs read no input, so one
+// that finishes within a budget of steps always prints the same output, and
+// CodeGen can emit that output instead of the program. Statements are given
+// one at a time, as CodeGen lowers them; evaluation gives up for good on a
+// statement that runs out of steps, prints more than MaxOutput bytes, reads
+// a variable that holds no value, or divides by zero.
+class Evaluator
+{
+  std::unique_ptr<ev::Interpreter> Interp;
+
+public:
+  static constexpr size_t MaxOutput = 1 << 20; // larger outputs are left to the program
+
+  // Fuel is the number of steps the program may take: one per statement
+  // executed and per if, elif, while or for condition tested.
+  Evaluator(uint64_t Fuel);
+  ~Evaluator();
+
+  // Runs the next top-level statement. Returns false if the program cannot
+  // be evaluated, which is then also returned for every later statement.
+  bool run(AST *Stmt);
+
+  // What the statements run so far printed.
+  llvm::StringRef getOutput() const;
+
+  // Steps taken so far.
+  uint64_t getSteps() const;
+};
+
+#endif
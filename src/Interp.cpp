@@ -0,0 +1,799 @@
+#include "Interp.h"
+#include "CodeGen.h"
+#include "ConstFold.h"
+#include "SymbolCollector.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include <vector>
+
+// The runtime prints for the bytecode as well, so output stays in order
+// when a loop moves over to compiled code.
+extern "C" void print_int(int v);
+extern "C" void print_bool(int v);
+extern "C" void rt_flush(void);
+extern "C" int rt_try(void (*fn)(void *), void *arg);
+
+// Dispatch with computed goto where the compiler supports it, with a
+// switch elsewhere.
+#if defined(__GNUC__)
+#define BC_THREADED 1
+#endif
+
+namespace bc
+{
+// Opcodes, with a mask of which of the operands A, B and C are registers
+// (1, 2 and 4); the others are jump targets, immediates or loop indices.
+//   Mov A = B                 Add..Exp A = B op C      AddK A = B + imm C
+//   Neg A = -B                Eq..Ge A = B cmp C       Jmp to A
+//   Jz/Jnz to B if A == 0/!= 0                         JEq..JGe to C if A cmp B
+//   PrintI/PrintB A           LoopHead loop A, exit B  Halt
+#define BC_OPCODES(X)                                                                            \
+  X(Mov, 3) X(Add, 7) X(Sub, 7) X(Mul, 7) X(Div, 7) X(Mod, 7) X(Exp, 7) X(AddK, 3) X(Neg, 3)   \
+  X(Eq, 7) X(Ne, 7) X(Lt, 7) X(Gt, 7) X(Le, 7) X(Ge, 7) X(Jmp, 0) X(Jz, 1) X(Jnz, 1)           \
+  X(JEq, 3) X(JNe, 3) X(JLt, 3) X(JGt, 3) X(JLe, 3) X(JGe, 3) X(PrintI, 1) X(PrintB, 1)        \
+  X(LoopHead, 0) X(Halt, 0)
+
+enum Opcode : uint32_t
+{
+#define BC_ENUM(Name, Regs) Name,
+  BC_OPCODES(BC_ENUM)
+#undef BC_ENUM
+};
+
+static const uint8_t RegOperands[] = {
+#define BC_REGS(Name, Regs) Regs,
+    BC_OPCODES(BC_REGS)
+#undef BC_REGS
+};
+
+// Registers are indexes into the frame: variables at their symbol ID,
+// temporaries and constants below 0.
+struct Inst
+{
+  union
+  {
+    Opcode Op;
+    const void *Handler; // replaces Op once the code is threaded
+  };
+  int32_t A, B, C;
+};
+
+struct LoopInfo
+{
+  AST *Loop;
+  uint64_t Iterations = 0;
+  CodeGen::LoopFunction Native = nullptr;
+  bool Failed = false; // the loop could not be compiled
+};
+
+struct Chunk
+{
+  std::vector<Inst> Code;
+  std::vector<int32_t> Consts;  // values of the constant registers
+  std::vector<LoopInfo> Loops;  // loops that may tier up
+  unsigned NumTemps = 0;
+  unsigned NumVars = 0;         // one past the highest symbol ID used
+
+  // Register of the K-th constant, below the temporaries.
+  int32_t getConstReg(unsigned K) const { return -(int32_t)(NumTemps + 1 + K); }
+};
+
+enum VarKind : uint8_t
+{
+  Unknown,
+  IntVar,
+  BoolVar
+};
+
+// True if evaluating the subtree writes a variable (++ or --).
+class SideEffects : public ASTVisitor<SideEffects, bool>
+{
+public:
+  bool visitUnaryOp(UnaryOp &) { return true; }
+  bool visitBinaryOp(BinaryOp &Node) { return visit(Node.getLeft()) || visit(Node.getRight()); }
+  bool visitNegExpr(NegExpr &Node) { return visit(Node.getExpr()); }
+  bool visitComparison(Comparison &Node)
+  {
+    return Node.getRight() && (visit(Node.getLeft()) || visit(Node.getRight()));
+  }
+  bool visitLogicalExpr(LogicalExpr &Node)
+  {
+    return visit(Node.getLeft()) || (Node.getRight() && visit(Node.getRight()));
+  }
+};
+
+// Lowers statements to bytecode. Expressions return the register holding
+// their value. A visitor that writes its result with a single instruction
+// may write it straight to the register in Dst, which it takes before
+// visiting its operands.
+class Lowerer : public ASTVisitor<Lowerer, int32_t>
+{
+  static constexpr int32_t NoReg = INT32_MAX;
+  // Constants are numbered from here until the temporaries are counted.
+  static constexpr int32_t ConstFlag = 1 << 30;
+
+  Chunk &C;
+  std::vector<uint8_t> &Kinds; // kind of each variable, by symbol ID
+  bool TierUp;
+  unsigned CurTemps = 0;
+  int32_t Dst = NoReg;
+  llvm::DenseMap<int64_t, unsigned> ConstIndex; // int64_t keys, as DenseMap reserves two int32_t ones
+
+  size_t emit(Opcode Op, int32_t A = 0, int32_t B = 0, int32_t Cop = 0)
+  {
+    Inst I;
+    I.Op = Op;
+    I.A = A;
+    I.B = B;
+    I.C = Cop;
+    C.Code.push_back(I);
+    return C.Code.size() - 1;
+  }
+
+  int32_t here() const { return C.Code.size(); }
+
+  void patch(size_t At, int32_t Target)
+  {
+    Inst &I = C.Code[At];
+    if (I.Op == Jmp)
+      I.A = Target;
+    else if (I.Op == Jz || I.Op == Jnz || I.Op == LoopHead)
+      I.B = Target;
+    else
+      I.C = Target;
+  }
+
+  void patch(llvm::ArrayRef<size_t> Jumps, int32_t Target)
+  {
+    for (size_t At : Jumps)
+      patch(At, Target);
+  }
+
+  int32_t var(unsigned Symbol)
+  {
+    C.NumVars = std::max(C.NumVars, Symbol + 1);
+    return Symbol;
+  }
+
+  static bool isVar(int32_t Reg) { return Reg >= 0 && Reg < ConstFlag; }
+
+  void declare(unsigned Symbol, VarKind Kind)
+  {
+    if (Symbol >= Kinds.size())
+      Kinds.resize(Symbol + 1);
+    Kinds[Symbol] = Kind;
+  }
+
+  int32_t constant(int32_t V)
+  {
+    std::pair<llvm::DenseMap<int64_t, unsigned>::iterator, bool> R = ConstIndex.try_emplace(V, C.Consts.size());
+    if (R.second)
+      C.Consts.push_back(V);
+    return ConstFlag + R.first->second;
+  }
+
+  int32_t temp()
+  {
+    C.NumTemps = std::max(C.NumTemps, ++CurTemps);
+    return -(int32_t)CurTemps;
+  }
+
+  int32_t takeDst()
+  {
+    int32_t D = Dst;
+    Dst = NoReg;
+    return D;
+  }
+
+  // The register an instruction writes its result to.
+  int32_t result(int32_t D) { return D != NoReg ? D : temp(); }
+
+  // Lowers an expression or condition, with its value in D if given.
+  int32_t value(AST *E, int32_t D = NoReg)
+  {
+    Dst = D;
+    int32_t R = visit(E);
+    Dst = NoReg;
+    if (D == NoReg || R == D)
+      return R;
+    emit(Mov, D, R);
+    return D;
+  }
+
+  // Lowers the left operand of an instruction. A variable is read when the
+  // instruction runs, so it is copied first when the right operand, which
+  // is evaluated in between, may write it.
+  int32_t leftOperand(AST *Left, AST *Right)
+  {
+    int32_t R = value(Left);
+    if (isVar(R) && SideEffects().visit(Right))
+    {
+      int32_t T = temp();
+      emit(Mov, T, R);
+      return T;
+    }
+    return R;
+  }
+
+  static Opcode getCompare(Comparison::Operator Op, bool Jump)
+  {
+    switch (Op)
+    {
+    case Comparison::Equal:
+      return Jump ? JEq : Eq;
+    case Comparison::Not_equal:
+      return Jump ? JNe : Ne;
+    case Comparison::Greater:
+      return Jump ? JGt : Gt;
+    case Comparison::Less:
+      return Jump ? JLt : Lt;
+    case Comparison::Greater_equal:
+      return Jump ? JGe : Ge;
+    default:
+      return Jump ? JLe : Le;
+    }
+  }
+
+  static Comparison::Operator getInverse(Comparison::Operator Op)
+  {
+    switch (Op)
+    {
+    case Comparison::Equal:
+      return Comparison::Not_equal;
+    case Comparison::Not_equal:
+      return Comparison::Equal;
+    case Comparison::Greater:
+      return Comparison::Less_equal;
+    case Comparison::Less:
+      return Comparison::Greater_equal;
+    case Comparison::Greater_equal:
+      return Comparison::Less;
+    default:
+      return Comparison::Greater;
+    }
+  }
+
+  // Lowers a condition into jumps taken when it is JumpIf, added to Jumps;
+  // otherwise control falls through.
+  void branch(Logic *Cond, bool JumpIf, llvm::SmallVectorImpl<size_t> &Jumps)
+  {
+    if (Comparison *Cmp = llvm::dyn_cast<Comparison>(Cond))
+    {
+      switch (Cmp->getOperator())
+      {
+      case Comparison::True:
+      case Comparison::False:
+        if ((Cmp->getOperator() == Comparison::True) == JumpIf)
+          Jumps.push_back(emit(Jmp));
+        return;
+      case Comparison::Ident:
+        Jumps.push_back(emit(JumpIf ? Jnz : Jz, var(llvm::cast<Final>(Cmp->getLeft())->getSymbol())));
+        return;
+      default:
+        break;
+      }
+      unsigned Saved = CurTemps;
+      int32_t L = leftOperand(Cmp->getLeft(), Cmp->getRight());
+      int32_t R = value(Cmp->getRight());
+      CurTemps = Saved;
+      Jumps.push_back(emit(getCompare(JumpIf ? Cmp->getOperator() : getInverse(Cmp->getOperator()), true), L, R));
+      return;
+    }
+
+    LogicalExpr *Log = llvm::cast<LogicalExpr>(Cond);
+    if (!Log->getRight())
+      return branch(Log->getLeft(), JumpIf, Jumps);
+    // X and Y jumps on false if either does; on true only if both are
+    // true. or is the same with true and false swapped.
+    bool IsAnd = Log->getOperator() == LogicalExpr::And;
+    if (JumpIf != IsAnd)
+    {
+      branch(Log->getLeft(), JumpIf, Jumps);
+      branch(Log->getRight(), JumpIf, Jumps);
+      return;
+    }
+    llvm::SmallVector<size_t, 4> Skip;
+    branch(Log->getLeft(), !JumpIf, Skip);
+    branch(Log->getRight(), JumpIf, Jumps);
+    patch(Skip, here());
+  }
+
+  void body(llvm::ArrayRef<AST *> Stmts)
+  {
+    for (AST *S : Stmts)
+      statement(S);
+  }
+
+  // Lowers a loop tested at the bottom: one jump per iteration.
+  void loop(AST *Node, Logic *Cond, llvm::ArrayRef<AST *> Body, AST *Step)
+  {
+    size_t Enter = emit(Jmp);
+    int32_t Start = here();
+    body(Body);
+    if (Step)
+      statement(Step);
+    patch(Enter, here());
+    size_t Head = 0;
+    if (TierUp)
+    {
+      Head = emit(LoopHead, C.Loops.size());
+      C.Loops.push_back(LoopInfo{Node});
+    }
+    llvm::SmallVector<size_t, 4> Back;
+    branch(Cond, true, Back);
+    patch(Back, Start);
+    if (TierUp)
+      patch(Head, here());
+  }
+
+public:
+  Lowerer(Chunk &C, std::vector<uint8_t> &Kinds, bool TierUp) : C(C), Kinds(Kinds), TierUp(TierUp) {}
+
+  void statement(AST *S)
+  {
+    CurTemps = 0;
+    if (UnaryOp *U = llvm::dyn_cast<UnaryOp>(S))
+    {
+      int32_t V = var(U->getSymbol());
+      emit(AddK, V, V, U->getOperator() == UnaryOp::Plus_plus ? 1 : -1);
+      return;
+    }
+    visit(S);
+  }
+
+  // Ends the code and gives the constants their registers.
+  void finish()
+  {
+    emit(Halt);
+    for (Inst &I : C.Code)
+      for (int32_t *Op : {&I.A, &I.B, &I.C})
+        if ((RegOperands[I.Op] & (1 << (Op - &I.A))) && *Op >= ConstFlag && *Op != NoReg)
+          *Op = C.getConstReg(*Op - ConstFlag);
+  }
+
+  int32_t visitProgram(Program &Node)
+  {
+    body(Node.getdata());
+    return 0;
+  }
+
+  // Initializers are all evaluated before the variables are stored, as in
+  // CodeGen; a single one is evaluated into its variable.
+  template <typename DeclT> void declaration(DeclT &Node, VarKind Kind)
+  {
+    llvm::ArrayRef<unsigned> Symbols = Node.getSymbols();
+    auto Inits = Node.getValues();
+    auto getInit = [&](unsigned I) -> AST * { return I < Inits.size() ? Inits[I] : nullptr; };
+    if (Symbols.size() == 1)
+    {
+      int32_t V = var(Symbols[0]);
+      if (AST *Init = getInit(0))
+        value(Init, V);
+      else
+        emit(Mov, V, constant(0));
+      declare(Symbols[0], Kind);
+      return;
+    }
+    llvm::SmallVector<int32_t, 8> Vals;
+    for (unsigned I = 0, N = Symbols.size(); I != N; ++I)
+    {
+      AST *Init = getInit(I);
+      int32_t R = Init ? value(Init) : constant(0);
+      if (!(R >= ConstFlag))
+      {
+        int32_t T = temp();
+        emit(Mov, T, R);
+        R = T;
+      }
+      Vals.push_back(R);
+    }
+    for (unsigned I = 0, N = Symbols.size(); I != N; ++I)
+    {
+      emit(Mov, var(Symbols[I]), Vals[I]);
+      declare(Symbols[I], Kind);
+    }
+  }
+
+  int32_t visitDeclarationInt(DeclarationInt &Node)
+  {
+    declaration(Node, IntVar);
+    return 0;
+  }
+
+  int32_t visitDeclarationBool(DeclarationBool &Node)
+  {
+    declaration(Node, BoolVar);
+    return 0;
+  }
+
+  int32_t visitAssignment(Assignment &Node)
+  {
+    int32_t V = var(Node.getLeft()->getSymbol());
+    AST *Right = Node.getRightExpr() ? (AST *)Node.getRightExpr() : Node.getRightLogic();
+    Opcode Op;
+    switch (Node.getAssignKind())
+    {
+    case Assignment::Plus_assign:
+      Op = Add;
+      break;
+    case Assignment::Minus_assign:
+      Op = Sub;
+      break;
+    case Assignment::Star_assign:
+      Op = Mul;
+      break;
+    case Assignment::Slash_assign:
+      Op = Div;
+      break;
+    default:
+      value(Right, V);
+      return 0;
+    }
+    // CodeGen loads the variable before it evaluates the right-hand side.
+    int32_t L = V;
+    if (SideEffects().visit(Right))
+    {
+      L = temp();
+      emit(Mov, L, V);
+    }
+    emit(Op, V, L, value(Right));
+    return 0;
+  }
+
+  int32_t visitPrintStmt(PrintStmt &Node)
+  {
+    unsigned Symbol = Node.getSymbol();
+    bool IsBool = Symbol < Kinds.size() && Kinds[Symbol] == BoolVar;
+    emit(IsBool ? PrintB : PrintI, var(Symbol));
+    return 0;
+  }
+
+  int32_t visitIfStmt(IfStmt &Node)
+  {
+    llvm::SmallVector<std::pair<Logic *, llvm::ArrayRef<AST *>>, 4> Arms;
+    Arms.push_back({Node.getCond(), Node.getBody()});
+    for (elifStmt *Elif : Node.getElifs())
+      Arms.push_back({Elif->getCond(), Elif->getBody()});
+
+    llvm::SmallVector<size_t, 4> Ends;
+    for (unsigned I = 0, N = Arms.size(); I != N; ++I)
+    {
+      llvm::SmallVector<size_t, 4> Next;
+      CurTemps = 0;
+      branch(Arms[I].first, false, Next);
+      body(Arms[I].second);
+      if (I + 1 != N || !Node.getElse().empty())
+        Ends.push_back(emit(Jmp));
+      patch(Next, here());
+    }
+    body(Node.getElse());
+    patch(Ends, here());
+    return 0;
+  }
+
+  int32_t visitWhileStmt(WhileStmt &Node)
+  {
+    loop(&Node, Node.getCond(), Node.getBody(), nullptr);
+    return 0;
+  }
+
+  int32_t visitForStmt(ForStmt &Node)
+  {
+    statement(Node.getFirst());
+    AST *Step = Node.getThirdAssign() ? (AST *)Node.getThirdAssign() : Node.getThirdUnary();
+    loop(&Node, Node.getSecond(), Node.getBody(), Step);
+    return 0;
+  }
+
+  int32_t visitFinal(Final &Node)
+  {
+    if (Node.getValueKind() == Final::Ident)
+      return var(Node.getSymbol());
+    return constant(Node.getVal());
+  }
+
+  int32_t visitSignedNumber(SignedNumber &Node)
+  {
+    int32_t V = Node.getValue();
+    return constant(Node.getSign() == SignedNumber::Minus ? (int32_t)(0u - (uint32_t)V) : V);
+  }
+
+  int32_t visitBinaryOp(BinaryOp &Node)
+  {
+    static const Opcode Ops[] = {Add, Sub, Mul, Div, Mod, Exp}; // in BinaryOp::Operator order
+    int32_t D = takeDst();
+    unsigned Saved = CurTemps;
+    int32_t L = leftOperand(Node.getLeft(), Node.getRight());
+    int32_t R = value(Node.getRight());
+    CurTemps = Saved;
+    int32_t To = result(D);
+    emit(Ops[Node.getOperator()], To, L, R);
+    return To;
+  }
+
+  int32_t visitUnaryOp(UnaryOp &Node)
+  {
+    int32_t D = takeDst();
+    int32_t V = var(Node.getSymbol());
+    emit(AddK, V, V, Node.getOperator() == UnaryOp::Plus_plus ? 1 : -1);
+    int32_t To = result(D);
+    emit(Mov, To, V);
+    return To;
+  }
+
+  int32_t visitNegExpr(NegExpr &Node)
+  {
+    int32_t D = takeDst();
+    unsigned Saved = CurTemps;
+    int32_t X = value(Node.getExpr());
+    CurTemps = Saved;
+    int32_t To = result(D);
+    emit(Neg, To, X);
+    return To;
+  }
+
+  int32_t visitComparison(Comparison &Node)
+  {
+    int32_t D = takeDst();
+    switch (Node.getOperator())
+    {
+    case Comparison::True:
+      return constant(1);
+    case Comparison::False:
+      return constant(0);
+    case Comparison::Ident:
+      return var(llvm::cast<Final>(Node.getLeft())->getSymbol());
+    default:
+      break;
+    }
+    unsigned Saved = CurTemps;
+    int32_t L = leftOperand(Node.getLeft(), Node.getRight());
+    int32_t R = value(Node.getRight());
+    CurTemps = Saved;
+    int32_t To = result(D);
+    emit(getCompare(Node.getOperator(), false), To, L, R);
+    return To;
+  }
+
+  int32_t visitLogicalExpr(LogicalExpr &Node)
+  {
+    takeDst();
+    if (!Node.getRight())
+      return value(Node.getLeft());
+    // The result is written in two places, so it goes to a temporary that
+    // the condition cannot read.
+    int32_t T = temp();
+    llvm::SmallVector<size_t, 4> False;
+    branch(&Node, false, False);
+    emit(Mov, T, constant(1));
+    size_t End = emit(Jmp);
+    patch(False, here());
+    emit(Mov, T, constant(0));
+    patch(End, here());
+    return T;
+  }
+};
+
+class Machine
+{
+  CodeGen &Tier;
+  llvm::raw_ostream &Diags;
+  uint64_t TierUp;
+  std::vector<uint8_t> Kinds;
+
+  // Compiles a hot loop; on failure the loop stays in the interpreter.
+  void compile(LoopInfo &L)
+  {
+    SymbolCollector Uses;
+    Uses.visit(L.Loop);
+    std::vector<unsigned> IntVars, BoolVars;
+    for (unsigned Symbol : Uses.Symbols)
+      (Symbol < Kinds.size() && Kinds[Symbol] == BoolVar ? BoolVars : IntVars).push_back(Symbol);
+    L.Native = Tier.compileLoop(*L.Loop, IntVars, BoolVars);
+    L.Failed = !L.Native;
+  }
+
+  bool execute(Chunk &C, int32_t *R);
+
+public:
+  Machine(CodeGen &Tier, llvm::raw_ostream &Diags, uint64_t TierUp) : Tier(Tier), Diags(Diags), TierUp(TierUp) {}
+
+  bool run(StatementStream &Stmts)
+  {
+    // The whole program is lowered before it runs, so that nothing runs
+    // when the front end finds an error further on.
+    Chunk C;
+    Lowerer Lower(C, Kinds, TierUp != 0);
+    while (AST *S = Stmts.next())
+      Lower.statement(S);
+    if (Stmts.hasError())
+      return true;
+    Lower.finish();
+
+    std::vector<int32_t> Frame(C.NumTemps + C.Consts.size() + C.NumVars);
+    int32_t *R = Frame.data() + C.NumTemps + C.Consts.size();
+    for (unsigned K = 0, N = C.Consts.size(); K != N; ++K)
+      R[C.getConstReg(K)] = C.Consts[K];
+    bool Failed = !execute(C, R);
+    rt_flush();
+    return Failed;
+  }
+};
+
+bool Machine::execute(Chunk &C, int32_t *R)
+{
+  Inst *Code = C.Code.data();
+#ifdef BC_THREADED
+  static const void *const Labels[] = {
+#define BC_LABEL(Name, Regs) &&L_##Name,
+      BC_OPCODES(BC_LABEL)
+#undef BC_LABEL
+  };
+  for (Inst &I : C.Code)
+    I.Handler = Labels[I.Op];
+#define OP(Name) L_##Name:
+#define DISPATCH() goto *IP->Handler
+#else
+#define OP(Name) case Name:
+#define DISPATCH() goto Dispatch
+#endif
+#define NEXT()                                                                                   \
+  do                                                                                             \
+  {                                                                                              \
+    ++IP;                                                                                        \
+    DISPATCH();                                                                                  \
+  } while (0)
+#define JUMP(Target)                                                                             \
+  do                                                                                             \
+  {                                                                                              \
+    IP = Code + (Target);                                                                        \
+    DISPATCH();                                                                                  \
+  } while (0)
+#define ARITH(Name, Expr)                                                                        \
+  OP(Name)                                                                                       \
+  {                                                                                              \
+    uint32_t X = R[IP->B], Y = R[IP->C];                                                         \
+    R[IP->A] = (int32_t)(Expr);                                                                  \
+    NEXT();                                                                                      \
+  }
+#define DIVIDE(Name, BinOp)                                                                      \
+  OP(Name)                                                                                       \
+  {                                                                                              \
+    int32_t Res;                                                                                 \
+    if (!cf::evalBinary(BinOp, R[IP->B], R[IP->C], Res))                                         \
+      goto DivisionError;                                                                        \
+    R[IP->A] = Res;                                                                              \
+    NEXT();                                                                                      \
+  }
+#define COMPARE(Name, JName, Cmp)                                                                \
+  OP(Name)                                                                                       \
+  {                                                                                              \
+    R[IP->A] = R[IP->B] Cmp R[IP->C];                                                            \
+    NEXT();                                                                                      \
+  }                                                                                              \
+  OP(JName)                                                                                      \
+  {                                                                                              \
+    if (R[IP->A] Cmp R[IP->B])                                                                   \
+      JUMP(IP->C);                                                                               \
+    NEXT();                                                                                      \
+  }
+
+  Inst *IP = Code;
+#ifndef BC_THREADED
+Dispatch:
+  switch (IP->Op)
+  {
+#else
+  DISPATCH();
+  {
+#endif
+    OP(Mov)
+    {
+      R[IP->A] = R[IP->B];
+      NEXT();
+    }
+    ARITH(Add, X + Y)
+    ARITH(Sub, X - Y)
+    ARITH(Mul, X * Y)
+    DIVIDE(Div, BinaryOp::Div)
+    DIVIDE(Mod, BinaryOp::Mod)
+    OP(Exp)
+    {
+      int32_t Res;
+      cf::evalBinary(BinaryOp::Exp, R[IP->B], R[IP->C], Res);
+      R[IP->A] = Res;
+      NEXT();
+    }
+    OP(AddK)
+    {
+      R[IP->A] = (int32_t)((uint32_t)R[IP->B] + (uint32_t)IP->C);
+      NEXT();
+    }
+    OP(Neg)
+    {
+      R[IP->A] = (int32_t)(0u - (uint32_t)R[IP->B]);
+      NEXT();
+    }
+    COMPARE(Eq, JEq, ==)
+    COMPARE(Ne, JNe, !=)
+    COMPARE(Lt, JLt, <)
+    COMPARE(Gt, JGt, >)
+    COMPARE(Le, JLe, <=)
+    COMPARE(Ge, JGe, >=)
+    OP(Jmp) JUMP(IP->A);
+    OP(Jz)
+    {
+      if (!R[IP->A])
+        JUMP(IP->B);
+      NEXT();
+    }
+    OP(Jnz)
+    {
+      if (R[IP->A])
+        JUMP(IP->B);
+      NEXT();
+    }
+    OP(PrintI)
+    {
+      print_int(R[IP->A]);
+      NEXT();
+    }
+    OP(PrintB)
+    {
+      print_bool(R[IP->A]);
+      NEXT();
+    }
+    OP(LoopHead)
+    {
+      LoopInfo &L = C.Loops[IP->A];
+      if (!L.Native && !L.Failed && ++L.Iterations == TierUp)
+        compile(L);
+      if (L.Native)
+      {
+        // The compiled loop runs from its condition to its end; a division
+        // error in it returns here.
+        struct NativeCall
+        {
+          CodeGen::LoopFunction Fn;
+          int32_t *R;
+        } Call = {L.Native, R};
+        int Error = rt_try([](void *Arg)
+                           {
+                             NativeCall &Call = *static_cast<NativeCall *>(Arg);
+                             Call.Fn(Call.R);
+                           },
+                           &Call);
+        if (Error)
+        {
+          Diags << (Error == 1 ? "Division by zero\n" : "Integer overflow in division\n");
+          return false;
+        }
+        JUMP(IP->B);
+      }
+      NEXT();
+    }
+    OP(Halt) return true;
+  }
+  return true;
+
+DivisionError:
+  // The interpreter stops with an error, as compiled programs do.
+  rt_flush();
+  Diags << (R[IP->C] == 0 ? "Division by zero\n" : "Integer overflow in division\n");
+  return false;
+#undef OP
+#undef DISPATCH
+#undef NEXT
+#undef JUMP
+#undef ARITH
+#undef DIVIDE
+#undef COMPARE
+}
+} // namespace bc
+
+Interp::Interp(CodeGen &Tier, llvm::raw_ostream &Diags, uint64_t TierUp)
+    : VM(std::make_unique<bc::Machine>(Tier, Diags, TierUp)) {}
+
+Interp::~Interp() = default;
+
+bool Interp::run(StatementStream &Stmts) { return VM->run(Stmts); }
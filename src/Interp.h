@@ -0,0 +1,38 @@
+#ifndef INTERP_H
+#define INTERP_H
+
+#include "AST.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstdint>
+#include <memory>
+
+class CodeGen;
+
+namespace bc
+{
+  class Machine;
+}
+
+// Interp runs a program without building an LLVM module, for short programs
+// where that would take longer than the program itself. The statements are
+// lowered to a register bytecode as they arrive, with variables in registers
+// indexed by symbol ID, and the program runs in a threaded-dispatch loop
+// once the stream has ended without an error.
+//
+// With a TierUp threshold, a loop whose condition is tested that many times
+// is compiled by CodeGen::compileLoop and finishes as native code on the
+// same registers. The loop's AST is needed then, so with TierUp the
+// statements of the stream must stay valid until run returns.
+class Interp
+{
+  std::unique_ptr<bc::Machine> VM;
+
+public:
+  Interp(CodeGen &Tier, llvm::raw_ostream &Diags, uint64_t TierUp = 0);
+  ~Interp();
+
+  // Runs the program; returns true if it could not be run to the end.
+  bool run(StatementStream &Stmts);
+};
+
+#endif
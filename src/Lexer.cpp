@@ -1,226 +1,467 @@
 #include "Lexer.h"
+#include <algorithm>
+#include "llvm/Support/MathExtras.h"
 #include "llvm/Support/raw_ostream.h"
 
+#if defined(__SSE2__) || defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
 // classifying characters
 namespace charinfo
 {
+    enum CharClass : unsigned char
+    {
+        Other = 0,
+        Whitespace = 1 << 0,
+        Digit = 1 << 1,
+        Letter = 1 << 2
+    };
+
+    // 256-entry character class table, built at compile time
+    struct ClassTable
+    {
+        unsigned char Class[256];
+
+        constexpr ClassTable() : Class()
+        {
+            for (const char *C = " \t\f\v\r\n"; *C; ++C)
+                Class[(unsigned char)*C] = Whitespace;
+            for (int C = '0'; C <= '9'; ++C)
+                Class[C] = Digit;
+            for (int C = 'a'; C <= 'z'; ++C)
+                Class[C] = Letter;
+            for (int C = 'A'; C <= 'Z'; ++C)
+                Class[C] = Letter;
+        }
+    };
+
+    static constexpr ClassTable Table;
+
+    LLVM_READNONE inline unsigned char getClass(char c)
+    {
+        return Table.Class[(unsigned char)c];
+    }
+
     // ignore whitespaces
     LLVM_READNONE inline bool isWhitespace(char c)
     {
-        return c == ' ' || c == '\t' || c == '\f' || c == '\v' ||
-               c == '\r' || c == '\n';
+        return getClass(c) & Whitespace;
     }
 
     LLVM_READNONE inline bool isDigit(char c)
     {
-        return c >= '0' && c <= '9';
+        return getClass(c) & Digit;
     }
 
     LLVM_READNONE inline bool isLetter(char c)
     {
-        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+        return getClass(c) & Letter;
+    }
+
+    LLVM_READNONE inline bool isIdentifierChar(char c)
+    {
+        return getClass(c) & (Letter | Digit);
+    }
+}
+
+// Vectorized scanning used to skip whitespace runs and comment bodies. Every
+// function scans [Ptr, End) with whole vectors while they fit and finishes
+// with scalar code, so nothing past the end of the buffer is read.
+namespace scan
+{
+    // returns the first character in [Ptr, End) that is not whitespace, or End
+    static const char *skipWhitespace(const char *Ptr, const char *End)
+    {
+        // most runs are a single space or a line break plus a little indentation
+        for (int I = 0; I < 4; ++I, ++Ptr)
+            if (Ptr == End || !charinfo::isWhitespace(*Ptr))
+                return Ptr;
+
+#if defined(__AVX2__)
+        const __m256i Space32 = _mm256_set1_epi8(' ');
+        const __m256i Tab32 = _mm256_set1_epi8('\t');
+        const __m256i Four32 = _mm256_set1_epi8(4);
+        while (End - Ptr >= 32)
+        {
+            __m256i V = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(Ptr));
+            // '\t', '\n', '\v', '\f' and '\r' are the range 9..13
+            __m256i Rel = _mm256_sub_epi8(V, Tab32);
+            __m256i InRange = _mm256_cmpeq_epi8(_mm256_min_epu8(Rel, Four32), Rel);
+            __m256i IsSpace = _mm256_or_si256(InRange, _mm256_cmpeq_epi8(V, Space32));
+            uint32_t Mask = ~(uint32_t)_mm256_movemask_epi8(IsSpace);
+            if (Mask)
+                return Ptr + llvm::countTrailingZeros(Mask);
+            Ptr += 32;
+        }
+#endif
+#if defined(__SSE2__)
+        const __m128i Space = _mm_set1_epi8(' ');
+        const __m128i Tab = _mm_set1_epi8('\t');
+        const __m128i Four = _mm_set1_epi8(4);
+        while (End - Ptr >= 16)
+        {
+            __m128i V = _mm_loadu_si128(reinterpret_cast<const __m128i *>(Ptr));
+            __m128i Rel = _mm_sub_epi8(V, Tab);
+            __m128i InRange = _mm_cmpeq_epi8(_mm_min_epu8(Rel, Four), Rel);
+            __m128i IsSpace = _mm_or_si128(InRange, _mm_cmpeq_epi8(V, Space));
+            uint32_t Mask = ~(uint32_t)_mm_movemask_epi8(IsSpace) & 0xFFFF;
+            if (Mask)
+                return Ptr + llvm::countTrailingZeros(Mask);
+            Ptr += 16;
+        }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        const uint8x16_t Space = vdupq_n_u8(' ');
+        const uint8x16_t Tab = vdupq_n_u8('\t');
+        const uint8x16_t Four = vdupq_n_u8(4);
+        while (End - Ptr >= 16)
+        {
+            uint8x16_t V = vld1q_u8(reinterpret_cast<const uint8_t *>(Ptr));
+            uint8x16_t IsSpace = vorrq_u8(vcleq_u8(vsubq_u8(V, Tab), Four), vceqq_u8(V, Space));
+            // the scalar loop below locates the first non-whitespace byte
+            if (vminvq_u8(IsSpace) != 0xFF)
+                break;
+            Ptr += 16;
+        }
+#endif
+        while (Ptr != End && charinfo::isWhitespace(*Ptr))
+            ++Ptr;
+        return Ptr;
     }
 
-    LLVM_READNONE inline bool isSpecialCharacter(char c)
+    // returns a pointer to the "*/" that closes a comment whose body starts at Ptr, or End
+    static const char *findCommentEnd(const char *Ptr, const char *End)
     {
-        return c == '=' || c == '+' || c == '-' || c == '*' || c == '/' || c == '!' || c == '>' || c == '<' || c == '(' || c == ')' || c == '{' || c == '}'|| c == ',' || c == ';' || c == '%' || c == '^';
+#if defined(__AVX2__)
+        const __m256i Star32 = _mm256_set1_epi8('*');
+        const __m256i Slash32 = _mm256_set1_epi8('/');
+        while (End - Ptr >= 33)
+        {
+            __m256i A = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(Ptr));
+            __m256i B = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(Ptr + 1));
+            uint32_t Mask = (uint32_t)_mm256_movemask_epi8(
+                _mm256_and_si256(_mm256_cmpeq_epi8(A, Star32), _mm256_cmpeq_epi8(B, Slash32)));
+            if (Mask)
+                return Ptr + llvm::countTrailingZeros(Mask);
+            Ptr += 32;
+        }
+#endif
+#if defined(__SSE2__)
+        const __m128i Star = _mm_set1_epi8('*');
+        const __m128i Slash = _mm_set1_epi8('/');
+        while (End - Ptr >= 17)
+        {
+            __m128i A = _mm_loadu_si128(reinterpret_cast<const __m128i *>(Ptr));
+            __m128i B = _mm_loadu_si128(reinterpret_cast<const __m128i *>(Ptr + 1));
+            uint32_t Mask = (uint32_t)_mm_movemask_epi8(
+                _mm_and_si128(_mm_cmpeq_epi8(A, Star), _mm_cmpeq_epi8(B, Slash)));
+            if (Mask)
+                return Ptr + llvm::countTrailingZeros(Mask);
+            Ptr += 16;
+        }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        const uint8x16_t Star = vdupq_n_u8('*');
+        const uint8x16_t Slash = vdupq_n_u8('/');
+        while (End - Ptr >= 17)
+        {
+            uint8x16_t A = vld1q_u8(reinterpret_cast<const uint8_t *>(Ptr));
+            uint8x16_t B = vld1q_u8(reinterpret_cast<const uint8_t *>(Ptr + 1));
+            if (vmaxvq_u8(vandq_u8(vceqq_u8(A, Star), vceqq_u8(B, Slash))))
+                break;
+            Ptr += 16;
+        }
+#endif
+        for (; End - Ptr >= 2; ++Ptr)
+            if (Ptr[0] == '*' && Ptr[1] == '/')
+                return Ptr;
+        return End;
     }
 }
 
+// Keyword recognition: dispatch on the length and the first character, then
+// compare the rest of the spelling once.
+static Token::TokenKind getKeywordKind(llvm::StringRef Name)
+{
+    switch (Name.size())
+    {
+    case 2:
+        if (Name == "if")
+            return Token::KW_if;
+        if (Name == "or")
+            return Token::KW_or;
+        break;
+    case 3:
+        switch (Name[0])
+        {
+        case 'i':
+            if (Name == "int")
+                return Token::KW_int;
+            break;
+        case 'f':
+            if (Name == "for")
+                return Token::KW_for;
+            break;
+        case 'a':
+            if (Name == "and")
+                return Token::KW_and;
+            break;
+        }
+        break;
+    case 4:
+        switch (Name[0])
+        {
+        case 'b':
+            if (Name == "bool")
+                return Token::KW_bool;
+            break;
+        case 'e':
+            if (Name == "else")
+                return Token::KW_else;
+            break;
+        case 't':
+            if (Name == "true")
+                return Token::KW_true;
+            break;
+        }
+        break;
+    case 5:
+        switch (Name[0])
+        {
+        case 'p':
+            if (Name == "print")
+                return Token::KW_print;
+            break;
+        case 'w':
+            if (Name == "while")
+                return Token::KW_while;
+            break;
+        case 'f':
+            if (Name == "false")
+                return Token::KW_false;
+            break;
+        }
+        break;
+    }
+    return Token::ident;
+}
+
+// Parses the loop hints of a comment whose text [Ptr, End) starts with an
+// @ into H. Returns false if it is not a list of valid hints separated by
+// whitespace.
+static bool parseLoopHints(const char *Ptr, const char *End, LoopHints &H)
+{
+    while (Ptr != End) {
+        if (*Ptr != '@')
+            return false;
+        const char *NameEnd = Ptr + 1;
+        while (NameEnd != End && charinfo::isLetter(*NameEnd))
+            ++NameEnd;
+        llvm::StringRef Name(Ptr + 1, NameEnd - Ptr - 1);
+        Ptr = NameEnd;
+
+        // an optional count in parentheses; large ones stop growing and
+        // fail the range checks below
+        bool HasCount = false;
+        uint32_t Count = 0;
+        if (Ptr != End && *Ptr == '(') {
+            const char *Digits = ++Ptr;
+            for (; Ptr != End && charinfo::isDigit(*Ptr); ++Ptr)
+                if (Count <= LoopHints::MaxUnrollCount)
+                    Count = Count * 10 + (*Ptr - '0');
+            if (Ptr == Digits || Ptr == End || *Ptr != ')')
+                return false;
+            ++Ptr;
+            HasCount = true;
+        }
+
+        if (Name == "unroll") {
+            if (HasCount && (Count == 0 || Count > LoopHints::MaxUnrollCount))
+                return false;
+            H.Unroll = 1;
+            H.UnrollCount = Count;
+        } else if (Name == "vectorize") {
+            if (HasCount && (!llvm::isPowerOf2_32(Count) || Count > LoopHints::MaxVectorizeWidth))
+                return false;
+            H.Vectorize = 1;
+            H.VectorizeWidth = Count;
+        } else if (Name == "interleave") {
+            if (!HasCount || !llvm::isPowerOf2_32(Count) || Count > LoopHints::MaxInterleaveCount)
+                return false;
+            H.InterleaveCount = Count;
+        } else
+            return false;
+
+        const char *Next = scan::skipWhitespace(Ptr, End);
+        if (Next == Ptr && Next != End)
+            return false;
+        Ptr = Next;
+    }
+    return true;
+}
+
 void Lexer::next(Token &token) {
-    while (*BufferPtr && charinfo::isWhitespace(*BufferPtr)) {
-        ++BufferPtr;
+    // skip whitespace and /* ... */ comments, collecting the loop hints of
+    // the comments before the token; a comment that only looks like hints
+    // is an ordinary comment
+    LoopHints Pending = LoopHints();
+    bool HavePending = false;
+    while (true) {
+        BufferPtr = scan::skipWhitespace(BufferPtr, BufferEnd);
+        if (BufferPtr[0] != '/' || BufferPtr[1] != '*')
+            break;
+        const char *CommentEnd = scan::findCommentEnd(BufferPtr + 2, BufferEnd);
+        if (CommentEnd == BufferEnd) {
+            // unterminated comment
+            formToken(token, BufferPtr + 2, Token::unknown);
+            return;
+        }
+        const char *Text = scan::skipWhitespace(BufferPtr + 2, CommentEnd);
+        LoopHints Parsed = Pending;
+        if (*Text == '@' && parseLoopHints(Text, CommentEnd, Parsed)) {
+            Pending = Parsed;
+            HavePending = true;
+        }
+        BufferPtr = CommentEnd + 2;
     }
     // make sure we didn't reach the end of input
     if (!*BufferPtr) {
-        token.Kind = Token::eoi;
+        formToken(token, BufferPtr, Token::eoi);
         return;
     }
     // collect characters and check for keywords or ident
     if (charinfo::isLetter(*BufferPtr)) {
         const char *end = BufferPtr + 1;
-        while (charinfo::isLetter(*end) || charinfo::isDigit(*end))
+        while (charinfo::isIdentifierChar(*end))
             ++end;
         llvm::StringRef Name(BufferPtr, end - BufferPtr);
-        Token::TokenKind kind;
-        if (Name == "int")
-            kind = Token::KW_int;
-        else if (Name == "bool")
-            kind = Token::KW_bool;
-        else if (Name == "print")
-            kind = Token::KW_print;
-        else if (Name == "while")
-            kind = Token::KW_while;
-        else if (Name == "for")
-            kind = Token::KW_for;
-        else if (Name == "if")
-            kind = Token::KW_if;
-        else if (Name == "else")
-            kind = Token::KW_else;
-        else if (Name == "true")
-            kind = Token::KW_true;
-        else if (Name == "false")
-            kind = Token::KW_false;
-        else if (Name == "and")
-            kind = Token::KW_and;
-        else if (Name == "or")
-            kind = Token::KW_or;
-        else
-            kind = Token::ident;
         // generate the token
-        formToken(token, end, kind);
+        Token::TokenKind Kind = getKeywordKind(Name);
+        formToken(token, end, Kind);
+        if (Kind == Token::ident)
+            token.Payload = Symbols.intern(Name);
+        else if (HavePending && token.isOneOf(Token::KW_while, Token::KW_for))
+            Hints.push_back({token.Offset, Pending});
         return;
-    } else if (charinfo::isDigit(*BufferPtr)) { // check for numbers
+    }
+    if (charinfo::isDigit(*BufferPtr)) { // check for numbers
         const char *end = BufferPtr + 1;
+        // the value is parsed here, once; Value stops growing when it no
+        // longer fits, and such literals are not valid tokens
+        uint64_t Value = *BufferPtr - '0';
         while (charinfo::isDigit(*end))
+        {
+            if (Value <= INT32_MAX)
+                Value = Value * 10 + (*end - '0');
             ++end;
-        formToken(token, end, Token::number);
-        return;
-    } else if (charinfo::isSpecialCharacter(*BufferPtr)) {
-        const char *endWithOneLetter = BufferPtr + 1;
-        const char *endWithTwoLetter = BufferPtr + 2;
-        const char *end;
-        llvm::StringRef NameWithOneLetter(BufferPtr, endWithOneLetter - BufferPtr);
-        llvm::StringRef NameWithTwoLetter(BufferPtr, endWithTwoLetter - BufferPtr);
-        Token::TokenKind kind;
-        bool isFound = false;
-        if (NameWithTwoLetter == "=="){
-            kind = Token::eq;
-            isFound = true;
-            end = endWithTwoLetter;
-        } else if (NameWithOneLetter == "=") {
-            kind = Token::assign;
-            isFound = true;
-            end = endWithOneLetter;
-        } else if (NameWithTwoLetter == "!="){
-            kind = Token::neq;
-            isFound = true;
-            end = endWithTwoLetter;
-        } else if (NameWithTwoLetter == "-("){
-            kind = Token::minus_paren;
-            isFound = true;
-            end = endWithTwoLetter;
-        }else if (NameWithTwoLetter == "+="){
-            kind = Token::plus_assign;
-            isFound = true;
-            end = endWithTwoLetter;
-        } else if (NameWithTwoLetter == "-="){
-            kind = Token::minus_assign;
-            isFound = true;
-            end = endWithTwoLetter;
-        } else if (NameWithTwoLetter == "*="){
-            kind = Token::star_assign;
-            isFound = true;
-            end = endWithTwoLetter;
-        } else if (NameWithTwoLetter == "*/"){
-            kind = Token::end_comment;
-            isFound = true;
-            end = endWithTwoLetter;
-        } else if (NameWithTwoLetter == "/="){
-            kind = Token::slash_assign;
-            isFound = true;
-            end = endWithTwoLetter;
-        } else if (NameWithTwoLetter == "/*"){
-            kind = Token::start_comment;
-            isFound = true;
-            end = endWithTwoLetter;
-        } else if (NameWithTwoLetter == ">="){
-            kind = Token::gte;
-            isFound = true;
-            end = endWithTwoLetter;
-        } else if (NameWithTwoLetter == "<="){
-            kind = Token::lte;
-            isFound = true;
-            end = endWithTwoLetter;
-        } else if (NameWithTwoLetter == "++"){
-            kind = Token::plus_plus;
-            isFound = true;
-            end = endWithTwoLetter;
-        } else if (NameWithTwoLetter == "--"){
-            kind = Token::minus_minus;
-            isFound = true;
-            end = endWithTwoLetter;
-        } else if (NameWithOneLetter == "+"){
-            kind = Token::plus;
-            isFound = true;
-            end = endWithOneLetter;
-        } else if (NameWithOneLetter == "-"){
-            kind = Token::minus;
-            isFound = true;
-            end = endWithOneLetter;
-        } else if (NameWithOneLetter == "*"){
-            kind = Token::star;
-            isFound = true;
-            end = endWithOneLetter;
-        } else if (NameWithOneLetter == "/"){
-            kind = Token::slash;
-            isFound = true;
-            end = endWithOneLetter;
-        } else if (NameWithOneLetter == "+"){
-            kind = Token::plus;
-            isFound = true;
-            end = endWithOneLetter;
-        } else if (NameWithOneLetter == ">"){
-            kind = Token::gt;
-            isFound = true;
-            end = endWithOneLetter;
-        } else if (NameWithOneLetter == "<"){
-            kind = Token::lt;
-            isFound = true;
-            end = endWithOneLetter;
-        } else if (NameWithOneLetter == "("){
-            kind = Token::l_paren;
-            isFound = true;
-            end = endWithOneLetter;
-        } else if (NameWithOneLetter == ")"){
-            kind = Token::r_paren;
-            isFound = true;
-            end = endWithOneLetter;
-        } else if (NameWithOneLetter == "{"){
-            kind = Token::l_brace;
-            isFound = true;
-            end = endWithOneLetter;
-        } else if (NameWithOneLetter == "}"){
-            kind = Token::r_brace;
-            isFound = true;
-            end = endWithOneLetter;
-        } else if (NameWithOneLetter == ";"){
-            kind = Token::semicolon;
-            isFound = true;
-            end = endWithOneLetter;
-        } else if (NameWithOneLetter == ","){
-            kind = Token::comma;
-            isFound = true;
-            end = endWithOneLetter;
-        } else if (NameWithOneLetter == "%"){
-            kind = Token::mod;
-            isFound = true;
-            end = endWithOneLetter;
-        } else if (NameWithOneLetter == "^"){
-            kind = Token::exp;
-            isFound = true;
-            end = endWithOneLetter;
         }
-        
-        // generate the token
-        if (isFound) formToken(token, end, kind);
-        else formToken(token, BufferPtr + 1, Token::unknown);
+        bool Fits = Value <= INT32_MAX;
+        formToken(token, end, Fits ? Token::number : Token::unknown);
+        if (Fits)
+            token.Payload = (uint32_t)Value;
         return;
-    } else {
-        formToken(token, BufferPtr + 1, Token::unknown); 
-        return;         
     }
-    return;
-}
 
-void Lexer::setBufferPtr(const char *buffer){
-    BufferPtr = buffer;
+    // operators and punctuation: dispatch on the first byte, then look at the
+    // second one for the two-character forms (the input is NUL-terminated)
+    const char Second = BufferPtr[1];
+    switch (*BufferPtr) {
+    case '=':
+        if (Second == '=')
+            return formToken(token, BufferPtr + 2, Token::eq);
+        return formToken(token, BufferPtr + 1, Token::assign);
+    case '!':
+        if (Second == '=')
+            return formToken(token, BufferPtr + 2, Token::neq);
+        break;
+    case '+':
+        if (Second == '=')
+            return formToken(token, BufferPtr + 2, Token::plus_assign);
+        if (Second == '+')
+            return formToken(token, BufferPtr + 2, Token::plus_plus);
+        return formToken(token, BufferPtr + 1, Token::plus);
+    case '-':
+        if (Second == '(')
+            return formToken(token, BufferPtr + 2, Token::minus_paren);
+        if (Second == '=')
+            return formToken(token, BufferPtr + 2, Token::minus_assign);
+        if (Second == '-')
+            return formToken(token, BufferPtr + 2, Token::minus_minus);
+        return formToken(token, BufferPtr + 1, Token::minus);
+    case '*':
+        if (Second == '=')
+            return formToken(token, BufferPtr + 2, Token::star_assign);
+        if (Second == '/')
+            return formToken(token, BufferPtr + 2, Token::end_comment);
+        return formToken(token, BufferPtr + 1, Token::star);
+    case '/':
+        if (Second == '=')
+            return formToken(token, BufferPtr + 2, Token::slash_assign);
+        return formToken(token, BufferPtr + 1, Token::slash);
+    case '>':
+        if (Second == '=')
+            return formToken(token, BufferPtr + 2, Token::gte);
+        return formToken(token, BufferPtr + 1, Token::gt);
+    case '<':
+        if (Second == '=')
+            return formToken(token, BufferPtr + 2, Token::lte);
+        return formToken(token, BufferPtr + 1, Token::lt);
+    case '(':
+        return formToken(token, BufferPtr + 1, Token::l_paren);
+    case ')':
+        return formToken(token, BufferPtr + 1, Token::r_paren);
+    case '{':
+        return formToken(token, BufferPtr + 1, Token::l_brace);
+    case '}':
+        return formToken(token, BufferPtr + 1, Token::r_brace);
+    case ';':
+        return formToken(token, BufferPtr + 1, Token::semicolon);
+    case ',':
+        return formToken(token, BufferPtr + 1, Token::comma);
+    case '%':
+        return formToken(token, BufferPtr + 1, Token::mod);
+    case '^':
+        return formToken(token, BufferPtr + 1, Token::exp);
+    default:
+        break;
+    }
+    formToken(token, BufferPtr + 1, Token::unknown);
 }
 
 void Lexer::formToken(Token &Tok, const char *TokEnd,
                       Token::TokenKind Kind)
 {
     Tok.Kind = Kind;
-    Tok.Text = llvm::StringRef(BufferPtr, TokEnd - BufferPtr);
+    Tok.Payload = SymbolTable::Invalid;
+    Tok.Offset = BufferPtr - BufferStart;
+    Tok.Length = TokEnd - BufferPtr;
     BufferPtr = TokEnd;
-}
\ No newline at end of file
+    ++NumTokens;
+}
+
+LoopHints Lexer::getLoopHints(const Token &Tok)
+{
+    if (NextHints == Hints.size()) {
+        Hints.clear();
+        NextHints = 0;
+    }
+    while (NextHints != Hints.size() && Hints[NextHints].first < Tok.Offset)
+        ++NextHints;
+    if (NextHints != Hints.size() && Hints[NextHints].first == Tok.Offset)
+        return Hints[NextHints++].second;
+    return LoopHints();
+}
+
+unsigned Lexer::getLine(const Token &Tok)
+{
+    const char *Ptr = BufferStart + Tok.Offset;
+    if (Ptr < LinePtr)
+    {
+        LinePtr = BufferStart;
+        Line = 1;
+    }
+    Line += std::count(LinePtr, Ptr, '\n');
+    LinePtr = Ptr;
+    return Line;
+}
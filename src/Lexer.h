@@ -1,8 +1,13 @@
 #ifndef LEXER_H // conditional compilations(checks whether a macro is not defined)
 #define LEXER_H
 
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/StringRef.h"        // encapsulates a pointer to a C string and its length
 #include "llvm/Support/MemoryBuffer.h" // read-only access to a block of memory, filled with the content of a file
+#include "LoopHints.h"
+#include "SymbolTable.h"
+#include <cstdint>
+#include <utility>
 
 class Lexer;
 
@@ -11,7 +16,7 @@ class Token
     friend class Lexer; // Lexer can access private and protected members of Token
 
 public:
-    enum TokenKind : unsigned short
+    enum TokenKind : uint8_t
     {
         eoi,            // end of input
         unknown,        // in case of error at the lexical level
@@ -30,8 +35,7 @@ public:
         lte,            // <=
         plus_plus,      // ++
         minus_minus,    // --
-        start_comment,  // /*
-        end_comment,    // */
+        end_comment,    // */ (comments themselves are skipped by the lexer, see getLoopHints)
         comma,          // ,
         semicolon,      // ;
         plus,           // +
@@ -59,12 +63,20 @@ public:
     };
 
 private:
-    TokenKind Kind;
-    llvm::StringRef Text; // points to the start of the text of the token
+    // The text of the token is Length bytes at Offset in the lexer's buffer,
+    // which Lexer::getText returns.
+    uint32_t Offset = 0;
+    uint32_t Length = 0;
+    TokenKind Kind = eoi;
+    // Interned ID of an identifier or value of an integer literal, parsed
+    // once by the lexer; SymbolTable::Invalid for other tokens.
+    uint32_t Payload = SymbolTable::Invalid;
 
 public:
     TokenKind getKind() const { return Kind; }
-    llvm::StringRef getText() const { return Text; }
+    uint32_t getOffset() const { return Offset; }
+    unsigned getSymbol() const { return Kind == ident ? Payload : SymbolTable::Invalid; }
+    int32_t getValue() const { return (int32_t)Payload; }
 
     // to test if the token is of a certain kind
     bool is(TokenKind K) const { return Kind == K; }
@@ -80,18 +92,47 @@ public:
 class Lexer
 {
     const char *BufferStart; // pointer to the beginning of the input
+    const char *BufferEnd;   // pointer to the terminating NUL character
     const char *BufferPtr;   // pointer to the next unprocessed character
+    SymbolTable &Symbols;    // identifiers are interned here
+    unsigned NumTokens = 0;  // number of tokens formed so far
+    const char *LinePtr;     // position up to which getLine has counted lines
+    unsigned Line = 1;       // line of LinePtr
+    // Hints of the comments before the tokens at these offsets, in order;
+    // the ones before NextHints have been asked for or passed.
+    llvm::SmallVector<std::pair<uint32_t, LoopHints>, 4> Hints;
+    unsigned NextHints = 0;
 
 public:
-    Lexer(const llvm::StringRef &Buffer)
+    // Buffer must be NUL-terminated, as std::string and MemoryBuffer contents
+    // are, and smaller than 4 GiB, since tokens hold 32-bit offsets into it.
+    Lexer(const llvm::StringRef &Buffer, SymbolTable &Symbols) : Symbols(Symbols)
     {
         BufferStart = Buffer.begin();
+        BufferEnd = Buffer.end();
         BufferPtr = BufferStart;
+        LinePtr = BufferStart;
     }
 
     void next(Token &token); // return the next token
-    void setBufferPtr(const char* buffer);
-    const char* getBuffer(){return BufferPtr;};
+
+    unsigned getNumTokens() const { return NumTokens; }
+
+    llvm::StringRef getText(const Token &Tok) const
+    {
+        return llvm::StringRef(BufferStart + Tok.Offset, Tok.Length);
+    }
+
+    // Returns the 1-based line of Tok. Lines are counted on demand from the
+    // previous query, so asking for tokens in order costs one pass over the
+    // input.
+    unsigned getLine(const Token &Tok);
+
+    // Returns the hints of the comments right before Tok, the keyword of a
+    // loop. A comment whose text starts with @ and is a list of valid hints
+    // (see LoopHints.h) holds hints; other comments, and hints before other
+    // tokens, are ignored. Tokens must be asked for in order.
+    LoopHints getLoopHints(const Token &Tok);
 
 private:
     void formToken(Token &Result, const char *TokEnd, Token::TokenKind Kind);
@@ -0,0 +1,271 @@
+#include "LibCompiler.h"
+#include "CodeGen.h"
+#include "CompileCache.h"
+#include "Driver.h"
+#include "Server.h"
+#include "llvm/Support/FileSystem.h"
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#ifdef LLVM_ON_UNIX
+#include <dlfcn.h>
+#endif
+
+using namespace llvm;
+
+struct compiler_context
+{
+  std::unique_ptr<CompileCache> Cache;
+
+  // Target state of the threads that are not compiling. A compile takes one
+  // or creates it, so there are never more than there were concurrent calls.
+  std::mutex Lock;
+  std::vector<std::unique_ptr<CodeGenContext>> Idle;
+};
+
+struct compiler_result
+{
+  ServerResponse Response;
+};
+
+struct compiler_program
+{
+  std::unique_ptr<JITProgram> Program;
+};
+
+namespace
+{
+  // The target state a call of a compiler_context works with, given back when
+  // the call returns. Programs loaded with it stay in its JIT.
+  class BorrowedContext
+  {
+    compiler_context &Ctx;
+    std::unique_ptr<CodeGenContext> Reuse;
+
+  public:
+    BorrowedContext(compiler_context &Ctx) : Ctx(Ctx)
+    {
+      {
+        std::lock_guard<std::mutex> Guard(Ctx.Lock);
+        if (!Ctx.Idle.empty())
+        {
+          Reuse = std::move(Ctx.Idle.back());
+          Ctx.Idle.pop_back();
+        }
+      }
+      if (!Reuse)
+        Reuse = std::make_unique<CodeGenContext>();
+    }
+
+    ~BorrowedContext()
+    {
+      std::lock_guard<std::mutex> Guard(Ctx.Lock);
+      Ctx.Idle.push_back(std::move(Reuse));
+    }
+
+    CodeGenContext &get() { return *Reuse; }
+  };
+} // namespace
+
+// Returns the file the library was loaded from, whose rebuilds invalidate
+// the cache like those of the compiler executable.
+static std::string getLibraryPath()
+{
+#ifdef LLVM_ON_UNIX
+  Dl_info Info;
+  if (dladdr((void *)&compiler_context_create, &Info) && Info.dli_fname)
+    return Info.dli_fname;
+#endif
+  return sys::fs::getMainExecutable(nullptr, (void *)&compiler_context_create);
+}
+
+// Fills the compiler options of Request from Options, or returns false if
+// they are not valid.
+static bool getRequest(const char *Source, size_t Size, const compiler_options *Options,
+                       ServerRequest &Request, ServerResponse &Response)
+{
+  compiler_options Defaults;
+  if (!Options)
+  {
+    compiler_options_init(&Defaults);
+    Options = &Defaults;
+  }
+
+  CodeGenOptions &Opts = Request.Opts;
+  if (Options->opt_level > 3)
+  {
+    Response.Failed = true;
+    Response.Diagnostics = "Invalid optimization level\n";
+    return false;
+  }
+  Opts.OptLevel = Options->opt_level;
+  switch (Options->emit)
+  {
+  case COMPILER_EMIT_LL:
+    Opts.Emit = EmitKind::LLVMIR;
+    break;
+  case COMPILER_EMIT_BC:
+    Opts.Emit = EmitKind::Bitcode;
+    break;
+  case COMPILER_EMIT_OBJ:
+    Opts.Emit = EmitKind::Object;
+    break;
+  case COMPILER_EMIT_AST:
+    Opts.Emit = EmitKind::AST;
+    break;
+  default:
+    Response.Failed = true;
+    Response.Diagnostics = "Invalid output kind\n";
+    return false;
+  }
+  if (Options->triple)
+    Opts.Triple = Options->triple;
+  if (Options->cpu)
+    Opts.CPU = Options->cpu;
+  Opts.EvalFuel = Options->eval_fuel;
+  Request.ConstFold = Options->const_fold != 0;
+  Request.Source.assign(Source, Size);
+  return true;
+}
+
+void compiler_options_init(compiler_options *opts)
+{
+  opts->opt_level = 0;
+  opts->emit = COMPILER_EMIT_LL;
+  opts->triple = nullptr;
+  opts->cpu = nullptr;
+  opts->const_fold = 1;
+  opts->eval_fuel = 0;
+  opts->interpret = 0;
+  opts->tier_up = 0;
+  opts->isolate = 0;
+  opts->time_limit = 0;
+}
+
+compiler_context *compiler_context_create(const char *cache_dir)
+{
+  compiler_context *Ctx = new compiler_context;
+  if (cache_dir)
+    Ctx->Cache = std::make_unique<CompileCache>(cache_dir, getLibraryPath());
+  return Ctx;
+}
+
+void compiler_context_destroy(compiler_context *ctx)
+{
+  delete ctx;
+}
+
+compiler_result *compiler_compile(compiler_context *ctx, const char *source, size_t size,
+                                  const compiler_options *opts)
+{
+  compiler_result *Result = new compiler_result;
+  ServerRequest Request;
+  if (!getRequest(source, size, opts, Request, Result->Response))
+    return Result;
+
+  BorrowedContext Reuse(*ctx);
+  handleRequest(Request, Result->Response, Reuse.get(), ctx->Cache.get());
+  return Result;
+}
+
+compiler_result *compiler_run(compiler_context *ctx, const char *source, size_t size,
+                              const compiler_options *opts)
+{
+  compiler_result *Result = new compiler_result;
+  ServerRequest Request;
+  if (!getRequest(source, size, opts, Request, Result->Response))
+    return Result;
+  if (opts && opts->interpret)
+  {
+    Request.Opts.Interpret = true;
+    Request.Opts.TierUp = opts->tier_up;
+  }
+  else
+    Request.Opts.Run = true;
+  Request.Opts.Emit = EmitKind::LLVMIR;
+
+  BorrowedContext Reuse(*ctx);
+  if (opts && opts->isolate)
+    handleIsolatedRequest(Request, Result->Response, Reuse.get(), ctx->Cache.get(), opts->time_limit);
+  else
+    handleRequest(Request, Result->Response, Reuse.get(), ctx->Cache.get());
+  return Result;
+}
+
+compiler_result *compiler_load(compiler_context *ctx, const char *source, size_t size,
+                               const compiler_options *opts, compiler_program **program)
+{
+  *program = nullptr;
+  compiler_result *Result = new compiler_result;
+  ServerResponse &Response = Result->Response;
+  ServerRequest Request;
+  if (!getRequest(source, size, opts, Request, Response))
+    return Result;
+  Request.Opts.Load = true;
+  Request.Opts.Emit = EmitKind::LLVMIR;
+
+  BorrowedContext Reuse(*ctx);
+  std::unique_ptr<JITProgram> Program;
+  CompileEnv Env;
+  Env.Reuse = &Reuse.get();
+  Env.Program = &Program;
+  CompilerStats Stats;
+  raw_string_ostream Diags(Response.Diagnostics);
+  Response.Failed = compileSource(Request.Source, Request.Opts, Request.ConstFold, Diags, Stats,
+                                  Response.ExitCode, Env);
+  Diags.flush();
+  if (!Response.Failed && Program)
+    *program = new compiler_program{std::move(Program)};
+  else
+    Response.Failed = true;
+  return Result;
+}
+
+compiler_result *compiler_program_run(compiler_program *program)
+{
+  compiler_result *Result = new compiler_result;
+  runProgram(*program->Program, Result->Response);
+  return Result;
+}
+
+compiler_result *compiler_program_run_isolated(compiler_program *program, unsigned time_limit)
+{
+  compiler_result *Result = new compiler_result;
+  ServerResponse &Response = Result->Response;
+  runInChild(time_limit, Response, [&]
+             { runProgram(*program->Program, Response); });
+  return Result;
+}
+
+void compiler_program_destroy(compiler_program *program)
+{
+  delete program;
+}
+
+int compiler_result_failed(const compiler_result *result)
+{
+  return result->Response.Failed;
+}
+
+int compiler_result_exit_code(const compiler_result *result)
+{
+  return result->Response.ExitCode;
+}
+
+const char *compiler_result_output(const compiler_result *result, size_t *size)
+{
+  if (size)
+    *size = result->Response.Output.size();
+  return result->Response.Output.c_str();
+}
+
+const char *compiler_result_diagnostics(const compiler_result *result)
+{
+  return result->Response.Diagnostics.c_str();
+}
+
+void compiler_result_destroy(compiler_result *result)
+{
+  delete result;
+}
@@ -0,0 +1,117 @@
+#ifndef LIBCOMPILER_H
+#define LIBCOMPILER_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The C API of libcompiler, for programs that embed the compiler instead of
+   running it as a process.
+
+   A compiler_context is created once and kept: it holds the target machines,
+   the JITs with the runtime declared in them and, optionally, an output
+   cache, so that only the first compile of each kind pays for setting them
+   up. Any number of threads may submit sources to one context at the same
+   time; each compile borrows the target state of one thread and gives it
+   back.
+
+   Every call returns a compiler_result holding what it produced and the
+   diagnostics. Results and programs are owned by the caller and freed with
+   their destroy functions; nothing else is allocated per call that outlives
+   it. Sources are program text or a binary AST written with
+   COMPILER_EMIT_AST. */
+
+typedef struct compiler_context compiler_context;
+typedef struct compiler_result compiler_result;
+typedef struct compiler_program compiler_program;
+
+typedef enum compiler_emit
+{
+    COMPILER_EMIT_LL,  /* textual LLVM IR */
+    COMPILER_EMIT_BC,  /* LLVM bitcode */
+    COMPILER_EMIT_OBJ, /* native object file */
+    COMPILER_EMIT_AST  /* binary AST */
+} compiler_emit;
+
+typedef struct compiler_options
+{
+    unsigned opt_level;           /* 0-3 */
+    compiler_emit emit;           /* output of compiler_compile */
+    const char *triple;           /* target triple, NULL for the host */
+    const char *cpu;              /* target CPU, NULL for a generic CPU */
+    int const_fold;               /* fold constants before CodeGen */
+    unsigned long long eval_fuel; /* steps of compile-time evaluation, 0 for none */
+    int interpret;                /* compiler_run uses the bytecode interpreter */
+    unsigned long long tier_up;   /* iterations after which the interpreter JITs a loop */
+    int isolate;                  /* compiler_run runs the program in a child process */
+    unsigned time_limit;          /* seconds after which an isolated program is stopped, 0 for none */
+} compiler_options;
+
+/* Sets the defaults of the compiler command line: -O0, LLVM IR for the
+   host, with constant folding. */
+void compiler_options_init(compiler_options *opts);
+
+/* Creates a context. With a cache_dir, outputs of compiler_compile are kept
+   in that directory and reused for unchanged sources. */
+compiler_context *compiler_context_create(const char *cache_dir);
+
+/* Destroys ctx. No call on it may be running and its programs must have
+   been destroyed. */
+void compiler_context_destroy(compiler_context *ctx);
+
+/* Compiles size bytes of source; the result's output is the IR, bitcode,
+   object file or binary AST selected by opts->emit. opts may be NULL for
+   the defaults. */
+compiler_result *compiler_compile(compiler_context *ctx, const char *source, size_t size,
+                                  const compiler_options *opts);
+
+/* Compiles and runs a program with the JIT, or with the interpreter if
+   opts->interpret is set. The result's output is what the program printed
+   and its exit code that of the program; a division by zero fails the
+   result. The program runs on the calling thread and the call returns when
+   it ends, so a program that does not end never returns. With
+   opts->isolate it instead runs in a child process, which is stopped after
+   opts->time_limit seconds; this also fails the result, as does a crash. */
+compiler_result *compiler_run(compiler_context *ctx, const char *source, size_t size,
+                              const compiler_options *opts);
+
+/* Compiles a program with the JIT and keeps it loaded. On success *program
+   is set to a handle that runs it; otherwise it is set to NULL and the
+   result has failed. */
+compiler_result *compiler_load(compiler_context *ctx, const char *source, size_t size,
+                               const compiler_options *opts, compiler_program **program);
+
+/* Runs a loaded program on the calling thread, like compiler_run. Several
+   threads may run one program at once. */
+compiler_result *compiler_program_run(compiler_program *program);
+
+/* Runs a loaded program in a child process, like compiler_run with
+   opts->isolate; time_limit is in seconds, 0 for none. */
+compiler_result *compiler_program_run_isolated(compiler_program *program, unsigned time_limit);
+
+/* Unloads a program and frees its code. */
+void compiler_program_destroy(compiler_program *program);
+
+/* Returns nonzero if the compile failed; the diagnostics say why. */
+int compiler_result_failed(const compiler_result *result);
+
+/* Returns the exit code of a program that was run. */
+int compiler_result_exit_code(const compiler_result *result);
+
+/* Returns the output and stores its size in *size, if size is not NULL.
+   Outputs may contain NUL bytes; the returned data is also followed by one. */
+const char *compiler_result_output(const compiler_result *result, size_t *size);
+
+/* Returns the diagnostics as a NUL-terminated string, empty if there are
+   none. */
+const char *compiler_result_diagnostics(const compiler_result *result);
+
+void compiler_result_destroy(compiler_result *result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
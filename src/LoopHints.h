@@ -0,0 +1,58 @@
+#ifndef LOOPHINTS_H
+#define LOOPHINTS_H
+
+#include <cstdint>
+
+// Optimization hints for a loop, written in a comment right before its while
+// or for keyword:
+//
+//   /* @unroll(4) @vectorize */
+//   for (i = 0; i < 1000; i++) { ... }
+//
+// @unroll unrolls the loop, by N with @unroll(N); @vectorize vectorizes it,
+// with N lanes with @vectorize(N); @interleave(N) runs N iterations of the
+// vectorized loop interleaved. A count of zero leaves it to LLVM. CodeGen
+// turns the hints into llvm.loop metadata, which the optimizer follows at
+// -O1 and above.
+struct LoopHints
+{
+  uint32_t Unroll : 1;
+  uint32_t UnrollCount : 15;    // at most MaxUnrollCount
+  uint32_t Vectorize : 1;
+  uint32_t VectorizeWidth : 7;  // a power of two up to MaxVectorizeWidth
+  uint32_t InterleaveCount : 8; // a power of two up to MaxInterleaveCount
+
+  // As LLVM's loop vectorizer accepts them.
+  static constexpr unsigned MaxUnrollCount = (1u << 15) - 1;
+  static constexpr unsigned MaxVectorizeWidth = 64;
+  static constexpr unsigned MaxInterleaveCount = 16;
+
+  bool empty() const { return !Unroll && !Vectorize && !InterleaveCount; }
+
+  // True if the counts are ones LLVM accepts and only set with their hint.
+  bool isValid() const
+  {
+    return (Unroll || !UnrollCount) && (Vectorize || !VectorizeWidth) && VectorizeWidth <= MaxVectorizeWidth &&
+           (VectorizeWidth & (VectorizeWidth - 1)) == 0 && InterleaveCount <= MaxInterleaveCount &&
+           (InterleaveCount & (InterleaveCount - 1)) == 0;
+  }
+
+  // The hints as one word with a fixed layout, for binary AST files.
+  uint32_t toWord() const
+  {
+    return Unroll | UnrollCount << 1 | Vectorize << 16 | VectorizeWidth << 17 | InterleaveCount << 24;
+  }
+
+  static LoopHints fromWord(uint32_t W)
+  {
+    LoopHints H;
+    H.Unroll = W & 1;
+    H.UnrollCount = W >> 1 & 0x7fff;
+    H.Vectorize = W >> 16 & 1;
+    H.VectorizeWidth = W >> 17 & 0x7f;
+    H.InterleaveCount = W >> 24;
+    return H;
+  }
+};
+
+#endif
@@ -11,153 +11,107 @@ Program *Parser::parse()
 Program *Parser::parseProgram()
 {
     llvm::SmallVector<AST *> data;
-    
-    while (!Tok.is(Token::eoi))
+    while (AST *S = parseStatement())
+        data.push_back(S);
+    if (HasError)
+        return nullptr;
+    return Ctx.create<Program>(Ctx.copyArray<AST *>(data));
+}
+
+AST *Parser::parseStatement()
+{
+    AST *Res = nullptr;
+    switch (Tok.getKind())
     {
-        switch (Tok.getKind())
-        {
-        case Token::KW_int: {
-            DeclarationInt *d;
-            d = parseIntDec();
-            if (d)
-                data.push_back(d);
-            else
-                goto _error;
-                
-            break;
-        }
-        case Token::KW_bool: {
-            DeclarationBool *dbool;
-            dbool = parseBoolDec();
-            if (dbool)
-                data.push_back(dbool);
-            else
-                goto _error;
+    case Token::eoi:
+        return nullptr;
+    case Token::KW_int:
+        Res = parseIntDec();
+        break;
+    case Token::KW_bool:
+        Res = parseBoolDec();
+        break;
+    case Token::ident:
+        Res = parseIdentStmt();
+        break;
+    case Token::KW_if:
+        Res = parseIf();
+        break;
+    case Token::KW_while:
+        Res = parseWhile();
+        break;
+    case Token::KW_for:
+        Res = parseFor();
+        break;
+    case Token::KW_print:
+        Res = parsePrint();
+        break;
+    default:
+        error();
+        break;
+    }
+    if (Res == nullptr)
+        goto _error;
+    advance();
+    return Res;
 
-            break;
-        }
-        case Token::ident: {
-            Token prev_token = Tok;
-            const char* prev_buffer = Lex.getBuffer();
-            UnaryOp *u;
-            u = parseUnary();
-            if (Tok.is(Token::semicolon))
-            {
-                if (u)
-                {
-                    data.push_back(u);
-                    break;
-                }
-                else{
-                    goto _error;
-                    
-                }
-            }
-            else
-            {
-                if (u)
-                {
-                    goto _error;
-                }
-                else{
-                    Tok = prev_token;
-                    Lex.setBufferPtr(prev_buffer);
-                }
-            }
-        
-            Assignment *a_int;
-            Assignment *a_bool;
-            prev_token = Tok;
-            prev_buffer = Lex.getBuffer();
+_error:
+    HasError = true;
+    while (Tok.getKind() != Token::eoi)
+        advance();
+    return nullptr;
+}
 
-            a_bool = parseBoolAssign();
+// Parses a statement that starts with an identifier: `x++;`, `x--;` or an assignment.
+// The kind of statement is decided from lookahead, so no token is lexed twice.
+AST *Parser::parseIdentStmt()
+{
+    AST *Res = nullptr;
 
-            if (a_bool){
-                data.push_back(a_bool);
-                break;
-            }
-            Tok = prev_token;
-            Lex.setBufferPtr(prev_buffer);
+    if (peek(1).isOneOf(Token::plus_plus, Token::minus_minus))
+        Res = parseUnary();
+    else if (peek(1).is(Token::assign) && isLogicAssign())
+        return parseBoolAssign();
+    else
+        Res = parseIntAssign();
 
-            a_int = parseIntAssign();
-            if (!Tok.is(Token::semicolon))
-            {
-                goto _error;
-            }
-            if (a_int)
-                data.push_back(a_int);
-            else
-                goto _error;
-                
-            break;
-        }
-        case Token::KW_if: {
-            IfStmt *i;
-            i = parseIf();
-            if (i)
-                data.push_back(i);
-            else
-                goto _error;
-            
-            break;
-        }
-        case Token::KW_while: {
-            WhileStmt *w;
-            w = parseWhile();
-            if (w)
-                data.push_back(w);
-            else {
-                goto _error;
-            }
-            break;
-        }
-        case Token::KW_for: {
-            ForStmt *f;
-            f = parseFor();
-            if (f)
-                data.push_back(f);
-            else {
-                goto _error;
-            }
-            break;
-        }
-        case Token::KW_print: {
-            PrintStmt *p;
-            p = parsePrint();
-            if (p)
-                data.push_back(p);
-            else {
-                goto _error;
-            }
-            break;
-        }
-        case Token::start_comment: {
-            parseComment();
-            if (!Tok.is(Token::end_comment))
-                goto _error;
-            break;
-        }
-        default: {
-            error();
+    if (Res == nullptr || !Tok.is(Token::semicolon))
+        goto _error;
+    return Res;
 
-            goto _error;
-            break;
-        }
-        }
-        advance();
-        
-    }
-    return new Program(data);
 _error:
     while (Tok.getKind() != Token::eoi)
         advance();
     return nullptr;
 }
 
+// Decides whether the right-hand side of the assignment starting at Tok is a
+// logical expression: it contains a comparison, `and`/`or` or a boolean
+// literal, or it is a single (possibly parenthesized) identifier.
+bool Parser::isLogicAssign()
+{
+    unsigned Idents = 0;
+    unsigned Others = 0;
+    for (unsigned N = 2;; ++N)
+    {
+        const Token &T = peek(N);
+        if (T.isOneOf(Token::semicolon, Token::eoi, Token::l_brace, Token::r_brace))
+            break;
+        if (T.isOneOf(Token::eq, Token::neq, Token::gt, Token::lt, Token::gte, Token::lte,
+                      Token::KW_and, Token::KW_or, Token::KW_true, Token::KW_false))
+            return true;
+        if (T.is(Token::ident))
+            ++Idents;
+        else if (!T.isOneOf(Token::l_paren, Token::r_paren))
+            ++Others;
+    }
+    return Idents == 1 && Others == 0;
+}
+
 DeclarationInt *Parser::parseIntDec()
 {
     Expr *E = nullptr;
-    llvm::SmallVector<llvm::StringRef> Vars;
+    llvm::SmallVector<unsigned> Symbols;
     llvm::SmallVector<Expr *> Values;
     
     if (expect(Token::KW_int)){
@@ -169,7 +123,7 @@ DeclarationInt *Parser::parseIntDec()
         goto _error;
     }
 
-    Vars.push_back(Tok.getText());
+    Symbols.push_back(Tok.getSymbol());
     advance();
 
     if (Tok.is(Token::assign))
@@ -185,7 +139,7 @@ DeclarationInt *Parser::parseIntDec()
     }
     else
     {
-        Values.push_back(new Final(Final::Number, llvm::StringRef("0")));
+        Values.push_back(Ctx.create<Final>(Final::Number, 0));
     }
     
     
@@ -196,7 +150,7 @@ DeclarationInt *Parser::parseIntDec()
             goto _error;
         }
             
-        Vars.push_back(Tok.getText());
+        Symbols.push_back(Tok.getSymbol());
         advance();
 
         if(Tok.is(Token::assign)){
@@ -210,7 +164,7 @@ DeclarationInt *Parser::parseIntDec()
             }
         }
         else{
-            Values.push_back(new Final(Final::Number, llvm::StringRef("0")));
+            Values.push_back(Ctx.create<Final>(Final::Number, 0));
         }
     }
 
@@ -219,7 +173,7 @@ DeclarationInt *Parser::parseIntDec()
     }
 
 
-    return new DeclarationInt(Vars, Values);
+    return Ctx.create<DeclarationInt>(Ctx.copyArray<unsigned>(Symbols), Ctx.copyArray<Expr *>(Values));
 _error: 
     while (Tok.getKind() != Token::eoi)
         advance();
@@ -230,7 +184,7 @@ _error:
 DeclarationBool *Parser::parseBoolDec()
 {
     Logic *L = nullptr;
-    llvm::SmallVector<llvm::StringRef> Vars;
+    llvm::SmallVector<unsigned> Symbols;
     llvm::SmallVector<Logic *> Values;
     
     if (expect(Token::KW_bool)){
@@ -242,7 +196,7 @@ DeclarationBool *Parser::parseBoolDec()
         goto _error;
     }
 
-    Vars.push_back(Tok.getText());
+    Symbols.push_back(Tok.getSymbol());
     advance();
 
     if (Tok.is(Token::assign))
@@ -258,7 +212,7 @@ DeclarationBool *Parser::parseBoolDec()
     }
     else
     {
-        Values.push_back(new Comparison(nullptr, nullptr, Comparison::False));
+        Values.push_back(Ctx.create<Comparison>(nullptr, nullptr, Comparison::False));
     }
     
     
@@ -269,7 +223,7 @@ DeclarationBool *Parser::parseBoolDec()
             goto _error;
         }
             
-        Vars.push_back(Tok.getText());
+        Symbols.push_back(Tok.getSymbol());
         advance();
 
         if(Tok.is(Token::assign)){
@@ -283,14 +237,14 @@ DeclarationBool *Parser::parseBoolDec()
             }
         }
         else{
-            Values.push_back(new Comparison(nullptr, nullptr, Comparison::False));
+            Values.push_back(Ctx.create<Comparison>(nullptr, nullptr, Comparison::False));
         }
     }
 
     if (expect(Token::semicolon)){
         goto _error;
     }
-    return new DeclarationBool(Vars, Values);
+    return Ctx.create<DeclarationBool>(Ctx.copyArray<unsigned>(Symbols), Ctx.copyArray<Logic *>(Values));
 _error: 
     while (Tok.getKind() != Token::eoi)
         advance();
@@ -305,7 +259,7 @@ Assignment *Parser::parseBoolAssign()
     Assignment::AssignKind AK;
     Logic *L = nullptr;
 
-    F = (Final *)(parseFinal());
+    F = llvm::dyn_cast_or_null<Final>(parseFinal());
     if (F == nullptr)
     {
         goto _error;
@@ -323,7 +277,7 @@ Assignment *Parser::parseBoolAssign()
             {
                 goto _error;
             }
-            return new Assignment(F, nullptr, AK, L);
+            return Ctx.create<Assignment>(F, nullptr, AK, L);
         }
         else
             goto _error;
@@ -345,7 +299,7 @@ Assignment *Parser::parseIntAssign()
     Expr *E = nullptr;
     Final *F = nullptr;
     Assignment::AssignKind AK;
-    F = (Final *)(parseFinal());
+    F = llvm::dyn_cast_or_null<Final>(parseFinal());
     if (F == nullptr)
     {
         goto _error;
@@ -378,7 +332,7 @@ Assignment *Parser::parseIntAssign()
     advance();
     E = parseExpr();    // check for mathematical expr
     if(E){
-        return new Assignment(F, E, AK, nullptr);
+        return Ctx.create<Assignment>(F, E, AK, nullptr);
     }
     else{
         goto _error;
@@ -394,19 +348,19 @@ _error:
 UnaryOp *Parser::parseUnary()
 {
     UnaryOp* Res = nullptr;
-    llvm::StringRef var;
+    unsigned Symbol;
 
     if (expect(Token::ident)){
         goto _error;
     }
 
-    var = Tok.getText();
+    Symbol = Tok.getSymbol();
     advance();
     if (Tok.getKind() == Token::plus_plus){
-        Res = new UnaryOp(UnaryOp::Plus_plus, var);
+        Res = Ctx.create<UnaryOp>(UnaryOp::Plus_plus, Symbol);
     }
     else if(Tok.getKind() == Token::minus_minus){
-        Res = new UnaryOp(UnaryOp::Minus_minus, var);
+        Res = Ctx.create<UnaryOp>(UnaryOp::Minus_minus, Symbol);
     }
     else{
         goto _error;
@@ -448,7 +402,7 @@ Expr *Parser::parseExpr()
         {
             goto _error;
         }
-        Left = new BinaryOp(Op, Left, Right);
+        Left = Ctx.create<BinaryOp>(Op, Left, Right);
     }
     return Left;
 
@@ -485,7 +439,7 @@ Expr *Parser::parseTerm()
         {
             goto _error;
         }
-        Left = new BinaryOp(Op, Left, Right);
+        Left = Ctx.create<BinaryOp>(Op, Left, Right);
     }
     return Left;
 
@@ -517,7 +471,7 @@ Expr *Parser::parseFactor()
         {
             goto _error;
         }
-        Left = new BinaryOp(Op, Left, Right);
+        Left = Ctx.create<BinaryOp>(Op, Left, Right);
     }
     return Left;
 
@@ -533,28 +487,21 @@ Expr *Parser::parseFinal()
     switch (Tok.getKind())
     {
     case Token::number:{
-        Res = new Final(Final::Number, Tok.getText());
+        Res = Ctx.create<Final>(Final::Number, Tok.getValue());
         advance();
         break;
     }
     case Token::ident: {
-        Res = new Final(Final::Ident, Tok.getText());
-        Token prev_tok = Tok;
-        const char* prev_buffer = Lex.getBuffer();
-        Expr* u = parseUnary();
-        if(u)
-            return u;
-        else{
-            Tok = prev_tok;
-            Lex.setBufferPtr(prev_buffer);
-            advance();
-        }
+        if (peek(1).isOneOf(Token::plus_plus, Token::minus_minus))
+            return parseUnary();
+        Res = Ctx.create<Final>(Final::Ident, 0, Tok.getSymbol());
+        advance();
         break;
     }
     case Token::plus:{
         advance();
         if(Tok.getKind() == Token::number){
-            Res = new SignedNumber(SignedNumber::Plus, Tok.getText());
+            Res = Ctx.create<SignedNumber>(SignedNumber::Plus, Tok.getValue());
             advance();
             break;
         }
@@ -564,7 +511,7 @@ Expr *Parser::parseFinal()
     case Token::minus:{
         advance();
         if (Tok.getKind() == Token::number){
-            Res = new SignedNumber(SignedNumber::Minus, Tok.getText());
+            Res = Ctx.create<SignedNumber>(SignedNumber::Minus, Tok.getValue());
             advance();
             break;
         }
@@ -575,7 +522,7 @@ Expr *Parser::parseFinal()
         Expr *math_expr = parseExpr();
         if(math_expr == nullptr)
             goto _error;
-        Res = new NegExpr(math_expr);
+        Res = Ctx.create<NegExpr>(math_expr);
         if (!consume(Token::r_paren))
             break;
         
@@ -608,11 +555,8 @@ _error:
 Logic *Parser::parseComparison()
 {
     Logic *Res = nullptr;
-    Final *Ident = nullptr;
     Expr *Left = nullptr;
     Expr *Right = nullptr;
-    Token prev_Tok;
-    const char* prev_buffer;
     if (Tok.is(Token::l_paren)) {
         advance();
         Res = parseLogic();
@@ -625,20 +569,25 @@ Logic *Parser::parseComparison()
     }
     else {
         if(Tok.is(Token::KW_true)){
-            Res = new Comparison(nullptr, nullptr, Comparison::True);
+            Res = Ctx.create<Comparison>(nullptr, nullptr, Comparison::True);
             advance();
             return Res;
         }
         else if(Tok.is(Token::KW_false)){
-            Res = new Comparison(nullptr, nullptr, Comparison::False);
+            Res = Ctx.create<Comparison>(nullptr, nullptr, Comparison::False);
             advance();
             return Res;
         }
-        else if(Tok.is(Token::ident)){
-            Ident = new Final(Final::Ident, Tok.getText());
+        else if(Tok.is(Token::ident) &&
+                !peek(1).isOneOf(Token::plus, Token::minus, Token::star, Token::slash, Token::mod,
+                                 Token::exp, Token::plus_plus, Token::minus_minus, Token::eq,
+                                 Token::neq, Token::gt, Token::lt, Token::gte, Token::lte)){
+            // only one boolean ident
+            Final *Ident = Ctx.create<Final>(Final::Ident, 0, Tok.getSymbol());
+            Res = Ctx.create<Comparison>(Ident, nullptr, Comparison::Ident);
+            advance();
+            return Res;
         }
-        prev_Tok = Tok;
-        prev_buffer = Lex.getBuffer();
         Left = parseExpr();
         if(Left == nullptr)
             goto _error;
@@ -658,13 +607,7 @@ Logic *Parser::parseComparison()
             else if (Tok.is(Token::lte))
                 Op = Comparison::Less_equal;    
             else {
-                if (Ident){
-                    Tok = prev_Tok;
-                    Lex.setBufferPtr(prev_buffer);
-                    Res = new Comparison(Ident, nullptr, Comparison::Ident);
-                    advance();
-                    return Res;
-                }
+                error();
                 goto _error;
             }
             advance();
@@ -674,7 +617,7 @@ Logic *Parser::parseComparison()
                 goto _error;
             }
             
-            Res = new Comparison(Left, Right, Op);
+            Res = Ctx.create<Comparison>(Left, Right, Op);
     }
     
     return Res;
@@ -711,7 +654,7 @@ Logic *Parser::parseLogic()
         {
             goto _error;
         }
-        Left = new LogicalExpr(Left, Right, Op);
+        Left = Ctx.create<LogicalExpr>(Left, Right, Op);
     }
     return Left;
 
@@ -723,22 +666,17 @@ _error:
 
 IfStmt *Parser::parseIf()
 {
-    llvm::SmallVector<AST *> ifStmts;
-    llvm::SmallVector<AST *> elseStmts;
+    llvm::ArrayRef<AST *> ifStmts;
+    llvm::ArrayRef<AST *> elseStmts;
     llvm::SmallVector<elifStmt *> elifStmts;
-    llvm::SmallVector<AST *> Stmts;
+    llvm::ArrayRef<AST *> Stmts;
     Logic *Cond = nullptr;
-    Token prev_token_if;
-    const char* prev_buffer_if;
-    Token prev_token_elif;
-    const char* prev_buffer_elif;
-    bool hasElif = false;
-    bool hasElse = false;
-
+    unsigned Line = 0;
 
     if (expect(Token::KW_if)){
         goto _error;
     }
+    Line = Lex.getLine(Tok);
 
     advance();
 
@@ -770,91 +708,67 @@ IfStmt *Parser::parseIf()
         
     if(ifStmts.empty())
         goto _error;
-    
-    prev_token_if = Tok;
-    prev_buffer_if = Lex.getBuffer();
-    
-    advance();
 
-    while (true)
+    // Tok stays on the closing brace unless an else branch follows.
+    while (peek(1).is(Token::KW_else))
     {
-        if (Tok.is(Token::KW_else))
+        advance();    // onto else
+        advance();    // past else
+        if (Tok.is(Token::KW_if))
         {
             advance();
-            if (Tok.is(Token::KW_if))
-            {
-                hasElif = true;
-                advance();
-                
-                if (expect(Token::l_paren)){
-                    goto _error;
-                }
-
-                advance();
-
-                Logic *Cond = parseLogic();
-
-                if (Cond == nullptr)
-                {
-                    goto _error;
-                }
-
-                if (expect(Token::r_paren)){
-                    goto _error;
-                }
-
-                advance();
-
-                if (expect(Token::l_brace)){
-                    goto _error;
-                }
-
-                advance();
-
-                Stmts = getBody();
-                prev_token_elif = Tok;
-                prev_buffer_elif = Lex.getBuffer();
-                
-                if(!Stmts.empty())
-                    advance();
-                else
-                    goto _error;
-                
-                elifStmt *elif = new elifStmt(Cond, Stmts);
-                elifStmts.push_back(elif);
+            
+            if (expect(Token::l_paren)){
+                goto _error;
             }
-            else
-            {
-                hasElse = true;
 
-                if (expect(Token::l_brace)){
-                    goto _error;
-                }
+            advance();
 
-                advance();
+            Logic *Cond = parseLogic();
 
-                elseStmts = getBody();
-                
-                if(elseStmts.empty())
-                    goto _error;
+            if (Cond == nullptr)
+            {
+                goto _error;
+            }
 
-                break;
+            if (expect(Token::r_paren)){
+                goto _error;
             }
+
+            advance();
+
+            if (expect(Token::l_brace)){
+                goto _error;
+            }
+
+            advance();
+
+            Stmts = getBody();
+
+            if(Stmts.empty())
+                goto _error;
+
+            elifStmt *elif = Ctx.create<elifStmt>(Cond, Stmts);
+            elifStmts.push_back(elif);
         }
         else
+        {
+            if (expect(Token::l_brace)){
+                goto _error;
+            }
+
+            advance();
+
+            elseStmts = getBody();
+            
+            if(elseStmts.empty())
+                goto _error;
+
             break;
+        }
     }
 
-    if(hasElif && !hasElse){
-        Tok = prev_token_elif;
-        Lex.setBufferPtr(prev_buffer_elif);
-    }
-    else if(!hasElif && !hasElse){
-        Tok = prev_token_if;
-        Lex.setBufferPtr(prev_buffer_if);
-    }
-        
-    return new IfStmt(Cond, ifStmts, elseStmts, elifStmts);
+    return Ctx.create<IfStmt>(Cond, ifStmts, elseStmts, Ctx.copyArray<elifStmt *>(elifStmts), Line);
 
 _error:
     while (Tok.getKind() != Token::eoi)
@@ -866,7 +780,7 @@ _error:
 
 PrintStmt *Parser::parsePrint()
 {
-    llvm::StringRef Var;
+    unsigned Symbol;
     if (expect(Token::KW_print)){
         goto _error;
     }
@@ -878,7 +792,7 @@ PrintStmt *Parser::parsePrint()
     if (expect(Token::ident)){
         goto _error;
     }
-    Var = Tok.getText();
+    Symbol = Tok.getSymbol();
     advance();
     if (expect(Token::r_paren)){
         goto _error;
@@ -887,7 +801,7 @@ PrintStmt *Parser::parsePrint()
     if (expect(Token::semicolon)){
         goto _error;
     }
-    return new PrintStmt(Var);
+    return Ctx.create<PrintStmt>(Symbol);
 
 _error:
     while (Tok.getKind() != Token::eoi)
@@ -898,12 +812,16 @@ _error:
 
 WhileStmt *Parser::parseWhile()
 {
-    llvm::SmallVector<AST *> Body;
+    llvm::ArrayRef<AST *> Body;
     Logic *Cond = nullptr;
+    unsigned Line = 0;
+    LoopHints Hints = LoopHints();
 
     if (expect(Token::KW_while)){
         goto _error;
     }
+    Line = Lex.getLine(Tok);
+    Hints = Lex.getLoopHints(Tok);
         
     advance();
 
@@ -935,7 +853,7 @@ WhileStmt *Parser::parseWhile()
         goto _error;
         
 
-    return new WhileStmt(Cond, Body);
+    return Ctx.create<WhileStmt>(Cond, Body, Line, Hints);
 
 _error:
     while (Tok.getKind() != Token::eoi)
@@ -949,13 +867,15 @@ ForStmt *Parser::parseFor()
     Logic *Second = nullptr;
     Assignment *ThirdAssign = nullptr;
     UnaryOp *ThirdUnary = nullptr;
-    llvm::SmallVector<AST *> Body;
-    Token prev_token;
-    const char* prev_buffer;
+    llvm::ArrayRef<AST *> Body;
+    unsigned Line = 0;
+    LoopHints Hints = LoopHints();
 
     if (expect(Token::KW_for)){
         goto _error;
     }
+    Line = Lex.getLine(Tok);
+    Hints = Lex.getLoopHints(Tok);
         
     advance();
 
@@ -990,22 +910,16 @@ ForStmt *Parser::parseFor()
 
     advance();
 
-    prev_token = Tok;
-    prev_buffer = Lex.getBuffer();
-
-    ThirdAssign = parseIntAssign();
-
-    if (ThirdAssign == nullptr){
-        Tok = prev_token;
-        Lex.setBufferPtr(prev_buffer);
-
+    if (peek(1).isOneOf(Token::plus_plus, Token::minus_minus)){
         ThirdUnary = parseUnary();
         if (ThirdUnary == nullptr){
             goto _error;
         }
-
     }
     else{
+        ThirdAssign = parseIntAssign();
+        if (ThirdAssign == nullptr)
+            goto _error;
         if(ThirdAssign->getAssignKind() == Assignment::Assign)   // The third part cannot have only '=' sign
             goto _error;
     }
@@ -1028,7 +942,7 @@ ForStmt *Parser::parseFor()
     if (Body.empty())
         goto _error;
 
-    return new ForStmt(First, Second, ThirdAssign, ThirdUnary, Body);
+    return Ctx.create<ForStmt>(First, Second, ThirdAssign, ThirdUnary, Body, Line, Hints);
 
 _error:
     while (Tok.getKind() != Token::eoi)
@@ -1037,22 +951,7 @@ _error:
 
 }
 
-void Parser::parseComment()
-{
-    if (expect(Token::start_comment)) {
-        goto _error;
-    }
-    advance();
-
-    while (!Tok.isOneOf(Token::end_comment, Token::eoi)) advance();
-
-    return;
-_error: 
-    while (Tok.getKind() != Token::eoi)
-        advance();
-}
-
-llvm::SmallVector<AST *> Parser::getBody()
+llvm::ArrayRef<AST *> Parser::getBody()
 {
     llvm::SmallVector<AST *> body;
     while (!Tok.is(Token::r_brace))
@@ -1061,61 +960,12 @@ llvm::SmallVector<AST *> Parser::getBody()
         {
         
         case Token::ident:{
-            Token prev_token = Tok;
-            const char* prev_buffer = Lex.getBuffer();
-            UnaryOp *u;
-            u = parseUnary();
-            if (Tok.is(Token::semicolon))
-            {
-                if (u)
-                {
-                    body.push_back(u);
-                    break;
-                }
-                else{
-
-                    goto _error;
-                }
-                    
-            }
-            else
-            {
-                if (u)
-                {
-
-                    goto _error;
-                }
-                else{
-                    Tok = prev_token;
-                    Lex.setBufferPtr(prev_buffer);
-                }
-                    
-            }
-
-            
-            Assignment *a_int;
-            Assignment *a_bool;
-            prev_token = Tok;
-            prev_buffer = Lex.getBuffer();
-
-            a_bool = parseBoolAssign();
-
-            if (a_bool){
-                body.push_back(a_bool);
-                break;
-            }
-            Tok = prev_token;
-            Lex.setBufferPtr(prev_buffer);
-
-            a_int = parseIntAssign();
-            if (a_int)
-                body.push_back(a_int);
+            AST *s;
+            s = parseIdentStmt();
+            if (s)
+                body.push_back(s);
             else
                 goto _error;
-            if (!Tok.is(Token::semicolon))
-            {
-                goto _error;
-            }
 
             break;
         }
@@ -1159,12 +1009,6 @@ llvm::SmallVector<AST *> Parser::getBody()
             }
             break;
         }
-        case Token::start_comment: {
-            parseComment();
-            if (!Tok.is(Token::end_comment))
-                goto _error;
-            break;
-        }
         default:{
             error();
 
@@ -1176,12 +1020,12 @@ llvm::SmallVector<AST *> Parser::getBody()
 
     }
     if(Tok.is(Token::r_brace)){
-        return body;
+        return Ctx.copyArray<AST *>(body);
     }
 
 _error:
     while (Tok.getKind() != Token::eoi)
         advance();
-    return body;
+    return llvm::ArrayRef<AST *>();
 
 }
@@ -2,24 +2,59 @@
 #define PARSER_H
 
 #include "AST.h"
+#include "ASTContext.h"
 #include "Lexer.h"
 #include "llvm/Support/raw_ostream.h"
 
 class Parser
 {
     Lexer &Lex;    // retrieve the next token from the input
+    ASTContext &Ctx; // owns the nodes created by the parser
+    llvm::raw_ostream &Diags; // receives syntax errors
     Token Tok;     // stores the next token
-    bool HasError; // indicates if an error was detected
+    llvm::SmallVector<Token, 8> Lookahead; // tokens lexed ahead of Tok
+    unsigned LookaheadPos = 0;             // first token in Lookahead not yet consumed
+    unsigned NumLookahead = 0;             // tokens that went through Lookahead
+    bool HasError; // indicates if a syntax error was detected
 
     void error()
     {
-        llvm::errs() << "Unexpected: " << Tok.getText() << Tok.getKind() << "\n";
+        Diags << "Unexpected: " << Lex.getText(Tok) << (unsigned)Tok.getKind() << "\n";
         HasError = true;
     }
 
     // retrieves the next token from the lexer.expect()
     // tests whether the look-ahead is of the expected kind
-    void advance() { Lex.next(Tok); }
+    void advance()
+    {
+        if (LookaheadPos == Lookahead.size())
+        {
+            Lex.next(Tok);
+            return;
+        }
+        Tok = Lookahead[LookaheadPos++];
+        if (LookaheadPos == Lookahead.size())
+        {
+            Lookahead.clear();
+            LookaheadPos = 0;
+        }
+    }
+
+    // returns the token N positions after Tok (peek(0) is Tok) without consuming anything;
+    // every token is lexed exactly once and buffered until it is consumed
+    const Token &peek(unsigned N)
+    {
+        if (N == 0)
+            return Tok;
+        while (Lookahead.size() - LookaheadPos < N)
+        {
+            Token T;
+            Lex.next(T);
+            Lookahead.push_back(T);
+            ++NumLookahead;
+        }
+        return Lookahead[LookaheadPos + N - 1];
+    }
 
     bool expect(Token::TokenKind Kind)
     {
@@ -41,6 +76,8 @@ class Parser
     }
 
     Program *parseProgram();
+    AST *parseIdentStmt();
+    bool isLogicAssign();
     DeclarationInt *parseIntDec();
     DeclarationBool *parseBoolDec();
     Assignment *parseBoolAssign();
@@ -56,12 +93,12 @@ class Parser
     WhileStmt *parseWhile();
     ForStmt *parseFor();
     PrintStmt *parsePrint();
-    void parseComment();
-    llvm::SmallVector<AST *> getBody();
+    llvm::ArrayRef<AST *> getBody();
 
 public:
     // initializes all members and retrieves the first token
-    Parser(Lexer &Lex) : Lex(Lex), HasError(false)
+    Parser(Lexer &Lex, ASTContext &Ctx, llvm::raw_ostream &Diags = llvm::errs())
+        : Lex(Lex), Ctx(Ctx), Diags(Diags), HasError(false)
     {
         advance();
     }
@@ -69,7 +106,15 @@ public:
     // get the value of error flag
     bool hasError() { return HasError; }
 
+    // number of tokens lexed ahead of the current one to make grammar decisions
+    unsigned getNumLookahead() const { return NumLookahead; }
+
     Program *parse();
+
+    // Parses the next top-level statement, for compiling a program one
+    // statement at a time. Returns null at the end of the input or after a
+    // syntax error, which hasError() tells apart.
+    AST *parseStatement();
 };
 
 #endif
\ No newline at end of file
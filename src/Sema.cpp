@@ -1,90 +1,106 @@
 #include "Sema.h"
-#include "llvm/ADT/StringSet.h"
+#include <vector>
 #include "llvm/Support/raw_ostream.h"
 
 
 namespace nms{
-class InputCheck : public ASTVisitor {
-  llvm::StringSet<> IntScope; // StringSet to store declared int variables
-  llvm::StringSet<> BoolScope;
+class InputCheck : public ASTVisitor<InputCheck> {
+  enum VarKind : unsigned char { Undeclared, IntVar, BoolVar };
+  std::vector<VarKind> Scope; // kind of each declared variable, indexed by symbol ID
+  const SymbolTable &Symbols; // names of the variables, for diagnostics
   bool HasError; // Flag to indicate if an error occurred
+  llvm::raw_ostream &Diags; // Stream the errors are reported to
 
   enum ErrorType { Twice, Not }; // Enum to represent error types: Twice - variable declared twice, Not - variable not declared
 
-  void error(ErrorType ET, llvm::StringRef V) {
+  void error(ErrorType ET, unsigned Symbol) {
     // Function to report errors
-    llvm::errs() << "Variable " << V << " is "
+    Diags << "Variable " << name(Symbol) << " is "
                  << (ET == Twice ? "already" : "not")
                  << " declared\n";
     HasError = true; // Set error flag to true
   }
 
+  llvm::StringRef name(unsigned Symbol) { return Symbols.getName(Symbol); }
+
+  VarKind kindOf(unsigned Symbol) {
+    return Symbol < Scope.size() ? Scope[Symbol] : Undeclared;
+  }
+
+  bool isInt(unsigned Symbol) { return kindOf(Symbol) == IntVar; }
+
+  bool isBool(unsigned Symbol) { return kindOf(Symbol) == BoolVar; }
+
+  // Records the kind of a variable; returns false if it was already declared.
+  bool declare(unsigned Symbol, VarKind Kind) {
+    if (Symbol >= Scope.size())
+      Scope.resize(Symbol + 1, Undeclared);
+    if (Scope[Symbol] != Undeclared)
+      return false;
+    Scope[Symbol] = Kind;
+    return true;
+  }
+
 public:
-  InputCheck() : HasError(false) {} // Constructor
+  InputCheck(const SymbolTable &Symbols, llvm::raw_ostream &Diags) : Symbols(Symbols), HasError(false), Diags(Diags) {} // Constructor
 
   bool hasError() { return HasError; } // Function to check if an error occurred
 
   // Visit function for Program nodes
-  virtual void visit(Program &Node) override { 
+  void visitProgram(Program &Node) { 
 
-    for (llvm::SmallVector<AST *>::const_iterator I = Node.begin(), E = Node.end(); I != E; ++I)
+    for (llvm::ArrayRef<AST *>::const_iterator I = Node.begin(), E = Node.end(); I != E; ++I)
     {
-      (*I)->accept(*this); // Visit each child node
+      visit(*I); // Visit each child node
     }
   };
 
-  virtual void visit(AST &Node) override {
-    Node.accept(*this);
-  }
-
   // Visit function for Final nodes
-  virtual void visit(Final &Node) override {
-    if (Node.getKind() == Final::Ident) {
+  void visitFinal(Final &Node) {
+    if (Node.getValueKind() == Final::Ident) {
       // Check if identifier is in the scope
-      if (IntScope.find(Node.getVal()) == IntScope.end() && BoolScope.find(Node.getVal()) == BoolScope.end())
-        error(Not, Node.getVal());
+      if (kindOf(Node.getSymbol()) == Undeclared)
+        error(Not, Node.getSymbol());
     }
   };
 
   // Visit function for BinaryOp nodes
-  virtual void visit(BinaryOp &Node) override {
+  void visitBinaryOp(BinaryOp &Node) {
     Expr* right = Node.getRight();
     Expr* left = Node.getLeft();
     if (left)
-      left->accept(*this);
+      visit(left);
     else
       HasError = true;
 
     if (right)
-      right->accept(*this);
+      visit(right);
     else
       HasError = true;
 
-    Final* l = (Final*)left;
-    if (l->getKind() == Final::Ident){
-      if (BoolScope.find(l->getVal()) != BoolScope.end()) {
-        llvm::errs() << "Cannot use binary operation on a boolean variable: " << l->getVal() << "\n";
+    Final* l = llvm::dyn_cast_or_null<Final>(left);
+    if (l && l->getValueKind() == Final::Ident){
+      if (isBool(l->getSymbol())) {
+        Diags << "Cannot use binary operation on a boolean variable: " << name(l->getSymbol()) << "\n";
         HasError = true;
       }
     }
 
-    Final* r = (Final*)right;
-    if (r->getKind() == Final::Ident){
-      if (BoolScope.find(r->getVal()) != BoolScope.end()) {
-        llvm::errs() << "Cannot use binary operation on a boolean variable: " << r->getVal() << "\n";
+    Final* r = llvm::dyn_cast_or_null<Final>(right);
+    if (r && r->getValueKind() == Final::Ident){
+      if (isBool(r->getSymbol())) {
+        Diags << "Cannot use binary operation on a boolean variable: " << name(r->getSymbol()) << "\n";
         HasError = true;
       }
     }
     
 
     if (Node.getOperator() == BinaryOp::Operator::Div || Node.getOperator() == BinaryOp::Operator::Mod ) {
-      Final* f = (Final*)right;
+      Final* f = llvm::dyn_cast_or_null<Final>(right);
 
-      if (f->getKind() == Final::ValueKind::Number) {
-        llvm::StringRef intval = f->getVal();
-
-        if (intval == "0") {
-          llvm::errs() << "Division by zero is not allowed." << "\n";
+      if (f && f->getValueKind() == Final::ValueKind::Number) {
+        if (f->getVal() == 0) {
+          Diags << "Division by zero is not allowed." << "\n";
           HasError = true;
         }
       }
@@ -93,59 +109,58 @@ public:
   };
 
   // Visit function for Assignment nodes
-  virtual void visit(Assignment &Node) override {
+  void visitAssignment(Assignment &Node) {
     Final *dest = Node.getLeft();
-    Expr *RightExpr;
+    Expr *RightExpr = nullptr;
     Logic *RightLogic;
 
-    dest->accept(*this);
+    visit(dest);
 
-    if (dest->getKind() == Final::Number) {
-        llvm::errs() << "Assignment destination must be an identifier, not a number.";
+    if (dest->getValueKind() == Final::Number) {
+        Diags << "Assignment destination must be an identifier, not a number.";
         HasError = true;
     }
 
-    if (BoolScope.find(dest->getVal()) != BoolScope.end()) {
+    if (isBool(dest->getSymbol())) {
       RightLogic = Node.getRightLogic();
       if (RightLogic){
-        RightLogic->accept(*this);
+        visit(RightLogic);
         if(Node.getAssignKind() != Assignment::AssignKind::Assign){
-          llvm::errs() << "Cannot use mathematical operation on boolean variable: " << dest->getVal() << "\n";
+          Diags << "Cannot use mathematical operation on boolean variable: " << name(dest->getSymbol()) << "\n";
           HasError = true;
         }
       }
       else{
-        llvm::errs() << "you should assign a boolean value to boolean variable: " << dest->getVal() << "\n";
+        Diags << "you should assign a boolean value to boolean variable: " << name(dest->getSymbol()) << "\n";
         HasError = true;
       }
     }
       
-    else if (IntScope.find(dest->getVal()) != IntScope.end()){
+    else if (isInt(dest->getSymbol())){
       RightExpr = Node.getRightExpr();
       RightLogic = Node.getRightLogic();
       if (RightExpr){
-        RightExpr->accept(*this);
+        visit(RightExpr);
       }
       else if(RightLogic){
-        RightLogic->accept(*this);
-        Comparison* RL = (Comparison*) RightLogic;
-        if (RL){
-          if (RL->getOperator() == Comparison::Ident){
-            Final* F = (Final*)(RL->getLeft());
-            if (IntScope.find(F->getVal()) == IntScope.end()) {
-              llvm::errs() << "you should assign an integer value to an integer variable: " << dest->getVal() << "\n";
-              HasError = true;
-            } 
-          }
-          else{
-            llvm::errs() << "you should assign an integer value to an integer variable: " << dest->getVal() << "\n";
+        visit(RightLogic);
+        // Only a lone int variable parses as a condition; and/or do not have an int value.
+        Comparison* RL = llvm::dyn_cast<Comparison>(RightLogic);
+        if (RL && RL->getOperator() == Comparison::Ident){
+          Final* F = llvm::cast<Final>(RL->getLeft());
+          if (!isInt(F->getSymbol())) {
+            Diags << "you should assign an integer value to an integer variable: " << name(dest->getSymbol()) << "\n";
             HasError = true;
-          }
+          } 
+        }
+        else{
+          Diags << "you should assign an integer value to an integer variable: " << name(dest->getSymbol()) << "\n";
+          HasError = true;
         }
         
       }
       else{
-        llvm::errs() << "you should assign an integer value to an integer variable: " << dest->getVal() << "\n";
+        Diags << "you should assign an integer value to an integer variable: " << name(dest->getSymbol()) << "\n";
         HasError = true;
       }
         
@@ -154,185 +169,190 @@ public:
     
     if (Node.getAssignKind() == Assignment::AssignKind::Slash_assign) {
 
-      Final* f = (Final*)(RightExpr);
+      Final* f = llvm::dyn_cast_or_null<Final>(RightExpr);
       if (f)
       {
-        if (f->getKind() == Final::ValueKind::Number) {
-        llvm::StringRef intval = f->getVal();
-
-        if (intval == "0") {
-          llvm::errs() << "Division by zero is not allowed." << "\n";
+        if (f->getValueKind() == Final::ValueKind::Number && f->getVal() == 0) {
+          Diags << "Division by zero is not allowed." << "\n";
           HasError = true;
         }
-        }
       }
     }
   };
 
-  virtual void visit(DeclarationInt &Node) override {
-    for (llvm::SmallVector<Expr *>::const_iterator I = Node.valBegin(), E = Node.valEnd(); I != E; ++I){
-      (*I)->accept(*this); // If the Declaration node has an expression, recursively visit the expression node
+  void visitDeclarationInt(DeclarationInt &Node) {
+    for (llvm::ArrayRef<Expr *>::const_iterator I = Node.valBegin(), E = Node.valEnd(); I != E; ++I){
+      visit(*I); // If the Declaration node has an expression, recursively visit the expression node
     }
-    for (llvm::SmallVector<llvm::StringRef>::const_iterator I = Node.varBegin(), E = Node.varEnd(); I != E;
-         ++I) {
-      if(BoolScope.find(*I) != BoolScope.end()){
-        llvm::errs() << "Variable " << *I << " is already declared as an boolean" << "\n";
+    for (llvm::ArrayRef<unsigned>::const_iterator Sym = Node.varBegin(), E = Node.varEnd(); Sym != E; ++Sym) {
+      if(kindOf(*Sym) == BoolVar){
+        Diags << "Variable " << name(*Sym) << " is already declared as an boolean" << "\n";
         HasError = true; 
       }
       else{
-        if (!IntScope.insert(*I).second)
-          error(Twice, *I); // If the insertion fails (element already exists in Scope), report a "Twice" error
+        if (!declare(*Sym, IntVar))
+          error(Twice, *Sym); // If the variable already has a kind, report a "Twice" error
       }
     }
   };
 
-  virtual void visit(DeclarationBool &Node) override {
-    for (llvm::SmallVector<Logic *>::const_iterator I = Node.valBegin(), E = Node.valEnd(); I != E; ++I){
-      (*I)->accept(*this); // If the Declaration node has an expression, recursively visit the expression node
+  void visitDeclarationBool(DeclarationBool &Node) {
+    for (llvm::ArrayRef<Logic *>::const_iterator I = Node.valBegin(), E = Node.valEnd(); I != E; ++I){
+      visit(*I); // If the Declaration node has an expression, recursively visit the expression node
     }
-    for (llvm::SmallVector<llvm::StringRef>::const_iterator I = Node.varBegin(), E = Node.varEnd(); I != E;
-         ++I) {
-      if(IntScope.find(*I) != IntScope.end()){
-        llvm::errs() << "Variable " << *I << " is already declared as an integer" << "\n";
+    for (llvm::ArrayRef<unsigned>::const_iterator Sym = Node.varBegin(), E = Node.varEnd(); Sym != E; ++Sym) {
+      if(kindOf(*Sym) == IntVar){
+        Diags << "Variable " << name(*Sym) << " is already declared as an integer" << "\n";
         HasError = true; 
       }
       else{
-        if (!BoolScope.insert(*I).second)
-          error(Twice, *I); // If the insertion fails (element already exists in Scope), report a "Twice" error
+        if (!declare(*Sym, BoolVar))
+          error(Twice, *Sym); // If the variable already has a kind, report a "Twice" error
       }
     }
     
   };
 
-  virtual void visit(Comparison &Node) override {
+  void visitComparison(Comparison &Node) {
     if(Node.getLeft()){
-      Node.getLeft()->accept(*this);
+      visit(Node.getLeft());
     }
     if(Node.getRight()){
-      Node.getRight()->accept(*this);
+      visit(Node.getRight());
     }
     // else{
     //   if (Node.getOperator() == Comparison::Ident){
     //     Final* F = (Final*)(Node.getLeft());
-    //     if (BoolScope.find(F->getVal()) == BoolScope.end()) {
-    //       llvm::errs() << "you need a boolean varaible to compare or assign: "<< F->getVal() << "\n";
+    //     if (!isBool(F->getSymbol())) {
+    //       Diags << "you need a boolean varaible to compare or assign: "<< F->getVal() << "\n";
     //       HasError = true;
     //     } 
     //   }
     // }
 
     if (Node.getOperator() != Comparison::True && Node.getOperator() != Comparison::False && Node.getOperator() != Comparison::Ident){
-      Final* L = (Final*)(Node.getLeft());
+      Final* L = llvm::dyn_cast_or_null<Final>(Node.getLeft());
       if(L){
-        if (L->getKind() == Final::ValueKind::Ident && IntScope.find(L->getVal()) == IntScope.end()) {
-          llvm::errs() << "you can only compare a defined integer variable: "<< L->getVal() << "\n";
+        if (L->getValueKind() == Final::ValueKind::Ident && !isInt(L->getSymbol())) {
+          Diags << "you can only compare a defined integer variable: "<< name(L->getSymbol()) << "\n";
           HasError = true;
         } 
       }
       
-      Final* R = (Final*)(Node.getRight());
+      Final* R = llvm::dyn_cast_or_null<Final>(Node.getRight());
       if(R){
-        if (R->getKind() == Final::ValueKind::Ident && IntScope.find(R->getVal()) == IntScope.end()) {
-          llvm::errs() << "you can only compare a defined integer variable: "<< R->getVal() << "\n";
+        if (R->getValueKind() == Final::ValueKind::Ident && !isInt(R->getSymbol())) {
+          Diags << "you can only compare a defined integer variable: "<< name(R->getSymbol()) << "\n";
           HasError = true;
         } 
       }
     }
   };
 
-  virtual void visit(LogicalExpr &Node) override {
+  void visitLogicalExpr(LogicalExpr &Node) {
     if(Node.getLeft()){
-      Node.getLeft()->accept(*this);
+      visit(Node.getLeft());
     }
     if(Node.getRight()){
-      Node.getRight()->accept(*this);
+      visit(Node.getRight());
     }
   };
 
-  virtual void visit(UnaryOp &Node) override {
-    if (IntScope.find(Node.getIdent()) == IntScope.end()){
-      llvm::errs() << "Variable "<<Node.getIdent() << " is not a defined integer variable." << "\n";
+  void visitUnaryOp(UnaryOp &Node) {
+    if (!isInt(Node.getSymbol())){
+      Diags << "Variable "<< name(Node.getSymbol()) << " is not a defined integer variable." << "\n";
       HasError = true;
     }
   };
 
-  virtual void visit(NegExpr &Node) override {
+  void visitNegExpr(NegExpr &Node) {
     Expr *expr = Node.getExpr();
-    (*expr).accept(*this);
+    visit(expr);
   };
 
-  virtual void visit(PrintStmt &Node) override {
+  void visitPrintStmt(PrintStmt &Node) {
     // Check if identifier is in the scope
-    if (IntScope.find(Node.getVar()) == IntScope.end() && BoolScope.find(Node.getVar()) == BoolScope.end())
-      error(Not, Node.getVar());
+    if (kindOf(Node.getSymbol()) == Undeclared)
+      error(Not, Node.getSymbol());
     
   };
 
-  virtual void visit(IfStmt &Node) override {
+  void visitIfStmt(IfStmt &Node) {
     Logic *l = Node.getCond();
-    (*l).accept(*this);
+    visit(l);
 
-    for (llvm::SmallVector<AST *>::const_iterator I = Node.begin(), E = Node.end(); I != E; ++I) {
-      (*I)->accept(*this);
+    for (llvm::ArrayRef<AST *>::const_iterator I = Node.begin(), E = Node.end(); I != E; ++I) {
+      visit(*I);
     }
-    for (llvm::SmallVector<AST *>::const_iterator I = Node.beginElse(), E = Node.endElse(); I != E; ++I){
-      (*I)->accept(*this);
+    for (llvm::ArrayRef<AST *>::const_iterator I = Node.beginElse(), E = Node.endElse(); I != E; ++I){
+      visit(*I);
     }
-    for (llvm::SmallVector<elifStmt *>::const_iterator I = Node.beginElif(), E = Node.endElif(); I != E; ++I){
-      (*I)->accept(*this);
+    for (llvm::ArrayRef<elifStmt *>::const_iterator I = Node.beginElif(), E = Node.endElif(); I != E; ++I){
+      visit(*I);
     }
   };
 
-  virtual void visit(elifStmt &Node) override {
+  void visitelifStmt(elifStmt &Node) {
     Logic* l = Node.getCond();
-    (*l).accept(*this);
+    visit(l);
 
-    for (llvm::SmallVector<AST *>::const_iterator I = Node.begin(), E = Node.end(); I != E; ++I) {
-      (*I)->accept(*this);
+    for (llvm::ArrayRef<AST *>::const_iterator I = Node.begin(), E = Node.end(); I != E; ++I) {
+      visit(*I);
     }
   };
 
-  virtual void visit(WhileStmt &Node) override {
+  void visitWhileStmt(WhileStmt &Node) {
     Logic* l = Node.getCond();
-    (*l).accept(*this);
+    visit(l);
 
-    for (llvm::SmallVector<AST *>::const_iterator I = Node.begin(), E = Node.end(); I != E; ++I) {
-      (*I)->accept(*this);
+    for (llvm::ArrayRef<AST *>::const_iterator I = Node.begin(), E = Node.end(); I != E; ++I) {
+      visit(*I);
     }
   };
 
-  virtual void visit(ForStmt &Node) override {
+  void visitForStmt(ForStmt &Node) {
     Assignment *first = Node.getFirst();
-    (*first).accept(*this);
+    visit(first);
 
     Logic *second = Node.getSecond();
-    (*second).accept(*this);
+    visit(second);
 
     Assignment *assign = Node.getThirdAssign();
     if(assign)
-      (*assign).accept(*this);
+      visit(assign);
     else{
       UnaryOp *unary = Node.getThirdUnary();
-      (*unary).accept(*this);
+      visit(unary);
     }
       
 
-    for (llvm::SmallVector<AST *>::const_iterator I = Node.begin(), E = Node.end(); I != E; ++I) {
-      (*I)->accept(*this);
+    for (llvm::ArrayRef<AST *>::const_iterator I = Node.begin(), E = Node.end(); I != E; ++I) {
+      visit(*I);
     }
   };
 
-  virtual void visit(SignedNumber &Node) override {
+  void visitSignedNumber(SignedNumber &Node) {
   };
 
 };
 }
 
+Sema::Sema(const SymbolTable &Symbols, llvm::raw_ostream &Diags) : Symbols(Symbols), Diags(Diags) {}
+
+Sema::~Sema() = default;
+
 bool Sema::semantic(Program *Tree) {
   if (!Tree)
     return false; // If the input AST is not valid, return false indicating no errors
-  nms::InputCheck *Check = new nms::InputCheck();;// Create an instance of the InputCheck class for semantic analysis
-  Tree->accept(*Check); // Initiate the semantic analysis by traversing the AST using the accept function
+  nms::InputCheck Check(Symbols, Diags); // Create an instance of the InputCheck class for semantic analysis
+  Check.visit(*Tree); // Initiate the semantic analysis by traversing the AST
+
+  return Check.hasError(); // Return the result of Check.hasError() indicating if any errors were detected during the analysis
+}
 
-  return Check->hasError(); // Return the result of Check.hasError() indicating if any errors were detected during the analysis
+bool Sema::checkStatement(AST *Stmt) {
+  if (!Stream)
+    Stream = std::make_unique<nms::InputCheck>(Symbols, Diags);
+  Stream->visit(*Stmt);
+  return Stream->hasError();
 }
@@ -3,10 +3,28 @@
 
 #include "AST.h"
 #include "Lexer.h"
+#include "llvm/Support/raw_ostream.h"
+#include <memory>
+
+namespace nms {
+class InputCheck;
+}
 
 class Sema {
+  const SymbolTable &Symbols; // names of the symbol IDs in the AST
+  llvm::raw_ostream &Diags; // receives semantic errors
+  std::unique_ptr<nms::InputCheck> Stream; // state of checkStatement
+
 public:
+  Sema(const SymbolTable &Symbols, llvm::raw_ostream &Diags = llvm::errs());
+  ~Sema();
+
   bool semantic(Program *Tree);
+
+  // Checks the next top-level statement of a program that is given one
+  // statement at a time; declarations are remembered for the statements
+  // after it. Returns true if this or an earlier statement had an error.
+  bool checkStatement(AST *Stmt);
 };
 
 #endif
\ No newline at end of file
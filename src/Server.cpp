@@ -0,0 +1,628 @@
+#include "Server.h"
+#include "Driver.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/ThreadPool.h"
+#include <chrono>
+#include <memory>
+#include <thread>
+
+#ifdef LLVM_ON_UNIX
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using namespace llvm;
+
+#ifdef LLVM_ON_UNIX
+// A client that goes away must not kill the server with SIGPIPE.
+#ifdef MSG_NOSIGNAL
+static const int SendFlags = MSG_NOSIGNAL;
+#else
+static const int SendFlags = 0;
+#endif
+#endif
+
+extern "C" void rt_set_output(void (*Sink)(void *Ctx, const char *Data, size_t N), void *Ctx);
+
+// Limits on the requests that the server reads; see Server.h.
+static const size_t MaxHeaderSize = 64;
+static const size_t MaxFieldSize = 4096;
+static const size_t MaxRequestSize = 64 << 20;
+
+namespace
+{
+  // Reads and writes the fields of the protocol described in Server.h.
+  class Connection
+  {
+    int FD;
+    char Buffer[4096];
+    size_t Begin = 0, End = 0; // unread bytes of Buffer
+    size_t BytesRead = 0;
+
+    bool fill()
+    {
+#ifdef LLVM_ON_UNIX
+      Begin = 0;
+      ssize_t N;
+      do
+        N = ::read(FD, Buffer, sizeof(Buffer));
+      while (N < 0 && errno == EINTR);
+      End = N > 0 ? N : 0;
+      return N > 0;
+#else
+      return false;
+#endif
+    }
+
+    bool readByte(char &C)
+    {
+      if (Begin == End && !fill())
+        return false;
+      C = Buffer[Begin++];
+      ++BytesRead;
+      return true;
+    }
+
+  public:
+    Connection(int FD) : FD(FD) {}
+
+    // Reads the header of the next field. Returns false on a malformed or
+    // truncated header, or one longer than MaxHeaderSize.
+    bool readHeader(std::string &Name, size_t &Length)
+    {
+      std::string Header;
+      char C = 0;
+      while (Header.size() < MaxHeaderSize && readByte(C) && C != '\n')
+        Header += C;
+      StringRef NameRef, LengthRef;
+      std::tie(NameRef, LengthRef) = StringRef(Header).split(' ');
+      if (C != '\n' || LengthRef.getAsInteger(10, Length))
+        return false;
+      Name = NameRef.str();
+      return true;
+    }
+
+    // Reads the Length bytes of a field's value. Returns false if they are
+    // truncated.
+    bool readValue(size_t Length, std::string &Value)
+    {
+      Value.clear();
+      while (Value.size() < Length)
+      {
+        if (Begin == End && !fill())
+          return false;
+        size_t N = std::min(End - Begin, Length - Value.size());
+        Value.append(Buffer + Begin, N);
+        Begin += N;
+        BytesRead += N;
+      }
+      return true;
+    }
+
+    // Reads the next field. Returns false on a malformed or truncated message.
+    bool readField(std::string &Name, std::string &Value)
+    {
+      size_t Length;
+      return readHeader(Name, Length) && readValue(Length, Value);
+    }
+
+    size_t getBytesRead() const { return BytesRead; }
+
+    static void addField(std::string &Message, StringRef Name, StringRef Value)
+    {
+      Message += Name;
+      Message += ' ';
+      Message += utostr(Value.size());
+      Message += '\n';
+      Message += Value;
+    }
+
+    bool write(StringRef Message)
+    {
+#ifdef LLVM_ON_UNIX
+      while (!Message.empty())
+      {
+        ssize_t N = ::send(FD, Message.data(), Message.size(), SendFlags);
+        if (N < 0 && errno == EINTR)
+          continue;
+        if (N <= 0)
+          return false;
+        Message = Message.drop_front(N);
+      }
+      return true;
+#else
+      return false;
+#endif
+    }
+  };
+}
+
+static StringRef getEmitName(EmitKind Emit)
+{
+  switch (Emit)
+  {
+  case EmitKind::Bitcode:
+    return "bc";
+  case EmitKind::Object:
+    return "obj";
+  case EmitKind::Executable:
+    return "exe";
+  case EmitKind::AST:
+    return "ast";
+  default:
+    return "ll";
+  }
+}
+
+// Returns false on a malformed request, or one over the limits of Server.h.
+static bool parseRequest(Connection &Conn, ServerRequest &Request)
+{
+  CodeGenOptions &Opts = Request.Opts;
+  std::string Name, Value;
+  size_t Length;
+  while (Conn.readHeader(Name, Length))
+  {
+    size_t MaxLength = Name == "source" || Name == "profile-data" ? MaxRequestSize : MaxFieldSize;
+    if (Length > MaxLength || Conn.getBytesRead() + Length > MaxRequestSize || !Conn.readValue(Length, Value))
+      return false;
+    StringRef V = Value;
+    if (Name == "end")
+      return true;
+    if (Name == "O")
+    {
+      if (V.getAsInteger(10, Opts.OptLevel) || Opts.OptLevel > 3)
+        return false;
+    }
+    else if (Name == "emit")
+    {
+      if (V == "ll")
+        Opts.Emit = EmitKind::LLVMIR;
+      else if (V == "bc")
+        Opts.Emit = EmitKind::Bitcode;
+      else if (V == "obj")
+        Opts.Emit = EmitKind::Object;
+      else if (V == "exe")
+        Opts.Emit = EmitKind::Executable;
+      else if (V == "ast")
+        Opts.Emit = EmitKind::AST;
+      else
+        return false;
+    }
+    else if (Name == "triple")
+      Opts.Triple = Value;
+    else if (Name == "cpu")
+      Opts.CPU = Value;
+    else if (Name == "run")
+      Opts.Run = V == "1";
+    else if (Name == "interp")
+      Opts.Interpret = V == "1";
+    else if (Name == "tier-up")
+    {
+      if (V.getAsInteger(10, Opts.TierUp))
+        return false;
+    }
+    else if (Name == "codegen-threads")
+    {
+      if (V.getAsInteger(10, Opts.CodeGenThreads))
+        return false;
+    }
+    else if (Name == "profile-generate")
+      Opts.ProfileGenerate = Value;
+    else if (Name == "profile-use")
+      Opts.ProfileUse = Value;
+    else if (Name == "profile-data")
+      Opts.ProfileData = std::move(Value);
+    else if (Name == "instrument")
+      Opts.Instrument = Value;
+    else if (Name == "eval-fuel")
+    {
+      if (V.getAsInteger(10, Opts.EvalFuel))
+        return false;
+    }
+    else if (Name == "const-fold")
+      Request.ConstFold = V == "1";
+    else if (Name == "source")
+      Request.Source = std::move(Value);
+    else
+      return false;
+  }
+  return false;
+}
+
+static void appendOutput(void *Ctx, const char *Data, size_t N)
+{
+  static_cast<std::string *>(Ctx)->append(Data, N);
+}
+
+void handleRequest(const ServerRequest &Request, ServerResponse &Response,
+                   CodeGenContext &Reuse, CompileCache *Cache)
+{
+  raw_string_ostream Diags(Response.Diagnostics);
+  CodeGenOptions Opts = Request.Opts;
+
+  // The server's stdout is not the client's: emit "-" into a temporary file
+  // and send its contents back.
+  SmallString<128> TempFile;
+  bool Runs = Opts.Run || Opts.Interpret;
+  if (!Runs && Opts.OutputFile == "-")
+  {
+    if (std::error_code EC = sys::fs::createTemporaryFile("compiler", "out", TempFile))
+    {
+      Diags << "Cannot create temporary file: " << EC.message() << "\n";
+      Response.Failed = true;
+      return;
+    }
+    Opts.OutputFile = std::string(TempFile.str());
+  }
+
+  CompileEnv Env;
+  Env.Cache = Cache;
+  Env.Reuse = &Reuse;
+  CompilerStats Stats;
+  if (Runs)
+    rt_set_output(appendOutput, &Response.Output);
+  Response.Failed = compileSource(Request.Source, Opts, Request.ConstFold, Diags, Stats,
+                                  Response.ExitCode, Env);
+  if (Runs)
+    rt_set_output(nullptr, nullptr);
+
+  if (!TempFile.empty())
+  {
+    if (!Response.Failed)
+      if (ErrorOr<std::unique_ptr<MemoryBuffer>> Buffer = MemoryBuffer::getFile(TempFile))
+        Response.Output = std::string((*Buffer)->getBuffer());
+    sys::fs::remove(TempFile);
+  }
+}
+
+#ifdef LLVM_ON_UNIX
+static bool getSocketAddress(StringRef SocketPath, sockaddr_un &Addr, raw_ostream &Diags)
+{
+  memset(&Addr, 0, sizeof(Addr));
+  Addr.sun_family = AF_UNIX;
+  if (SocketPath.size() >= sizeof(Addr.sun_path))
+  {
+    Diags << "Socket path is too long: " << SocketPath << "\n";
+    return true;
+  }
+  memcpy(Addr.sun_path, SocketPath.data(), SocketPath.size());
+  return false;
+}
+
+static std::string getResponseMessage(const ServerResponse &Response)
+{
+  std::string Message;
+  Connection::addField(Message, "failed", Response.Failed ? "1" : "0");
+  Connection::addField(Message, "exit", itostr(Response.ExitCode));
+  Connection::addField(Message, "stdout", Response.Output);
+  Connection::addField(Message, "stderr", Response.Diagnostics);
+  Connection::addField(Message, "end", "");
+  return Message;
+}
+
+// Reads a message of getResponseMessage into Response. Returns false if it
+// is truncated.
+static bool parseResponse(StringRef Message, ServerResponse &Response)
+{
+  while (true)
+  {
+    StringRef Header;
+    std::tie(Header, Message) = Message.split('\n');
+    StringRef Name, LengthRef;
+    std::tie(Name, LengthRef) = Header.split(' ');
+    size_t Length;
+    if (LengthRef.getAsInteger(10, Length) || Length > Message.size())
+      return false;
+    StringRef Value = Message.take_front(Length);
+    Message = Message.drop_front(Length);
+    if (Name == "end")
+      return true;
+    if (Name == "failed")
+      Response.Failed = Value == "1";
+    else if (Name == "exit")
+      Value.getAsInteger(10, Response.ExitCode);
+    else if (Name == "stdout")
+      Response.Output = Value.str();
+    else if (Name == "stderr")
+      Response.Diagnostics = Value.str();
+  }
+}
+#endif
+
+void runInChild(unsigned Timeout, ServerResponse &Response, function_ref<void()> Body)
+{
+#ifdef LLVM_ON_UNIX
+  int FDs[2];
+  if (::socketpair(AF_UNIX, SOCK_STREAM, 0, FDs) < 0)
+  {
+    Response.Failed = true;
+    Response.Diagnostics += std::string("Cannot start the program: ") + strerror(errno) + "\n";
+    return;
+  }
+  pid_t Pid = ::fork();
+  if (Pid < 0)
+  {
+    ::close(FDs[0]);
+    ::close(FDs[1]);
+    Response.Failed = true;
+    Response.Diagnostics += std::string("Cannot start the program: ") + strerror(errno) + "\n";
+    return;
+  }
+  if (Pid == 0)
+  {
+    ::close(FDs[0]);
+    Body();
+    Connection Conn(FDs[1]);
+    ::_exit(Conn.write(getResponseMessage(Response)) ? 0 : 1);
+  }
+  ::close(FDs[1]);
+
+  // Read what the child sends until it has exited and all of it is read.
+  // The end of the stream cannot tell, as children that other threads fork
+  // meanwhile keep the other end open. Stop the child after Timeout.
+  using Clock = std::chrono::steady_clock;
+  Clock::time_point Deadline = Clock::now() + std::chrono::seconds(Timeout);
+  std::string Message;
+  char Buffer[4096];
+  int Status = 0;
+  bool Exited = false, TimedOut = false;
+  while (true)
+  {
+    if (!Exited && Timeout && Clock::now() >= Deadline)
+    {
+      ::kill(Pid, SIGKILL);
+      ::waitpid(Pid, &Status, 0);
+      TimedOut = true;
+      break;
+    }
+    pollfd P = {FDs[0], POLLIN, 0};
+    int Ready = ::poll(&P, 1, Exited ? 0 : 10);
+    if (Ready < 0 && errno == EINTR)
+      continue;
+    if (Ready > 0)
+    {
+      ssize_t N = ::read(FDs[0], Buffer, sizeof(Buffer));
+      if (N > 0 || (N < 0 && errno == EINTR))
+      {
+        if (N > 0)
+          Message.append(Buffer, N);
+        continue;
+      }
+    }
+    if (Exited)
+      break;
+    if (::waitpid(Pid, &Status, WNOHANG) == Pid)
+      Exited = true;
+    else if (Ready > 0)
+      // The stream ended; the child is exiting.
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  ::close(FDs[0]);
+
+  ServerResponse Result;
+  if (!TimedOut && WIFEXITED(Status) && WEXITSTATUS(Status) == 0 && parseResponse(Message, Result))
+  {
+    Response = std::move(Result);
+    return;
+  }
+  Response.Failed = true;
+  if (TimedOut)
+    Response.Diagnostics += "The program ran for more than " + utostr(Timeout) + " s and was stopped\n";
+  else if (WIFSIGNALED(Status))
+    Response.Diagnostics += "The program was killed by signal " + itostr(WTERMSIG(Status)) + "\n";
+  else
+    Response.Diagnostics += "The program stopped without a result\n";
+#else
+  Body();
+#endif
+}
+
+void handleIsolatedRequest(const ServerRequest &Request, ServerResponse &Response, CodeGenContext &Reuse,
+                           CompileCache *Cache, unsigned Timeout)
+{
+  if (Request.Opts.Interpret)
+  {
+    runInChild(Timeout, Response, [&]
+               { handleRequest(Request, Response, Reuse, Cache); });
+    return;
+  }
+  if (!Request.Opts.Run)
+  {
+    handleRequest(Request, Response, Reuse, Cache);
+    return;
+  }
+
+  // The program is compiled here, so that the JIT stays warm, and run in a
+  // child.
+  CodeGenOptions Opts = Request.Opts;
+  Opts.Run = false;
+  Opts.Load = true;
+  Opts.Emit = EmitKind::LLVMIR;
+  std::unique_ptr<JITProgram> Program;
+  CompileEnv Env;
+  Env.Reuse = &Reuse;
+  Env.Program = &Program;
+  CompilerStats Stats;
+  raw_string_ostream Diags(Response.Diagnostics);
+  Response.Failed = compileSource(Request.Source, Opts, Request.ConstFold, Diags, Stats, Response.ExitCode, Env);
+  Diags.flush();
+  if (Response.Failed || !Program)
+  {
+    Response.Failed = true;
+    return;
+  }
+  runInChild(Timeout, Response, [&]
+             { runProgram(*Program, Response); });
+}
+
+void runProgram(JITProgram &Program, ServerResponse &Response)
+{
+  raw_string_ostream Diags(Response.Diagnostics);
+  rt_set_output(appendOutput, &Response.Output);
+  Response.Failed = Program.run(Response.ExitCode, Diags);
+  rt_set_output(nullptr, nullptr);
+  Diags.flush();
+}
+
+#ifdef LLVM_ON_UNIX
+static void serveConnection(int FD, const ServerOptions &Options, CompileCache *Cache)
+{
+  // Every worker thread keeps its own target machines and JITs.
+  static thread_local std::unique_ptr<CodeGenContext> Reuse;
+  if (!Reuse)
+    Reuse = std::make_unique<CodeGenContext>();
+
+  Connection Conn(FD);
+  ServerRequest Request;
+  ServerResponse Response;
+  Request.Opts.RuntimeObject = Options.RuntimeObject;
+  Request.Opts.Linker = Options.Linker;
+  if (!parseRequest(Conn, Request))
+  {
+    Response.Failed = true;
+    Response.Diagnostics = "Malformed request\n";
+  }
+  // Their files would be written by the server.
+  else if ((Request.Opts.Run || Request.Opts.Interpret) &&
+           (!Request.Opts.ProfileGenerate.empty() || !Request.Opts.Instrument.empty()))
+  {
+    Response.Failed = true;
+    Response.Diagnostics = "The server cannot run programs built with --profile-generate or --instrument\n";
+  }
+  else
+    handleIsolatedRequest(Request, Response, *Reuse, Cache, Options.RunTimeout);
+
+  Conn.write(getResponseMessage(Response));
+  ::close(FD);
+}
+#endif
+
+int runServer(StringRef SocketPath, const ServerOptions &Options, CompileCache *Cache)
+{
+#ifdef LLVM_ON_UNIX
+  sockaddr_un Addr;
+  if (getSocketAddress(SocketPath, Addr, errs()))
+    return 1;
+
+  // Replace the socket left by a server that was killed, but never another file.
+  sys::fs::file_status Status;
+  if (!sys::fs::status(SocketPath, Status))
+  {
+    if (Status.type() != sys::fs::file_type::socket_file)
+    {
+      errs() << SocketPath << " exists and is not a socket\n";
+      return 1;
+    }
+    sys::fs::remove(SocketPath);
+  }
+
+  int Listen = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (Listen < 0 || ::bind(Listen, (sockaddr *)&Addr, sizeof(Addr)) < 0 ||
+      ::listen(Listen, SOMAXCONN) < 0)
+  {
+    errs() << "Cannot listen on " << SocketPath << ": " << strerror(errno) << "\n";
+    return 1;
+  }
+
+  ThreadPool Pool(hardware_concurrency(Options.Jobs));
+  while (true)
+  {
+    int FD = ::accept(Listen, nullptr, nullptr);
+    if (FD < 0)
+    {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      errs() << "Cannot accept connections on " << SocketPath << ": " << strerror(errno) << "\n";
+      break;
+    }
+    Pool.async([FD, &Options, Cache]
+               { serveConnection(FD, Options, Cache); });
+  }
+  Pool.wait();
+  ::close(Listen);
+  sys::fs::remove(SocketPath);
+  return 1;
+#else
+  errs() << "The compiler server needs Unix domain sockets\n";
+  return 1;
+#endif
+}
+
+bool sendRequest(StringRef SocketPath, const ServerRequest &Request,
+                 ServerResponse &Response, raw_ostream &Diags)
+{
+#ifdef LLVM_ON_UNIX
+  sockaddr_un Addr;
+  if (getSocketAddress(SocketPath, Addr, Diags))
+    return true;
+  int FD = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (FD < 0 || ::connect(FD, (sockaddr *)&Addr, sizeof(Addr)) < 0)
+  {
+    Diags << "Cannot connect to " << SocketPath << ": " << strerror(errno) << "\n";
+    if (FD >= 0)
+      ::close(FD);
+    return true;
+  }
+
+  const CodeGenOptions &Opts = Request.Opts;
+  std::string Message;
+  Connection::addField(Message, "O", utostr(Opts.OptLevel));
+  Connection::addField(Message, "emit", getEmitName(Opts.Emit));
+  Connection::addField(Message, "triple", Opts.Triple);
+  Connection::addField(Message, "cpu", Opts.CPU);
+  Connection::addField(Message, "run", Opts.Run ? "1" : "0");
+  Connection::addField(Message, "interp", Opts.Interpret ? "1" : "0");
+  Connection::addField(Message, "tier-up", utostr(Opts.TierUp));
+  Connection::addField(Message, "codegen-threads", utostr(Opts.CodeGenThreads));
+  Connection::addField(Message, "profile-generate", Opts.ProfileGenerate);
+  Connection::addField(Message, "profile-use", Opts.ProfileUse);
+  Connection::addField(Message, "profile-data", Opts.ProfileData);
+  Connection::addField(Message, "instrument", Opts.Instrument);
+  Connection::addField(Message, "eval-fuel", utostr(Opts.EvalFuel));
+  Connection::addField(Message, "const-fold", Request.ConstFold ? "1" : "0");
+  Connection::addField(Message, "source", Request.Source);
+  Connection::addField(Message, "end", "");
+
+  Connection Conn(FD);
+  bool Complete = false;
+  if (Conn.write(Message))
+  {
+    std::string Name, Value;
+    while (Conn.readField(Name, Value))
+    {
+      if (Name == "end")
+      {
+        Complete = true;
+        break;
+      }
+      if (Name == "failed")
+        Response.Failed = Value == "1";
+      else if (Name == "exit")
+        StringRef(Value).getAsInteger(10, Response.ExitCode);
+      else if (Name == "stdout")
+        Response.Output = std::move(Value);
+      else if (Name == "stderr")
+        Response.Diagnostics = std::move(Value);
+    }
+  }
+  ::close(FD);
+  if (!Complete)
+  {
+    Diags << "Lost the connection to " << SocketPath << "\n";
+    return true;
+  }
+  return false;
+#else
+  Diags << "The compiler server needs Unix domain sockets\n";
+  return true;
+#endif
+}
@@ -0,0 +1,93 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "CodeGen.h"
+#include "CompileCache.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+#include <string>
+
+// The compiler server keeps a warm process listening on a Unix socket, so
+// that tools do not pay for process startup and LLVM initialization on every
+// compile. Each connection carries one request and gets one response; the
+// requests are served concurrently by a pool of workers, and each worker
+// keeps its target machines and JITs across requests.
+//
+// Requests and responses are sequences of fields, each written as
+// "<name> <length>\n" followed by <length> bytes, and ended by the field
+// "end 0\n". Request fields are O, emit (ll, bc, obj, exe or ast), triple, cpu,
+// run, interp and const-fold (0 or 1), tier-up, codegen-threads,
+// profile-generate, profile-use (the name of the profile, for messages),
+// profile-data (its contents), instrument, eval-fuel, and source. Response
+// fields are failed (0 or 1), exit, stdout and stderr; stdout holds the
+// output, or what the program printed with run or interp. The server answers
+// "Malformed request" to a request with a header longer than 64 bytes, a
+// field other than source and profile-data longer than 4 KiB, or more than
+// 64 MiB in all.
+//
+// Clients cannot make the server open files of their choosing or start
+// programs other than its linker: profiles come with the request, outputs
+// are always returned in the response, the linker and runtime are set when
+// the server starts, and programs that the server runs cannot write
+// profiles or hot-spot reports. The paths of profile-generate and
+// instrument are only written by executables, which clients run themselves.
+
+struct ServerRequest
+{
+  CodeGenOptions Opts;
+  bool ConstFold = true;
+  std::string Source;
+};
+
+struct ServerResponse
+{
+  bool Failed = false;
+  int ExitCode = 0;
+  std::string Output;      // output with "-", or what the program printed with --run
+  std::string Diagnostics;
+};
+
+// Compiles or runs Request on the calling thread, with the target machines
+// and JITs of Reuse and outputs going through Cache when it is not null.
+// Used by the server's workers and by the library API of LibCompiler.h.
+void handleRequest(const ServerRequest &Request, ServerResponse &Response,
+                   CodeGenContext &Reuse, CompileCache *Cache);
+
+// Runs Body in a child process, in which Body fills Response, and copies
+// the response back. A child that crashes, or runs for more than Timeout
+// seconds (0 for no limit) and is killed, fails Response instead. Only the
+// calling thread exists in the child, so Body must not wait for others.
+void runInChild(unsigned Timeout, ServerResponse &Response, llvm::function_ref<void()> Body);
+
+// Like handleRequest, but a program that Request runs is run with
+// runInChild; with the JIT it is still compiled on the calling thread.
+void handleIsolatedRequest(const ServerRequest &Request, ServerResponse &Response, CodeGenContext &Reuse,
+                           CompileCache *Cache, unsigned Timeout);
+
+// Runs Program on the calling thread, with its output and exit code going
+// to Response.
+void runProgram(JITProgram &Program, ServerResponse &Response);
+
+// Settings of the server, which requests cannot change.
+struct ServerOptions
+{
+  unsigned Jobs = 0;        // workers, 0 for all cores
+  unsigned RunTimeout = 10; // seconds a program run by a request may take, 0 for no limit
+  std::string RuntimeObject; // runtime linked into executables
+  std::string Linker = "cc"; // driver used to link executables
+};
+
+// Serves requests on SocketPath until the process is killed. Outputs go
+// through Cache when it is not null. Programs that requests run are run in
+// a child process, so that one that crashes or does not end in time only
+// fails its own request. Returns the exit code of the process when the
+// socket cannot be set up.
+int runServer(llvm::StringRef SocketPath, const ServerOptions &Options, CompileCache *Cache);
+
+// Sends Request to the server on SocketPath and waits for the response.
+// Returns true if the server could not be reached.
+bool sendRequest(llvm::StringRef SocketPath, const ServerRequest &Request,
+                 ServerResponse &Response, llvm::raw_ostream &Diags);
+
+#endif
@@ -0,0 +1,137 @@
+#ifndef SYMBOLCOLLECTOR_H
+#define SYMBOLCOLLECTOR_H
+
+#include "AST.h"
+#include <vector>
+
+// Collects the variables a statement uses, each once and in the order they
+// are first seen, and which of them it writes. Code compiled for part of a
+// program (a hot loop of the interpreter, an outlined region of CodeGen)
+// loads these from the frame and stores them back.
+class SymbolCollector : public ASTVisitor<SymbolCollector>
+{
+  std::vector<bool> Seen;
+  std::vector<bool> Written;
+
+  void add(unsigned Symbol)
+  {
+    if (Symbol >= Seen.size())
+      Seen.resize(Symbol + 1);
+    if (!Seen[Symbol])
+    {
+      Seen[Symbol] = true;
+      Symbols.push_back(Symbol);
+    }
+  }
+
+  void write(unsigned Symbol)
+  {
+    add(Symbol);
+    if (Symbol >= Written.size())
+      Written.resize(Symbol + 1);
+    Written[Symbol] = true;
+  }
+
+  void collect(llvm::ArrayRef<AST *> Stmts)
+  {
+    for (AST *S : Stmts)
+      visit(S);
+  }
+
+public:
+  std::vector<unsigned> Symbols;
+
+  bool isWritten(unsigned Symbol) const { return Symbol < Written.size() && Written[Symbol]; }
+
+  void visitDeclarationInt(DeclarationInt &Node)
+  {
+    for (Expr *E : Node.getValues())
+      if (E)
+        visit(E);
+    for (unsigned Symbol : Node.getSymbols())
+      write(Symbol);
+  }
+
+  void visitDeclarationBool(DeclarationBool &Node)
+  {
+    for (Logic *L : Node.getValues())
+      if (L)
+        visit(L);
+    for (unsigned Symbol : Node.getSymbols())
+      write(Symbol);
+  }
+
+  void visitAssignment(Assignment &Node)
+  {
+    write(Node.getLeft()->getSymbol());
+    if (Node.getRightExpr())
+      visit(Node.getRightExpr());
+    else
+      visit(Node.getRightLogic());
+  }
+
+  void visitPrintStmt(PrintStmt &Node) { add(Node.getSymbol()); }
+
+  void visitIfStmt(IfStmt &Node)
+  {
+    visit(Node.getCond());
+    collect(Node.getBody());
+    for (elifStmt *Elif : Node.getElifs())
+    {
+      visit(Elif->getCond());
+      collect(Elif->getBody());
+    }
+    collect(Node.getElse());
+  }
+
+  void visitWhileStmt(WhileStmt &Node)
+  {
+    visit(Node.getCond());
+    collect(Node.getBody());
+  }
+
+  void visitForStmt(ForStmt &Node)
+  {
+    if (Node.getFirst())
+      visit(Node.getFirst());
+    visit(Node.getSecond());
+    collect(Node.getBody());
+    if (Node.getThirdAssign())
+      visit(Node.getThirdAssign());
+    else
+      visit(Node.getThirdUnary());
+  }
+
+  void visitFinal(Final &Node)
+  {
+    if (Node.getValueKind() == Final::Ident)
+      add(Node.getSymbol());
+  }
+
+  void visitBinaryOp(BinaryOp &Node)
+  {
+    visit(Node.getLeft());
+    visit(Node.getRight());
+  }
+
+  void visitUnaryOp(UnaryOp &Node) { write(Node.getSymbol()); }
+
+  void visitNegExpr(NegExpr &Node) { visit(Node.getExpr()); }
+
+  void visitComparison(Comparison &Node)
+  {
+    if (Node.getLeft())
+      visit(Node.getLeft());
+    if (Node.getRight())
+      visit(Node.getRight());
+  }
+
+  void visitLogicalExpr(LogicalExpr &Node)
+  {
+    visit(Node.getLeft());
+    if (Node.getRight())
+      visit(Node.getRight());
+  }
+};
+
+#endif
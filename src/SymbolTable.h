@@ -0,0 +1,32 @@
+#ifndef SYMBOLTABLE_H
+#define SYMBOLTABLE_H
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include <vector>
+
+// SymbolTable interns identifier spellings. The lexer gives every identifier
+// token a dense ID once, so Sema, ConstFold and CodeGen can keep per-variable
+// state in flat vectors indexed by ID instead of hashing the name again.
+class SymbolTable
+{
+  llvm::StringMap<unsigned> IDs;
+  std::vector<llvm::StringRef> Names; // spelling of each ID, owned by IDs
+
+public:
+  static constexpr unsigned Invalid = ~0u; // ID of tokens and nodes that are not identifiers
+
+  unsigned intern(llvm::StringRef Name)
+  {
+    std::pair<llvm::StringMap<unsigned>::iterator, bool> R = IDs.try_emplace(Name, Names.size());
+    if (R.second)
+      Names.push_back(R.first->getKey());
+    return R.first->second;
+  }
+
+  llvm::StringRef getName(unsigned ID) const { return Names[ID]; }
+
+  unsigned size() const { return Names.size(); }
+};
+
+#endif